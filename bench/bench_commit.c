@@ -0,0 +1,83 @@
+/**
+ * @file bench_commit.c
+ * @brief Group commit throughput benchmark.
+ *
+ * Measures insert throughput in WAL mode with DB_DURABILITY_FSYNC for an
+ * increasing number of concurrent writers. With group commit, throughput
+ * should grow with the writer count because one fsync covers a whole batch.
+ */
+
+#include "../include/database.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_DB "data/bench_commit.json"
+#define WRITES_PER_THREAD 200
+
+/**
+ * @brief Writer thread body: inserts WRITES_PER_THREAD small documents.
+ *
+ * @param[in] arg Unused.
+ * @return void* Always NULL.
+ */
+static void *writer(void *arg)
+{
+    (void) arg;
+    for (int i = 0; i < WRITES_PER_THREAD; i++) {
+        cJSON *doc = cJSON_CreateObject();
+        cJSON_AddNumberToObject(doc, "seq", i);
+        cJSON_AddStringToObject(doc, "payload", "group-commit-benchmark");
+        db_insert("bench", doc);
+        cJSON_Delete(doc);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Benchmark entry point.
+ *
+ * @return int Exit status code.
+ */
+int main(void)
+{
+    const int thread_counts[] = {1, 4, 16, 64};
+    pthread_t threads[64];
+
+    db_set_wal_mode(true);
+    db_set_durability(DB_DURABILITY_FSYNC);
+    db_init(BENCH_DB);
+    db_set_test_mode(true);
+
+    printf("%-10s %12s %12s\n", "writers", "writes", "writes/s");
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        int n = thread_counts[t];
+        db_drop_all();
+
+        double start = now_sec();
+        for (int i = 0; i < n; i++)
+            pthread_create(&threads[i], NULL, writer, NULL);
+        for (int i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        double elapsed = now_sec() - start;
+
+        int total = n * WRITES_PER_THREAD;
+        printf("%-10d %12d %12.0f\n", n, total, total / elapsed);
+    }
+
+    db_cleanup();
+    db_destroy(BENCH_DB);
+    return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file bench_index.c
+ * @brief `_id` lookup benchmark.
+ *
+ * Fills the hash index with 1K to 10M keys shaped like document ids and
+ * measures the average time of a random successful lookup at every size. For
+ * sizes where it finishes in reasonable time, the same lookups are timed
+ * against a cJSON object (the previous index), whose cost grows linearly.
+ */
+
+#include "../include/index.h"
+#include "../third_party/cJSON/cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 1000000
+#define BASELINE_MAX 100000
+#define BASELINE_LOOKUPS 2000
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Returns a pseudo-random number in [0, n) (xorshift, reproducible).
+ */
+static size_t next_key(size_t n)
+{
+    static unsigned long long state = 88172645463325252ULL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (size_t) (state % n);
+}
+
+/**
+ * @brief Times random lookups in a cJSON object of @p n keys.
+ *
+ * @param[in] n Number of keys.
+ * @return Average nanoseconds per lookup.
+ */
+static double baseline(size_t n)
+{
+    char key[32];
+    cJSON *obj = cJSON_CreateObject();
+    for (size_t i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "doc-%zu", i);
+        cJSON_AddNullToObject(obj, key);
+    }
+
+    size_t hits = 0;
+    double start = now_sec();
+    for (int i = 0; i < BASELINE_LOOKUPS; i++) {
+        snprintf(key, sizeof(key), "doc-%zu", next_key(n));
+        hits += cJSON_GetObjectItem(obj, key) != NULL;
+    }
+    double elapsed = now_sec() - start;
+    cJSON_Delete(obj);
+    if (hits != BASELINE_LOOKUPS)
+        fprintf(stderr, "baseline lookup failed\n");
+    return elapsed / BASELINE_LOOKUPS * 1e9;
+}
+
+/**
+ * @brief Benchmark entry point.
+ *
+ * @return int Exit status code.
+ */
+int main(void)
+{
+    const size_t sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+    char key[32];
+
+    fprintf(stderr, "%-10s %14s %14s %14s\n", "keys", "build s", "lookup ns", "cJSON ns");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+
+        double start = now_sec();
+        index_t *idx = index_create(0);
+        for (size_t i = 0; i < n; i++) {
+            int len = snprintf(key, sizeof(key), "doc-%zu", i);
+            index_put(idx, key, (size_t) len, (void *) (i + 1), NULL);
+        }
+        double build = now_sec() - start;
+
+        size_t hits = 0;
+        start = now_sec();
+        for (int i = 0; i < LOOKUPS; i++) {
+            int len = snprintf(key, sizeof(key), "doc-%zu", next_key(n));
+            hits += index_get(idx, key, (size_t) len) != NULL;
+        }
+        double lookup = (now_sec() - start) / LOOKUPS * 1e9;
+        index_free(idx, NULL);
+        if (hits != LOOKUPS)
+            fprintf(stderr, "lookup failed\n");
+
+        if (n <= BASELINE_MAX)
+            fprintf(stderr, "%-10zu %14.3f %14.1f %14.1f\n", n, build, lookup, baseline(n));
+        else
+            fprintf(stderr, "%-10zu %14.3f %14.1f %14s\n", n, build, lookup, "-");
+    }
+    return 0;
+}
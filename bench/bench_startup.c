@@ -0,0 +1,158 @@
+/**
+ * @file bench_startup.c
+ * @brief Cold start benchmark.
+ *
+ * Builds a synthetic database, stores it once per storage format, and then
+ * measures how long db_init() takes to load each copy (eagerly with a growing
+ * number of loader threads, and lazily), how long the first `_id` lookup
+ * takes after that, and how much memory the process needed at its peak.
+ * Every load runs in a fresh child process so the peak resident set size is
+ * not inherited from the generator.
+ */
+
+#include "../include/database.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DOCS 200000
+#define BENCH_SRC "data/bench_startup_src.json"
+#define BENCH_EXPORT "data/bench_startup_export.json"
+#define BENCH_JSON "data/bench_startup.json"
+#define BENCH_BINARY "data/bench_startup.xdb"
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Loads @p path in a child process and prints load time and peak RSS.
+ *
+ * @param[in] label   Format label for the report.
+ * @param[in] path    Database to load.
+ * @param[in] lazy    True to map the file and decode documents on first access.
+ * @param[in] threads Loader threads (ignored for lazy loads).
+ */
+static void measure(const char *label, const char *path, bool lazy, int threads)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* Silence engine logging in the measured child */
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(1);
+        db_set_lazy_load(lazy);
+        db_set_load_threads(threads);
+        double start = now_sec();
+        db_init(path);
+        double elapsed = now_sec() - start;
+        int docs = db_count("events") + db_count("users");
+
+        cJSON *query = cJSON_CreateObject();
+        cJSON_AddStringToObject(query, "_id", "doc-123457");
+        start = now_sec();
+        cJSON *found = db_find("events", query, 1);
+        double lookup = now_sec() - start;
+        if (cJSON_GetArraySize(found) != 1)
+            fprintf(stderr, "lookup failed\n");
+        cJSON_Delete(found);
+        cJSON_Delete(query);
+
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        fprintf(stderr, "%-12s %8d %10d %10.3f %12.0f %12.3f %10ld\n", label, threads, docs,
+                elapsed, docs / elapsed, lookup * 1000, ru.ru_maxrss / 1024);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * @brief Stores the exported dataset as a database in the given format.
+ *
+ * @param[in] path   Database path.
+ * @param[in] format Storage format of the collection images.
+ */
+static void store(const char *path, storage_format_t format)
+{
+    db_set_storage_format(format);
+    db_init(path);
+    db_set_test_mode(true);
+    db_import(BENCH_EXPORT);
+    db_cleanup();
+}
+
+/**
+ * @brief Builds the synthetic dataset and stores it in every format.
+ */
+static void generate(void)
+{
+    db_init(BENCH_SRC);
+    db_set_test_mode(true);
+    db_set_durability(DB_DURABILITY_NONE);
+    db_set_wal_mode(true);
+    for (int i = 0; i < BENCH_DOCS; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "doc-%d", i);
+        cJSON *doc = cJSON_CreateObject();
+        cJSON_AddStringToObject(doc, "_id", id);
+        cJSON_AddNumberToObject(doc, "seq", i);
+        cJSON_AddNumberToObject(doc, "ts", 1700000000 + i);
+        cJSON_AddStringToObject(doc, "kind", (i % 3) ? "click" : "view");
+        cJSON_AddStringToObject(doc, "payload", "lorem ipsum dolor sit amet");
+        cJSON_AddBoolToObject(doc, "active", i % 2);
+        db_insert((i % 10) ? "events" : "users", doc);
+        cJSON_Delete(doc);
+    }
+    db_export(BENCH_EXPORT, STORAGE_FORMAT_JSON);
+    db_cleanup();
+
+    db_set_wal_mode(false);
+    store(BENCH_JSON, STORAGE_FORMAT_JSON);
+    store(BENCH_BINARY, STORAGE_FORMAT_BINARY);
+}
+
+/**
+ * @brief Benchmark entry point.
+ *
+ * @return int Exit status code.
+ */
+int main(void)
+{
+    /* 1. Generate the dataset in a child so the parent's peak RSS stays small */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        generate();
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    /* 2. Measure cold loads */
+    fprintf(stderr, "%-12s %8s %10s %10s %12s %12s %10s\n", "format", "threads", "docs",
+            "seconds", "docs/s", "lookup ms", "peak MB");
+    db_set_wal_mode(false);
+    const int threads[] = {1, 2, 4, 8, 16, 32};
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+        measure("json", BENCH_JSON, false, threads[i]);
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+        measure("binary", BENCH_BINARY, false, threads[i]);
+    measure("json-lazy", BENCH_JSON, true, 1);
+    measure("binary-lazy", BENCH_BINARY, true, 1);
+
+    db_destroy(BENCH_SRC);
+    db_destroy(BENCH_JSON);
+    db_destroy(BENCH_BINARY);
+    remove(BENCH_EXPORT);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file bitmap.h
+ * @brief Compressed bitmaps of 32-bit integers.
+ *
+ * A roaring-style bitmap: values are grouped by their high 16 bits into
+ * containers, each holding the low 16 bits either as a sorted array (up to
+ * BITMAP_ARRAY_MAX values) or as a 65536-bit set. Sparse groups cost two
+ * bytes per value, dense ones 8 KB, and intersections and unions of dense
+ * groups run over whole 64-bit words.
+ */
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Largest number of values kept in an array container.
+ */
+#define BITMAP_ARRAY_MAX 4096
+
+/**
+ * @brief Opaque bitmap handle.
+ */
+typedef struct bitmap bitmap_t;
+
+/**
+ * @brief Receives the values of a bitmap, in ascending order.
+ *
+ * @param[in] value The value.
+ * @param[in] ctx   Caller context.
+ * @return false to stop the walk.
+ */
+typedef bool (*bitmap_visit_fn)(uint32_t value, void *ctx);
+
+/**
+ * @brief Creates an empty bitmap.
+ *
+ * @return The new bitmap (release with bitmap_free()), or NULL on allocation failure.
+ */
+bitmap_t *bitmap_create(void);
+
+/**
+ * @brief Releases a bitmap.
+ *
+ * @param[in] b The bitmap (may be NULL).
+ */
+void bitmap_free(bitmap_t *b);
+
+/**
+ * @brief Copies a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return The copy, or NULL on allocation failure.
+ */
+bitmap_t *bitmap_copy(const bitmap_t *b);
+
+/**
+ * @brief Returns the number of values in a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return Value count.
+ */
+size_t bitmap_count(const bitmap_t *b);
+
+/**
+ * @brief Returns the memory held by the containers of a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return Size in bytes.
+ */
+size_t bitmap_bytes(const bitmap_t *b);
+
+/**
+ * @brief Adds a value.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to add.
+ * @return false on allocation failure (the bitmap is left unchanged).
+ */
+bool bitmap_add(bitmap_t *b, uint32_t value);
+
+/**
+ * @brief Removes a value.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to remove.
+ * @return true if the value was present.
+ */
+bool bitmap_remove(bitmap_t *b, uint32_t value);
+
+/**
+ * @brief Tells whether a value is present.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to look up.
+ * @return true if present.
+ */
+bool bitmap_contains(const bitmap_t *b, uint32_t value);
+
+/**
+ * @brief Keeps only the values also present in another bitmap.
+ *
+ * Works in place and cannot fail.
+ *
+ * @param[in] dst Bitmap to narrow.
+ * @param[in] src Bitmap to intersect with.
+ */
+void bitmap_and(bitmap_t *dst, const bitmap_t *src);
+
+/**
+ * @brief Adds the values of another bitmap.
+ *
+ * @param[in] dst Bitmap to extend.
+ * @param[in] src Bitmap to merge.
+ * @return false on allocation failure (@p dst then holds a subset of the union).
+ */
+bool bitmap_or(bitmap_t *dst, const bitmap_t *src);
+
+/**
+ * @brief Visits the values of a bitmap in ascending order.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] visit Called for every value.
+ * @param[in] ctx   Passed to @p visit.
+ * @return false if @p visit stopped the walk.
+ */
+bool bitmap_foreach(const bitmap_t *b, bitmap_visit_fn visit, void *ctx);
+
+#endif /* BITMAP_H */
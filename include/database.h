@@ -3,34 +3,90 @@
  * @brief Core Database Interface Engine.
  *
  * This header provides the API for a lightweight JSON-based document store.
- * It handles basic CRUD operations, persistence to disk, and snapshot management.
+ * It handles basic CRUD operations, persistence to disk (full image rewrites or
+ * an append-only write-ahead log), and snapshot management.
  */
 
 #ifndef DATABASE_H
 #define DATABASE_H
 
 #include "../third_party/cJSON/cJSON.h"
+#include "storage.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief How durable a write must be before the call that issued it returns.
+ *
+ * Concurrent writers share flushes and fsyncs (group commit), so stronger
+ * levels cost latency but scale with the number of writers.
+ */
+typedef enum
+{
+    DB_DURABILITY_DEFAULT = -1, /**< Use the server-wide level (per-request override only). */
+    DB_DURABILITY_NONE = 0,     /**< Buffered in memory; written by a later commit or shutdown. */
+    DB_DURABILITY_FLUSH = 1,    /**< Handed to the operating system (survives a process crash). */
+    DB_DURABILITY_FSYNC = 2     /**< On stable storage (survives a power loss). */
+} db_durability_t;
+
+/**
+ * @brief Why a write failed, as reported by db_last_error().
+ */
+typedef enum
+{
+    DB_ERROR_NONE = 0,      /**< The write succeeded (or failed for another reason). */
+    DB_ERROR_NOT_FOUND,     /**< No document has the requested `_id`. */
+    DB_ERROR_DUPLICATE_ID,  /**< The collection already holds a document with that `_id`. */
+    DB_ERROR_DUPLICATE_KEY  /**< A unique index already holds another document with that key. */
+} db_error_t;
+
+/**
+ * @brief Progress of a snapshot started with db_snapshot_start().
+ */
+typedef enum
+{
+    DB_SNAPSHOT_UNKNOWN = -1, /**< No snapshot with this id is remembered. */
+    DB_SNAPSHOT_RUNNING = 0,  /**< Still being written by the snapshot process. */
+    DB_SNAPSHOT_DONE = 1,     /**< Complete; the directory can be restored. */
+    DB_SNAPSHOT_FAILED = 2    /**< The snapshot process failed and left nothing behind. */
+} db_snapshot_state_t;
 
 /**
  * @brief Initializes the database engine.
  *
- * Loads existing data from the disk into memory or creates a new storage file
- * if one does not exist. This must be called before any other DB operations.
+ * Loads existing data from the disk into memory or creates a new database if
+ * none exists. Every collection is stored in its own image file inside the
+ * `<filepath>.d/` directory, which is scanned to discover the collections, so
+ * writing, checkpointing and snapshotting a collection does not touch the
+ * others. A single-file database from an earlier version found at
+ * @p filepath is loaded and converted. Any write-ahead log left next to it
+ * (`<filepath>.wal`) is replayed on top of the images and folded into them.
+ * This must be called before any other DB operations.
  *
- * @param[in] filepath Path to the JSON storage file (e.g., "data/production.json").
+ * @param[in] filepath Database path (e.g., "data/production.json").
  */
 void db_init(const char *filepath);
 
 /**
  * @brief Gracefully shuts down the database.
  *
- * Flushes all in-memory data to the disk and releases all allocated
- * internal resources to prevent memory leaks.
+ * Flushes all in-memory data to the disk (checkpointing the write-ahead log
+ * if one is open) and releases all allocated internal resources to prevent
+ * memory leaks.
  */
 void db_cleanup(void);
 
+/**
+ * @brief Deletes every file belonging to a database.
+ *
+ * Removes the collection images, the write-ahead log and any single-file
+ * image left at @p filepath. The database must not be open.
+ *
+ * @param[in] filepath Path the database is opened with.
+ */
+void db_destroy(const char *filepath);
+
 /**
  * @brief Enables or disables testing mode.
  *
@@ -41,14 +97,219 @@ void db_cleanup(void);
  */
 void db_set_test_mode(bool enable);
 
+/**
+ * @brief Enables or disables write-ahead logging.
+ *
+ * In WAL mode every mutation is appended as one compact record to
+ * `<filepath>.wal` instead of rewriting the whole storage file, so the cost of
+ * a write depends on the size of the document rather than of the database.
+ * The log is folded back into the storage file by a background checkpointer
+ * (see db_set_checkpoint_policy()), on db_cleanup(), and when WAL mode is
+ * switched off.
+ *
+ * @param[in] enable True to log mutations, false to rewrite the file on every write.
+ * @note May be called before or after db_init().
+ */
+void db_set_wal_mode(bool enable);
+
+/**
+ * @brief Enables or disables lazy loading of the storage file.
+ *
+ * When enabled, db_init() maps the storage file read-only and records only
+ * where each document and its `_id` are located; a document is decoded the
+ * first time it is read or modified. Startup time then depends on scanning
+ * the file rather than building every document tree, and `_id` lookups are
+ * served as soon as db_init() returns. Collection scans decode the documents
+ * they visit. Must be called before db_init(). Disabled by default.
+ *
+ * @param[in] enable True to load documents on first access.
+ */
+void db_set_lazy_load(bool enable);
+
+/**
+ * @brief Sets the number of threads used to load the storage files.
+ *
+ * With more than one thread, db_init() maps the file, splits it into document
+ * spans and decodes contiguous ranges of them on a worker pool before linking
+ * them into their collections in file order. Must be called before db_init().
+ *
+ * @param[in] threads Number of worker threads, or 0 (the default) for one per online CPU.
+ */
+void db_set_load_threads(int threads);
+
+/**
+ * @brief Selects the format of the storage file.
+ *
+ * STORAGE_FORMAT_BINARY stores length-prefixed, typed documents grouped by
+ * collection, which loads as a stream and avoids holding the whole file and
+ * its parse tree in memory at once. The format of an existing file is
+ * detected on load, so switching formats converts the file at the next
+ * checkpoint. Defaults to STORAGE_FORMAT_JSON.
+ *
+ * @param[in] format The format used for subsequent writes of the storage file.
+ */
+void db_set_storage_format(storage_format_t format);
+
+/**
+ * @brief Exports a consistent copy of the database to a file.
+ *
+ * @param[in] path   Destination file path.
+ * @param[in] format Format of the exported file (JSON for interchange).
+ * @return true if the file was written completely, false otherwise.
+ */
+bool db_export(const char *path, storage_format_t format);
+
+/**
+ * @brief Replaces all collections with the contents of an exported file.
+ *
+ * The file may be JSON or binary. The imported state is persisted in the
+ * configured storage format before the call returns.
+ *
+ * @param[in] path Source file path.
+ * @return true if the file was loaded, false if it is missing or malformed.
+ */
+bool db_import(const char *path);
+
+/**
+ * @brief Configures the background checkpointer.
+ *
+ * In WAL mode a checkpointer thread periodically writes a new storage file
+ * from a consistent copy of the database and discards the log records it
+ * covers, which bounds both restart replay time and log size on disk. A
+ * checkpoint starts when any enabled threshold is reached.
+ *
+ * Defaults: 64 MB of log, 100000 logged operations, or 300 seconds.
+ *
+ * @param[in] log_bytes Log size threshold in bytes (0 disables it).
+ * @param[in] ops       Logged operation threshold (0 disables it).
+ * @param[in] seconds   Maximum age of the storage file in seconds (0 disables it).
+ */
+void db_set_checkpoint_policy(long log_bytes, long ops, int seconds);
+
+/**
+ * @brief Takes a checkpoint immediately on the calling thread.
+ *
+ * Writers are only blocked while the in-memory copy is taken, not during
+ * serialization and disk I/O. Does nothing outside WAL mode.
+ */
+void db_checkpoint(void);
+
+/**
+ * @brief Sets how often the TTL reaper runs.
+ *
+ * A reaper thread deletes the documents expired in TTL indexes (see
+ * db_create_index()) in batches, each logged and committed as one unit.
+ * Defaults to 60 seconds.
+ *
+ * @param[in] seconds Seconds between passes (0 disables background expiry).
+ */
+void db_set_ttl_interval(int seconds);
+
+/**
+ * @brief Deletes the documents expired in TTL indexes on the calling thread.
+ *
+ * @return Number of documents deleted.
+ */
+long db_expire(void);
+
+/**
+ * @brief Sets the server-wide durability level for write operations.
+ *
+ * Defaults to DB_DURABILITY_FLUSH.
+ *
+ * @param[in] level The level applied to writes without a per-request override.
+ */
+void db_set_durability(db_durability_t level);
+
+/**
+ * @brief Overrides the durability level for writes issued by the calling thread.
+ *
+ * Intended for per-request settings in the network layer: set it before a
+ * write and reset it with DB_DURABILITY_DEFAULT afterwards.
+ *
+ * @param[in] level The level to apply, or DB_DURABILITY_DEFAULT to clear the override.
+ */
+void db_set_request_durability(db_durability_t level);
+
+/**
+ * @brief Tells why the last write issued by the calling thread failed.
+ *
+ * Set by db_insert(), db_update(), db_upsert(), db_delete() and
+ * db_create_index(), so the network layer can pick a status code.
+ *
+ * @return The reason, or DB_ERROR_NONE if the write succeeded or failed for
+ *         another reason (invalid input, exhausted memory).
+ */
+db_error_t db_last_error(void);
+
 /**
  * @brief Forces an immediate snapshot of the database.
  *
  * Manually triggers a backup of the current production data to a timestamped
- * file in the storage directory.
+ * directory next to the database files and waits until it is complete. The
+ * snapshot is written by a forked process (see db_snapshot_start()), so other
+ * threads keep reading and writing in the meantime.
  */
 void db_force_snapshot(void);
 
+/**
+ * @brief Starts a point-in-time snapshot without blocking writers on its I/O.
+ *
+ * Under the engine lock the current collection images are hard linked into a
+ * staging directory and the process forks. The child owns a copy-on-write
+ * view of the database at that instant, serializes the collections changed
+ * since their image was written and renames the directory to
+ * `backup_YYYYMMDD_HHMMSS-<id>.d`, while the parent returns right away. The
+ * snapshot is self-contained (it has no log or parent) and is restored with
+ * db_restore_snapshot(). Automatic snapshots use the same mechanism.
+ *
+ * @return A positive snapshot id to pass to db_snapshot_status(), or -1 if no
+ *         snapshot could be started.
+ */
+long db_snapshot_start(void);
+
+/**
+ * @brief Reports the progress of a snapshot started by db_snapshot_start().
+ *
+ * The last 64 snapshot ids are remembered.
+ *
+ * @param[in]  id   Snapshot id.
+ * @param[out] path Receives the snapshot directory (may be NULL).
+ * @param[in]  size Size of @p path.
+ * @return The state of the snapshot, or DB_SNAPSHOT_UNKNOWN for an unknown id.
+ */
+db_snapshot_state_t db_snapshot_status(long id, char *path, size_t size);
+
+/**
+ * @brief Takes a snapshot and reports where it was written.
+ *
+ * Snapshots are incremental: collection images are hard linked (or
+ * reflinked) rather than copied, and only the write-ahead log written since
+ * the previous snapshot is stored, with a manifest naming that snapshot as
+ * the parent. Snapshots taken within the same second are merged. Use
+ * db_restore_snapshot() to turn a snapshot back into a database.
+ *
+ * @param[out] path Receives the snapshot directory `backup_YYYYMMDD_HHMMSS.d` (may be NULL).
+ * @param[in]  size Size of @p path.
+ * @return true if the snapshot was written.
+ */
+bool db_snapshot(char *path, size_t size);
+
+/**
+ * @brief Rebuilds a database from a snapshot.
+ *
+ * Follows the snapshot's parents, links its collection images into
+ * `<filepath>.d/` and concatenates the logs of the chain into
+ * `<filepath>.wal`, so db_init() on @p filepath recovers the state the
+ * database had when the snapshot was taken. The engine does not need to be
+ * initialized.
+ *
+ * @param[in] snapshot Snapshot directory (as reported by db_snapshot()).
+ * @param[in] filepath Path of the database to create; it must not exist yet.
+ * @return true if the database files were written.
+ */
+bool db_restore_snapshot(const char *snapshot, const char *filepath);
+
 /**
  * @brief Removes all collections and stored data.
  *
@@ -61,17 +322,20 @@ void db_drop_all(void);
  * @brief Inserts a new document into a collection.
  *
  * Automatically generates a unique `_id` field for the document before insertion.
+ * `_id` values are unique within a collection.
  *
  * @param[in] collection The name of the target collection.
  * @param[in] data       A cJSON object representing the document data.
- * @return true if the insertion was successful, false otherwise.
+ * @return true if the insertion was successful, false if the collection already
+ *         holds a document with the same `_id` or the same key in a unique
+ *         index (see db_last_error()), or on failure.
  */
 bool db_insert(const char *collection, cJSON *data);
 
 /**
  * @brief Queries documents from a collection.
  *
- * Performs basic key-value matching based on the provided query object.
+ * Performs key-value and range matching based on the provided query object.
  *
  * @param[in] collection The name of the target collection.
  * @param[in] query      cJSON object defining match conditions (NULL to match all).
@@ -81,6 +345,102 @@ bool db_insert(const char *collection, cJSON *data);
  */
 cJSON *db_find(const char *collection, cJSON *query, int limit);
 
+/**
+ * @brief Ranks the documents of a collection against a search text.
+ *
+ * Uses the text index on @p field (`{"field": ..., "type": "text"}`). Every
+ * document holding at least one word of @p text is scored with BM25, and
+ * the best ones are returned first, each with its score in `_score`.
+ *
+ * @param[in] collection The name of the target collection.
+ * @param[in] field      Field covered by a text index.
+ * @param[in] text       Search text.
+ * @param[in] limit      Maximum number of documents to return (0 for no limit).
+ * @return A cJSON array of document copies, or NULL if the collection has no
+ *         usable text index on @p field.
+ * @note The caller is responsible for freeing the returned cJSON object using cJSON_Delete().
+ */
+cJSON *db_search(const char *collection, const char *field, const char *text, int limit);
+
+/**
+ * @brief Sort order, limit and projection of a query.
+ */
+typedef struct
+{
+    const char *sort;        /**< Field to order results by (NULL keeps collection order). */
+    bool descending;         /**< True to return the highest values first. */
+    int limit;               /**< Maximum number of documents to return (0 for no limit). */
+    const cJSON *fields;     /**< Array of field names to return (NULL for whole documents). */
+    const cJSON *projection; /**< `{"field": 1|0}` to return or leave out (overrides fields). */
+} db_find_options_t;
+
+/**
+ * @brief Checks a projection for db_find_ex().
+ *
+ * A projection is an object whose members are numbers or booleans: truthy
+ * ones (`1`, `true`) name the only fields to return, falsy ones (`0`,
+ * `false`) the fields to leave out. Both cannot be mixed, except for `_id`,
+ * which is returned unless set falsy. Names may be dotted paths; included
+ * ones cannot name array elements (`tags.1`), which results could not hold
+ * at their position.
+ *
+ * @param[in] projection The projection.
+ * @return true if db_find_ex() accepts it.
+ */
+bool db_projection_valid(const cJSON *projection);
+
+/**
+ * @brief Queries documents from a collection, optionally sorted.
+ *
+ * Results are ordered by the value of the sort field (see query_compare());
+ * documents with equal values keep their collection order. When an ordered
+ * index covers the sort field the documents can be read in index order, so a
+ * limit stops the scan early instead of sorting every match.
+ *
+ * The query is answered by the cheapest of the `_id` index, the secondary
+ * indexes it can use, an intersection of bitmap indexes and a full scan, as
+ * costed by planner.h from index counts and sampled statistics of the
+ * collection (see db_explain()).
+ *
+ * With `fields`, results only hold the listed fields. When the index used by
+ * the query also holds every field the query, the sort and the list name
+ * (`_id` is always available), results are built from the index keys without
+ * reading or copying the documents. Fields naming array elements (`tags.1`)
+ * return no documents, since results could not hold them at their position.
+ *
+ * A `projection` (see db_projection_valid()) is applied while copying: only
+ * the included fields are duplicated, and excluded ones are skipped rather
+ * than copied and then removed. An invalid projection returns no documents.
+ *
+ * @param[in] collection The name of the target collection.
+ * @param[in] query      cJSON object defining match conditions (NULL to match all).
+ * @param[in] opts       Sort order, limit and fields (NULL for collection order, no
+ *                       limit and whole documents).
+ * @return A cJSON array containing matching documents, or NULL on failure.
+ * @note The caller is responsible for freeing the returned cJSON object using cJSON_Delete().
+ */
+cJSON *db_find_ex(const char *collection, cJSON *query, const db_find_options_t *opts);
+
+/**
+ * @brief Runs a query and describes how it was answered.
+ *
+ * The query runs like db_find_ex() but its results are dropped. The
+ * description holds the chosen access path (`plan`: its `access`, `index`,
+ * whether it reads in sort `ordered`, its `candidates`, the
+ * `estimatedExamined` documents and whether the limit was pushed down into the
+ * walk), the `rejected` paths with their costs, the `estimatedMatches`, the
+ * `statistics` the estimate came from, and what actually happened: documents
+ * `examined`, `returned` and `timeMs`.
+ *
+ * @param[in] collection The name of the target collection.
+ * @param[in] query      cJSON object defining match conditions (NULL to match all).
+ * @param[in] opts       Sort order, limit and fields (may be NULL).
+ * @return A cJSON object describing the plan, or NULL if the collection does
+ *         not exist.
+ * @note The caller is responsible for freeing the returned cJSON object using cJSON_Delete().
+ */
+cJSON *db_explain(const char *collection, cJSON *query, const db_find_options_t *opts);
+
 /**
  * @brief Performs a selective update on an existing document.
  *
@@ -91,7 +451,9 @@ cJSON *db_find(const char *collection, cJSON *query, int limit);
  * @param[in] collection The name of the target collection.
  * @param[in] id         The unique `_id` string of the document to update.
  * @param[in] data       A cJSON object containing the fields to update or add.
- * @return true if the document was found and updated, false otherwise.
+ * @return true if the document was found and updated, false otherwise (an
+ *         update giving the document the key of another one in a unique index
+ *         is rejected, see db_last_error()).
  */
 bool db_update(const char *collection, const char *id, cJSON *data);
 
@@ -99,12 +461,14 @@ bool db_update(const char *collection, const char *id, cJSON *data);
  * @brief Updates an existing document or inserts it if not found.
  *
  * If a document with the given `id` exists, it performs a selective update.
- * If it does not exist, it inserts the data as a new document.
+ * If it does not exist, it inserts the data as a new document under that `id`
+ * (unless the data carries its own `_id`). Both steps happen atomically.
  *
  * @param[in] collection The name of the target collection.
  * @param[in] id         The unique `_id` string of the document (can be NULL for forced insert).
  * @param[in] data       A cJSON object representing the document data.
- * @return true on successful update or insertion, false otherwise.
+ * @return true on successful update or insertion, false otherwise. An update
+ *         rejected by a unique index does not fall back to an insert.
  */
 bool db_upsert(const char *collection, const char *id, cJSON *data);
 
@@ -125,4 +489,49 @@ bool db_delete(const char *collection, const char *id);
  */
 int db_count(const char *collection);
 
+/**
+ * @brief Creates a secondary index on a collection.
+ *
+ * The index is built from the current documents, kept up to date by every
+ * write, and used by db_find() for equality predicates on the indexed fields.
+ * Ordered indexes also serve predicates on a prefix of the fields, range
+ * predicates and sorts. Unique
+ * indexes (`"unique": true`) make writes fail with DB_ERROR_DUPLICATE_KEY
+ * instead of storing a second document under one key. TTL indexes
+ * (`"expireAfterSeconds": N` on one field holding seconds since the epoch)
+ * let the reaper delete documents N seconds past that time. Index
+ * definitions are stored next to the collection files and rebuilt on startup.
+ *
+ * @param[in] collection The name of the target collection (created if missing).
+ * @param[in] spec       Index specification, e.g. `{"field": "user_id"}`,
+ *                       `{"field": "ts", "type": "ordered"}` or
+ *                       `{"fields": ["tenant", "status"]}`.
+ * @return true if the index exists afterwards (creating an identical index is
+ *         a no-op), false if the specification is invalid, conflicts with an
+ *         existing index, or is unique while documents share a key.
+ */
+bool db_create_index(const char *collection, const cJSON *spec);
+
+/**
+ * @brief Drops a secondary index.
+ *
+ * @param[in] collection The name of the target collection.
+ * @param[in] name       Index name, as reported by db_list_indexes().
+ * @return true if the index was dropped, false if it does not exist.
+ */
+bool db_drop_index(const char *collection, const char *name);
+
+/**
+ * @brief Lists the indexes of a collection.
+ *
+ * Every entry holds the index specification plus its `name`, the number of
+ * distinct `keys` and the number of indexed documents (`entries`). The `_id`
+ * index comes first.
+ *
+ * @param[in] collection The name of the target collection.
+ * @return A cJSON array (empty if the collection does not exist).
+ * @note The caller is responsible for freeing the returned cJSON object using cJSON_Delete().
+ */
+cJSON *db_list_indexes(const char *collection);
+
 #endif /* DATABASE_H */
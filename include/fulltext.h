@@ -0,0 +1,146 @@
+/**
+ * @file fulltext.h
+ * @brief Inverted index over the words of a text field.
+ *
+ * Text is split into tokens: runs of ASCII letters and digits, lowercased,
+ * and of bytes outside ASCII (so UTF-8 words stay whole). Every token maps to
+ * a posting list recording, for each document holding it, the document
+ * number and the number of occurrences. Posting lists are compressed: the
+ * gap to the previous document number and the count are stored as varints,
+ * so most entries take two bytes.
+ *
+ * Documents are referenced, never copied, like in secondary.h. Searches rank
+ * documents with the Okapi BM25 score over the tokens of the search text.
+ */
+
+#ifndef FULLTEXT_H
+#define FULLTEXT_H
+
+#include "../third_party/cJSON/cJSON.h"
+#include "index.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Tokens longer than this many bytes are not indexed.
+ */
+#define FULLTEXT_MAX_TOKEN 64
+
+/**
+ * @brief Opaque inverted index handle.
+ */
+typedef struct fulltext fulltext_t;
+
+/**
+ * @brief Receives the results of fulltext_search(), best first.
+ *
+ * @param[in] doc   Stored document.
+ * @param[in] score Relevance score (higher is better).
+ * @param[in] ctx   Caller context.
+ * @return false to stop the search.
+ */
+typedef bool (*fulltext_visit_fn)(cJSON *doc, double score, void *ctx);
+
+/**
+ * @brief Creates an empty index.
+ *
+ * @return The new index (release with fulltext_free()), or NULL on allocation failure.
+ */
+fulltext_t *fulltext_create(void);
+
+/**
+ * @brief Releases an index (the documents it references are left alone).
+ *
+ * @param[in] ft The index (may be NULL).
+ */
+void fulltext_free(fulltext_t *ft);
+
+/**
+ * @brief Returns the number of distinct tokens in the index.
+ *
+ * @param[in] ft The index.
+ * @return Token count.
+ */
+size_t fulltext_terms(const fulltext_t *ft);
+
+/**
+ * @brief Returns the size of the compressed posting lists.
+ *
+ * @param[in] ft The index.
+ * @return Size in bytes.
+ */
+size_t fulltext_bytes(const fulltext_t *ft);
+
+/**
+ * @brief Adds the text of a stored document.
+ *
+ * @param[in] ft     The index.
+ * @param[in] text   Text to index.
+ * @param[in] stored Pointer recorded in the index.
+ * @return false on allocation failure (the document is then not indexed).
+ */
+bool fulltext_add(fulltext_t *ft, const char *text, cJSON *stored);
+
+/**
+ * @brief Removes a stored document.
+ *
+ * @param[in] ft     The index.
+ * @param[in] text   Text the document was added with.
+ * @param[in] stored Pointer recorded when it was added.
+ * @return true if the document was indexed.
+ */
+bool fulltext_remove(fulltext_t *ft, const char *text, const cJSON *stored);
+
+/**
+ * @brief Swaps the pointer recorded for a document.
+ *
+ * @param[in] ft     The index.
+ * @param[in] old    Pointer recorded so far.
+ * @param[in] stored Pointer to record instead.
+ */
+void fulltext_replace(fulltext_t *ft, const cJSON *old, cJSON *stored);
+
+/**
+ * @brief Visits the documents holding any token of a search text, best first.
+ *
+ * Documents with equal scores are visited in the order they were added.
+ *
+ * @param[in] ft    The index.
+ * @param[in] text  Search text.
+ * @param[in] limit Maximum number of documents (0 for all of them).
+ * @param[in] visit Called for every result.
+ * @param[in] ctx   Passed to @p visit.
+ * @return false on allocation failure.
+ */
+bool fulltext_search(const fulltext_t *ft, const char *text, size_t limit,
+                     fulltext_visit_fn visit, void *ctx);
+
+/**
+ * @brief Writes an index to a stream.
+ *
+ * Documents are written as their positions in @p numbers, so the index can be
+ * loaded against another copy of the same documents.
+ *
+ * @param[in] ft      The index.
+ * @param[in] fp      Destination stream.
+ * @param[in] numbers Stored pointer (as key bytes) -> position + 1 of every
+ *                    document the index references.
+ * @return false on a write error or if a document has no position.
+ */
+bool fulltext_save(const fulltext_t *ft, FILE *fp, const index_t *numbers);
+
+/**
+ * @brief Reads an index written by fulltext_save() into an empty one.
+ *
+ * @param[in] ft    An empty index.
+ * @param[in] fp    Source stream.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false if the stream is truncated or malformed or memory is
+ *         exhausted (free the index then).
+ */
+bool fulltext_load(fulltext_t *ft, FILE *fp, cJSON *const *docs, size_t count);
+
+#endif /* FULLTEXT_H */
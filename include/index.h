@@ -0,0 +1,129 @@
+/**
+ * @file index.h
+ * @brief Hash table used for document lookups by key.
+ *
+ * An open-addressing hash table (linear probing, backward-shift deletion)
+ * mapping byte-string keys to opaque pointers. Lookups hash the key once and
+ * compare it only against entries with the same 64-bit hash, so their cost
+ * does not depend on the number of entries.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Opaque hash table handle.
+ */
+typedef struct index_table index_t;
+
+/**
+ * @brief Releases a value stored in the table.
+ *
+ * @param[in] value The value to release.
+ */
+typedef void (*index_free_fn)(void *value);
+
+/**
+ * @brief Receives one entry of a table walk.
+ *
+ * @param[in] key   Key bytes.
+ * @param[in] len   Key length in bytes.
+ * @param[in] value Stored value.
+ * @param[in] ctx   Caller context.
+ * @return false to stop the walk.
+ */
+typedef bool (*index_visit_fn)(const char *key, size_t len, void *value, void *ctx);
+
+/**
+ * @brief Creates an empty table.
+ *
+ * @param[in] expected Number of entries to size the table for (0 for a small default).
+ * @return The new table (release with index_free()), or NULL on allocation failure.
+ */
+index_t *index_create(size_t expected);
+
+/**
+ * @brief Releases a table and optionally its values.
+ *
+ * @param[in] idx        The table (may be NULL).
+ * @param[in] free_value Called for every stored value (NULL to leave them alone).
+ */
+void index_free(index_t *idx, index_free_fn free_value);
+
+/**
+ * @brief Returns the number of entries in the table.
+ *
+ * @param[in] idx The table.
+ * @return Entry count.
+ */
+size_t index_count(const index_t *idx);
+
+/**
+ * @brief Grows the table so @p count entries fit without further rehashing.
+ *
+ * @param[in] idx   The table.
+ * @param[in] count Expected number of entries.
+ * @return false on allocation failure (the table is left unchanged).
+ */
+bool index_reserve(index_t *idx, size_t count);
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param[in] idx The table.
+ * @param[in] key Key bytes (need not be NUL-terminated).
+ * @param[in] len Key length in bytes.
+ * @return The stored value, or NULL if the key is absent.
+ */
+void *index_get(const index_t *idx, const char *key, size_t len);
+
+/**
+ * @brief Inserts a key or replaces the value stored under it.
+ *
+ * The key is copied; the value is stored as is.
+ *
+ * @param[in]  idx   The table.
+ * @param[in]  key   Key bytes.
+ * @param[in]  len   Key length in bytes.
+ * @param[in]  value Value to store.
+ * @param[out] old   Receives the replaced value, or NULL if the key was new (may be NULL).
+ * @return false on allocation failure (the table is left unchanged).
+ */
+bool index_put(index_t *idx, const char *key, size_t len, void *value, void **old);
+
+/**
+ * @brief Removes a key.
+ *
+ * @param[in] idx The table.
+ * @param[in] key Key bytes.
+ * @param[in] len Key length in bytes.
+ * @return The value that was stored, or NULL if the key was absent.
+ */
+void *index_remove(index_t *idx, const char *key, size_t len);
+
+/**
+ * @brief Visits every entry, in no particular order.
+ *
+ * The table must not be modified during the walk.
+ *
+ * @param[in] idx   The table.
+ * @param[in] visit Called for every entry.
+ * @param[in] ctx   Passed to @p visit.
+ * @return false if @p visit stopped the walk.
+ */
+bool index_foreach(const index_t *idx, index_visit_fn visit, void *ctx);
+
+/**
+ * @brief Hashes a key with the function used by the table.
+ *
+ * @param[in] key Key bytes.
+ * @param[in] len Key length in bytes.
+ * @return 64-bit hash.
+ */
+uint64_t index_hash(const char *key, size_t len);
+
+#endif /* INDEX_H */
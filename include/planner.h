@@ -0,0 +1,163 @@
+/**
+ * @file planner.h
+ * @brief Statistics and cost model used to choose how a find reads a collection.
+ *
+ * The statistics of a collection are taken from a sample of its documents:
+ * for every field path found in them (nested objects included), the
+ * fraction of documents holding it, an estimate of its number of distinct
+ * values and the range of its numbers. Exact distinct counts reported by
+ * indexes replace the sampled ones. From them, planner_selectivity()
+ * estimates the fraction of documents a query matches, assuming conditions
+ * on different fields are independent.
+ *
+ * Every way of answering a find (an access path: a scan, the `_id` index, one
+ * secondary index or an intersection of bitmap indexes) yields a number of
+ * candidate documents, known exactly or bounded by the indexes. planner_cost()
+ * turns it into the number of documents the find is expected to examine:
+ * every candidate, or, when a limit applies to candidates read in result
+ * order, only as many as it takes to find that many matches.
+ */
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "../third_party/cJSON/cJSON.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Documents a sample holds at most.
+ */
+#define PLANNER_SAMPLE 1000
+
+/**
+ * @brief Opaque statistics of one collection.
+ */
+typedef struct planner_stats planner_stats_t;
+
+/**
+ * @brief Ways a find can read its candidate documents.
+ */
+typedef enum
+{
+    PLAN_SCAN = 0, /**< Every document of the collection. */
+    PLAN_ID,       /**< The document the `_id` index holds for the queried `_id`. */
+    PLAN_INDEX,    /**< The documents one secondary index selects. */
+    PLAN_INTERSECT /**< The documents every answering bitmap index selects. */
+} plan_access_t;
+
+/**
+ * @brief One candidate access path and its cost.
+ */
+typedef struct
+{
+    plan_access_t access; /**< How candidates are read. */
+    size_t candidates;    /**< Documents read (estimated for ranges too long to count). */
+    bool ordered;         /**< Candidates come in the requested sort order. */
+    double examined;      /**< Expected documents examined (set by planner_cost()). */
+} plan_t;
+
+/**
+ * @brief Creates empty statistics.
+ *
+ * @return The statistics (release with planner_stats_free()), or NULL on
+ *         allocation failure.
+ */
+planner_stats_t *planner_stats_create(void);
+
+/**
+ * @brief Releases statistics.
+ *
+ * @param[in] stats The statistics (may be NULL).
+ */
+void planner_stats_free(planner_stats_t *stats);
+
+/**
+ * @brief Replaces the statistics with those of a sample.
+ *
+ * Distinct values are extrapolated to the whole collection from how many
+ * values the sample holds once or several times (Charikar et al.'s GEE
+ * estimator), so fields unique per document scale with the collection while
+ * fields with few values do not.
+ *
+ * @param[in] stats The statistics.
+ * @param[in] docs  Sampled documents.
+ * @param[in] n     Entries in docs.
+ * @param[in] total Documents in the collection.
+ * @return false on allocation failure (the statistics are then empty).
+ */
+bool planner_stats_sample(planner_stats_t *stats, const cJSON *const *docs, size_t n,
+                          size_t total);
+
+/**
+ * @brief Records the exact number of distinct values of a field.
+ *
+ * @param[in] stats    The statistics.
+ * @param[in] field    Field path.
+ * @param[in] distinct Distinct values, e.g. the keys of an index on the field.
+ * @param[in] holders  Documents holding the field.
+ * @return false on allocation failure.
+ */
+bool planner_stats_set(planner_stats_t *stats, const char *field, size_t distinct,
+                       size_t holders);
+
+/**
+ * @brief Returns the collection size the statistics describe.
+ *
+ * @param[in] stats The statistics.
+ * @return Documents in the collection when they were taken.
+ */
+size_t planner_stats_docs(const planner_stats_t *stats);
+
+/**
+ * @brief Describes the statistics of some fields.
+ *
+ * @param[in] stats  The statistics.
+ * @param[in] fields Object whose member names are the fields to describe
+ *                   (e.g. a query), or NULL for every field.
+ * @return An object mapping each known field to
+ *         `{"present", "distinct"[, "min", "max"]}`, or NULL on allocation
+ *         failure.
+ */
+cJSON *planner_stats_describe(const planner_stats_t *stats, const cJSON *fields);
+
+/**
+ * @brief Estimates the fraction of documents a query matches.
+ *
+ * Equality selects the documents holding the field divided by its distinct
+ * values, numeric ranges the part of the sampled range they cover, and other
+ * ranges a third of the holders. `$and` and the members of a filter
+ * multiply, `$or` combines like independent events, and `$ne`, `$nin` and
+ * `$not` take the complement. Fields without statistics are held by every
+ * document and take ten values.
+ *
+ * @param[in] stats The statistics (may be NULL, every field then unknown).
+ * @param[in] query The filter (NULL matches all).
+ * @return A fraction in [0, 1].
+ */
+double planner_selectivity(const planner_stats_t *stats, const cJSON *query);
+
+/**
+ * @brief Computes the documents an access path is expected to examine.
+ *
+ * A path reading candidates in result order stops after @p limit matches,
+ * candidates matching at the rate of @p matches over their number. Other
+ * paths examine every candidate.
+ *
+ * @param[in,out] plan    The access path; examined is set.
+ * @param[in]     matches Expected matching documents.
+ * @param[in]     limit   Results wanted (0 for all).
+ * @param[in]     sorted  Results are sorted.
+ */
+void planner_cost(plan_t *plan, double matches, size_t limit, bool sorted);
+
+/**
+ * @brief Names an access path.
+ *
+ * @param[in] access The access path.
+ * @return `"scan"`, `"id"`, `"index"` or `"intersect"`.
+ */
+const char *planner_access_name(plan_access_t access);
+
+#endif /* PLANNER_H */
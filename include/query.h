@@ -13,20 +13,230 @@
 
 #include <stdbool.h>
 
+/**
+ * @brief Opaque handle of a compiled query.
+ */
+typedef struct query_program query_program_t;
+
+/**
+ * @brief Opaque handle of a parsed field path.
+ */
+typedef struct query_path query_path_t;
+
 /**
  * @brief Checks if a document matches a specific query filter.
- * * Performs a key-value comparison. For a match to be successful, all keys
- * present in the query must exist in the document with identical values.
+ * * Every member of the query must hold. A member names a field and gives
+ * either a value the field must equal or an operator expression:
+ * - `$eq`, `$ne`: equal / not equal (`$ne` matches missing fields).
+ * - `$gt`, `$gte`, `$lt`, `$lte`: numbers with numbers, strings with strings.
+ * - `$in`, `$nin`: equal to one / none of the values of an array (`$nin`
+ *   matches missing fields).
+ * - `$exists`: the field is present (`true`) or missing (`false`).
+ * - `$not`: the condition it holds (a value or an expression) fails.
+ * The members `$and` and `$or` take an array of filters, all / one of which
+ * must match, and `$not` a filter that must not match. Equality compares
+ * strings, numbers, booleans and null by type and value, and arrays and
+ * objects in full. Unknown operators and operands of the wrong type never
+ * match.
  * * **Example:**
  * - Doc: `{"name": "Alice", "role": "admin"}`
- * - Query: `{"role": "admin"}`
+ * - Query: `{"$or": [{"role": "admin"}, {"name": {"$in": ["Bob", "Eve"]}}]}`
  * - Result: `true`
  * * @param[in] doc   The source document cJSON object to check.
  * @param[in] query The filter criteria cJSON object.
  * @return true if the document matches all fields in the query, false otherwise.
- * @note This function performs a shallow match; nested objects may require
- * additional recursive handling depending on implementation.
+ * @note A field name is a path: `address.city` names the `city` member of
+ * the `address` object and `items.0` the first element of the `items` array.
+ * A document that does not hold every segment misses the field.
  */
 bool query_match(cJSON *doc, cJSON *query);
 
+/**
+ * @brief Orders two values for sorting.
+ *
+ * Numbers sort before strings, strings before booleans (`false` before
+ * `true`), and missing values or values of any other type before all of
+ * them. Numbers compare numerically and strings bytewise.
+ *
+ * @param[in] a First value (may be NULL).
+ * @param[in] b Second value (may be NULL).
+ * @return A negative, zero or positive value as @p a sorts before, equal to or after @p b.
+ */
+int query_compare(const cJSON *a, const cJSON *b);
+
+/**
+ * @brief Tells whether two field names are the same field.
+ *
+ * Names are compared ignoring case, like documents are searched, so indexes
+ * and sorts agree with the queries on which field a name designates.
+ *
+ * @param[in] a First field name.
+ * @param[in] b Second field name.
+ * @return true if the names only differ in case.
+ */
+bool query_field_equal(const char *a, const char *b);
+
+/**
+ * @brief Tells whether a field name can address an array element.
+ *
+ * @param[in] field Field name.
+ * @return true if a segment is an array index, as in `items.0.sku`.
+ */
+bool query_field_positional(const char *field);
+
+/**
+ * @brief Tells whether a query value is an operator expression.
+ *
+ * **Example:** `{"$gte": 1700000000, "$lt": 1700003600}`
+ *
+ * @param[in] item Query value.
+ * @return true for an object whose first member name starts with '$'.
+ */
+bool query_is_operator(const cJSON *item);
+
+/**
+ * @brief Collects the conditions a query places on single fields.
+ *
+ * Conditions of `$and` branches are lifted to the top level, operator
+ * expressions on one field are merged, and the first `$or` is kept as is;
+ * `$not` and further conditions on a field already seen are dropped. Every
+ * document the query matches also matches the result, so indexes can pick
+ * their candidates from it.
+ *
+ * **Example:** `{"a": {"$gt": 1}, "$and": [{"a": {"$lt": 5}}, {"b": 2}]}`
+ * becomes `{"a": {"$gt": 1, "$lt": 5}, "b": 2}`.
+ *
+ * @param[in] query The filter (may be NULL).
+ * @return A new object (release with cJSON_Delete()), or NULL on allocation
+ *         failure.
+ */
+cJSON *query_flatten(const cJSON *query);
+
+/**
+ * @brief Compiles a query filter for repeated matching.
+ *
+ * The program resolves each field the query names once per document and
+ * compares it with constants converted ahead of time, instead of walking the
+ * query for every document as query_match() does. The query may be released
+ * once the program is built.
+ *
+ * @param[in] query The filter criteria cJSON object (NULL matches all).
+ * @return The program (release with query_program_free()), or NULL on
+ *         allocation failure.
+ */
+query_program_t *query_compile(const cJSON *query);
+
+/**
+ * @brief Checks if a document matches a compiled query.
+ *
+ * @param[in] prog The program.
+ * @param[in] doc  The document (may be NULL).
+ * @return The same result as query_match() with the compiled query.
+ */
+bool query_run(const query_program_t *prog, const cJSON *doc);
+
+/**
+ * @brief Releases a compiled query.
+ *
+ * @param[in] prog The program (may be NULL).
+ */
+void query_program_free(query_program_t *prog);
+
+/**
+ * @brief Parses a field name into a path.
+ *
+ * The name is split on dots. Each segment names a member of an object
+ * (ignoring case, like cJSON_GetObjectItem()) or, when it is a decimal number,
+ * an element of an array.
+ *
+ * **Example:** `items.0.sku` is the `sku` member of the first element of the
+ * `items` array.
+ *
+ * @param[in] field Field name.
+ * @return The path (release with query_path_free()), or NULL on allocation
+ *         failure.
+ */
+query_path_t *query_path_create(const char *field);
+
+/**
+ * @brief Releases a parsed path.
+ *
+ * @param[in] path The path (may be NULL).
+ */
+void query_path_free(query_path_t *path);
+
+/**
+ * @brief Returns the field name a path was parsed from.
+ *
+ * @param[in] path The path.
+ * @return The field name.
+ */
+const char *query_path_text(const query_path_t *path);
+
+/**
+ * @brief Resolves a path in a document.
+ *
+ * @param[in] path The path.
+ * @param[in] doc  The document (may be NULL).
+ * @return The value, or NULL if the document does not hold it.
+ */
+const cJSON *query_path_get(const query_path_t *path, const cJSON *doc);
+
+/**
+ * @brief Detaches the value a path names from a document.
+ *
+ * @param[in] path The path.
+ * @param[in] doc  The document.
+ * @return The detached value (caller frees), or NULL if the document does not
+ *         hold it.
+ */
+cJSON *query_path_detach(const query_path_t *path, cJSON *doc);
+
+/**
+ * @brief Stores a value under a path, creating the objects leading to it.
+ *
+ * Every segment is taken as a member name: storing `1` under `items.0` into
+ * `{}` gives `{"items": {"0": 1}}`, which query_path_get() reads back but a
+ * document would hold as an array. Results returned to clients therefore do
+ * not store positional paths (see query_field_positional()).
+ *
+ * @param[in] path  The path.
+ * @param[in] doc   The object to store into.
+ * @param[in] value The value (owned by @p doc on success).
+ * @return false if a segment leading to the value holds something other than
+ *         an object, the last one already holds a value, or on allocation
+ *         failure.
+ */
+bool query_path_put(const query_path_t *path, cJSON *doc, cJSON *value);
+
+/**
+ * @brief Copies a document without the values some paths name.
+ *
+ * Values are left out while copying, so they are never duplicated. Each path
+ * leaves out the value query_path_get() would return; objects and arrays
+ * leading to it are copied without it.
+ *
+ * **Example:** leaving out `items.0.sku` and `name` from
+ * `{"name": "a", "items": [{"sku": "x", "qty": 2}]}` gives
+ * `{"items": [{"qty": 2}]}`.
+ *
+ * @param[in] doc   The document.
+ * @param[in] paths Paths of the values to leave out.
+ * @param[in] count Entries in paths.
+ * @return The copy (caller frees), or NULL on allocation failure.
+ */
+cJSON *query_path_copy_except(const cJSON *doc, query_path_t *const *paths, size_t count);
+
+/**
+ * @brief Tells whether a path leads through or to the value of another.
+ *
+ * **Example:** `address.city` is within `address` and within itself.
+ *
+ * @param[in] path  The path.
+ * @param[in] outer The enclosing path.
+ * @return true if the segments of @p outer start those of @p path (ignoring
+ *         case).
+ */
+bool query_path_within(const query_path_t *path, const query_path_t *outer);
+
 #endif /* QUERY_H */
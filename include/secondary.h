@@ -0,0 +1,420 @@
+/**
+ * @file secondary.h
+ * @brief Secondary indexes over document fields.
+ *
+ * A secondary index maps the values of one or more document fields to the
+ * stored documents holding them, so queries on those fields read only the
+ * matching documents instead of scanning the collection. Documents are
+ * referenced, never copied: the caller owns them and must report every
+ * document it stores, replaces or frees.
+ *
+ * Two kinds exist. Hash indexes answer equality predicates on all of their
+ * fields. Ordered indexes keep their keys sorted (see query_compare()), field
+ * by field, so they also answer predicates on a prefix of their fields, range
+ * predicates on the field after an equality prefix, and return documents in
+ * the order of the first field. Equality includes `$eq` and `$in`, a list of
+ * values the field may take, which turns into one key or range per value;
+ * other operators are left to the query. Text indexes tokenize a string
+ * field into an inverted index (see fulltext.h); they only serve
+ * secondary_search().
+ * Bitmap indexes, meant for fields with few distinct values, map every value
+ * of one field to a compressed bitmap (see bitmap.h) of document slots; the
+ * slots are shared by the bitmap indexes of a collection through a
+ * secondary_slots_t, so secondary_select() results of several indexes can be
+ * intersected to answer queries on several fields.
+ *
+ * A document is indexed when query_match() can compare its first field
+ * (strings, numbers and booleans); documents whose first field is missing or
+ * holds another type are left out, which is exactly the set a predicate the
+ * index answers cannot match. The values of the other fields are recorded in
+ * the key, so queries reading only indexed fields can be answered from it.
+ */
+
+#ifndef SECONDARY_H
+#define SECONDARY_H
+
+#include "../third_party/cJSON/cJSON.h"
+#include "bitmap.h"
+#include "fulltext.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Opaque secondary index handle.
+ */
+typedef struct secondary_index secondary_t;
+
+/**
+ * @brief Key of a visited posting list, read with secondary_key_values().
+ */
+typedef struct secondary_key secondary_key_t;
+
+/**
+ * @brief Slot numbers shared by the bitmap indexes of a collection.
+ */
+typedef struct secondary_slots secondary_slots_t;
+
+/**
+ * @brief How an index can narrow a query.
+ */
+typedef enum
+{
+    SECONDARY_UNUSABLE = 0, /**< The query does not constrain the field in a usable way. */
+    SECONDARY_EQUALITY,     /**< Every field is compared with a value or a list of values. */
+    SECONDARY_RANGE         /**< A prefix of the fields is bounded (ordered and bitmap indexes). */
+} secondary_match_t;
+
+/**
+ * @brief Receives the documents visited by secondary_scan().
+ *
+ * The callback may replace the visited document through secondary_replace()
+ * but must not add or remove documents.
+ *
+ * @param[in] doc Stored document.
+ * @param[in] key Key the document is stored under (valid during the call).
+ * @param[in] ctx Caller context.
+ * @return false to stop the scan.
+ */
+typedef bool (*secondary_visit_fn)(cJSON *doc, const secondary_key_t *key, void *ctx);
+
+/**
+ * @brief Creates an empty index from its specification.
+ *
+ * The specification is an object such as `{"field": "ts", "type": "ordered"}`
+ * or `{"fields": ["tenant", "status"]}`: either one `field` or a list of
+ * distinct `fields`, most significant first. Fields are paths (see
+ * query_path_create()), such as `address.city`. `type` is `"hash"` (the
+ * default), `"ordered"`, `"text"` or `"bitmap"` (the last two take one field
+ * only), and `"unique": true` makes secondary_conflicts() report documents
+ * sharing a key. Bitmap indexes must be bound with secondary_bind() before
+ * documents are added. `"expireAfterSeconds": N` (a number, zero or more)
+ * makes a single-field index a TTL index (see secondary_ttl()); it implies
+ * `"type": "ordered"` and rejects any other type.
+ *
+ * @param[in] spec Index specification.
+ * @return The new index (release with secondary_free()), or NULL if the
+ *         specification is invalid or memory is exhausted.
+ */
+secondary_t *secondary_create(const cJSON *spec);
+
+/**
+ * @brief Releases an index (the documents it references are left alone).
+ *
+ * @param[in] sec The index (may be NULL).
+ */
+void secondary_free(secondary_t *sec);
+
+/**
+ * @brief Returns the name of an index.
+ *
+ * Hash and ordered indexes are named after their fields joined by commas,
+ * text and bitmap indexes after their field followed by `:text` or `:bitmap`.
+ *
+ * @param[in] sec The index.
+ * @return The name, owned by the index.
+ */
+const char *secondary_name(const secondary_t *sec);
+
+/**
+ * @brief Returns the first indexed field, which orders ordered indexes.
+ *
+ * @param[in] sec The index.
+ * @return The field name, owned by the index.
+ */
+const char *secondary_field(const secondary_t *sec);
+
+/**
+ * @brief Tells whether a field is part of an index.
+ *
+ * @param[in] sec   The index.
+ * @param[in] field Field name.
+ * @return true if @p field is one of the indexed fields (ignoring case).
+ */
+bool secondary_covers(const secondary_t *sec, const char *field);
+
+/**
+ * @brief Tells whether an index keeps its keys in order.
+ *
+ * @param[in] sec The index.
+ * @return true for ordered indexes.
+ */
+bool secondary_ordered(const secondary_t *sec);
+
+/**
+ * @brief Tells whether an index is a text index.
+ *
+ * @param[in] sec The index.
+ * @return true for text indexes.
+ */
+bool secondary_text(const secondary_t *sec);
+
+/**
+ * @brief Tells whether an index is a bitmap index.
+ *
+ * @param[in] sec The index.
+ * @return true for bitmap indexes.
+ */
+bool secondary_bitmap(const secondary_t *sec);
+
+/**
+ * @brief Creates an empty slot table for the bitmap indexes of a collection.
+ *
+ * @return The new table (release with secondary_slots_free() once its
+ *         indexes are freed), or NULL on allocation failure.
+ */
+secondary_slots_t *secondary_slots_create(void);
+
+/**
+ * @brief Releases a slot table.
+ *
+ * @param[in] slots The table (may be NULL).
+ */
+void secondary_slots_free(secondary_slots_t *slots);
+
+/**
+ * @brief Attaches a bitmap index to the slot table of its collection.
+ *
+ * @param[in] sec   A bitmap index, still empty.
+ * @param[in] slots The slot table, which must outlive the index.
+ */
+void secondary_bind(secondary_t *sec, secondary_slots_t *slots);
+
+/**
+ * @brief Visits the documents whose slots a bitmap holds, in slot order.
+ *
+ * The callback may replace the visited document through secondary_replace()
+ * but must not add or remove documents.
+ *
+ * @param[in] slots The slot table.
+ * @param[in] set   Slots to visit, such as an intersection of
+ *                  secondary_select() results.
+ * @param[in] visit Called for every document, with a NULL key.
+ * @param[in] ctx   Passed to @p visit.
+ */
+void secondary_slots_visit(const secondary_slots_t *slots, const bitmap_t *set,
+                           secondary_visit_fn visit, void *ctx);
+
+/**
+ * @brief Tells whether an index rejects duplicate keys.
+ *
+ * @param[in] sec The index.
+ * @return true for unique indexes.
+ */
+bool secondary_unique(const secondary_t *sec);
+
+/**
+ * @brief Returns how long documents of a TTL index live.
+ *
+ * A document expires once the current time reaches its indexed field, a
+ * number of seconds since the epoch, plus this delay; documents holding
+ * anything else never expire. The owner of the index finds expired documents
+ * with a `$lte` range scan and deletes them.
+ *
+ * @param[in] sec The index.
+ * @return The `expireAfterSeconds` of the index, or a negative value if it is
+ *         not a TTL index.
+ */
+double secondary_ttl(const secondary_t *sec);
+
+/**
+ * @brief Tells whether storing a document would break a unique index.
+ *
+ * Only documents the index holds are constrained: those missing the first
+ * field are not, nor are those holding null, an array or an object in any
+ * indexed field. A missing later field counts as a value of its own.
+ *
+ * @param[in] sec  The index.
+ * @param[in] view Decoded contents of the document to store.
+ * @param[in] self Pointer recorded for the version the document replaces,
+ *                 which does not conflict with it (NULL for a new document).
+ * @return true if the index is unique and another document is stored under
+ *         the same key.
+ */
+bool secondary_conflicts(const secondary_t *sec, const cJSON *view, const cJSON *self);
+
+/**
+ * @brief Returns the number of documents referenced by an index.
+ *
+ * @param[in] sec The index.
+ * @return Entry count.
+ */
+size_t secondary_entries(const secondary_t *sec);
+
+/**
+ * @brief Returns the number of distinct keys of an index.
+ *
+ * For a single-field index this is the number of distinct values of the
+ * field among the documents it holds.
+ *
+ * @param[in] sec The index.
+ * @return Keys (terms, for text indexes).
+ */
+size_t secondary_keys(const secondary_t *sec);
+
+/**
+ * @brief Returns the normalized specification of an index.
+ *
+ * @param[in] sec The index.
+ * @return The specification, owned by the index.
+ */
+const cJSON *secondary_spec(const secondary_t *sec);
+
+/**
+ * @brief Adds a stored document to the index.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded contents of the document (read for the key).
+ * @param[in] stored Pointer recorded in the index (@p view itself, or the
+ *                   placeholder it was decoded from).
+ * @return false on allocation failure; the index then stops serving queries.
+ */
+bool secondary_add(secondary_t *sec, const cJSON *view, cJSON *stored);
+
+/**
+ * @brief Removes a stored document from the index.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded contents of the document, as it was added.
+ * @param[in] stored Pointer recorded when it was added.
+ */
+void secondary_remove(secondary_t *sec, const cJSON *view, const cJSON *stored);
+
+/**
+ * @brief Swaps the pointer recorded for a document without changing its key.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded contents of the document.
+ * @param[in] old    Pointer recorded so far.
+ * @param[in] stored Pointer to record instead.
+ */
+void secondary_replace(secondary_t *sec, const cJSON *view, const cJSON *old, cJSON *stored);
+
+/**
+ * @brief Tells how an index can narrow a query.
+ *
+ * @param[in]  sec      The index.
+ * @param[in]  query    Query object (may be NULL).
+ * @param[out] estimate Receives an upper bound of the documents a scan visits.
+ * @return The kind of predicate the index can answer.
+ */
+secondary_match_t secondary_match(const secondary_t *sec, const cJSON *query, size_t *estimate);
+
+/**
+ * @brief Counts the documents secondary_scan() visits for a query.
+ *
+ * Equality keys are counted exactly; ranges are walked key by key, so the
+ * walk stops once the count exceeds @p cap, typically the cost of the best
+ * alternative, which bounds the time spent counting by the time it saves.
+ *
+ * @param[in] sec   The index.
+ * @param[in] query Query object (may be NULL).
+ * @param[in] cap   Count past which keys are no longer walked.
+ * @return The count, or cap + 1 once it is exceeded; the entry count when the
+ *         index cannot narrow the query.
+ */
+size_t secondary_count(const secondary_t *sec, const cJSON *query, size_t cap);
+
+/**
+ * @brief Visits the documents that can match a query.
+ *
+ * Documents are visited in index order: ascending or descending key for
+ * ordered and bitmap indexes, with documents sharing a key in the order they
+ * were added (in slot order for bitmap indexes). An ordered or bitmap index
+ * the query cannot narrow visits all of its documents. Every visited document
+ * still has to be checked with query_match().
+ *
+ * @param[in] sec        The index.
+ * @param[in] query      Query object (may be NULL).
+ * @param[in] descending True to walk an ordered index from its highest key.
+ * @param[in] visit      Called for every candidate document.
+ * @param[in] ctx        Passed to @p visit.
+ */
+void secondary_scan(const secondary_t *sec, const cJSON *query, bool descending,
+                    secondary_visit_fn visit, void *ctx);
+
+/**
+ * @brief Collects the slots of the documents a bitmap index can match.
+ *
+ * Like secondary_scan(), the documents still have to be checked with
+ * query_match().
+ *
+ * @param[in] sec   A bitmap index.
+ * @param[in] query Query object.
+ * @return A new bitmap (release with bitmap_free()), or NULL if the index is
+ *         not a bitmap index, cannot narrow the query, lost an update to an
+ *         allocation failure, or memory is exhausted.
+ */
+bitmap_t *secondary_select(const secondary_t *sec, const cJSON *query);
+
+/**
+ * @brief Ranks the documents of a text index against a search text.
+ *
+ * @param[in] sec   A text index.
+ * @param[in] text  Search text.
+ * @param[in] limit Maximum number of documents (0 for all of them).
+ * @param[in] visit Called for every result, best first.
+ * @param[in] ctx   Passed to @p visit.
+ * @return false if the index is not a text index, lost an update to an
+ *         allocation failure, or memory is exhausted.
+ */
+bool secondary_search(const secondary_t *sec, const char *text, size_t limit,
+                      fulltext_visit_fn visit, void *ctx);
+
+/**
+ * @brief Decodes the indexed fields of a visited key.
+ *
+ * Fields missing from the document are left out. The values are numerically
+ * equal to the stored ones (-0 reads back as 0).
+ *
+ * @param[in] sec The index.
+ * @param[in] key Key passed to the visitor.
+ * @param[in] out Object receiving one member per indexed field, nested
+ *                along its path (see query_path_put()).
+ * @return false if a field holds a value the key does not record (null, an
+ *         array or an object), if two fields collide (`a` and `a.b`) or on
+ *         allocation failure; read the document instead.
+ */
+bool secondary_key_values(const secondary_t *sec, const secondary_key_t *key, cJSON *out);
+
+/**
+ * @brief Describes an index for listings.
+ *
+ * @param[in] sec The index.
+ * @return A new object with the specification, the name and entry counts.
+ */
+cJSON *secondary_describe(const secondary_t *sec);
+
+/**
+ * @brief Writes the contents of an index to a stream.
+ *
+ * Documents are written as their positions in @p numbers rather than as
+ * pointers, so secondary_load() can attach the index to the same documents
+ * loaded again, without decoding them to compute keys.
+ *
+ * @param[in] sec     The index.
+ * @param[in] fp      Destination stream.
+ * @param[in] numbers Stored pointer (as key bytes) -> position + 1 of every
+ *                    document of the collection.
+ * @return false on a write error, if a document has no position or if the
+ *         index stopped serving queries after an allocation failure.
+ */
+bool secondary_save(const secondary_t *sec, FILE *fp, const index_t *numbers);
+
+/**
+ * @brief Fills an empty index with contents written by secondary_save().
+ *
+ * The index must have been created from the same specification and, for
+ * bitmap indexes, bound to its slot table.
+ *
+ * @param[in] sec   An empty index.
+ * @param[in] fp    Source stream.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false if the stream is truncated or malformed or memory is
+ *         exhausted; free the index then.
+ */
+bool secondary_load(secondary_t *sec, FILE *fp, cJSON *const *docs, size_t count);
+
+#endif /* SECONDARY_H */
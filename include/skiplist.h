@@ -0,0 +1,159 @@
+/**
+ * @file skiplist.h
+ * @brief Ordered map used by range indexes.
+ *
+ * A skiplist mapping byte-string keys, ordered by memcmp() with shorter keys
+ * first on a common prefix, to opaque pointers. Lookups, insertions and
+ * removals take O(log n) expected steps; nodes are linked in both directions
+ * at the bottom level so ranges can be walked forwards or backwards.
+ */
+
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Opaque skiplist handle.
+ */
+typedef struct skiplist skiplist_t;
+
+/**
+ * @brief Opaque skiplist node, used as a position while walking a range.
+ */
+typedef struct skiplist_node skiplist_node_t;
+
+/**
+ * @brief Releases a value stored in the list.
+ *
+ * @param[in] value The value to release.
+ */
+typedef void (*skiplist_free_fn)(void *value);
+
+/**
+ * @brief Creates an empty list.
+ *
+ * @return The new list (release with skiplist_free()), or NULL on allocation failure.
+ */
+skiplist_t *skiplist_create(void);
+
+/**
+ * @brief Releases a list and optionally its values.
+ *
+ * @param[in] list       The list (may be NULL).
+ * @param[in] free_value Called for every stored value (NULL to leave them alone).
+ */
+void skiplist_free(skiplist_t *list, skiplist_free_fn free_value);
+
+/**
+ * @brief Returns the number of keys in the list.
+ *
+ * @param[in] list The list.
+ * @return Key count.
+ */
+size_t skiplist_count(const skiplist_t *list);
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param[in] list The list.
+ * @param[in] key  Key bytes.
+ * @param[in] len  Key length in bytes.
+ * @return The stored value, or NULL if the key is absent.
+ */
+void *skiplist_get(const skiplist_t *list, const char *key, size_t len);
+
+/**
+ * @brief Inserts a key or replaces the value stored under it.
+ *
+ * The key is copied; the value is stored as is.
+ *
+ * @param[in]  list  The list.
+ * @param[in]  key   Key bytes.
+ * @param[in]  len   Key length in bytes.
+ * @param[in]  value Value to store.
+ * @param[out] old   Receives the replaced value, or NULL if the key was new (may be NULL).
+ * @return false on allocation failure (the list is left unchanged).
+ */
+bool skiplist_put(skiplist_t *list, const char *key, size_t len, void *value, void **old);
+
+/**
+ * @brief Removes a key.
+ *
+ * @param[in] list The list.
+ * @param[in] key  Key bytes.
+ * @param[in] len  Key length in bytes.
+ * @return The value that was stored, or NULL if the key was absent.
+ */
+void *skiplist_remove(skiplist_t *list, const char *key, size_t len);
+
+/**
+ * @brief Finds the first node at or above a lower bound.
+ *
+ * @param[in] list      The list.
+ * @param[in] key       Bound key bytes (NULL for the first node).
+ * @param[in] len       Bound key length in bytes.
+ * @param[in] inclusive True to include a node equal to the bound.
+ * @return The node, or NULL if no key lies above the bound.
+ */
+skiplist_node_t *skiplist_lower(const skiplist_t *list, const char *key, size_t len,
+                                bool inclusive);
+
+/**
+ * @brief Finds the last node at or below an upper bound.
+ *
+ * @param[in] list      The list.
+ * @param[in] key       Bound key bytes (NULL for the last node).
+ * @param[in] len       Bound key length in bytes.
+ * @param[in] inclusive True to include a node equal to the bound.
+ * @return The node, or NULL if no key lies below the bound.
+ */
+skiplist_node_t *skiplist_upper(const skiplist_t *list, const char *key, size_t len,
+                                bool inclusive);
+
+/**
+ * @brief Returns the node following @p node in key order (NULL at the end).
+ *
+ * @param[in] node A node of the list.
+ * @return The next node.
+ */
+skiplist_node_t *skiplist_next(const skiplist_node_t *node);
+
+/**
+ * @brief Returns the node preceding @p node in key order (NULL at the start).
+ *
+ * @param[in] node A node of the list.
+ * @return The previous node.
+ */
+skiplist_node_t *skiplist_prev(const skiplist_node_t *node);
+
+/**
+ * @brief Returns the key of a node.
+ *
+ * @param[in]  node A node of the list.
+ * @param[out] len  Receives the key length in bytes.
+ * @return The key bytes, owned by the list.
+ */
+const char *skiplist_key(const skiplist_node_t *node, size_t *len);
+
+/**
+ * @brief Returns the value of a node.
+ *
+ * @param[in] node A node of the list.
+ * @return The stored value.
+ */
+void *skiplist_value(const skiplist_node_t *node);
+
+/**
+ * @brief Compares two keys in list order.
+ *
+ * @param[in] a    First key.
+ * @param[in] alen Length of @p a.
+ * @param[in] b    Second key.
+ * @param[in] blen Length of @p b.
+ * @return A negative, zero or positive value as @p a sorts before, equal to or after @p b.
+ */
+int skiplist_compare(const char *a, size_t alen, const char *b, size_t blen);
+
+#endif /* SKIPLIST_H */
@@ -0,0 +1,166 @@
+/**
+ * @file storage.h
+ * @brief On-disk encoding of database images.
+ *
+ * This module serializes the in-memory database to a storage file and loads
+ * it back. Two formats are supported: JSON (human readable, used for
+ * import/export) and a compact binary format made of length-prefixed, typed
+ * documents grouped by collection, which is written and read as a stream.
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "../third_party/cJSON/cJSON.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Magic bytes opening every binary storage file.
+ */
+#define STORAGE_MAGIC "XDB\001"
+
+/**
+ * @brief Supported storage file formats.
+ */
+typedef enum
+{
+    STORAGE_FORMAT_JSON = 0,  /**< One JSON object of collections, a document per line. */
+    STORAGE_FORMAT_BINARY = 1 /**< Length-prefixed typed documents per collection. */
+} storage_format_t;
+
+/**
+ * @brief Produces the document a placeholder node stands for.
+ *
+ * Lazily loaded documents are kept as placeholder nodes (see db_set_lazy_load());
+ * the writer calls this to obtain a temporary copy of each one it meets.
+ *
+ * @param[in] placeholder The placeholder node found in a collection.
+ * @param[in] ctx         Caller-supplied context.
+ * @return A newly allocated document the writer frees after use, or NULL.
+ */
+typedef cJSON *(*storage_resolve_fn)(const cJSON *placeholder, void *ctx);
+
+/**
+ * @brief Receives one document span found by storage_scan().
+ *
+ * A call with a NULL @p doc announces a collection before its documents, so
+ * empty collections are reported too.
+ *
+ * @param[in] ctx        Caller-supplied context.
+ * @param[in] collection NUL-terminated collection name (valid during the call only).
+ * @param[in] format     Encoding of the span (see storage_materialize()).
+ * @param[in] doc        First byte of the encoded document.
+ * @param[in] len        Length of the encoded document.
+ * @param[in] id         First byte of the document's string `_id`, or NULL if it
+ *                       has none or it cannot be read without decoding.
+ * @param[in] id_len     Length of @p id in bytes.
+ * @return false to abort the scan.
+ */
+typedef bool (*storage_span_fn)(void *ctx, const char *collection, storage_format_t format,
+                                const uint8_t *doc, size_t len, const uint8_t *id,
+                                size_t id_len);
+
+/**
+ * @brief Writes a database image to an open stream.
+ *
+ * Documents are serialized one at a time (into a reusable buffer for the
+ * binary format), so no serialized copy of the whole database is ever held
+ * in memory. JSON output holds one compact document per line.
+ *
+ * Binary layout (all integers little-endian):
+ * - Header:     `"XDB\1"`
+ * - Collection: `'C'`, u32 name length, name bytes, u32 document count,
+ *               then per document: u32 encoded length, encoded document.
+ * - Trailer:    `'E'`
+ *
+ * Documents stored as cJSON_Raw nodes without a string are placeholders and
+ * are passed to @p resolve.
+ *
+ * @param[in] fp      Destination stream opened for binary writing.
+ * @param[in] root    Object mapping collection names to document arrays.
+ * @param[in] format  Format to write.
+ * @param[in] resolve Placeholder resolver (NULL if the image has none).
+ * @param[in] ctx     Context passed to @p resolve.
+ * @return true if everything was written to the stream.
+ */
+bool storage_write(FILE *fp, const cJSON *root, storage_format_t format,
+                   storage_resolve_fn resolve, void *ctx);
+
+/**
+ * @brief Loads a database image from an open stream.
+ *
+ * The format is detected from the first bytes. Binary files are decoded
+ * document by document while streaming, so peak memory stays close to the
+ * size of the resulting in-memory database.
+ *
+ * @param[in] fp Source stream positioned at the start of the file.
+ * @return The root object (caller frees with cJSON_Delete()), or NULL if the
+ *         stream is empty or malformed.
+ */
+cJSON *storage_read(FILE *fp);
+
+/**
+ * @brief Walks an image held in memory without decoding its documents.
+ *
+ * Reports the byte span of every document, grouped by collection, together
+ * with the location of its `_id` when it can be found without a full decode.
+ * Used to start from a memory-mapped file with lazily materialized documents.
+ *
+ * @param[in] data Image bytes (JSON or binary, detected).
+ * @param[in] len  Image size in bytes.
+ * @param[in] fn   Callback invoked for every document span.
+ * @param[in] ctx  Context passed to @p fn.
+ * @return true if the whole image was well-formed and scanned.
+ */
+bool storage_scan(const uint8_t *data, size_t len, storage_span_fn fn, void *ctx);
+
+/**
+ * @brief Decodes an image held in memory on several threads.
+ *
+ * Document boundaries are found with storage_scan(); the documents are then
+ * decoded in contiguous ranges on a worker pool and linked into their
+ * collections in file order, so the result equals that of storage_read().
+ *
+ * @param[in] data    Image bytes (JSON or binary, detected).
+ * @param[in] len     Image size in bytes.
+ * @param[in] threads Number of decoding threads.
+ * @return The root object (caller frees with cJSON_Delete()), or NULL if the
+ *         image is malformed or cannot be split into documents.
+ */
+cJSON *storage_load(const uint8_t *data, size_t len, int threads);
+
+/**
+ * @brief Decodes one document span reported by storage_scan().
+ *
+ * @param[in] doc    First byte of the encoded document.
+ * @param[in] len    Length of the encoded document.
+ * @param[in] format Encoding of the span.
+ * @return The decoded document (caller frees), or NULL if malformed.
+ */
+cJSON *storage_materialize(const uint8_t *doc, size_t len, storage_format_t format);
+
+/**
+ * @brief Encodes a single value in the binary document encoding.
+ *
+ * @param[in]     item The value to encode.
+ * @param[in,out] buf  Growable output buffer (may be NULL initially, caller frees).
+ * @param[in,out] cap  Allocated size of @p buf.
+ * @param[in,out] len  Bytes used in @p buf; the encoding is appended at this offset.
+ * @return true on success, false on allocation failure.
+ */
+bool storage_encode(const cJSON *item, uint8_t **buf, size_t *cap, size_t *len);
+
+/**
+ * @brief Decodes a single value from the binary document encoding.
+ *
+ * @param[in] data Encoded bytes.
+ * @param[in] len  Number of bytes available in @p data.
+ * @return The decoded value (caller frees), or NULL if the bytes are malformed.
+ */
+cJSON *storage_decode(const uint8_t *data, size_t len);
+
+#endif /* STORAGE_H */
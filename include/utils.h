@@ -9,6 +9,18 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Work item run by utils_parallel_for() on a range of indices.
+ *
+ * @param[in] begin First index of the range.
+ * @param[in] end   One past the last index of the range.
+ * @param[in] ctx   Caller-supplied context.
+ */
+typedef void (*utils_range_fn)(size_t begin, size_t end, void *ctx);
+
 /**
  * @brief Generates a random 16-character alphanumeric UUID.
  * * This function creates a unique string identifier typically used for
@@ -28,4 +40,25 @@ char *utils_gen_uuid(void);
  */
 void utils_log(const char *level, const char *msg);
 
+/**
+ * @brief Returns the number of online CPUs (at least 1).
+ *
+ * @return int Number of processors available to the process.
+ */
+int utils_cpu_count(void);
+
+/**
+ * @brief Splits [0, count) into contiguous ranges and runs them on a worker pool.
+ *
+ * The calling thread processes the first range itself and returns once every
+ * range is done. With a single thread (or when a worker cannot be started)
+ * the ranges run sequentially on the caller.
+ *
+ * @param[in] count   Number of indices to process.
+ * @param[in] threads Number of threads to use (values below 1 mean 1).
+ * @param[in] fn      Function invoked once per range.
+ * @param[in] ctx     Context passed to @p fn.
+ */
+void utils_parallel_for(size_t count, int threads, utils_range_fn fn, void *ctx);
+
 #endif /* UTILS_H */
@@ -0,0 +1,595 @@
+/**
+ * @file bitmap.c
+ * @brief Compressed bitmaps of 32-bit integers.
+ *
+ * Implements the bitmap declared in bitmap.h. Containers are kept sorted by
+ * their high 16 bits and found by binary search. An array container turns
+ * into a bitset when it would exceed BITMAP_ARRAY_MAX values; a bitset turns
+ * back into an array after an intersection leaves few enough values, or when
+ * removals bring it down to half that size, so alternating adds and removes
+ * around the threshold do not convert it every time.
+ */
+
+#include "../include/bitmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Number of 64-bit words in a bitset container.
+ */
+#define BITSET_WORDS 1024
+
+/**
+ * @brief Values sharing their high 16 bits.
+ */
+typedef struct
+{
+    uint16_t key;     /**< High 16 bits. */
+    uint32_t card;    /**< Values held. */
+    uint32_t cap;     /**< Entries allocated in values. */
+    uint16_t *values; /**< Sorted low bits (array containers). */
+    uint64_t *words;  /**< BITSET_WORDS words (bitset containers). */
+} container_t;
+
+/**
+ * @brief Bitmap state.
+ */
+struct bitmap
+{
+    container_t *cs; /**< Containers, by ascending key. */
+    size_t count;    /**< Containers used. */
+    size_t cap;      /**< Containers allocated. */
+    size_t card;     /**< Values held. */
+};
+
+/**
+ * @brief Releases the storage of a container.
+ *
+ * @param[in] c The container.
+ */
+static void _container_release(container_t *c)
+{
+    free(c->values);
+    free(c->words);
+    c->values = NULL;
+    c->words = NULL;
+}
+
+/**
+ * @brief Finds the position of a key among the containers.
+ *
+ * @param[in]  b     The bitmap.
+ * @param[in]  key   High 16 bits.
+ * @param[out] found Receives whether the container exists.
+ * @return The position of the container, or where it would be inserted.
+ */
+static size_t _find(const bitmap_t *b, uint16_t key, bool *found)
+{
+    size_t lo = 0, hi = b->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->cs[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < b->count && b->cs[lo].key == key;
+    return lo;
+}
+
+/**
+ * @brief Finds the position of a value in an array container.
+ *
+ * @param[in]  c     The container.
+ * @param[in]  low   Low 16 bits.
+ * @param[out] found Receives whether the value is present.
+ * @return The position of the value, or where it would be inserted.
+ */
+static uint32_t _array_find(const container_t *c, uint16_t low, bool *found)
+{
+    uint32_t lo = 0, hi = c->card;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (c->values[mid] < low)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < c->card && c->values[lo] == low;
+    return lo;
+}
+
+/**
+ * @brief Counts the bits set in a bitset container.
+ *
+ * @param[in] words The words.
+ * @return Number of bits set.
+ */
+static uint32_t _popcount(const uint64_t *words)
+{
+    uint32_t card = 0;
+    for (size_t i = 0; i < BITSET_WORDS; i++)
+        card += (uint32_t) __builtin_popcountll(words[i]);
+    return card;
+}
+
+/**
+ * @brief Turns an array container into a bitset.
+ *
+ * @param[in] c The container.
+ * @return false on allocation failure (the container is left unchanged).
+ */
+static bool _to_bitset(container_t *c)
+{
+    uint64_t *words = calloc(BITSET_WORDS, sizeof(*words));
+    if (!words)
+        return false;
+    for (uint32_t i = 0; i < c->card; i++)
+        words[c->values[i] >> 6] |= 1ULL << (c->values[i] & 63);
+    free(c->values);
+    c->values = NULL;
+    c->cap = 0;
+    c->words = words;
+    return true;
+}
+
+/**
+ * @brief Turns a bitset container into an array, if memory allows.
+ *
+ * @param[in] c The container (c->card must be up to date).
+ */
+static void _to_array(container_t *c)
+{
+    uint16_t *values = malloc((c->card ? c->card : 1) * sizeof(*values));
+    if (!values)
+        return;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < BITSET_WORDS; i++) {
+        for (uint64_t w = c->words[i]; w; w &= w - 1)
+            values[n++] = (uint16_t) (i * 64 + (uint32_t) __builtin_ctzll(w));
+    }
+    free(c->words);
+    c->words = NULL;
+    c->values = values;
+    c->cap = c->card ? c->card : 1;
+}
+
+/**
+ * @brief Removes the container at a position.
+ *
+ * @param[in] b   The bitmap.
+ * @param[in] pos Position of the container.
+ */
+static void _drop(bitmap_t *b, size_t pos)
+{
+    _container_release(&b->cs[pos]);
+    memmove(&b->cs[pos], &b->cs[pos + 1], (b->count - pos - 1) * sizeof(*b->cs));
+    b->count--;
+}
+
+/**
+ * @brief Inserts a container at a position.
+ *
+ * @param[in] b   The bitmap.
+ * @param[in] pos Position of the new container.
+ * @param[in] c   The container (owned by the bitmap on success).
+ * @return false on allocation failure.
+ */
+static bool _insert(bitmap_t *b, size_t pos, const container_t *c)
+{
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 4;
+        container_t *cs = realloc(b->cs, cap * sizeof(*cs));
+        if (!cs)
+            return false;
+        b->cs = cs;
+        b->cap = cap;
+    }
+    memmove(&b->cs[pos + 1], &b->cs[pos], (b->count - pos) * sizeof(*b->cs));
+    b->cs[pos] = *c;
+    b->count++;
+    return true;
+}
+
+/**
+ * @brief Copies a container.
+ *
+ * @param[out] dst Receives the copy.
+ * @param[in]  src The container.
+ * @return false on allocation failure.
+ */
+static bool _container_copy(container_t *dst, const container_t *src)
+{
+    *dst = *src;
+    if (src->words) {
+        dst->words = malloc(BITSET_WORDS * sizeof(*dst->words));
+        if (!dst->words)
+            return false;
+        memcpy(dst->words, src->words, BITSET_WORDS * sizeof(*dst->words));
+    } else {
+        dst->cap = src->card ? src->card : 1;
+        dst->values = malloc(dst->cap * sizeof(*dst->values));
+        if (!dst->values)
+            return false;
+        memcpy(dst->values, src->values, src->card * sizeof(*dst->values));
+    }
+    return true;
+}
+
+/**
+ * @brief Creates an empty bitmap.
+ *
+ * @return The new bitmap, or NULL on allocation failure.
+ */
+bitmap_t *bitmap_create(void)
+{
+    return calloc(1, sizeof(bitmap_t));
+}
+
+/**
+ * @brief Releases a bitmap.
+ *
+ * @param[in] b The bitmap (may be NULL).
+ */
+void bitmap_free(bitmap_t *b)
+{
+    if (!b)
+        return;
+    for (size_t i = 0; i < b->count; i++)
+        _container_release(&b->cs[i]);
+    free(b->cs);
+    free(b);
+}
+
+/**
+ * @brief Copies a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return The copy, or NULL on allocation failure.
+ */
+bitmap_t *bitmap_copy(const bitmap_t *b)
+{
+    bitmap_t *copy = bitmap_create();
+    if (!copy)
+        return NULL;
+    copy->cs = malloc((b->count ? b->count : 1) * sizeof(*copy->cs));
+    if (!copy->cs) {
+        free(copy);
+        return NULL;
+    }
+    copy->cap = b->count ? b->count : 1;
+    for (size_t i = 0; i < b->count; i++) {
+        if (!_container_copy(&copy->cs[i], &b->cs[i])) {
+            bitmap_free(copy);
+            return NULL;
+        }
+        copy->count++;
+    }
+    copy->card = b->card;
+    return copy;
+}
+
+/**
+ * @brief Returns the number of values in a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return Value count.
+ */
+size_t bitmap_count(const bitmap_t *b)
+{
+    return b->card;
+}
+
+/**
+ * @brief Returns the memory held by the containers of a bitmap.
+ *
+ * @param[in] b The bitmap.
+ * @return Size in bytes.
+ */
+size_t bitmap_bytes(const bitmap_t *b)
+{
+    size_t bytes = b->cap * sizeof(*b->cs);
+    for (size_t i = 0; i < b->count; i++) {
+        bytes += b->cs[i].words ? BITSET_WORDS * sizeof(uint64_t)
+                                : b->cs[i].cap * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Adds a value.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to add.
+ * @return false on allocation failure.
+ */
+bool bitmap_add(bitmap_t *b, uint32_t value)
+{
+    uint16_t key = (uint16_t) (value >> 16), low = (uint16_t) value;
+    bool found;
+    size_t pos = _find(b, key, &found);
+    if (!found) {
+        container_t c = {.key = key, .card = 1, .cap = 4};
+        c.values = malloc(c.cap * sizeof(*c.values));
+        if (!c.values)
+            return false;
+        c.values[0] = low;
+        if (!_insert(b, pos, &c)) {
+            free(c.values);
+            return false;
+        }
+        b->card++;
+        return true;
+    }
+
+    container_t *c = &b->cs[pos];
+    if (c->words) {
+        uint64_t bit = 1ULL << (low & 63);
+        if (c->words[low >> 6] & bit)
+            return true;
+        c->words[low >> 6] |= bit;
+    } else {
+        uint32_t i = _array_find(c, low, &found);
+        if (found)
+            return true;
+        if (c->card == BITMAP_ARRAY_MAX) {
+            if (!_to_bitset(c))
+                return false;
+            c->words[low >> 6] |= 1ULL << (low & 63);
+        } else {
+            if (c->card == c->cap) {
+                uint32_t cap = c->cap * 2 < BITMAP_ARRAY_MAX ? c->cap * 2 : BITMAP_ARRAY_MAX;
+                uint16_t *values = realloc(c->values, cap * sizeof(*values));
+                if (!values)
+                    return false;
+                c->values = values;
+                c->cap = cap;
+            }
+            memmove(&c->values[i + 1], &c->values[i], (c->card - i) * sizeof(*c->values));
+            c->values[i] = low;
+        }
+    }
+    c->card++;
+    b->card++;
+    return true;
+}
+
+/**
+ * @brief Removes a value.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to remove.
+ * @return true if the value was present.
+ */
+bool bitmap_remove(bitmap_t *b, uint32_t value)
+{
+    uint16_t key = (uint16_t) (value >> 16), low = (uint16_t) value;
+    bool found;
+    size_t pos = _find(b, key, &found);
+    if (!found)
+        return false;
+
+    container_t *c = &b->cs[pos];
+    if (c->words) {
+        uint64_t bit = 1ULL << (low & 63);
+        if (!(c->words[low >> 6] & bit))
+            return false;
+        c->words[low >> 6] &= ~bit;
+        c->card--;
+        if (c->card <= BITMAP_ARRAY_MAX / 2)
+            _to_array(c);
+    } else {
+        uint32_t i = _array_find(c, low, &found);
+        if (!found)
+            return false;
+        memmove(&c->values[i], &c->values[i + 1], (c->card - i - 1) * sizeof(*c->values));
+        c->card--;
+    }
+    b->card--;
+    if (c->card == 0)
+        _drop(b, pos);
+    return true;
+}
+
+/**
+ * @brief Tells whether a value is present.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] value Value to look up.
+ * @return true if present.
+ */
+bool bitmap_contains(const bitmap_t *b, uint32_t value)
+{
+    uint16_t low = (uint16_t) value;
+    bool found;
+    size_t pos = _find(b, (uint16_t) (value >> 16), &found);
+    if (!found)
+        return false;
+    const container_t *c = &b->cs[pos];
+    if (c->words)
+        return (c->words[low >> 6] >> (low & 63)) & 1;
+    _array_find(c, low, &found);
+    return found;
+}
+
+/**
+ * @brief Intersects two containers with the same key into the first one.
+ *
+ * @param[in] dst Container to narrow.
+ * @param[in] src Container to intersect with.
+ */
+static void _container_and(container_t *dst, const container_t *src)
+{
+    if (dst->words && src->words) {
+        /* Word-wide AND, which compilers vectorize */
+        for (size_t i = 0; i < BITSET_WORDS; i++)
+            dst->words[i] &= src->words[i];
+        dst->card = _popcount(dst->words);
+        if (dst->card <= BITMAP_ARRAY_MAX)
+            _to_array(dst);
+    } else if (dst->words) {
+        /* Keep the bits named by the array, one word at a time */
+        uint32_t j = 0;
+        for (uint32_t i = 0; i < BITSET_WORDS; i++) {
+            uint64_t mask = 0;
+            for (; j < src->card && (uint32_t) (src->values[j] >> 6) == i; j++)
+                mask |= 1ULL << (src->values[j] & 63);
+            dst->words[i] &= mask;
+        }
+        dst->card = _popcount(dst->words);
+        _to_array(dst);
+    } else {
+        uint32_t n = 0;
+        bool found;
+        for (uint32_t i = 0; i < dst->card; i++) {
+            uint16_t low = dst->values[i];
+            if (src->words)
+                found = (src->words[low >> 6] >> (low & 63)) & 1;
+            else
+                _array_find(src, low, &found);
+            if (found)
+                dst->values[n++] = low;
+        }
+        dst->card = n;
+    }
+}
+
+/**
+ * @brief Keeps only the values also present in another bitmap.
+ *
+ * @param[in] dst Bitmap to narrow.
+ * @param[in] src Bitmap to intersect with.
+ */
+void bitmap_and(bitmap_t *dst, const bitmap_t *src)
+{
+    size_t kept = 0, j = 0;
+    dst->card = 0;
+    for (size_t i = 0; i < dst->count; i++) {
+        container_t *c = &dst->cs[i];
+        while (j < src->count && src->cs[j].key < c->key)
+            j++;
+        if (j < src->count && src->cs[j].key == c->key)
+            _container_and(c, &src->cs[j]);
+        else
+            c->card = 0;
+        if (c->card == 0) {
+            _container_release(c);
+            continue;
+        }
+        dst->card += c->card;
+        dst->cs[kept++] = *c;
+    }
+    dst->count = kept;
+}
+
+/**
+ * @brief Merges a container into one with the same key.
+ *
+ * @param[in] dst Container to extend.
+ * @param[in] src Container to merge.
+ * @return false on allocation failure (@p dst is left unchanged).
+ */
+static bool _container_or(container_t *dst, const container_t *src)
+{
+    if (!dst->words && (src->words || dst->card + src->card > BITMAP_ARRAY_MAX)) {
+        if (!_to_bitset(dst))
+            return false;
+    }
+    if (dst->words) {
+        if (src->words) {
+            /* Word-wide OR, which compilers vectorize */
+            for (size_t i = 0; i < BITSET_WORDS; i++)
+                dst->words[i] |= src->words[i];
+        } else {
+            for (uint32_t i = 0; i < src->card; i++)
+                dst->words[src->values[i] >> 6] |= 1ULL << (src->values[i] & 63);
+        }
+        dst->card = _popcount(dst->words);
+        return true;
+    }
+
+    /* Merge the two sorted arrays into a new one */
+    uint32_t total = dst->card + src->card;
+    uint32_t n = 0, i = 0, j = 0;
+    uint16_t *merged = malloc((total ? total : 1) * sizeof(*merged));
+    if (!merged)
+        return false;
+    while (i < dst->card || j < src->card) {
+        if (j == src->card || (i < dst->card && dst->values[i] < src->values[j])) {
+            merged[n++] = dst->values[i++];
+        } else {
+            if (i < dst->card && dst->values[i] == src->values[j])
+                i++;
+            merged[n++] = src->values[j++];
+        }
+    }
+    free(dst->values);
+    dst->values = merged;
+    dst->cap = total ? total : 1;
+    dst->card = n;
+    return true;
+}
+
+/**
+ * @brief Adds the values of another bitmap.
+ *
+ * @param[in] dst Bitmap to extend.
+ * @param[in] src Bitmap to merge.
+ * @return false on allocation failure.
+ */
+bool bitmap_or(bitmap_t *dst, const bitmap_t *src)
+{
+    for (size_t j = 0; j < src->count; j++) {
+        bool found;
+        size_t pos = _find(dst, src->cs[j].key, &found);
+        if (found) {
+            uint32_t before = dst->cs[pos].card;
+            if (!_container_or(&dst->cs[pos], &src->cs[j]))
+                return false;
+            dst->card += dst->cs[pos].card - before;
+        } else {
+            container_t c;
+            if (!_container_copy(&c, &src->cs[j])) {
+                _container_release(&c);
+                return false;
+            }
+            if (!_insert(dst, pos, &c)) {
+                _container_release(&c);
+                return false;
+            }
+            dst->card += c.card;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Visits the values of a bitmap in ascending order.
+ *
+ * @param[in] b     The bitmap.
+ * @param[in] visit Visitor.
+ * @param[in] ctx   Visitor context.
+ * @return false if the visitor stopped the walk.
+ */
+bool bitmap_foreach(const bitmap_t *b, bitmap_visit_fn visit, void *ctx)
+{
+    for (size_t i = 0; i < b->count; i++) {
+        const container_t *c = &b->cs[i];
+        uint32_t high = (uint32_t) c->key << 16;
+        if (c->words) {
+            for (uint32_t w = 0; w < BITSET_WORDS; w++) {
+                for (uint64_t bits = c->words[w]; bits; bits &= bits - 1) {
+                    if (!visit(high | (w * 64 + (uint32_t) __builtin_ctzll(bits)), ctx))
+                        return false;
+                }
+            }
+        } else {
+            for (uint32_t k = 0; k < c->card; k++) {
+                if (!visit(high | c->values[k], ctx))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
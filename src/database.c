@@ -3,284 +3,4339 @@
  * @brief Secure storage engine implementation for the Database system.
  *
  * Implements a thread-safe, JSON-backed document database with atomic
- * write-to-disk capabilities, automatic snapshotting, and fast indexing.
+ * write-to-disk capabilities, an append-only write-ahead log, automatic
+ * snapshotting, and fast indexing.
  */
 
 #include "../include/database.h"
 
+#include "../include/index.h"
+#include "../include/planner.h"
 #include "../include/query.h"
+#include "../include/secondary.h"
+#include "../include/storage.h"
 #include "../include/utils.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+/**
+ * @brief Default checkpoint thresholds (see db_set_checkpoint_policy()).
+ */
+#define CHECKPOINT_LOG_BYTES (64L * 1024 * 1024)
+#define CHECKPOINT_OPS 100000L
+#define CHECKPOINT_SECONDS 300
+
+/**
+ * @brief Default seconds between two passes of the TTL reaper (see db_set_ttl_interval()).
+ */
+#define TTL_INTERVAL_SECONDS 60
+
+/**
+ * @brief Expired documents deleted per TTL batch, which shares one commit.
+ */
+#define TTL_BATCH 1000
+
+/**
+ * @brief Extension of per-collection image files inside the database directory.
+ */
+#define COLL_FILE_EXT ".coll"
+
+/**
+ * @brief Files describing a snapshot inside its directory.
+ */
+#define SNAPSHOT_MANIFEST "MANIFEST.json"
+#define SNAPSHOT_LOG "snapshot.wal"
+
+/**
+ * @brief Secondary index definitions inside the database directory.
+ */
+#define INDEX_CATALOG "INDEXES.json"
+
+/**
+ * @brief Extension appended to a collection image for its saved secondary indexes.
+ */
+#define INDEX_FILE_EXT ".idx"
+
+/**
+ * @brief Magic bytes opening every index file.
+ */
+#define INDEX_FILE_MAGIC "XDI\001"
+
+/**
+ * @brief Longest chain of incremental snapshots a restore follows.
+ */
+#define SNAPSHOT_CHAIN_MAX 100000
+
+/**
+ * @brief Number of forked snapshots whose state is remembered for polling.
+ */
+#define SNAPSHOT_JOBS 64
+
+/**
+ * @brief Longest encoded collection name used verbatim in a file name.
+ */
+#define COLL_NAME_MAX 160
+
+/**
+ * @brief Commit buffer size (in bytes) at which records are written without a waiter.
+ */
+#define WAL_BUFFER_BYTES (1024 * 1024)
 
 /** * @brief Global database state variables.
  */
-static char g_db_path[256];                              /**< Destination file path on disk. */
+static char g_db_path[256];                              /**< Database path (names the files). */
+static char g_wal_path[300];                             /**< Write-ahead log path on disk. */
+static char g_wal_old_path[310]; /**< Log segment being folded in by a checkpoint. */
+static char g_db_dir[260];       /**< Directory holding one image file per collection. */
+static cJSON *g_dirty_colls = NULL; /**< Collections changed since their image was written. */
+static char g_snap_dir[600];        /**< Latest snapshot taken since db_init(). */
+static char g_snap_parent[600];     /**< Snapshot g_snap_dir extends ("" for a full one). */
+static uint64_t g_snap_gen = 0;     /**< Log generation g_snap_dir was taken in. */
+static long g_snap_wal_off = 0;     /**< Log bytes already covered by g_snap_dir. */
+static uint64_t g_wal_gen = 0;      /**< Bumped whenever the log is truncated or rotated. */
 static cJSON *root = NULL;                               /**< In-memory representation of the DB. */
-static cJSON *g_index = NULL;                            /**< Global index for O(1) ID lookups. */
+static index_t *g_colls = NULL; /**< Collections by name (collection_t values). */
+static cJSON *g_index_defs = NULL; /**< Secondary index specs by collection (see INDEX_CATALOG). */
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /**< Monitor for thread safety. */
 static int g_op_counter = 0;                             /**< Counter to trigger snapshots. */
 static bool g_test_mode = false; /**< Flag to suppress snapshots during tests. */
+static bool g_wal_mode = false;  /**< Append mutations to the WAL instead of rewriting. */
+static storage_format_t g_format = STORAGE_FORMAT_JSON; /**< Format of new images. */
+static int g_load_threads = 0;   /**< Startup worker threads (0 = one per CPU). */
+static FILE *g_wal_fp = NULL;    /**< Open append handle on the WAL (WAL mode only). */
+static char *g_wal_buf = NULL;   /**< Serialized records not yet written to the WAL. */
+static size_t g_wal_buf_len = 0; /**< Bytes used in g_wal_buf. */
+static size_t g_wal_buf_cap = 0; /**< Bytes allocated for g_wal_buf. */
+static bool g_dirty = false;     /**< Image rewrite pending (non-WAL mode). */
+static uint64_t g_appended_lsn = 0; /**< Sequence number of the last recorded mutation. */
+static uint64_t g_image_lsn = 0;    /**< Sequence number covered by the image on disk. */
+
+/** * @brief Group commit state, guarded by g_commit_lock.
+ */
+static pthread_mutex_t g_commit_lock = PTHREAD_MUTEX_INITIALIZER; /**< Guards commit state. */
+static pthread_cond_t g_commit_cond = PTHREAD_COND_INITIALIZER;   /**< Signals finished batches. */
+static pthread_mutex_t g_wal_io_lock = PTHREAD_MUTEX_INITIALIZER; /**< Serializes WAL file I/O. */
+static bool g_commit_leader = false;   /**< A thread is currently writing a batch. */
+static uint64_t g_flushed_lsn = 0;     /**< Last sequence number handed to the OS. */
+static uint64_t g_synced_lsn = 0;      /**< Last sequence number on stable storage. */
+static uint64_t g_sync_wanted_lsn = 0; /**< Highest sequence number awaiting an fsync. */
+static db_durability_t g_durability = DB_DURABILITY_FLUSH; /**< Server-wide default level. */
+static _Thread_local db_durability_t t_request_durability =
+    DB_DURABILITY_DEFAULT; /**< Per-request override of the calling thread. */
+static _Thread_local db_error_t t_last_error = DB_ERROR_NONE; /**< Why the last write failed. */
+
+/** * @brief Checkpointer thread state, guarded by the engine lock.
+ */
+static pthread_t g_ckpt_thread;                              /**< Background checkpointer. */
+static pthread_cond_t g_ckpt_cond = PTHREAD_COND_INITIALIZER; /**< Wakes the checkpointer. */
+static bool g_ckpt_started = false;                          /**< Thread has been created. */
+static bool g_ckpt_stop = false;                             /**< Asks the thread to exit. */
+static bool g_ckpt_running = false;    /**< A background checkpoint is in flight. */
+static long g_ckpt_max_bytes = CHECKPOINT_LOG_BYTES; /**< Log bytes that trigger a checkpoint. */
+static long g_ckpt_max_ops = CHECKPOINT_OPS;         /**< Records that trigger a checkpoint. */
+static int g_ckpt_max_secs = CHECKPOINT_SECONDS;     /**< Age that triggers a checkpoint. */
+static long g_wal_bytes = 0;           /**< Log bytes recorded since the last checkpoint. */
+static long g_wal_ops = 0;             /**< Records logged since the last checkpoint. */
+static time_t g_ckpt_last = 0;         /**< Time of the last checkpoint. */
+
+/** * @brief TTL reaper thread state, guarded by the engine lock.
+ */
+static pthread_t g_ttl_thread;                               /**< Background reaper. */
+static pthread_cond_t g_ttl_cond = PTHREAD_COND_INITIALIZER; /**< Wakes the reaper. */
+static bool g_ttl_started = false;                           /**< Thread has been created. */
+static bool g_ttl_stop = false;                              /**< Asks the thread to exit. */
+static int g_ttl_interval = TTL_INTERVAL_SECONDS; /**< Seconds between passes (0 disables them). */
+static time_t g_ttl_last = 0;                     /**< Time of the last pass. */
+
+/**
+ * @brief Location of a document that has not been decoded yet.
+ *
+ * Lazily loaded collections hold placeholder nodes (cJSON_Raw without a
+ * string) whose valueint indexes g_lazy. The table and the mapping it points
+ * into are immutable between db_init() and db_cleanup(), so unlocked image
+ * writers can decode placeholders from a private copy of the database.
+ */
+typedef struct
+{
+    const uint8_t *data;     /**< Encoded document inside the mapping. */
+    size_t len;              /**< Encoded length in bytes. */
+    const uint8_t *id;       /**< `_id` string bytes inside the mapping. */
+    size_t id_len;           /**< Length of the `_id` in bytes. */
+    storage_format_t format; /**< Encoding of the span. */
+} lazy_doc_t;
+
+/**
+ * @brief A read-only file mapping kept alive for lazily loaded documents.
+ */
+typedef struct
+{
+    void *addr; /**< Start of the mapping. */
+    size_t len; /**< Mapped length in bytes. */
+} mapping_t;
+
+/** * @brief Lazy loading state (see db_set_lazy_load()).
+ */
+static bool g_lazy_load = false;   /**< Map the image instead of decoding it at startup. */
+static mapping_t *g_maps = NULL;   /**< Images mapped at startup. */
+static size_t g_map_count = 0;     /**< Entries used in g_maps. */
+static lazy_doc_t *g_lazy = NULL;  /**< Spans of documents loaded lazily. */
+static size_t g_lazy_count = 0;    /**< Entries used in g_lazy. */
+static size_t g_lazy_cap = 0;      /**< Entries allocated in g_lazy. */
+
+/**
+ * @brief A snapshot written by a forked process (see db_snapshot_start()).
+ */
+typedef struct
+{
+    long id;                   /**< Snapshot id (0 for a free slot). */
+    pid_t pid;                 /**< Writer process, 0 once it has been reaped. */
+    db_snapshot_state_t state; /**< Last known state. */
+    char path[600];            /**< Snapshot directory. */
+} snapshot_job_t;
+
+/** * @brief Forked snapshot state, guarded by the engine lock.
+ */
+static snapshot_job_t g_snap_jobs[SNAPSHOT_JOBS]; /**< Recent snapshots, by id % SNAPSHOT_JOBS. */
+static long g_snap_next_id = 1;                   /**< Id of the next forked snapshot. */
+static long g_snap_auto_id = 0;                   /**< Latest snapshot started by writes. */
+
+/**
+ * @brief In-memory state of one collection, stored in g_colls.
+ *
+ * The document array is the member of root named after the collection; the
+ * index references the documents stored in it.
+ */
+typedef struct
+{
+    cJSON *docs;              /**< Document array (owned by root). */
+    size_t count;             /**< Documents in docs. */
+    index_t *ids;             /**< Documents by `_id`. */
+    bool partial;             /**< An entry was dropped after an allocation failure; misses scan. */
+    secondary_t **secs;       /**< Secondary indexes. */
+    size_t sec_count;         /**< Entries used in secs. */
+    secondary_slots_t *slots; /**< Document slots of the bitmap indexes (NULL if none). */
+    bool indexes_saved;       /**< The index file matches the image and the indexes. */
+    planner_stats_t *stats;   /**< Sampled statistics (NULL until a find needs them). */
+    size_t changes;           /**< Mutations since the collection was registered. */
+    size_t stats_changes;     /**< Value of changes when stats were sampled. */
+} collection_t;
+
+/**
+ * @brief Identifies the collection image an index file was saved against.
+ *
+ * Images are never modified in place, only replaced by a rename, so the
+ * file identity, size and modification time change whenever the contents do.
+ */
+typedef struct
+{
+    uint64_t dev;        /**< Device of the image file. */
+    uint64_t ino;        /**< Inode of the image file. */
+    uint64_t size;       /**< Size of the image file. */
+    uint64_t mtime_sec;  /**< Modification time of the image file (seconds). */
+    uint64_t mtime_nsec; /**< Modification time of the image file (nanoseconds). */
+    uint64_t docs;       /**< Documents in the collection. */
+} index_stamp_t;
+
+/**
+ * @brief Returns the span a placeholder stands for.
+ *
+ * @param[in] item Collection or index entry.
+ * @return The span, or NULL if @p item is a regular document.
+ */
+static const lazy_doc_t *_lazy_doc(const cJSON *item)
+{
+    if (!item || !cJSON_IsRaw(item) || item->valuestring)
+        return NULL;
+    if (item->valueint < 0 || (size_t) item->valueint >= g_lazy_count)
+        return NULL;
+    return &g_lazy[item->valueint];
+}
+
+/**
+ * @brief Decodes the document behind a placeholder into a new tree.
+ *
+ * Matches the storage_resolve_fn signature so image writers can serialize
+ * placeholders without the engine lock.
+ *
+ * @param[in] placeholder Placeholder node.
+ * @param[in] ctx         Unused.
+ * @return The decoded document (caller frees), or NULL if it is malformed.
+ */
+static cJSON *_lazy_decode(const cJSON *placeholder, void *ctx)
+{
+    (void) ctx;
+    const lazy_doc_t *lazy = _lazy_doc(placeholder);
+    cJSON *doc = lazy ? storage_materialize(lazy->data, lazy->len, lazy->format) : NULL;
+    if (!doc)
+        utils_log("ERROR", "Failed to decode a lazily loaded document");
+    return doc;
+}
+
+/**
+ * @brief Returns the `_id` of a stored document without decoding it.
+ *
+ * @param[in]  doc Collection entry (regular document or placeholder).
+ * @param[out] len Length of the `_id` in bytes.
+ * @return The `_id` bytes (not NUL-terminated for placeholders), or NULL if
+ *         the document has no string `_id`.
+ */
+static const char *_doc_id(const cJSON *doc, size_t *len)
+{
+    const lazy_doc_t *lazy = _lazy_doc(doc);
+    if (lazy) {
+        *len = lazy->id_len;
+        return (const char *) lazy->id;
+    }
+    const cJSON *id = cJSON_GetObjectItem(doc, "_id");
+    if (!cJSON_IsString(id))
+        return NULL;
+    *len = strlen(id->valuestring);
+    return id->valuestring;
+}
+
+/**
+ * @brief Tells whether a stored document has the given `_id`.
+ *
+ * Placeholders are compared against the raw `_id` bytes, without decoding.
+ *
+ * @param[in] item Collection entry.
+ * @param[in] id   `_id` value to look for.
+ * @return true if the `_id` matches.
+ */
+static bool _doc_has_id(const cJSON *item, const char *id)
+{
+    const lazy_doc_t *lazy = _lazy_doc(item);
+    if (lazy)
+        return strlen(id) == lazy->id_len && memcmp(lazy->id, id, lazy->id_len) == 0;
+
+    cJSON *itemId = cJSON_GetObjectItem(item, "_id");
+    return itemId && cJSON_IsString(itemId) && strcmp(itemId->valuestring, id) == 0;
+}
+
+/**
+ * @brief Releases a collection_t stored in g_colls (index_free_fn).
+ *
+ * @param[in] value The collection; its documents belong to root and are left alone.
+ */
+static void _coll_free(void *value)
+{
+    collection_t *c = value;
+    for (size_t i = 0; i < c->sec_count; i++)
+        secondary_free(c->secs[i]);
+    free(c->secs);
+    secondary_slots_free(c->slots);
+    planner_stats_free(c->stats);
+    index_free(c->ids, NULL);
+    free(c);
+}
+
+/**
+ * @brief Looks up a collection by name.
+ *
+ * @param[in] name Collection name (case-sensitive).
+ * @return The collection, or NULL if it does not exist.
+ * @note Must be called within a locked mutex context.
+ */
+static collection_t *_coll_get(const char *name)
+{
+    return (g_colls && name) ? index_get(g_colls, name, strlen(name)) : NULL;
+}
+
+/**
+ * @brief Points the `_id` index entry of a collection at a document.
+ *
+ * The index references the documents stored in the collection; every code
+ * path that frees a stored document must call this or _index_unset() for its
+ * `_id` in the same critical section, so entries never dangle.
+ *
+ * @param[in] c   The collection.
+ * @param[in] id  Document `_id`.
+ * @param[in] doc Stored document (owned by the collection).
+ * @note Must be called within a locked mutex context.
+ */
+static void _index_set(collection_t *c, const char *id, cJSON *doc)
+{
+    if (!index_put(c->ids, id, strlen(id), doc, NULL)) {
+        /* Dropping the entry keeps lookups correct: misses fall back to a scan */
+        index_remove(c->ids, id, strlen(id));
+        c->partial = true;
+        utils_log("ERROR", "Not enough memory to update the index");
+    }
+}
+
+/**
+ * @brief Removes the `_id` index entry of a collection.
+ *
+ * @param[in] c  The collection.
+ * @param[in] id Document `_id`.
+ * @note Must be called within a locked mutex context.
+ */
+static void _index_unset(collection_t *c, const char *id)
+{
+    index_remove(c->ids, id, strlen(id));
+}
+
+/**
+ * @brief Finds a stored document of a collection by `_id`.
+ *
+ * @param[in] c  The collection.
+ * @param[in] id Document `_id`.
+ * @return The stored document (possibly a placeholder), or NULL if absent.
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_coll_find(const collection_t *c, const char *id)
+{
+    cJSON *doc = index_get(c->ids, id, strlen(id));
+    if (doc || !c->partial)
+        return doc;
+
+    for (doc = c->docs->child; doc; doc = doc->next) {
+        if (_doc_has_id(doc, id))
+            return doc;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the decoded contents of a stored document.
+ *
+ * @param[in]  item Collection entry (regular document or placeholder).
+ * @param[out] tmp  Receives a decoded copy to free when @p item is a
+ *                  placeholder, NULL otherwise.
+ * @return The contents, or NULL if a placeholder cannot be decoded.
+ */
+static const cJSON *_doc_view(const cJSON *item, cJSON **tmp)
+{
+    if (!_lazy_doc(item)) {
+        *tmp = NULL;
+        return item;
+    }
+    *tmp = _lazy_decode(item, NULL);
+    return *tmp;
+}
+
+/**
+ * @brief Adds a stored document to the secondary indexes of its collection.
+ *
+ * @param[in] c   The collection.
+ * @param[in] doc Stored document (possibly a placeholder).
+ * @note Must be called within a locked mutex context.
+ */
+static void _sec_add(collection_t *c, cJSON *doc)
+{
+    if (c->sec_count == 0)
+        return;
+    cJSON *tmp;
+    const cJSON *view = _doc_view(doc, &tmp);
+    for (size_t i = 0; view && i < c->sec_count; i++) {
+        if (!secondary_add(c->secs[i], view, doc))
+            utils_log("ERROR", "Not enough memory to update a secondary index");
+    }
+    cJSON_Delete(tmp);
+}
+
+/**
+ * @brief Removes a stored document from the secondary indexes of its collection.
+ *
+ * Like _index_unset(), this must run before the document is freed.
+ *
+ * @param[in] c    The collection.
+ * @param[in] doc  Stored document (possibly a placeholder).
+ * @param[in] view Contents of @p doc as they were indexed (NULL to read them from @p doc).
+ * @note Must be called within a locked mutex context.
+ */
+static void _sec_remove(collection_t *c, const cJSON *doc, const cJSON *view)
+{
+    if (c->sec_count == 0)
+        return;
+    cJSON *tmp = NULL;
+    if (!view)
+        view = _doc_view(doc, &tmp);
+    for (size_t i = 0; view && i < c->sec_count; i++)
+        secondary_remove(c->secs[i], view, doc);
+    cJSON_Delete(tmp);
+}
+
+/**
+ * @brief Records why the current write failed.
+ *
+ * @param[in] error The reason, reported by db_last_error().
+ * @return false, for use in return statements.
+ */
+static bool _fail(db_error_t error)
+{
+    t_last_error = error;
+    return false;
+}
+
+/**
+ * @brief Tells whether storing a document would break a unique index.
+ *
+ * @param[in] c    The collection.
+ * @param[in] view Contents of the document to store.
+ * @param[in] self Stored version the document replaces (NULL for a new one).
+ * @return true if a unique index already holds another document with the same key.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _sec_conflict(const collection_t *c, const cJSON *view, const cJSON *self)
+{
+    for (size_t i = 0; i < c->sec_count; i++) {
+        if (secondary_conflicts(c->secs[i], view, self))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Creates an empty secondary index for a collection.
+ *
+ * Room for the index is reserved in the collection, and bitmap indexes are
+ * bound to its slot table, but the index is not attached yet.
+ *
+ * @param[in] c    The collection.
+ * @param[in] spec Index specification (see secondary_create()).
+ * @return The index, or NULL if the specification is invalid or memory is exhausted.
+ * @note Must be called within a locked mutex context.
+ */
+static secondary_t *_sec_new(collection_t *c, const cJSON *spec)
+{
+    secondary_t *sec = secondary_create(spec);
+    secondary_t **secs = sec ? realloc(c->secs, (c->sec_count + 1) * sizeof(*secs)) : NULL;
+    if (!secs) {
+        secondary_free(sec);
+        return NULL;
+    }
+    c->secs = secs;
+
+    /* Bitmap indexes number documents through a table shared by the collection */
+    if (secondary_bitmap(sec)) {
+        if (!c->slots)
+            c->slots = secondary_slots_create();
+        if (!c->slots) {
+            secondary_free(sec);
+            return NULL;
+        }
+        secondary_bind(sec, c->slots);
+    }
+    return sec;
+}
+
+/**
+ * @brief Builds a secondary index over a collection and attaches it.
+ *
+ * Placeholders are decoded into temporary copies, so indexing a lazily
+ * loaded collection does not materialize it.
+ *
+ * @param[in] c    The collection.
+ * @param[in] spec Index specification (see secondary_create()).
+ * @return The attached index, or NULL if the specification is invalid,
+ *         memory is exhausted or a unique index would hold duplicate keys.
+ * @note Must be called within a locked mutex context.
+ */
+static secondary_t *_sec_create(collection_t *c, const cJSON *spec)
+{
+    secondary_t *sec = _sec_new(c, spec);
+    if (!sec)
+        return NULL;
+
+    for (cJSON *doc = c->docs->child; doc; doc = doc->next) {
+        cJSON *tmp;
+        const cJSON *view = _doc_view(doc, &tmp);
+        bool duplicate = view && secondary_conflicts(sec, view, NULL);
+        bool ok = !view || (!duplicate && secondary_add(sec, view, doc));
+        cJSON_Delete(tmp);
+        if (!ok) {
+            secondary_free(sec);
+            if (duplicate)
+                _fail(DB_ERROR_DUPLICATE_KEY);
+            return NULL;
+        }
+    }
+    c->secs[c->sec_count++] = sec;
+    return sec;
+}
+
+/**
+ * @brief Returns the position of a secondary index in its collection.
+ *
+ * @param[in] c    The collection.
+ * @param[in] name Index name.
+ * @return The position, or c->sec_count if there is no such index.
+ */
+static size_t _sec_find(const collection_t *c, const char *name)
+{
+    size_t i = 0;
+    while (i < c->sec_count && strcmp(secondary_name(c->secs[i]), name) != 0)
+        i++;
+    return i;
+}
+
+/**
+ * @brief Replaces a placeholder by its decoded document, in place.
+ *
+ * Index entries referencing the placeholder are moved to the decoded document.
+ *
+ * @param[in] c    Collection containing @p item.
+ * @param[in] item Entry to materialize.
+ * @return The materialized document (@p item itself if it already was one),
+ *         or NULL if the stored bytes are malformed.
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_materialize(collection_t *c, cJSON *item)
+{
+    if (!_lazy_doc(item))
+        return item;
+
+    cJSON *doc = _lazy_decode(item, NULL);
+    if (!doc)
+        return NULL;
+
+    /* The `_id` bytes live in the mapping, so they outlive the placeholder */
+    size_t len;
+    const char *id = _doc_id(item, &len);
+    if (id && index_get(c->ids, id, len) == item)
+        index_put(c->ids, id, len, doc, NULL);
+    for (size_t i = 0; i < c->sec_count; i++)
+        secondary_replace(c->secs[i], doc, item, doc);
+
+    cJSON_ReplaceItemViaPointer(c->docs, item, doc);
+    return doc;
+}
+
+/**
+ * @brief Returns a private copy of a stored document.
+ *
+ * @param[in] item Collection entry (regular document or placeholder).
+ * @return A new tree owned by the caller, or NULL on failure.
+ */
+static cJSON *_copy_doc(const cJSON *item)
+{
+    return _lazy_doc(item) ? _lazy_decode(item, NULL) : cJSON_Duplicate(item, 1);
+}
+
+/**
+ * @brief Registers a document array of root as a collection and indexes it.
+ *
+ * Entries reference the stored documents (placeholders included), so the
+ * index costs one slot per document instead of a copy of the collection.
+ * When several documents share an `_id` the first one is indexed. The
+ * secondary indexes listed in g_index_defs are built as well.
+ *
+ * @param[in] docs Document array (its key in root is the collection name).
+ * @return The collection, or NULL on allocation failure.
+ * @note Must be called within a locked mutex context.
+ */
+static collection_t *_coll_register(cJSON *docs)
+{
+    collection_t *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->docs = docs;
+    c->ids = index_create((size_t) cJSON_GetArraySize(docs));
+    if (!c->ids || !index_put(g_colls, docs->string, strlen(docs->string), c, NULL)) {
+        _coll_free(c);
+        return NULL;
+    }
+
+    size_t duplicates = 0;
+    for (cJSON *doc = docs->child; doc; doc = doc->next) {
+        c->count++;
+        size_t len;
+        const char *id = _doc_id(doc, &len);
+        if (!id)
+            continue;
+        if (index_get(c->ids, id, len))
+            duplicates++;
+        else if (!index_put(c->ids, id, len, doc, NULL))
+            c->partial = true;
+    }
+
+    if (duplicates > 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Collection '%s' holds %zu documents with a duplicate _id",
+                 docs->string, duplicates);
+        utils_log("WARN", msg);
+    }
+
+    /* Secondary indexes defined for this collection */
+    const cJSON *defs = cJSON_GetObjectItemCaseSensitive(g_index_defs, docs->string);
+    for (const cJSON *spec = defs ? defs->child : NULL; spec; spec = spec->next) {
+        if (!_sec_create(c, spec))
+            utils_log("ERROR", "Failed to build a secondary index");
+    }
+    return c;
+}
+
+/**
+ * @brief Returns a collection, creating it if it does not exist.
+ *
+ * @param[in] name Collection name.
+ * @return The collection, or NULL on allocation failure.
+ * @note Must be called within a locked mutex context.
+ */
+static collection_t *_coll_open(const char *name)
+{
+    collection_t *c = _coll_get(name);
+    if (c)
+        return c;
+
+    cJSON *docs = cJSON_CreateArray();
+    if (!docs || !cJSON_AddItemToObject(root, name, docs)) {
+        cJSON_Delete(docs);
+        return NULL;
+    }
+    c = _coll_register(docs);
+    if (!c) {
+        cJSON_Delete(cJSON_DetachItemViaPointer(root, docs));
+        utils_log("ERROR", "Not enough memory to create a collection");
+    }
+    return c;
+}
+
+/**
+ * @brief Rebuilds the collection table and the indexes of every collection.
+ *
+ * Called whenever root is replaced as a whole.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _rebuild_index(void)
+{
+    index_free(g_colls, _coll_free);
+    g_colls = index_create(0);
+
+    /* Safety Check */
+    if (!root || !g_colls)
+        return;
+
+    for (cJSON *docs = root->child; docs; docs = docs->next) {
+        if (!_coll_register(docs))
+            utils_log("ERROR", "Not enough memory to build the index");
+    }
+}
+
+/**
+ * @brief Copies a file byte-for-byte.
+ *
+ * @param[in] src_path Source file path.
+ * @param[in] dst_path Destination file path.
+ * @param[in] append   True to append to the destination instead of truncating it.
+ * @return true if the source was opened and fully copied, false otherwise.
+ */
+static bool _copy_file(const char *src_path, const char *dst_path, bool append)
+{
+    FILE *src = fopen(src_path, "rb");
+    if (!src)
+        return false;
+
+    FILE *dst = fopen(dst_path, append ? "ab" : "wb");
+    if (!dst) {
+        fclose(src);
+        return false;
+    }
+
+    char buf[8192];
+    size_t n;
+    bool ok = true;
+    while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
+        if (fwrite(buf, 1, n, dst) != n) {
+            ok = false;
+            break;
+        }
+    }
+
+    fclose(src);
+    if (fclose(dst) != 0)
+        ok = false;
+    return ok;
+}
+
+/**
+ * @brief Appends the byte range [@p from, @p to) of a file to another file.
+ *
+ * @param[in] src_path Source file path.
+ * @param[in] dst_path Destination file path (created if missing).
+ * @param[in] from     First byte to copy.
+ * @param[in] to       One past the last byte to copy.
+ * @return true if the whole range was copied.
+ */
+static bool _copy_range(const char *src_path, const char *dst_path, long from, long to)
+{
+    FILE *src = fopen(src_path, "rb");
+    if (!src)
+        return false;
+
+    FILE *dst = fopen(dst_path, "ab");
+    if (!dst) {
+        fclose(src);
+        return false;
+    }
+
+    char buf[8192];
+    long left = to - from;
+    bool ok = fseek(src, from, SEEK_SET) == 0;
+    while (ok && left > 0) {
+        size_t want = left < (long) sizeof(buf) ? (size_t) left : sizeof(buf);
+        size_t n = fread(buf, 1, want, src);
+        if (n == 0 || fwrite(buf, 1, n, dst) != n)
+            ok = false;
+        left -= (long) n;
+    }
+
+    fclose(src);
+    if (fclose(dst) != 0)
+        ok = false;
+    return ok;
+}
+
+/**
+ * @brief Makes @p dst_path hold the contents of @p src_path as cheaply as possible.
+ *
+ * Collection images are never modified in place (new versions are renamed
+ * over them), so a hard link is a stable copy that costs no data I/O. Where
+ * links are not possible (e.g. across file systems) the file is cloned with a
+ * reflink, and copied as a last resort.
+ *
+ * @param[in] src_path Source file path.
+ * @param[in] dst_path Destination file path (replaced).
+ * @return true if the destination holds the source's contents.
+ */
+static bool _link_file(const char *src_path, const char *dst_path)
+{
+    remove(dst_path);
+    if (link(src_path, dst_path) == 0)
+        return true;
+
+#ifdef FICLONE
+    int src = open(src_path, O_RDONLY);
+    if (src >= 0) {
+        int dst = open(dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool cloned = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+        if (dst >= 0)
+            close(dst);
+        close(src);
+        if (cloned)
+            return true;
+    }
+#endif
+    return _copy_file(src_path, dst_path, false);
+}
+
+/**
+ * @brief Writes a database image to a file in the configured storage format.
+ *
+ * @param[in] state  Root object to serialize.
+ * @param[in] path   Destination file (truncated).
+ * @param[in] format Storage format to use.
+ * @param[in] sync   True to fsync the file before returning.
+ * @return true if the file was completely written (and synced).
+ */
+static bool _write_image(const cJSON *state, const char *path, storage_format_t format, bool sync)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+
+    bool ok = storage_write(fp, state, format, _lazy_decode, NULL) && fflush(fp) == 0;
+    if (ok && sync)
+        ok = fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0)
+        ok = false;
+    return ok;
+}
+
+/**
+ * @brief Builds the path of a collection's image file.
+ *
+ * Collection names are percent-encoded so any name maps to a safe, distinct
+ * file name; very long names are shortened and suffixed with a hash.
+ *
+ * @param[in]  dir    Database directory.
+ * @param[in]  name   Collection name.
+ * @param[in]  suffix Extra suffix for temporary files ("" for the image itself).
+ * @param[out] out    Destination buffer.
+ * @param[in]  size   Size of @p out.
+ */
+static void _coll_path(const char *dir, const char *name, const char *suffix, char *out,
+                       size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    char enc[COLL_NAME_MAX + 24];
+    size_t n = 0;
+
+    const unsigned char *c = (const unsigned char *) name;
+    for (; *c && n < COLL_NAME_MAX; c++) {
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+            *c == '_' || *c == '-') {
+            enc[n++] = (char) *c;
+        } else {
+            enc[n++] = '%';
+            enc[n++] = hex[*c >> 4];
+            enc[n++] = hex[*c & 15];
+        }
+    }
+    if (*c) {
+        /* FNV-1a of the full name keeps shortened names distinct */
+        uint64_t h = 1469598103934665603ULL;
+        for (c = (const unsigned char *) name; *c; c++)
+            h = (h ^ *c) * 1099511628211ULL;
+        n += (size_t) snprintf(enc + n, sizeof(enc) - n, "~%016llx", (unsigned long long) h);
+    }
+    enc[n] = '\0';
+    snprintf(out, size, "%s/%s%s%s", dir, enc, COLL_FILE_EXT, suffix);
+}
+
+/**
+ * @brief Tells whether a directory entry is a collection image file.
+ *
+ * @param[in] name Entry name.
+ * @return true if @p name ends with COLL_FILE_EXT.
+ */
+static bool _is_coll_file(const char *name)
+{
+    size_t len = strlen(name), ext = strlen(COLL_FILE_EXT);
+    return len > ext && strcmp(name + len - ext, COLL_FILE_EXT) == 0;
+}
+
+/**
+ * @brief Tells whether a directory entry is the index file of a collection.
+ *
+ * @param[in] name Entry name.
+ * @return true if @p name ends with COLL_FILE_EXT followed by INDEX_FILE_EXT.
+ */
+static bool _is_index_file(const char *name)
+{
+    size_t len = strlen(name), ext = strlen(COLL_FILE_EXT INDEX_FILE_EXT);
+    return len > ext && strcmp(name + len - ext, COLL_FILE_EXT INDEX_FILE_EXT) == 0;
+}
+
+/**
+ * @brief Flushes directory metadata (renames and removals) to disk.
+ *
+ * @param[in] dir Directory to sync.
+ */
+static void _sync_dir(const char *dir)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+    if (fsync(fd) != 0)
+        perror("Failed to sync database directory");
+    close(fd);
+}
+
+/**
+ * @brief Removes a directory and the files it contains.
+ *
+ * @param[in] dir Directory to remove (subdirectories are not expected).
+ */
+static void _remove_tree(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    const struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        remove(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+/**
+ * @brief Makes a directory hold exactly the collection images of another one.
+ *
+ * The index catalog is linked along with the images.
+ *
+ * @param[in] src_dir Directory whose images are linked (see _link_file()).
+ * @param[in] dst_dir Existing directory; images it holds already are replaced.
+ * @return true if every image was linked or copied.
+ */
+static bool _link_images(const char *src_dir, const char *dst_dir)
+{
+    DIR *d = opendir(dst_dir);
+    if (!d)
+        return false;
+    const struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (!_is_coll_file(ent->d_name) && strcmp(ent->d_name, INDEX_CATALOG) != 0)
+            continue;
+        char path[800];
+        snprintf(path, sizeof(path), "%s/%s", dst_dir, ent->d_name);
+        remove(path);
+    }
+    closedir(d);
+
+    d = opendir(src_dir);
+    if (!d)
+        return false;
+    bool ok = true;
+    while (ok && (ent = readdir(d))) {
+        if (!_is_coll_file(ent->d_name) && strcmp(ent->d_name, INDEX_CATALOG) != 0)
+            continue;
+        char src[800], dst[800];
+        snprintf(src, sizeof(src), "%s/%s", src_dir, ent->d_name);
+        snprintf(dst, sizeof(dst), "%s/%s", dst_dir, ent->d_name);
+        ok = _link_file(src, dst);
+    }
+    closedir(d);
+    return ok;
+}
+
+/**
+ * @brief Writes g_index_defs to the index catalog of the database directory.
+ *
+ * The catalog is replaced atomically and never modified in place, so
+ * snapshots can link it like the collection images.
+ *
+ * @return true if the catalog was written.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _catalog_write(void)
+{
+    char *text = cJSON_Print(g_index_defs);
+    if (!text)
+        return false;
+
+    char path[400], tmp_path[410];
+    snprintf(path, sizeof(path), "%s/%s", g_db_dir, INDEX_CATALOG);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    bool ok = fp && fputs(text, fp) >= 0 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    free(text);
+    ok = ok && rename(tmp_path, path) == 0;
+    if (ok)
+        _sync_dir(g_db_dir);
+    else
+        perror("Failed to write the index catalog");
+    return ok;
+}
+
+/**
+ * @brief Reads the stamp of a collection image.
+ *
+ * @param[in]  name  Collection name.
+ * @param[in]  docs  Documents in the collection.
+ * @param[out] stamp Receives the stamp.
+ * @return false if the collection has no image.
+ */
+static bool _index_stamp(const char *name, size_t docs, index_stamp_t *stamp)
+{
+    char path[700];
+    struct stat st;
+    _coll_path(g_db_dir, name, "", path, sizeof(path));
+    if (stat(path, &st) != 0)
+        return false;
+    *stamp = (index_stamp_t) {(uint64_t) st.st_dev,          (uint64_t) st.st_ino,
+                              (uint64_t) st.st_size,         (uint64_t) st.st_mtim.tv_sec,
+                              (uint64_t) st.st_mtim.tv_nsec, (uint64_t) docs};
+    return true;
+}
+
+/**
+ * @brief Saves the secondary indexes of a collection next to its image.
+ *
+ * The file holds the magic, the stamp of the image, then for every index its
+ * normalized specification (u64 length and bytes, host byte order, like the
+ * stamp) followed by its contents (see secondary_save()). Documents are named
+ * by their position in the collection. A collection without indexes loses
+ * its file.
+ *
+ * @param[in] name Collection name.
+ * @param[in] c    The collection, whose image must hold its current state.
+ * @return true if the file is up to date.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _index_file_save(const char *name, collection_t *c)
+{
+    char path[720], tmp_path[730];
+    _coll_path(g_db_dir, name, INDEX_FILE_EXT, path, sizeof(path));
+    if (c->sec_count == 0)
+        return remove(path) == 0 || errno == ENOENT;
+
+    /* Positions of the stored documents, in collection order */
+    index_t *numbers = index_create(c->count);
+    uintptr_t docs = 0;
+    bool ok = numbers != NULL;
+    for (cJSON *doc = c->docs->child; ok && doc; doc = doc->next)
+        ok = index_put(numbers, (const char *) &doc, sizeof(doc), (void *) ++docs, NULL);
+
+    index_stamp_t stamp;
+    ok = ok && _index_stamp(name, docs, &stamp);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = ok ? fopen(tmp_path, "wb") : NULL;
+    ok = fp && fwrite(INDEX_FILE_MAGIC, 1, 4, fp) == 4 && fwrite(&stamp, sizeof(stamp), 1, fp) == 1;
+    for (size_t i = 0; ok && i < c->sec_count; i++) {
+        char *spec = cJSON_PrintUnformatted(secondary_spec(c->secs[i]));
+        uint64_t len = spec ? strlen(spec) : 0;
+        ok = spec && fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(spec, 1, len, fp) == len &&
+             secondary_save(c->secs[i], fp, numbers);
+        free(spec);
+    }
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok)
+        remove(tmp_path);
+    index_free(numbers, NULL);
+    return ok;
+}
+
+/**
+ * @brief Saves the index files that no longer match their collection.
+ *
+ * Collections changed since their image was written are skipped: their file
+ * is saved by the checkpoint that writes the image.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _index_files_save(void)
+{
+    for (const cJSON *coll = root ? root->child : NULL; coll; coll = coll->next) {
+        collection_t *c = _coll_get(coll->string);
+        if (!c || c->indexes_saved ||
+            cJSON_GetObjectItemCaseSensitive(g_dirty_colls, coll->string))
+            continue;
+        c->indexes_saved = _index_file_save(coll->string, c);
+        if (!c->indexes_saved && c->sec_count > 0)
+            utils_log("WARN", "Failed to save an index file; the indexes will be rebuilt");
+    }
+}
+
+/**
+ * @brief Detaches and frees every secondary index of a collection.
+ *
+ * @param[in] c The collection.
+ * @note Must be called within a locked mutex context.
+ */
+static void _sec_clear(collection_t *c)
+{
+    for (size_t i = 0; i < c->sec_count; i++)
+        secondary_free(c->secs[i]);
+    c->sec_count = 0;
+    secondary_slots_free(c->slots);
+    c->slots = NULL;
+}
+
+/**
+ * @brief Attaches the secondary indexes of a collection from its index file.
+ *
+ * The file is used only if it was saved against the image just loaded and
+ * holds exactly the indexes of the catalog, in catalog order; otherwise
+ * nothing is attached and the indexes are built from the documents.
+ *
+ * @param[in] c    A collection loaded from its image, without indexes.
+ * @param[in] name Collection name.
+ * @param[in] defs Catalog entries of the collection.
+ * @return true if every index was loaded.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _index_file_load(collection_t *c, const char *name, const cJSON *defs)
+{
+    char path[720];
+    _coll_path(g_db_dir, name, INDEX_FILE_EXT, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+
+    size_t count = (size_t) cJSON_GetArraySize(c->docs);
+    cJSON **docs = malloc((count ? count : 1) * sizeof(*docs));
+    size_t n = 0;
+    for (cJSON *doc = c->docs->child; docs && doc; doc = doc->next)
+        docs[n++] = doc;
+
+    char magic[4];
+    index_stamp_t saved, current;
+    bool ok = docs && fread(magic, 1, 4, fp) == 4 && memcmp(magic, INDEX_FILE_MAGIC, 4) == 0 &&
+              fread(&saved, sizeof(saved), 1, fp) == 1;
+    if (ok && (!_index_stamp(name, count, &current) ||
+               memcmp(&saved, &current, sizeof(saved)) != 0)) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Index file of '%s' is out of date; rebuilding", name);
+        utils_log("INFO", msg);
+        fclose(fp);
+        free(docs);
+        return false;
+    }
+
+    for (const cJSON *spec = defs->child; ok && spec; spec = spec->next) {
+        secondary_t *sec = _sec_new(c, spec);
+        char *want = sec ? cJSON_PrintUnformatted(secondary_spec(sec)) : NULL;
+        uint64_t len = 0;
+        ok = want && fread(&len, sizeof(len), 1, fp) == 1 && len == strlen(want);
+        char *got = ok ? malloc((size_t) len) : NULL;
+        ok = got && fread(got, 1, (size_t) len, fp) == len && memcmp(got, want, len) == 0 &&
+             secondary_load(sec, fp, docs, count);
+        free(got);
+        free(want);
+        if (ok)
+            c->secs[c->sec_count++] = sec;
+        else
+            secondary_free(sec);
+    }
+    ok = ok && fgetc(fp) == EOF;
+    fclose(fp);
+    free(docs);
+    if (!ok) {
+        _sec_clear(c);
+        utils_log("WARN", "Ignoring an unreadable index file");
+    }
+    return ok;
+}
+
+/**
+ * @brief Loads the index catalog and attaches the secondary indexes saved for it.
+ *
+ * Runs before the log is replayed, since index files describe the images:
+ * replay then maintains the loaded indexes. Collections whose index file is
+ * missing or out of date get their indexes from _catalog_build() once the
+ * log has been replayed, so replay does not maintain indexes that are built
+ * from the final state anyway.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _catalog_load(void)
+{
+    char path[400];
+    snprintf(path, sizeof(path), "%s/%s", g_db_dir, INDEX_CATALOG);
+    cJSON_Delete(g_index_defs);
+    g_index_defs = NULL;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        char *text = NULL;
+        long len = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+        if (len >= 0 && fseek(fp, 0, SEEK_SET) == 0 && (text = malloc((size_t) len + 1))) {
+            text[fread(text, 1, (size_t) len, fp)] = '\0';
+            g_index_defs = cJSON_Parse(text);
+            free(text);
+        }
+        fclose(fp);
+        if (!cJSON_IsObject(g_index_defs))
+            utils_log("ERROR", "Ignoring a malformed index catalog");
+    }
+    if (!cJSON_IsObject(g_index_defs)) {
+        cJSON_Delete(g_index_defs);
+        g_index_defs = cJSON_CreateObject();
+        return;
+    }
+
+    for (const cJSON *defs = g_index_defs->child; defs; defs = defs->next) {
+        collection_t *c = _coll_get(defs->string);
+        if (!c) {
+            /* Registering the collection builds its indexes */
+            _coll_open(defs->string);
+            continue;
+        }
+        c->indexes_saved = _index_file_load(c, defs->string, defs);
+    }
+}
+
+/**
+ * @brief Builds the secondary indexes of the catalog that were not loaded from a file.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _catalog_build(void)
+{
+    for (const cJSON *defs = g_index_defs->child; defs; defs = defs->next) {
+        collection_t *c = _coll_get(defs->string);
+        if (!c) {
+            _coll_open(defs->string);
+            continue;
+        }
+        bool build = c->sec_count == 0;
+        for (const cJSON *spec = defs->child; build && spec; spec = spec->next) {
+            if (!_sec_create(c, spec))
+                utils_log("ERROR", "Failed to build a secondary index");
+        }
+    }
+}
+
+/**
+ * @brief Records that a collection must be written by the next checkpoint.
+ *
+ * @param[in] coll_name Collection name.
+ * @param[in] lsn       Sequence number of the mutation.
+ * @note Must be called within a locked mutex context.
+ */
+static void _mark_dirty(const char *coll_name, uint64_t lsn)
+{
+    collection_t *c = _coll_get(coll_name);
+    if (c) {
+        c->indexes_saved = false;
+        c->changes++;
+    }
+    cJSON *entry = cJSON_GetObjectItemCaseSensitive(g_dirty_colls, coll_name);
+    if (entry)
+        cJSON_SetNumberValue(entry, (double) lsn);
+    else
+        cJSON_AddNumberToObject(g_dirty_colls, coll_name, (double) lsn);
+}
+
+/**
+ * @brief Marks every collection for the next checkpoint.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _mark_all_dirty(void)
+{
+    for (const cJSON *coll = root ? root->child : NULL; coll; coll = coll->next)
+        _mark_dirty(coll->string, g_appended_lsn);
+}
+
+/**
+ * @brief Forgets collections whose last change is covered by a written image.
+ *
+ * @param[in] upto Highest sequence number covered by the images just installed.
+ * @note Must be called within a locked mutex context.
+ */
+static void _clear_dirty(uint64_t upto)
+{
+    cJSON *entry = g_dirty_colls->child;
+    while (entry) {
+        cJSON *next = entry->next;
+        if (entry->valuedouble <= (double) upto)
+            cJSON_Delete(cJSON_DetachItemViaPointer(g_dirty_colls, entry));
+        entry = next;
+    }
+}
+
+/**
+ * @brief Writes one collection to `<image>` + @p suffix.
+ *
+ * @param[in] dir    Directory holding the images.
+ * @param[in] coll   Collection array (its key is the collection name).
+ * @param[in] format Storage format to use.
+ * @param[in] suffix Temporary file suffix.
+ * @param[in] sync   True to fsync the file.
+ * @return true if the file was completely written.
+ */
+static bool _write_collection(const char *dir, const cJSON *coll, storage_format_t format,
+                              const char *suffix, bool sync)
+{
+    char path[700];
+    _coll_path(dir, coll->string, suffix, path, sizeof(path));
+
+    /* The image of a collection is a database holding just that collection */
+    cJSON *image = cJSON_CreateObject();
+    cJSON_AddItemReferenceToObject(image, coll->string, (cJSON *) coll);
+    bool ok = _write_image(image, path, format, sync);
+    cJSON_Delete(image);
+    if (!ok)
+        remove(path);
+    return ok;
+}
+
+/**
+ * @brief Replaces a collection's image with the file written under @p suffix.
+ *
+ * @param[in] dir    Directory holding the images.
+ * @param[in] name   Collection name.
+ * @param[in] suffix Temporary file suffix used by _write_collection().
+ * @return true if the rename succeeded.
+ */
+static bool _install_collection(const char *dir, const char *name, const char *suffix)
+{
+    char tmp_path[700], path[700];
+    _coll_path(dir, name, suffix, tmp_path, sizeof(tmp_path));
+    _coll_path(dir, name, "", path, sizeof(path));
+    return rename(tmp_path, path) == 0;
+}
+
+/**
+ * @brief Removes the images and index files of collections that no longer exist.
+ *
+ * @param[in] dir  Directory holding the images.
+ * @param[in] keep Extra object whose keys name collections to keep (may be NULL);
+ *                 every collection currently in memory is always kept.
+ * @note Must be called within a locked mutex context.
+ */
+static void _prune_collections(const char *dir, const cJSON *keep)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+
+    const struct dirent *ent;
+    while ((ent = readdir(d))) {
+        bool index_file = _is_index_file(ent->d_name);
+        if (!_is_coll_file(ent->d_name) && !index_file)
+            continue;
+
+        char path[800], wanted[800];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        bool used = false;
+        const cJSON *sets[2] = {root, keep};
+        for (int i = 0; i < 2 && !used; i++) {
+            for (const cJSON *c = sets[i] ? sets[i]->child : NULL; c && !used; c = c->next) {
+                _coll_path(dir, c->string, index_file ? INDEX_FILE_EXT : "", wanted,
+                           sizeof(wanted));
+                used = strcmp(path, wanted) == 0;
+            }
+        }
+        if (!used)
+            remove(path);
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Persists every changed collection using an atomic write pattern.
+ *
+ * Each collection lives in its own image file under the database directory,
+ * so only collections changed since their image was written are serialized
+ * (to a temporary file first, then renamed into place). Images of dropped
+ * collections are removed.
+ *
+ * @param[in] sync True to fsync the new images before they replace the old ones.
+ * @return true if every changed collection was written, false otherwise.
+ * @note This is an internal helper and does not handle its own locking.
+ */
+static bool _save_internal(bool sync)
+{
+    if (!root)
+        return false;
+
+    bool ok = true;
+    for (const cJSON *entry = g_dirty_colls->child; entry; entry = entry->next) {
+        const cJSON *coll = cJSON_GetObjectItemCaseSensitive(root, entry->string);
+        if (!coll)
+            continue;
+        if (!_write_collection(g_db_dir, coll, g_format, ".tmp", sync)) {
+            perror("Failed to write temporary collection file");
+            ok = false;
+        } else if (!_install_collection(g_db_dir, coll->string, ".tmp")) {
+            /* Atomic swap of temporary file with actual file */
+            perror("Failed to replace collection file");
+            ok = false;
+        }
+    }
+    if (!ok)
+        return false;
+
+    _prune_collections(g_db_dir, NULL);
+    if (sync)
+        _sync_dir(g_db_dir);
+    _clear_dirty(UINT64_MAX);
+    return true;
+}
+
+/**
+ * @brief Marks every record up to @p lsn as flushed and synced and wakes waiters.
+ *
+ * @param[in] lsn Highest log sequence number now on stable storage.
+ */
+static void _commit_mark_durable(uint64_t lsn)
+{
+    pthread_mutex_lock(&g_commit_lock);
+    if (lsn > g_flushed_lsn)
+        g_flushed_lsn = lsn;
+    if (lsn > g_synced_lsn)
+        g_synced_lsn = lsn;
+    pthread_cond_broadcast(&g_commit_cond);
+    pthread_mutex_unlock(&g_commit_lock);
+}
+
+/**
+ * @brief Resets the checkpoint trigger counters after an image was installed.
+ *
+ * @param[in] lsn Sequence number covered by the new image.
+ * @note Must be called within a locked mutex context.
+ */
+static void _checkpoint_done(uint64_t lsn)
+{
+    g_image_lsn = lsn;
+    g_ckpt_last = time(NULL);
+    remove(g_wal_old_path);
+}
+
+/**
+ * @brief Synchronously folds the write-ahead log into a fresh base image.
+ *
+ * Used at startup, shutdown and as an error fallback; steady-state checkpoints
+ * are taken by the background thread (see _checkpoint_background). The image
+ * is written (and synced) first; the log is only truncated once the rename
+ * succeeded. A crash in between leaves records that are already part of the
+ * image, which is harmless because replay is idempotent (see _wal_apply).
+ * Records still waiting in the commit buffer are covered by the image too, so
+ * they are discarded and every pending commit is released.
+ *
+ * @return true if the images were written and the log discarded.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _checkpoint(void)
+{
+    if (!_save_internal(true))
+        return false;
+
+    g_wal_buf_len = 0;
+    g_dirty = false;
+
+    if (g_wal_fp) {
+        pthread_mutex_lock(&g_wal_io_lock);
+        fflush(g_wal_fp);
+        if (ftruncate(fileno(g_wal_fp), 0) != 0)
+            perror("Failed to truncate write-ahead log");
+        pthread_mutex_unlock(&g_wal_io_lock);
+    } else {
+        remove(g_wal_path);
+    }
+    g_wal_bytes = 0;
+    g_wal_ops = 0;
+    g_wal_gen++;
+    _checkpoint_done(g_appended_lsn);
+    _index_files_save();
+
+    _commit_mark_durable(g_appended_lsn);
+    return true;
+}
+
+/**
+ * @brief Writes a chunk of serialized records to the log file.
+ *
+ * @param[in] buf  Newline-terminated records.
+ * @param[in] len  Number of bytes in @p buf.
+ * @param[in] sync True to fsync the log after writing.
+ * @return true if every byte reached the operating system (and disk when syncing).
+ * @note Caller must hold g_wal_io_lock.
+ */
+static bool _wal_write(const char *buf, size_t len, bool sync)
+{
+    if (len > 0 && fwrite(buf, 1, len, g_wal_fp) != len)
+        return false;
+    if (fflush(g_wal_fp) != 0)
+        return false;
+    if (sync && fsync(fileno(g_wal_fp)) != 0)
+        return false;
+    return true;
+}
+
+/**
+ * @brief Writes everything buffered so far to its final location.
+ *
+ * In WAL mode the commit buffer is appended to the log; otherwise a pending
+ * image rewrite is performed.
+ *
+ * @param[in] sync True to fsync what was written.
+ * @return true on success.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _flush_pending(bool sync)
+{
+    bool ok = true;
+    if (g_wal_fp) {
+        pthread_mutex_lock(&g_wal_io_lock);
+        ok = _wal_write(g_wal_buf, g_wal_buf_len, sync);
+        pthread_mutex_unlock(&g_wal_io_lock);
+        g_wal_buf_len = 0;
+        if (!ok) {
+            perror("Failed to append to write-ahead log");
+            /* Fall back to a full image so no acknowledged mutation is lost */
+            _checkpoint();
+            return false;
+        }
+    } else if (g_dirty) {
+        ok = _save_internal(sync);
+        g_dirty = !ok;
+    }
+    if (ok && sync)
+        _commit_mark_durable(g_appended_lsn);
+    return ok;
+}
+
+/**
+ * @brief Serializes one mutation record into the commit buffer.
+ *
+ * Records are compact JSON objects, one per line:
+ * - `{"op":"put","collection":C,"doc":D}`    full post-image of a document.
+ * - `{"op":"delete","collection":C,"id":I}`  removal by `_id`.
+ * - `{"op":"drop"}`                          removal of every collection.
+ *
+ * @param[in] op   Record operation name.
+ * @param[in] coll Collection name (NULL for "drop").
+ * @param[in] doc  Document post-image for "put", referenced rather than copied.
+ * @param[in] id   Document `_id` for "delete".
+ * @return true if the record was buffered.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _wal_append(const char *op, const char *coll, cJSON *doc, const char *id)
+{
+    cJSON *rec = cJSON_CreateObject();
+    cJSON_AddStringToObject(rec, "op", op);
+    if (coll)
+        cJSON_AddStringToObject(rec, "collection", coll);
+    if (doc)
+        cJSON_AddItemReferenceToObject(rec, "doc", doc);
+    if (id)
+        cJSON_AddStringToObject(rec, "id", id);
+
+    char *line = cJSON_PrintUnformatted(rec);
+    cJSON_Delete(rec);
+    if (!line)
+        return false;
+
+    size_t len = strlen(line);
+    if (g_wal_buf_len + len + 1 > g_wal_buf_cap) {
+        size_t cap = g_wal_buf_cap ? g_wal_buf_cap : 4096;
+        while (cap < g_wal_buf_len + len + 1)
+            cap *= 2;
+        char *grown = realloc(g_wal_buf, cap);
+        if (!grown) {
+            free(line);
+            return false;
+        }
+        g_wal_buf = grown;
+        g_wal_buf_cap = cap;
+    }
+    memcpy(g_wal_buf + g_wal_buf_len, line, len);
+    g_wal_buf[g_wal_buf_len + len] = '\n';
+    g_wal_buf_len += len + 1;
+    g_wal_bytes += (long) len + 1;
+    g_wal_ops++;
+    free(line);
+    return true;
+}
+
+/**
+ * @brief Writes the manifest describing a snapshot.
+ *
+ * @param[in] dir    Snapshot directory.
+ * @param[in] parent Name of the snapshot whose log this one continues ("" if none).
+ * @return true if the manifest was written.
+ */
+static bool _write_manifest(const char *dir, const char *parent)
+{
+    cJSON *manifest = cJSON_CreateObject();
+    cJSON_AddNumberToObject(manifest, "version", 1);
+    cJSON_AddNumberToObject(manifest, "created", (double) time(NULL));
+    if (parent[0])
+        cJSON_AddStringToObject(manifest, "parent", parent);
+    else
+        cJSON_AddNullToObject(manifest, "parent");
+    char *text = cJSON_Print(manifest);
+    cJSON_Delete(manifest);
+    if (!text)
+        return false;
+
+    char path[700], tmp_path[710];
+    snprintf(path, sizeof(path), "%s/%s", dir, SNAPSHOT_MANIFEST);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    bool ok = fp && fputs(text, fp) >= 0;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    free(text);
+    return ok && rename(tmp_path, path) == 0;
+}
+
+/**
+ * @brief Reads the manifest of a snapshot.
+ *
+ * @param[in] dir Snapshot directory.
+ * @return The parsed manifest (caller frees), or NULL if missing or malformed.
+ */
+static cJSON *_read_manifest(const char *dir)
+{
+    char path[700];
+    snprintf(path, sizeof(path), "%s/%s", dir, SNAPSHOT_MANIFEST);
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    return cJSON_Parse(buf);
+}
+
+/**
+ * @brief Builds the path of a snapshot next to the database files.
+ *
+ * @param[in]  base Directory containing the database or snapshot the name is relative to.
+ * @param[in]  name Snapshot name.
+ * @param[out] out  Destination buffer.
+ * @param[in]  size Size of @p out.
+ */
+static void _snapshot_path(const char *base, const char *name, char *out, size_t size)
+{
+    const char *slash = strrchr(base, '/');
+    if (slash)
+        snprintf(out, size, "%.*s/%s", (int) (slash - base), base, name);
+    else
+        snprintf(out, size, "%s", name);
+}
+
+/**
+ * @brief Creates an incremental restore point of the current database files.
+ * * Snapshots are directories named `backup_YYYYMMDD_HHMMSS.d` next to the
+ * database. Collection images are never modified in place, so they are hard
+ * linked (or reflinked) into the snapshot instead of copied, and only the log
+ * written since the previous snapshot is copied: a snapshot whose log
+ * generation matches the previous one records it as its parent and holds just
+ * the log delta. A snapshot taken in the same second as the previous one
+ * extends it. The cost is therefore proportional to what changed since the
+ * last snapshot; db_restore_snapshot() reassembles the chain.
+ * * @return true if the snapshot was written.
+ * @note This is an internal helper called by _persist and db_force_snapshot.
+ * Must be called within a locked mutex context.
+ */
+static bool _create_snapshot(void)
+{
+    char name[64], dir[600];
+    time_t now = time(NULL);
+    const struct tm *t = localtime(&now);
+    snprintf(name, sizeof(name), "backup_%04d%02d%02d_%02d%02d%02d.d", t->tm_year + 1900,
+             t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+    _snapshot_path(g_db_path, name, dir, sizeof(dir));
+
+    /* Make the files on disk reflect every recorded mutation */
+    _flush_pending(false);
+
+    /* The log since the previous snapshot is a valid delta unless it was truncated or rotated */
+    bool chained = g_wal_fp && g_snap_dir[0] && g_snap_gen == g_wal_gen &&
+                   access(g_snap_dir, F_OK) == 0;
+    bool extend = chained && strcmp(dir, g_snap_dir) == 0;
+    char parent[600] = "";
+    if (extend) {
+        snprintf(parent, sizeof(parent), "%s", g_snap_parent);
+    } else if (chained) {
+        const char *slash = strrchr(g_snap_dir, '/');
+        snprintf(parent, sizeof(parent), "%s", slash ? slash + 1 : g_snap_dir);
+    }
+
+    if (!extend) {
+        _remove_tree(dir);
+        if (mkdir(dir, 0755) != 0) {
+            perror("Failed to create snapshot directory");
+            return false;
+        }
+    }
+
+    bool ok = _link_images(g_db_dir, dir);
+    long from = chained ? g_snap_wal_off : 0, to = 0;
+    if (ok && g_wal_fp) {
+        char log_path[700];
+        snprintf(log_path, sizeof(log_path), "%s/%s", dir, SNAPSHOT_LOG);
+        /* A segment still being checkpointed precedes the live log */
+        if (!chained && access(g_wal_old_path, F_OK) == 0)
+            ok = _copy_file(g_wal_old_path, log_path, true);
+
+        pthread_mutex_lock(&g_wal_io_lock);
+        struct stat st;
+        if (ok && fstat(fileno(g_wal_fp), &st) == 0 && st.st_size >= from) {
+            to = (long) st.st_size;
+            ok = _copy_range(g_wal_path, log_path, from, to);
+        } else {
+            ok = false;
+        }
+        pthread_mutex_unlock(&g_wal_io_lock);
+    }
+    if (ok)
+        ok = _write_manifest(dir, parent);
+    if (!ok) {
+        perror("Failed to write snapshot");
+        _remove_tree(dir);
+        g_snap_dir[0] = '\0';
+        return false;
+    }
+
+    snprintf(g_snap_dir, sizeof(g_snap_dir), "%s", dir);
+    snprintf(g_snap_parent, sizeof(g_snap_parent), "%s", parent);
+    g_snap_gen = g_wal_gen;
+    g_snap_wal_off = to;
+
+    char log_msg[700];
+    snprintf(log_msg, sizeof(log_msg), "Snapshot created: %s", dir);
+    utils_log("INFO", log_msg);
+    return true;
+}
+
+/**
+ * @brief Collects the exit status of a snapshot process if it has finished.
+ *
+ * @param[in,out] job   Snapshot to check.
+ * @param[in]     block True to wait for the process to exit.
+ * @note Must be called within a locked mutex context.
+ */
+static void _snapshot_reap(snapshot_job_t *job, bool block)
+{
+    if (job->pid <= 0)
+        return;
+
+    int status;
+    pid_t done = waitpid(job->pid, &status, block ? 0 : WNOHANG);
+    if (done == 0)
+        return;
+    if (done == job->pid)
+        job->state = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? DB_SNAPSHOT_DONE
+                                                                      : DB_SNAPSHOT_FAILED;
+    else
+        /* Reaped elsewhere (e.g. SIGCHLD ignored): the directory tells the outcome */
+        job->state = access(job->path, F_OK) == 0 ? DB_SNAPSHOT_DONE : DB_SNAPSHOT_FAILED;
+    job->pid = 0;
+
+    char msg[700];
+    snprintf(msg, sizeof(msg), "Snapshot %s: %s",
+             job->state == DB_SNAPSHOT_DONE ? "created" : "failed", job->path);
+    utils_log(job->state == DB_SNAPSHOT_DONE ? "INFO" : "ERROR", msg);
+}
+
+/**
+ * @brief Reaps every finished snapshot process.
+ *
+ * @param[in] block True to wait for all of them to exit.
+ * @note Must be called within a locked mutex context.
+ */
+static void _snapshot_reap_all(bool block)
+{
+    for (int i = 0; i < SNAPSHOT_JOBS; i++)
+        _snapshot_reap(&g_snap_jobs[i], block);
+}
+
+/**
+ * @brief Looks up the state of a forked snapshot.
+ *
+ * @param[in] id Snapshot id.
+ * @return The job, or NULL if the id is unknown or was recycled.
+ * @note Must be called within a locked mutex context.
+ */
+static snapshot_job_t *_snapshot_job(long id)
+{
+    snapshot_job_t *job = &g_snap_jobs[id % SNAPSHOT_JOBS];
+    if (id <= 0 || job->id != id)
+        return NULL;
+    _snapshot_reap(job, false);
+    return job;
+}
+
+/**
+ * @brief Body of the snapshot process: writes the forked view of the database.
+ *
+ * The process owns a copy-on-write image of memory taken under the engine
+ * lock, so it serializes a consistent state while the parent keeps serving.
+ * Images that were already current are linked by the parent before the fork;
+ * only collections changed since their image was written are serialized here.
+ * The directory only appears under its final name once it is complete.
+ *
+ * @param[in] staging Directory prepared by the parent.
+ * @param[in] path    Final snapshot directory.
+ */
+static void _snapshot_child(const char *staging, const char *path)
+{
+    bool ok = true;
+    for (const cJSON *coll = root->child; ok && coll; coll = coll->next) {
+        char image[700];
+        _coll_path(staging, coll->string, "", image, sizeof(image));
+        if (!cJSON_GetObjectItemCaseSensitive(g_dirty_colls, coll->string) &&
+            access(image, F_OK) == 0)
+            continue;
+        /* Write beside the link and rename over it so the live image is never touched */
+        ok = _write_collection(staging, coll, g_format, ".tmp", true) &&
+             _install_collection(staging, coll->string, ".tmp");
+    }
+    if (ok) {
+        _prune_collections(staging, NULL);
+        ok = _write_manifest(staging, "");
+    }
+    if (ok) {
+        _sync_dir(staging);
+        _remove_tree(path);
+        ok = rename(staging, path) == 0;
+    }
+    if (!ok)
+        _remove_tree(staging);
+    _exit(ok ? 0 : 1);
+}
+
+/**
+ * @brief Starts a snapshot written by a forked process.
+ *
+ * Only the hard links of the current images and the fork itself happen under
+ * the lock; no document is serialized by the calling process.
+ *
+ * @return The snapshot id, or -1 if it could not be started.
+ * @note Must be called within a locked mutex context.
+ */
+static long _snapshot_fork(void)
+{
+    long id = g_snap_next_id;
+    snapshot_job_t *job = &g_snap_jobs[id % SNAPSHOT_JOBS];
+    _snapshot_reap(job, false);
+    if (job->pid > 0) {
+        utils_log("WARN", "Too many snapshots in progress");
+        return -1;
+    }
+
+    char name[96], path[600], staging[620];
+    time_t now = time(NULL);
+    const struct tm *t = localtime(&now);
+    snprintf(name, sizeof(name), "backup_%04d%02d%02d_%02d%02d%02d-%ld.d", t->tm_year + 1900,
+             t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, id);
+    _snapshot_path(g_db_path, name, path, sizeof(path));
+    snprintf(staging, sizeof(staging), "%s.tmp", path);
+
+    _remove_tree(staging);
+    if (mkdir(staging, 0755) != 0 || !_link_images(g_db_dir, staging)) {
+        perror("Failed to prepare snapshot directory");
+        _remove_tree(staging);
+        return -1;
+    }
+
+    /* Buffered output would otherwise be written by both processes */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+        _snapshot_child(staging, path);
+    if (pid < 0) {
+        perror("Failed to fork snapshot process");
+        _remove_tree(staging);
+        return -1;
+    }
+
+    g_snap_next_id++;
+    job->id = id;
+    job->pid = pid;
+    job->state = DB_SNAPSHOT_RUNNING;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    return id;
+}
+
+/**
+ * @brief Records a mutation for the commit pipeline.
+ *
+ * In WAL mode only the mutation record is buffered, so the cost depends on the
+ * document size; the buffer itself is written by the group-commit leader (see
+ * _commit). The checkpointer is woken once the log crosses its thresholds.
+ * Without WAL the image of the affected collection is marked dirty and
+ * rewritten once per commit batch.
+ *
+ * @param[in] op   Record operation name ("put", "delete" or "drop").
+ * @param[in] coll Affected collection name.
+ * @param[in] doc  Document post-image for "put".
+ * @param[in] id   Document `_id` for "delete".
+ * @return The log sequence number to pass to _commit() once the lock is released.
+ * @note Must be called within a locked mutex context.
+ */
+static uint64_t _record(const char *op, const char *coll, cJSON *doc, const char *id)
+{
+    uint64_t lsn = ++g_appended_lsn;
+    if (coll)
+        _mark_dirty(coll, lsn);
+
+    if (g_wal_fp) {
+        if (!_wal_append(op, coll, doc, id)) {
+            _checkpoint();
+        } else if (g_wal_buf_len >= WAL_BUFFER_BYTES) {
+            /* Bound the memory held by DB_DURABILITY_NONE writers */
+            _flush_pending(false);
+        }
+        if ((g_ckpt_max_bytes > 0 && g_wal_bytes >= g_ckpt_max_bytes) ||
+            (g_ckpt_max_ops > 0 && g_wal_ops >= g_ckpt_max_ops))
+            pthread_cond_signal(&g_ckpt_cond);
+    } else {
+        g_dirty = true;
+    }
+    return lsn;
+}
+
+/**
+ * @brief Counts one write towards the automatic snapshots.
+ *
+ * Triggers a snapshot every 5 writes unless in test mode.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _snapshot_tick(void)
+{
+    if (!g_test_mode) {
+        g_op_counter++;
+        if (g_op_counter >= 5) {
+            /* Skip rounds while the previous automatic snapshot is still being written */
+            const snapshot_job_t *job = _snapshot_job(g_snap_auto_id);
+            if (!job || job->state != DB_SNAPSHOT_RUNNING)
+                g_snap_auto_id = _snapshot_fork();
+            g_op_counter = 0;
+        }
+    }
+}
+
+/**
+ * @brief Records a mutation for the commit pipeline and runs write-triggered maintenance.
+ *
+ * See _record() and _snapshot_tick().
+ *
+ * @param[in] op   Record operation name ("put", "delete" or "drop").
+ * @param[in] coll Affected collection name.
+ * @param[in] doc  Document post-image for "put".
+ * @param[in] id   Document `_id` for "delete".
+ * @return The log sequence number to pass to _commit() once the lock is released.
+ * @note This is an internal helper and does not handle its own locking.
+ */
+static uint64_t _persist(const char *op, const char *coll, cJSON *doc, const char *id)
+{
+    uint64_t lsn = _record(op, coll, doc, id);
+    _snapshot_tick();
+    return lsn;
+}
+
+/**
+ * @brief Resolves the durability level that applies to the calling thread.
+ *
+ * @return The per-request override if one is set, otherwise the server default.
+ */
+static db_durability_t _effective_durability(void)
+{
+    if (t_request_durability != DB_DURABILITY_DEFAULT)
+        return t_request_durability;
+
+    pthread_mutex_lock(&g_commit_lock);
+    db_durability_t level = g_durability;
+    pthread_mutex_unlock(&g_commit_lock);
+    return level;
+}
+
+/**
+ * @brief Takes the current commit batch and writes it out.
+ *
+ * The batch is detached from the commit buffer under the engine lock, but the
+ * write and fsync happen with only g_wal_io_lock held, so writers can keep
+ * filling the next batch in the meantime.
+ *
+ * @param[in] sync True to fsync the batch.
+ * @return The highest log sequence number contained in the batch.
+ */
+static uint64_t _commit_batch(bool sync)
+{
+    pthread_mutex_lock(&lock);
+    uint64_t upto = g_appended_lsn;
+
+    if (!g_wal_fp) {
+        /* Without WAL one image rewrite covers the whole batch */
+        if (g_dirty) {
+            g_dirty = !_save_internal(sync);
+        }
+        pthread_mutex_unlock(&lock);
+        return upto;
+    }
+
+    char *batch = g_wal_buf;
+    size_t len = g_wal_buf_len;
+    g_wal_buf = NULL;
+    g_wal_buf_len = 0;
+    g_wal_buf_cap = 0;
+
+    pthread_mutex_lock(&g_wal_io_lock);
+    pthread_mutex_unlock(&lock);
+    bool ok = _wal_write(batch, len, sync);
+    pthread_mutex_unlock(&g_wal_io_lock);
+    free(batch);
+
+    if (!ok) {
+        perror("Failed to append to write-ahead log");
+        pthread_mutex_lock(&lock);
+        _checkpoint();
+        pthread_mutex_unlock(&lock);
+    }
+    return upto;
+}
+
+/**
+ * @brief Writes the current batch as the commit leader.
+ *
+ * @param[in] sync True to fsync the batch.
+ * @note Must be called with g_commit_lock held and no leader active; the lock
+ * is released during I/O and held again on return.
+ */
+static void _commit_lead(bool sync)
+{
+    g_commit_leader = true;
+    pthread_mutex_unlock(&g_commit_lock);
+
+    uint64_t upto = _commit_batch(sync);
+
+    pthread_mutex_lock(&g_commit_lock);
+    if (upto > g_flushed_lsn)
+        g_flushed_lsn = upto;
+    if (sync && upto > g_synced_lsn)
+        g_synced_lsn = upto;
+    g_commit_leader = false;
+    pthread_cond_broadcast(&g_commit_cond);
+}
+
+/**
+ * @brief Waits until a mutation is as durable as the caller asked for.
+ *
+ * Implements group commit: the first waiter becomes the leader and writes the
+ * whole pending batch with one flush (and at most one fsync); writers that
+ * arrive while it is busy queue up for the next batch. Throughput under load
+ * therefore scales with the batch size instead of being bounded by one fsync
+ * per write.
+ *
+ * @param[in] lsn Log sequence number returned by _persist(), 0 for none.
+ * @note Must be called without holding the engine lock.
+ */
+static void _commit(uint64_t lsn)
+{
+    if (lsn == 0)
+        return;
+
+    db_durability_t level = _effective_durability();
+    if (level == DB_DURABILITY_NONE)
+        return;
+
+    pthread_mutex_lock(&g_commit_lock);
+    if (level == DB_DURABILITY_FSYNC && lsn > g_sync_wanted_lsn)
+        g_sync_wanted_lsn = lsn;
+
+    while ((level == DB_DURABILITY_FSYNC ? g_synced_lsn : g_flushed_lsn) < lsn) {
+        if (g_commit_leader) {
+            pthread_cond_wait(&g_commit_cond, &g_commit_lock);
+            continue;
+        }
+        /* Become the leader for everything buffered so far */
+        _commit_lead(g_sync_wanted_lsn > g_synced_lsn);
+    }
+    pthread_mutex_unlock(&g_commit_lock);
+}
+
+/**
+ * @brief Moves the live log aside so a checkpoint can cover it.
+ *
+ * After rotation, records up to the current sequence number live in
+ * g_wal_old_path and new records go to a fresh g_wal_path. If a previous
+ * checkpoint failed and left a segment behind, the live log is appended to it.
+ *
+ * @return true if the log was rotated.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _wal_rotate(void)
+{
+    if (!_flush_pending(false))
+        return false;
+
+    pthread_mutex_lock(&g_wal_io_lock);
+    fclose(g_wal_fp);
+    bool ok;
+    if (access(g_wal_old_path, F_OK) == 0) {
+        ok = _copy_file(g_wal_path, g_wal_old_path, true) && remove(g_wal_path) == 0;
+    } else {
+        ok = rename(g_wal_path, g_wal_old_path) == 0;
+    }
+    g_wal_fp = fopen(g_wal_path, "a");
+    g_wal_gen++;
+    pthread_mutex_unlock(&g_wal_io_lock);
+
+    if (!g_wal_fp) {
+        perror("Failed to reopen write-ahead log");
+        return false;
+    }
+    if (ok) {
+        g_wal_bytes = 0;
+        g_wal_ops = 0;
+    }
+    return ok;
+}
+
+/**
+ * @brief Takes a checkpoint without holding the engine lock during I/O.
+ *
+ * Under the lock the log is rotated and private copies of the collections
+ * changed since their last image are taken as the consistent view;
+ * serialization, the writes and the fsyncs then run unlocked, so writers only
+ * wait for the in-memory copy of what changed. The new images are installed
+ * only if no newer checkpoint (e.g. a synchronous one) replaced the files in
+ * the meantime, and the rotated segment they cover is discarded afterwards.
+ *
+ * @note Must be called without holding the engine lock.
+ */
+static void _checkpoint_background(void)
+{
+    pthread_mutex_lock(&lock);
+    if (g_ckpt_running || !g_wal_fp || !root || g_appended_lsn == g_image_lsn ||
+        !_wal_rotate()) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    g_ckpt_running = true;
+    uint64_t covered = g_appended_lsn;
+    storage_format_t format = g_format;
+    cJSON *view = cJSON_CreateObject();
+    for (const cJSON *entry = g_dirty_colls->child; entry; entry = entry->next) {
+        const cJSON *coll = cJSON_GetObjectItemCaseSensitive(root, entry->string);
+        if (coll)
+            cJSON_AddItemToObject(view, entry->string, cJSON_Duplicate(coll, 1));
+    }
+    /* Collections of the covered state whose images must survive pruning */
+    cJSON *live = cJSON_CreateObject();
+    for (const cJSON *coll = root->child; coll; coll = coll->next)
+        cJSON_AddNullToObject(live, coll->string);
+    pthread_mutex_unlock(&lock);
+
+    bool ok = true;
+    for (const cJSON *coll = view->child; ok && coll; coll = coll->next)
+        ok = _write_collection(g_db_dir, coll, format, ".ckpt", true);
+
+    pthread_mutex_lock(&lock);
+    if (ok && covered > g_image_lsn) {
+        for (const cJSON *coll = view->child; ok && coll; coll = coll->next)
+            ok = _install_collection(g_db_dir, coll->string, ".ckpt");
+    } else {
+        ok = false;
+    }
+    if (ok) {
+        _prune_collections(g_db_dir, live);
+        _sync_dir(g_db_dir);
+        _clear_dirty(covered);
+        _checkpoint_done(covered);
+        utils_log("INFO", "Checkpoint written");
+    } else {
+        /* Collections still dirty are rewritten by the next checkpoint */
+        for (const cJSON *coll = view->child; coll; coll = coll->next) {
+            char tmp_path[512];
+            _coll_path(g_db_dir, coll->string, ".ckpt", tmp_path, sizeof(tmp_path));
+            remove(tmp_path);
+        }
+    }
+    g_ckpt_running = false;
+    pthread_mutex_unlock(&lock);
+
+    cJSON_Delete(view);
+    cJSON_Delete(live);
+}
+
+/**
+ * @brief Tells whether the log has crossed a checkpoint threshold.
+ *
+ * @return true if the byte, operation or age threshold is reached.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _checkpoint_due(void)
+{
+    if (!g_wal_fp || g_wal_ops == 0)
+        return false;
+    if (g_ckpt_max_bytes > 0 && g_wal_bytes >= g_ckpt_max_bytes)
+        return true;
+    if (g_ckpt_max_ops > 0 && g_wal_ops >= g_ckpt_max_ops)
+        return true;
+    return g_ckpt_max_secs > 0 && time(NULL) - g_ckpt_last >= g_ckpt_max_secs;
+}
+
+/**
+ * @brief Checkpointer thread entry point.
+ *
+ * Wakes up when a writer signals a crossed threshold and at least once per
+ * second to check the age threshold and to flush records left in the commit
+ * buffer by DB_DURABILITY_NONE writers.
+ *
+ * @param[in] arg Unused.
+ * @return void* Always NULL.
+ */
+static void *_checkpointer_main(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (!g_ckpt_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&g_ckpt_cond, &lock, &deadline);
+        if (g_ckpt_stop)
+            break;
+
+        _snapshot_reap_all(false);
+        bool due = _checkpoint_due();
+        bool backlog = g_wal_buf_len > 0;
+        pthread_mutex_unlock(&lock);
+
+        if (due) {
+            _checkpoint_background();
+        } else if (backlog) {
+            pthread_mutex_lock(&g_commit_lock);
+            if (!g_commit_leader)
+                _commit_lead(false);
+            pthread_mutex_unlock(&g_commit_lock);
+        }
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief Stores a document under its `_id`, replacing any previous version.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] doc       Document to store; ownership is transferred.
+ * @note Must be called within a locked mutex context.
+ */
+static void _apply_put(const char *coll_name, cJSON *doc)
+{
+    collection_t *c = _coll_open(coll_name);
+    cJSON *id = cJSON_GetObjectItem(doc, "_id");
+    if (!c || !cJSON_IsString(id)) {
+        cJSON_Delete(doc);
+        return;
+    }
+
+    cJSON *item = _coll_find(c, id->valuestring);
+    if (item) {
+        _sec_remove(c, item, NULL);
+        cJSON_Delete(cJSON_DetachItemViaPointer(c->docs, item));
+        c->count--;
+    }
+    cJSON_AddItemToArray(c->docs, doc);
+    c->count++;
+
+    _index_set(c, id->valuestring, doc);
+    _sec_add(c, doc);
+}
+
+/**
+ * @brief Removes a document by `_id` if it is present.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] id        Document `_id` value.
+ * @return true if a document was removed.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _apply_delete(const char *coll_name, const char *id)
+{
+    collection_t *c = _coll_get(coll_name);
+    cJSON *item = c ? _coll_find(c, id) : NULL;
+    if (!item)
+        return false;
+
+    /* Safe deletion using detach */
+    _index_unset(c, id);
+    _sec_remove(c, item, NULL);
+    cJSON_Delete(cJSON_DetachItemViaPointer(c->docs, item));
+    c->count--;
+    return true;
+}
+
+/**
+ * @brief Expired documents collected by a TTL scan.
+ */
+typedef struct
+{
+    char *ids[TTL_BATCH];          /**< `_id` of every collected document (owned). */
+    const cJSON *items[TTL_BATCH]; /**< Stored document each `_id` was read from. */
+    size_t count;                  /**< Entries used. */
+    size_t limit;                  /**< Entries wanted. */
+} expire_batch_t;
+
+/**
+ * @brief Collects an expired document (secondary_visit_fn).
+ *
+ * The index range is exact, so documents are not decoded to be checked.
+ * Documents without a string `_id` cannot be deleted and are skipped.
+ *
+ * @param[in] item Stored document or placeholder.
+ * @param[in] key  Unused.
+ * @param[in] arg  The expire_batch_t being filled.
+ * @return false once the batch is full.
+ */
+static bool _expire_visit(cJSON *item, const secondary_key_t *key, void *arg)
+{
+    (void) key;
+    expire_batch_t *batch = arg;
+    size_t len;
+    const char *id = _doc_id(item, &len);
+    char *copy = id ? strndup(id, len) : NULL;
+    if (copy) {
+        batch->ids[batch->count] = copy;
+        batch->items[batch->count] = item;
+        batch->count++;
+    }
+    return batch->count < batch->limit;
+}
+
+/**
+ * @brief Deletes expired documents of one collection, up to a limit.
+ *
+ * Every TTL index of the collection is scanned for keys up to `now - ttl`.
+ * A document expired in two indexes is deleted once.
+ *
+ * @param[in]     name  Collection name.
+ * @param[in]     now   Current time, in seconds since the epoch.
+ * @param[in]     limit Maximum number of documents to delete.
+ * @param[in,out] lsn   Receives the sequence number of the last record written.
+ * @return Number of documents deleted.
+ * @note Must be called within a locked mutex context.
+ */
+static size_t _expire_collection(const char *name, double now, size_t limit, uint64_t *lsn)
+{
+    collection_t *c = _coll_get(name);
+    expire_batch_t batch = {.count = 0, .limit = limit};
+    for (size_t i = 0; c && i < c->sec_count && batch.count < limit; i++) {
+        double ttl = secondary_ttl(c->secs[i]);
+        if (ttl < 0)
+            continue;
+        cJSON *query = cJSON_CreateObject();
+        cJSON *ops = cJSON_AddObjectToObject(query, secondary_field(c->secs[i]));
+        /* Without its bound the scan would visit every document */
+        if (ops && cJSON_AddNumberToObject(ops, "$lte", now - ttl))
+            secondary_scan(c->secs[i], query, false, _expire_visit, &batch);
+        cJSON_Delete(query);
+    }
+
+    size_t deleted = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+        if (_coll_find(c, batch.ids[i]) == batch.items[i] && _apply_delete(name, batch.ids[i])) {
+            *lsn = _record("delete", name, NULL, batch.ids[i]);
+            deleted++;
+        }
+        free(batch.ids[i]);
+    }
+    return deleted;
+}
+
+/**
+ * @brief Deletes every expired document, in batches.
+ *
+ * Each batch deletes up to TTL_BATCH documents in one critical section and
+ * then waits for their records with a single commit, so a large expiry costs
+ * one log write (or one image rewrite without WAL) per batch instead of one
+ * per document. Writers can run between batches.
+ *
+ * @return Number of documents deleted.
+ * @note Must be called without holding the engine lock.
+ */
+static long _expire(void)
+{
+    long total = 0;
+    size_t deleted;
+    do {
+        pthread_mutex_lock(&lock);
+        uint64_t lsn = 0;
+        double now = (double) time(NULL);
+        deleted = 0;
+        for (const cJSON *coll = root ? root->child : NULL; coll && deleted < TTL_BATCH;
+             coll = coll->next)
+            deleted += _expire_collection(coll->string, now, TTL_BATCH - deleted, &lsn);
+        if (deleted > 0)
+            _snapshot_tick();
+        g_ttl_last = time(NULL);
+        pthread_mutex_unlock(&lock);
+
+        _commit(lsn);
+        total += (long) deleted;
+    } while (deleted == TTL_BATCH);
+    return total;
+}
+
+/**
+ * @brief TTL reaper thread entry point.
+ *
+ * Runs _expire() every g_ttl_interval seconds and logs what it deleted.
+ *
+ * @param[in] arg Unused.
+ * @return void* Always NULL.
+ */
+static void *_reaper_main(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (!g_ttl_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += g_ttl_interval > 0 ? g_ttl_interval : 1;
+        pthread_cond_timedwait(&g_ttl_cond, &lock, &deadline);
+        if (g_ttl_stop)
+            break;
+        if (g_ttl_interval <= 0 || time(NULL) - g_ttl_last < g_ttl_interval)
+            continue;
+        pthread_mutex_unlock(&lock);
+
+        long expired = _expire();
+        if (expired > 0) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Expired %ld document(s)", expired);
+            utils_log("INFO", msg);
+        }
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief Re-applies a single WAL record to the in-memory state.
+ *
+ * Every record is idempotent ("put" replaces by `_id`, "delete" ignores
+ * missing documents), so replaying records already folded into the image
+ * converges to the same state.
+ *
+ * @param[in] rec Parsed log record.
+ * @return true if the record was well-formed.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _wal_apply(cJSON *rec)
+{
+    cJSON *op = cJSON_GetObjectItem(rec, "op");
+    cJSON *coll = cJSON_GetObjectItem(rec, "collection");
+    if (!cJSON_IsString(op))
+        return false;
+
+    if (strcmp(op->valuestring, "drop") == 0) {
+        cJSON_Delete(root);
+        root = cJSON_CreateObject();
+        _rebuild_index();
+        return true;
+    }
+    if (!cJSON_IsString(coll))
+        return false;
+
+    if (strcmp(op->valuestring, "put") == 0) {
+        cJSON *doc = cJSON_DetachItemFromObject(rec, "doc");
+        if (!cJSON_IsObject(doc)) {
+            cJSON_Delete(doc);
+            return false;
+        }
+        _apply_put(coll->valuestring, doc);
+        _mark_dirty(coll->valuestring, g_appended_lsn);
+        return true;
+    }
+    if (strcmp(op->valuestring, "delete") == 0) {
+        cJSON *id = cJSON_GetObjectItem(rec, "id");
+        if (!cJSON_IsString(id))
+            return false;
+        if (_apply_delete(coll->valuestring, id->valuestring))
+            _mark_dirty(coll->valuestring, g_appended_lsn);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Replays a write-ahead log segment on top of the loaded base image.
+ *
+ * Stops at the first malformed line, which can only be a record torn by a
+ * crash in the middle of an append.
+ *
+ * @param[in] path Log segment to replay.
+ * @return Number of records applied.
+ * @note Must be called within a locked mutex context.
+ */
+static long _wal_replay(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return 0;
+
+    long applied = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, fp) > 0) {
+        cJSON *rec = cJSON_Parse(line);
+        bool ok = rec && _wal_apply(rec);
+        cJSON_Delete(rec);
+        if (!ok) {
+            utils_log("WARN", "Write-ahead log ends with a torn record; ignoring the tail");
+            break;
+        }
+        applied++;
+    }
+    free(line);
+    fclose(fp);
+    return applied;
+}
+
+/**
+ * @brief Opens the write-ahead log for appending.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _wal_open(void)
+{
+    if (g_wal_fp)
+        return;
+    g_wal_fp = fopen(g_wal_path, "a");
+    g_wal_gen++;
+    if (!g_wal_fp)
+        perror("Failed to open write-ahead log");
+}
+
+/**
+ * @brief Flushes the write-ahead log into the image and closes it.
+ *
+ * @note Must be called within a locked mutex context.
+ */
+static void _wal_close(void)
+{
+    if (!g_wal_fp)
+        return;
+    _flush_pending(false);
+    if (ftell(g_wal_fp) > 0)
+        _checkpoint();
+    pthread_mutex_lock(&g_wal_io_lock);
+    fclose(g_wal_fp);
+    g_wal_fp = NULL;
+    pthread_mutex_unlock(&g_wal_io_lock);
+    free(g_wal_buf);
+    g_wal_buf = NULL;
+    g_wal_buf_len = 0;
+    g_wal_buf_cap = 0;
+}
+
+/**
+ * @brief Maps a whole file read-only.
+ *
+ * @param[in]  path File to map.
+ * @param[out] len  Size of the mapping.
+ * @return The mapping (release with munmap()), or NULL if the file is missing
+ *         or empty.
+ */
+static void *_map_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *len = (size_t) st.st_size;
+    return map;
+}
+
+/**
+ * @brief Records one document span found while scanning a mapped image.
+ *
+ * Documents whose `_id` could be located become placeholders; the rest are
+ * decoded straight away. Matches the storage_span_fn signature.
+ *
+ * @param[in] ctx Root object being built.
+ * @return false if a document could not be stored.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _lazy_add(void *ctx, const char *collection, storage_format_t format,
+                      const uint8_t *doc, size_t len, const uint8_t *id, size_t id_len)
+{
+    cJSON *loaded = ctx;
+    cJSON *coll = cJSON_GetObjectItemCaseSensitive(loaded, collection);
+    if (!coll) {
+        coll = cJSON_CreateArray();
+        cJSON_AddItemToObject(loaded, collection, coll);
+    }
+    if (!doc)
+        return true;
+
+    if (!id || g_lazy_count >= INT_MAX) {
+        cJSON *item = storage_materialize(doc, len, format);
+        return item && cJSON_AddItemToArray(coll, item);
+    }
+
+    if (g_lazy_count == g_lazy_cap) {
+        size_t cap = g_lazy_cap ? g_lazy_cap * 2 : 1024;
+        lazy_doc_t *grown = realloc(g_lazy, cap * sizeof(*grown));
+        if (!grown)
+            return false;
+        g_lazy = grown;
+        g_lazy_cap = cap;
+    }
+
+    cJSON *placeholder = cJSON_CreateNull();
+    if (!placeholder)
+        return false;
+    placeholder->type = cJSON_Raw;
+    placeholder->valueint = (int) g_lazy_count;
+    g_lazy[g_lazy_count++] = (lazy_doc_t) {doc, len, id, id_len, format};
+    return cJSON_AddItemToArray(coll, placeholder);
+}
+
+/**
+ * @brief Maps an image and loads it with lazily decoded documents.
+ *
+ * Only document boundaries and `_id` locations are recorded; a document is
+ * decoded the first time it is read or modified. The mapping stays in place
+ * until db_cleanup(), even after checkpoints have replaced the file.
+ *
+ * @param[in] path Image file to map.
+ * @return The root object, or NULL if the file is missing, empty or malformed
+ *         (the caller then falls back to a regular load).
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_lazy_open(const char *path)
+{
+    size_t len;
+    void *map = _map_file(path, &len);
+    if (!map)
+        return NULL;
+
+    cJSON *loaded = cJSON_CreateObject();
+    size_t first = g_lazy_count;
+    if (!loaded || !storage_scan(map, len, _lazy_add, loaded)) {
+        utils_log("WARN", "Cannot map the storage file lazily; loading it eagerly");
+        cJSON_Delete(loaded);
+        munmap(map, len);
+        g_lazy_count = first;
+        return NULL;
+    }
+
+    mapping_t *grown = realloc(g_maps, (g_map_count + 1) * sizeof(*grown));
+    if (!grown) {
+        /* Placeholders now point into the mapping: it cannot be released */
+        utils_log("ERROR", "Failed to track a storage file mapping");
+        return loaded;
+    }
+    g_maps = grown;
+    g_maps[g_map_count++] = (mapping_t) {map, len};
+    return loaded;
+}
+
+/**
+ * @brief Maps an image and decodes its documents on a worker pool.
+ *
+ * @param[in] path    Image file to load.
+ * @param[in] threads Number of decoding threads.
+ * @return The root object, or NULL if the file is missing, empty or cannot be
+ *         split into documents (the caller then falls back to a regular load).
+ */
+static cJSON *_parallel_open(const char *path, int threads)
+{
+    size_t len;
+    void *map = _map_file(path, &len);
+    if (!map)
+        return NULL;
+
+    cJSON *loaded = storage_load(map, len, threads);
+    munmap(map, len);
+    return loaded;
+}
+
+/**
+ * @brief Releases the mapping and span table of a lazily loaded image.
+ *
+ * @note Only safe once no placeholder is referenced anymore.
+ */
+static void _lazy_close(void)
+{
+    for (size_t i = 0; i < g_map_count; i++)
+        munmap(g_maps[i].addr, g_maps[i].len);
+    free(g_maps);
+    g_maps = NULL;
+    g_map_count = 0;
+    free(g_lazy);
+    g_lazy = NULL;
+    g_lazy_count = 0;
+    g_lazy_cap = 0;
+}
+
+/**
+ * @brief Loads one image file with the configured loader.
+ *
+ * @param[in] path    JSON or binary image, detected from the file contents.
+ * @param[in] threads Loader threads for eager loads.
+ * @return The root object of the image, or NULL if it is missing or malformed.
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_load_image(const char *path, int threads)
+{
+    cJSON *loaded = NULL;
+    if (g_lazy_load)
+        loaded = _lazy_open(path);
+    else if (threads > 1)
+        loaded = _parallel_open(path, threads);
+
+    FILE *fp = loaded ? NULL : fopen(path, "rb");
+    if (fp) {
+        loaded = storage_read(fp);
+        fclose(fp);
+    }
+    return loaded;
+}
+
+/**
+ * @brief Discovers and loads every collection image of the database directory.
+ *
+ * Leftovers of interrupted writes are removed. Collections are loaded in
+ * name order so the in-memory layout does not depend on the file system.
+ *
+ * @param[in] threads Loader threads for eager loads.
+ * @return The root object, or NULL if the directory does not exist.
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_load_dir(int threads)
+{
+    struct dirent **ents;
+    int n = scandir(g_db_dir, &ents, NULL, alphasort);
+    if (n < 0)
+        return NULL;
+
+    cJSON *loaded = cJSON_CreateObject();
+    for (int i = 0; i < n; i++) {
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", g_db_dir, ents[i]->d_name);
+        if (strstr(ents[i]->d_name, COLL_FILE_EXT ".") && !_is_index_file(ents[i]->d_name)) {
+            remove(path);
+        } else if (_is_coll_file(ents[i]->d_name)) {
+            cJSON *part = _load_image(path, threads);
+            if (!part) {
+                char msg[700];
+                snprintf(msg, sizeof(msg), "Skipping unreadable collection file: %s", path);
+                utils_log("ERROR", msg);
+            }
+
+            /* Move the collections over; they keep their keys */
+            cJSON *coll = part ? part->child : NULL;
+            while (coll) {
+                cJSON *next = coll->next;
+                cJSON_DetachItemViaPointer(part, coll);
+                cJSON_AddItemToArray(loaded, coll);
+                coll = next;
+            }
+            cJSON_Delete(part);
+        }
+        free(ents[i]);
+    }
+    free(ents);
+    return loaded;
+}
+
+/**
+ * @brief Initializes the database engine and loads existing data.
+ *
+ * @param[in] filepath Database path; images live in `<filepath>.d/`.
+ */
+void db_init(const char *filepath)
+{
+    pthread_mutex_lock(&lock);
+    srand((unsigned int) time(NULL));
+
+    strncpy(g_db_path, filepath, sizeof(g_db_path) - 1);
+    snprintf(g_wal_path, sizeof(g_wal_path), "%s.wal", g_db_path);
+    snprintf(g_wal_old_path, sizeof(g_wal_old_path), "%s.old", g_wal_path);
+    snprintf(g_db_dir, sizeof(g_db_dir), "%s.d", g_db_path);
+    g_dirty_colls = cJSON_CreateObject();
+    g_snap_dir[0] = '\0';
+
+    /* One image per collection, JSON or binary, detected from the file contents */
+    int threads = g_load_threads > 0 ? g_load_threads : utils_cpu_count();
+    root = _load_dir(threads);
+
+    /* Single-file image of earlier versions: split it up at the end of startup */
+    bool migrate = false;
+    if (!root) {
+        root = _load_image(g_db_path, threads);
+        migrate = root != NULL;
+    }
+
+    if (mkdir(g_db_dir, 0755) != 0 && errno != EEXIST)
+        perror("Failed to create database directory");
+
+    if (!root) {
+        root = cJSON_CreateObject();
+        utils_log("INFO", "Initialized new database instance");
+    }
+
+    /* Build index for the first time */
+    _rebuild_index();
+
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Storage loaded and indexed from: %s", g_db_path);
+    utils_log("INFO", msg);
+
+    /* Indexes saved against the images, then the mutations logged after them */
+    _catalog_load();
+    long replayed = _wal_replay(g_wal_old_path) + _wal_replay(g_wal_path);
+    if (replayed > 0) {
+        snprintf(msg, sizeof(msg), "Replayed %ld write-ahead log record(s)", replayed);
+        utils_log("INFO", msg);
+    }
+    _catalog_build();
+    if (migrate)
+        _mark_all_dirty();
+    if ((replayed > 0 || migrate) && _checkpoint() && migrate) {
+        remove(g_db_path);
+        utils_log("INFO", "Converted the storage file to one image per collection");
+    }
+    g_ckpt_last = time(NULL);
+
+    if (g_wal_mode)
+        _wal_open();
+
+    g_ckpt_stop = false;
+    g_ckpt_started = pthread_create(&g_ckpt_thread, NULL, _checkpointer_main, NULL) == 0;
+    g_ttl_last = time(NULL);
+    g_ttl_stop = false;
+    g_ttl_started = pthread_create(&g_ttl_thread, NULL, _reaper_main, NULL) == 0;
+
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Shuts down the database engine.
+ */
+void db_cleanup(void)
+{
+    pthread_mutex_lock(&lock);
+    bool started = g_ckpt_started;
+    bool reaping = g_ttl_started;
+    g_ckpt_stop = true;
+    g_ckpt_started = false;
+    g_ttl_stop = true;
+    g_ttl_started = false;
+    pthread_cond_signal(&g_ckpt_cond);
+    pthread_cond_signal(&g_ttl_cond);
+    pthread_mutex_unlock(&lock);
+    if (started)
+        pthread_join(g_ckpt_thread, NULL);
+    if (reaping)
+        pthread_join(g_ttl_thread, NULL);
+
+    pthread_mutex_lock(&lock);
+    _snapshot_reap_all(true);
+    _wal_close();
+    _flush_pending(true);
+    _index_files_save();
+    if (root) {
+        cJSON_Delete(root);
+        root = NULL;
+    }
+    index_free(g_colls, _coll_free);
+    g_colls = NULL;
+    cJSON_Delete(g_index_defs);
+    g_index_defs = NULL;
+    cJSON_Delete(g_dirty_colls);
+    g_dirty_colls = NULL;
+    _lazy_close();
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Deletes every file belonging to a database.
+ *
+ * @param[in] filepath Path the database was opened with.
+ */
+void db_destroy(const char *filepath)
+{
+    char path[300];
+    remove(filepath);
+    snprintf(path, sizeof(path), "%s.wal", filepath);
+    remove(path);
+    snprintf(path, sizeof(path), "%s.wal.old", filepath);
+    remove(path);
+    snprintf(path, sizeof(path), "%s.d", filepath);
+    _remove_tree(path);
+}
+
+/**
+ * @brief Enables or disables testing mode.
+ *
+ * @param[in] enable True to suppress snapshots, false for normal operation.
+ */
+void db_set_test_mode(bool enable)
+{
+    pthread_mutex_lock(&lock);
+    g_test_mode = enable;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Enables or disables write-ahead logging.
+ *
+ * @param[in] enable True to append mutations to the log, false to rewrite the image.
+ */
+void db_set_wal_mode(bool enable)
+{
+    pthread_mutex_lock(&lock);
+    g_wal_mode = enable;
+    /* Only touch the file system once db_init() has resolved the paths */
+    if (root) {
+        if (enable)
+            _wal_open();
+        else
+            _wal_close();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Sets the server-wide durability level for write operations.
+ *
+ * @param[in] level Level applied to writes without a per-request override.
+ */
+void db_set_durability(db_durability_t level)
+{
+    if (level == DB_DURABILITY_DEFAULT)
+        return;
+    pthread_mutex_lock(&g_commit_lock);
+    g_durability = level;
+    pthread_mutex_unlock(&g_commit_lock);
+}
+
+/**
+ * @brief Overrides the durability level for writes issued by the calling thread.
+ *
+ * @param[in] level Level to apply, or DB_DURABILITY_DEFAULT to clear the override.
+ */
+void db_set_request_durability(db_durability_t level)
+{
+    t_request_durability = level;
+}
+
+/**
+ * @brief Tells why the last write of the calling thread failed.
+ *
+ * @return The reason, or DB_ERROR_NONE after a successful write.
+ */
+db_error_t db_last_error(void)
+{
+    return t_last_error;
+}
+
+/**
+ * @brief Enables or disables lazy loading of the storage file.
+ *
+ * @param[in] enable True to map the file and decode documents on first access.
+ */
+void db_set_lazy_load(bool enable)
+{
+    pthread_mutex_lock(&lock);
+    g_lazy_load = enable;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Sets the number of threads used to load the image and build the index.
+ *
+ * @param[in] threads Worker count, or 0 for one per online CPU.
+ */
+void db_set_load_threads(int threads)
+{
+    pthread_mutex_lock(&lock);
+    g_load_threads = threads > 0 ? threads : 0;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Selects the format used for the storage file from now on.
+ *
+ * @param[in] format Storage format for subsequent image writes.
+ */
+void db_set_storage_format(storage_format_t format)
+{
+    pthread_mutex_lock(&lock);
+    g_format = format;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Writes a consistent copy of the database to a file.
+ *
+ * @param[in] path   Destination file path.
+ * @param[in] format Format of the exported file.
+ * @return true if the export file was written completely.
+ */
+bool db_export(const char *path, storage_format_t format)
+{
+    /* Serialize a private copy so writers are not held up by the export */
+    pthread_mutex_lock(&lock);
+    cJSON *view = cJSON_Duplicate(root, 1);
+    pthread_mutex_unlock(&lock);
+
+    bool ok = view && _write_image(view, path, format, false);
+    cJSON_Delete(view);
+    return ok;
+}
+
+/**
+ * @brief Replaces the database contents with those of an exported file.
+ *
+ * @param[in] path JSON or binary file to load.
+ * @return true if the file was loaded and persisted.
+ */
+bool db_import(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+    cJSON *loaded = storage_read(fp);
+    fclose(fp);
+    if (!cJSON_IsObject(loaded)) {
+        cJSON_Delete(loaded);
+        return false;
+    }
+
+    pthread_mutex_lock(&lock);
+    cJSON_Delete(root);
+    root = loaded;
+    _rebuild_index();
+    g_appended_lsn++;
+    _mark_all_dirty();
+    /* Not expressible as log records: persist as a new image straight away */
+    _checkpoint();
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+/**
+ * @brief Configures when the background checkpointer folds the log into the image.
+ *
+ * @param[in] log_bytes Log size threshold in bytes (0 disables it).
+ * @param[in] ops       Logged operation threshold (0 disables it).
+ * @param[in] seconds   Maximum age of the image in seconds (0 disables it).
+ */
+void db_set_checkpoint_policy(long log_bytes, long ops, int seconds)
+{
+    pthread_mutex_lock(&lock);
+    g_ckpt_max_bytes = log_bytes;
+    g_ckpt_max_ops = ops;
+    g_ckpt_max_secs = seconds;
+    pthread_cond_signal(&g_ckpt_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Takes a checkpoint on the calling thread.
+ *
+ * Uses the same non-blocking procedure as the background checkpointer.
+ */
+void db_checkpoint(void)
+{
+    _checkpoint_background();
+}
+
+/**
+ * @brief Sets how often the TTL reaper runs.
+ *
+ * @param[in] seconds Seconds between passes (0 disables background expiry).
+ */
+void db_set_ttl_interval(int seconds)
+{
+    pthread_mutex_lock(&lock);
+    g_ttl_interval = seconds;
+    pthread_cond_signal(&g_ttl_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Deletes expired documents on the calling thread.
+ *
+ * Uses the same batched procedure as the background reaper.
+ *
+ * @return Number of documents deleted.
+ */
+long db_expire(void)
+{
+    return _expire();
+}
+
+/**
+ * @brief Forces an immediate snapshot of the current database state.
+ * * Manually triggers the creation of a restore point.
+ */
+void db_force_snapshot(void)
+{
+    long id = db_snapshot_start();
+    while (id > 0 && db_snapshot_status(id, NULL, 0) == DB_SNAPSHOT_RUNNING)
+        usleep(10000);
+}
+
+/**
+ * @brief Starts a snapshot written by a forked process.
+ *
+ * @return The snapshot id to poll, or -1 on failure.
+ */
+long db_snapshot_start(void)
+{
+    pthread_mutex_lock(&lock);
+    long id = root ? _snapshot_fork() : -1;
+    pthread_mutex_unlock(&lock);
+    return id;
+}
+
+/**
+ * @brief Reports the state of a snapshot started by db_snapshot_start().
+ *
+ * @param[in]  id   Snapshot id.
+ * @param[out] path Receives the snapshot directory (may be NULL).
+ * @param[in]  size Size of @p path.
+ * @return The snapshot state.
+ */
+db_snapshot_state_t db_snapshot_status(long id, char *path, size_t size)
+{
+    pthread_mutex_lock(&lock);
+    const snapshot_job_t *job = _snapshot_job(id);
+    db_snapshot_state_t state = job ? job->state : DB_SNAPSHOT_UNKNOWN;
+    if (job && path && size > 0)
+        snprintf(path, size, "%s", job->path);
+    pthread_mutex_unlock(&lock);
+    return state;
+}
+
+/**
+ * @brief Takes a snapshot and reports where it was written.
+ *
+ * @param[out] path Receives the snapshot directory (may be NULL).
+ * @param[in]  size Size of @p path.
+ * @return true if the snapshot was written.
+ */
+bool db_snapshot(char *path, size_t size)
+{
+    pthread_mutex_lock(&lock);
+    bool ok = _create_snapshot();
+    if (ok && path && size > 0)
+        snprintf(path, size, "%s", g_snap_dir);
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+/**
+ * @brief Rebuilds a database from a snapshot and the snapshots it extends.
+ *
+ * @param[in] snapshot Snapshot directory.
+ * @param[in] filepath Path of the database to create.
+ * @return true if the database files were written.
+ */
+bool db_restore_snapshot(const char *snapshot, const char *filepath)
+{
+    /* Collect the chain, newest first */
+    char(*chain)[600] = NULL;
+    size_t count = 0, cap = 0;
+    char cur[600];
+    snprintf(cur, sizeof(cur), "%s", snapshot);
+    bool ok = true;
+    while (ok && cur[0]) {
+        cJSON *manifest = _read_manifest(cur);
+        if (!manifest || count >= SNAPSHOT_CHAIN_MAX) {
+            char msg[700];
+            snprintf(msg, sizeof(msg), "Cannot read snapshot: %s", cur);
+            utils_log("ERROR", msg);
+            cJSON_Delete(manifest);
+            ok = false;
+            break;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            char(*grown)[600] = realloc(chain, cap * sizeof(*chain));
+            if (!grown) {
+                cJSON_Delete(manifest);
+                ok = false;
+                break;
+            }
+            chain = grown;
+        }
+        memcpy(chain[count++], cur, sizeof(cur));
+
+        const cJSON *parent = cJSON_GetObjectItem(manifest, "parent");
+        if (cJSON_IsString(parent))
+            _snapshot_path(chain[count - 1], parent->valuestring, cur, sizeof(cur));
+        else
+            cur[0] = '\0';
+        cJSON_Delete(manifest);
+    }
+
+    char dir[300], wal[300];
+    snprintf(dir, sizeof(dir), "%s.d", filepath);
+    snprintf(wal, sizeof(wal), "%s.wal", filepath);
+    if (ok && access(dir, F_OK) == 0) {
+        utils_log("ERROR", "Restore target already exists");
+        ok = false;
+    }
+    if (ok && (mkdir(dir, 0755) != 0 || !_link_images(chain[0], dir))) {
+        perror("Failed to restore collection files");
+        ok = false;
+    }
+
+    /* The logs of the chain, oldest first, replay to the snapshot's state */
+    if (ok)
+        remove(wal);
+    for (size_t i = count; ok && i-- > 0;) {
+        char log_path[700];
+        snprintf(log_path, sizeof(log_path), "%s/%s", chain[i], SNAPSHOT_LOG);
+        if (access(log_path, F_OK) == 0 && !_copy_file(log_path, wal, true)) {
+            perror("Failed to restore write-ahead log");
+            ok = false;
+        }
+    }
+    free(chain);
+
+    if (ok) {
+        char msg[700];
+        snprintf(msg, sizeof(msg), "Snapshot %s restored to %s", snapshot, filepath);
+        utils_log("INFO", msg);
+    }
+    return ok;
+}
+
+/**
+ * @brief Removes all collections and stored data.
+ */
+void db_drop_all(void)
+{
+    pthread_mutex_lock(&lock);
+    if (root)
+        cJSON_Delete(root);
+
+    root = cJSON_CreateObject();
+    cJSON_Delete(g_index_defs);
+    g_index_defs = cJSON_CreateObject();
+    _rebuild_index();
+    _catalog_write();
+    uint64_t lsn = _persist("drop", NULL, NULL, NULL);
+    pthread_mutex_unlock(&lock);
+    _commit(lsn);
+}
+
+/**
+ * @brief Stores a copy of a new document and logs it.
+ *
+ * @param[in]  coll_name Target collection name.
+ * @param[in]  data      Document; an `_id` is added to it if it has none.
+ * @param[in]  id        `_id` to add if @p data has none (NULL to generate one).
+ * @param[out] lsn       Sequence number of the logged record.
+ * @return false if the collection already holds a document with that `_id`
+ *         or with the same key in a unique index.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _insert(const char *coll_name, cJSON *data, const char *id, uint64_t *lsn)
+{
+    /* Ensure ID exists */
+    if (!cJSON_HasObjectItem(data, "_id")) {
+        char *uuid = id ? NULL : utils_gen_uuid();
+        cJSON_AddStringToObject(data, "_id", id ? id : uuid);
+        free(uuid);
+    }
+
+    /* `_id` values are unique within a collection */
+    cJSON *data_id = cJSON_GetObjectItem(data, "_id");
+    collection_t *c = _coll_get(coll_name);
+    if (c && cJSON_IsString(data_id) && _coll_find(c, data_id->valuestring))
+        return _fail(DB_ERROR_DUPLICATE_ID);
+    if (c && _sec_conflict(c, data, NULL))
+        return _fail(DB_ERROR_DUPLICATE_KEY);
+
+    c = _coll_open(coll_name);
+    if (!c)
+        return false;
+
+    /* Store DEEP COPY in collection to own the memory */
+    cJSON *stored = cJSON_Duplicate(data, 1);
+    if (!stored)
+        return false;
+    cJSON_AddItemToArray(c->docs, stored);
+    c->count++;
+
+    /* Index the stored document itself */
+    cJSON *stored_id = cJSON_GetObjectItem(stored, "_id");
+    if (cJSON_IsString(stored_id))
+        _index_set(c, stored_id->valuestring, stored);
+    _sec_add(c, stored);
+
+    *lsn = _persist("put", coll_name, stored, NULL);
+    return true;
+}
+
+/**
+ * @brief Merges fields into a stored document and logs the new version.
+ *
+ * @param[in]  coll_name Target collection name.
+ * @param[in]  id        Document `_id` value (Immutable).
+ * @param[in]  data      JSON object containing fields to merge.
+ * @param[out] lsn       Sequence number of the logged record.
+ * @return false if the document was not found or the new version would
+ *         share its key in a unique index with another document.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _update(const char *coll_name, const char *id, cJSON *data, uint64_t *lsn)
+{
+    collection_t *c = _coll_get(coll_name);
+    cJSON *existing_doc = c ? _coll_find(c, id) : NULL;
+    if (!existing_doc)
+        return _fail(DB_ERROR_NOT_FOUND);
+
+    /* 1. Create a Deep Copy of the existing document (Memory Isolation) */
+    cJSON *new_doc = _copy_doc(existing_doc);
+    if (!new_doc)
+        return false;
+
+    /* 2. Selective Merge on the Copy */
+    cJSON *field = data->child;
+    while (field) {
+        if (field->string && strcmp(field->string, "_id") != 0) {
+            cJSON *dup_field = cJSON_Duplicate(field, 1);
+            if (cJSON_HasObjectItem(new_doc, field->string)) {
+                cJSON_ReplaceItemInObject(new_doc, field->string, dup_field);
+            } else {
+                cJSON_AddItemToObject(new_doc, field->string, dup_field);
+            }
+        }
+        field = field->next;
+    }
+
+    /* The document may keep its own key, but not take another one's */
+    if (_sec_conflict(c, new_doc, existing_doc)) {
+        cJSON_Delete(new_doc);
+        return _fail(DB_ERROR_DUPLICATE_KEY);
+    }
+    _sec_remove(c, existing_doc, NULL);
+
+    /* 3. Safe Swap Strategy: Detach old node, Append new node.
+     * This prevents corruption of 'next/prev' pointers in the middle of the list. */
+    cJSON_DetachItemViaPointer(c->docs, existing_doc);
+    cJSON_Delete(existing_doc); /* Free old memory */
+
+    cJSON_AddItemToArray(c->docs, new_doc); /* Append updated version to end */
+
+    /* 4. Sync Indexes */
+    _index_set(c, id, new_doc);
+    _sec_add(c, new_doc);
+
+    *lsn = _persist("put", coll_name, new_doc, NULL);
+    return true;
+}
+
+/**
+ * @brief Inserts a document into a collection.
+ * * @note CRITICAL STABILITY FIX: This function now creates a DEEP COPY
+ * of the input data before storing it. This prevents double-free corruption
+ * when the server network layer frees the request payload.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] data      JSON object representing the document.
+ * @return true on success, false if input data is NULL or the `_id` is taken.
+ */
+bool db_insert(const char *coll_name, cJSON *data)
+{
+    t_last_error = DB_ERROR_NONE;
+    if (!data)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    uint64_t lsn = 0;
+    bool ok = _insert(coll_name, data, NULL, &lsn);
+    pthread_mutex_unlock(&lock);
+    _commit(lsn);
+    return ok;
+}
+
+/**
+ * @brief A document found by db_find_ex(), with its sort key.
+ */
+typedef struct
+{
+    cJSON *doc;        /**< Stored document, or a view built from an index key. */
+    const cJSON *key;  /**< Value of the sort field (NULL if missing). */
+    size_t pos;        /**< Position in visit order, to keep the sort stable. */
+    bool owned;        /**< doc is a view owned by the hit. */
+    bool descending;   /**< Sort direction. */
+} find_hit_t;
+
+/**
+ * @brief Fields a find returns or leaves out, parsed once per call.
+ */
+typedef struct
+{
+    query_path_t **paths; /**< Named fields, minus those within another one. */
+    size_t count;         /**< Entries used in paths. */
+    bool exclude;         /**< paths are left out of whole documents instead of returned. */
+} find_projection_t;
+
+/**
+ * @brief State of one db_find_ex() call, shared with _find_visit().
+ */
+typedef struct
+{
+    collection_t *c;                /**< Collection being read. */
+    const query_program_t *program; /**< Compiled query filter. */
+    secondary_t *sec;               /**< Index being scanned (NULL for a collection scan). */
+    bool covered;                   /**< Answer from the index keys when they hold every field. */
+    bool want_id;                   /**< Covered views need the `_id`. */
+    find_hit_t *hits;               /**< Matching documents, in visit order. */
+    size_t count;                   /**< Entries used in hits. */
+    size_t cap;                     /**< Entries allocated in hits. */
+    size_t stop;                    /**< Stop visiting after this many matches (0 for never). */
+    size_t examined;                /**< Candidates checked against the query. */
+    bool failed;                    /**< An allocation failed. */
+} find_ctx_t;
+
+/**
+ * @brief Builds a view of a document from an index key and its `_id`.
+ *
+ * @param[in] ctx  The find state.
+ * @param[in] item Stored document or placeholder (only its `_id` is read).
+ * @param[in] key  Key the document is indexed under.
+ * @return The view (caller frees), or NULL if the key does not hold every
+ *         field or memory ran out.
+ * @note Must be called within a locked mutex context.
+ */
+static cJSON *_key_view(const find_ctx_t *ctx, const cJSON *item, const secondary_key_t *key)
+{
+    cJSON *view = cJSON_CreateObject();
+    if (!view || !secondary_key_values(ctx->sec, key, view)) {
+        cJSON_Delete(view);
+        return NULL;
+    }
+    if (ctx->want_id) {
+        size_t len;
+        const char *id = _doc_id(item, &len);
+        char *copy = id ? strndup(id, len) : NULL;
+        cJSON *value = copy ? cJSON_CreateString(copy) : NULL;
+        free(copy);
+        if (!value || !cJSON_AddItemToObject(view, "_id", value)) {
+            cJSON_Delete(value);
+            cJSON_Delete(view);
+            return NULL;
+        }
+    }
+    return view;
+}
+
+/**
+ * @brief Checks one candidate document and records it if it matches.
+ *
+ * Covered finds match a view decoded from the index key, so the document is
+ * neither decoded nor copied; documents whose key does not hold every field
+ * are read instead.
+ *
+ * @param[in] item Stored document or placeholder.
+ * @param[in] key  Index key of the document (NULL for a collection scan).
+ * @param[in] arg  The find_ctx_t of the call.
+ * @return false once enough documents were found.
+ * @note Must be called within a locked mutex context.
+ */
+static bool _find_visit(cJSON *item, const secondary_key_t *key, void *arg)
+{
+    find_ctx_t *ctx = arg;
+    ctx->examined++;
+    cJSON *view = (ctx->covered && key) ? _key_view(ctx, item, key) : NULL;
+    cJSON *doc = view ? view : _materialize(ctx->c, item);
+    if (!doc || !query_run(ctx->program, doc)) {
+        cJSON_Delete(view);
+        return true;
+    }
+
+    if (ctx->count == ctx->cap) {
+        size_t cap = ctx->cap ? ctx->cap * 2 : 16;
+        find_hit_t *hits = realloc(ctx->hits, cap * sizeof(*hits));
+        if (!hits) {
+            cJSON_Delete(view);
+            ctx->failed = true;
+            return false;
+        }
+        ctx->hits = hits;
+        ctx->cap = cap;
+    }
+    ctx->hits[ctx->count].doc = doc;
+    ctx->hits[ctx->count].pos = ctx->count;
+    ctx->hits[ctx->count].owned = view != NULL;
+    ctx->count++;
+    return ctx->stop == 0 || ctx->count < ctx->stop;
+}
+
+/**
+ * @brief Tells whether an index holds every field a find reads.
+ *
+ * @param[in] sec   The index.
+ * @param[in] query Query filter.
+ * @param[in] proj  Fields the find returns.
+ * @param[in] sort  Sort field (may be NULL).
+ * @return true if the query, the returned fields and the sort field only
+ *         name indexed fields (or `_id`, for the returned fields).
+ */
+static bool _find_covered(const secondary_t *sec, const cJSON *query,
+                          const find_projection_t *proj, const char *sort)
+{
+    if (proj->exclude)
+        return false;
+    for (const cJSON *q = query ? query->child : NULL; q; q = q->next) {
+        if (!secondary_covers(sec, q->string))
+            return false;
+    }
+    for (size_t i = 0; i < proj->count; i++) {
+        const char *field = query_path_text(proj->paths[i]);
+        if (strcmp(field, "_id") != 0 && !secondary_covers(sec, field))
+            return false;
+    }
+    return !sort || secondary_covers(sec, sort);
+}
+
+/**
+ * @brief Tells whether a projection member includes its field.
+ *
+ * @param[in] item The member.
+ * @return true for `true` and non-zero numbers.
+ */
+static bool _projection_included(const cJSON *item)
+{
+    return cJSON_IsTrue(item) || (cJSON_IsNumber(item) && item->valuedouble != 0);
+}
+
+/**
+ * @brief Checks a projection for db_find_ex().
+ *
+ * @param[in] projection The projection.
+ * @return true if it is an object of numbers and booleans that does not mix
+ *         included and excluded fields other than `_id`, nor includes array
+ *         elements.
+ */
+bool db_projection_valid(const cJSON *projection)
+{
+    if (!cJSON_IsObject(projection))
+        return false;
+    const cJSON *first = NULL;
+    for (const cJSON *m = projection->child; m; m = m->next) {
+        if (!cJSON_IsBool(m) && !cJSON_IsNumber(m))
+            return false;
+        if (strcmp(m->string, "_id") == 0)
+            continue;
+        if (first && _projection_included(first) != _projection_included(m))
+            return false;
+        if (_projection_included(m) && query_field_positional(m->string))
+            return false;
+        first = first ? first : m;
+    }
+    return true;
+}
+
+/**
+ * @brief Adds a field to a projection.
+ *
+ * @param[in,out] proj  The projection, with room for the path.
+ * @param[in]     field Field path.
+ * @return false on allocation failure.
+ */
+static bool _find_projection_add(find_projection_t *proj, const char *field)
+{
+    if (!(proj->paths[proj->count] = query_path_create(field)))
+        return false;
+    proj->count++;
+    return true;
+}
+
+/**
+ * @brief Checks the `fields` of a find.
+ *
+ * @param[in] fields The requested fields.
+ * @return true if it is an array of field names that do not name array
+ *         elements (see query_path_put()).
+ */
+static bool _find_fields_valid(const cJSON *fields)
+{
+    if (!cJSON_IsArray(fields))
+        return false;
+    for (const cJSON *f = fields->child; f; f = f->next) {
+        if (!cJSON_IsString(f) || query_field_positional(f->valuestring))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parses the fields a find returns or leaves out.
+ *
+ * A projection with included fields returns them and `_id` (unless
+ * excluded); otherwise its excluded fields are left out of whole documents.
+ * Without a projection, `fields` lists the fields to return.
+ *
+ * A field within another named one (`address.city` next to `address`) is
+ * dropped, as is a repeated one, since the other already covers it.
+ *
+ * @param[in]  opts Find options, holding a valid projection or fields.
+ * @param[out] proj Receives the paths (release with _find_projection_free()).
+ * @return false on allocation failure.
+ */
+static bool _find_projection(const db_find_options_t *opts, find_projection_t *proj)
+{
+    const cJSON *list = opts->projection ? opts->projection : opts->fields;
+    size_t n = (size_t) cJSON_GetArraySize(list) + 1;
+    proj->paths = calloc(n, sizeof(*proj->paths));
+    proj->count = 0;
+    proj->exclude = false;
+    if (!proj->paths)
+        return false;
+
+    if (opts->projection) {
+        /* Only `_id` decides the mode when no other field is named: `{}` returns everything */
+        const cJSON *id = cJSON_GetObjectItemCaseSensitive(list, "_id");
+        proj->exclude = !(id && _projection_included(id));
+        for (const cJSON *m = list->child; m; m = m->next) {
+            if (m != id)
+                proj->exclude = !_projection_included(m);
+        }
+        for (const cJSON *m = list->child; m; m = m->next) {
+            bool named = _projection_included(m) != proj->exclude;
+            if (named && !_find_projection_add(proj, m->string))
+                return false;
+        }
+        if (!id && !proj->exclude && !_find_projection_add(proj, "_id"))
+            return false;
+    } else {
+        for (const cJSON *f = list->child; f; f = f->next) {
+            if (!_find_projection_add(proj, f->valuestring))
+                return false;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < proj->count; i++) {
+        const query_path_t *path = proj->paths[i];
+        bool within = false;
+        for (size_t j = 0; !within && j < proj->count; j++) {
+            const query_path_t *outer = proj->paths[j];
+            within = j != i && outer && query_path_within(path, outer) &&
+                     (j < i || !query_path_within(outer, path));
+        }
+        if (within) {
+            query_path_free(proj->paths[i]);
+            proj->paths[i] = NULL;
+        }
+    }
+    for (size_t i = 0; i < proj->count; i++) {
+        if (proj->paths[i])
+            proj->paths[kept++] = proj->paths[i];
+    }
+    proj->count = kept;
+    return true;
+}
+
+/**
+ * @brief Releases the paths of a projection.
+ *
+ * @param[in] proj The projection.
+ */
+static void _find_projection_free(find_projection_t *proj)
+{
+    for (size_t i = 0; i < proj->count; i++)
+        query_path_free(proj->paths[i]);
+    free(proj->paths);
+    proj->paths = NULL;
+    proj->count = 0;
+}
+
+/**
+ * @brief Copies the requested fields of a hit into a result document.
+ *
+ * Views built from index keys give their members away instead of copying them,
+ * or become the result once excluded fields are removed. Nested fields are
+ * returned inside the objects leading to them.
+ *
+ * @param[in,out] hit  The hit (doc is set to NULL when it becomes the result).
+ * @param[in]     proj Requested fields (NULL for the whole document).
+ * @return The result document, or NULL on allocation failure.
+ */
+static cJSON *_find_output(find_hit_t *hit, const find_projection_t *proj)
+{
+    if (!proj)
+        return cJSON_Duplicate(hit->doc, 1);
+    if (proj->exclude && !hit->owned)
+        return query_path_copy_except(hit->doc, proj->paths, proj->count);
+    if (proj->exclude) {
+        for (size_t i = 0; i < proj->count; i++)
+            cJSON_Delete(query_path_detach(proj->paths[i], hit->doc));
+        cJSON *out = hit->doc;
+        hit->doc = NULL;
+        return out;
+    }
+
+    cJSON *out = cJSON_CreateObject();
+    for (size_t i = 0; out && i < proj->count; i++) {
+        cJSON *value = hit->owned ? query_path_detach(proj->paths[i], hit->doc)
+                                  : cJSON_Duplicate(query_path_get(proj->paths[i], hit->doc), 1);
+        if (value && !query_path_put(proj->paths[i], out, value))
+            cJSON_Delete(value);
+    }
+    return out;
+}
+
+/**
+ * @brief Orders find hits by sort key, then by visit order (qsort callback).
+ *
+ * @param[in] a First hit.
+ * @param[in] b Second hit.
+ * @return A negative, zero or positive value.
+ */
+static int _hit_compare(const void *a, const void *b)
+{
+    const find_hit_t *x = a, *y = b;
+    int c = query_compare(x->key, y->key);
+    if (x->descending)
+        c = -c;
+    if (c == 0)
+        c = (x->pos > y->pos) - (x->pos < y->pos);
+    return c;
+}
+
+/**
+ * @brief Intersects the candidates of every bitmap index that narrows a query.
+ *
+ * An `$or` narrows the query too when each of its branches can be answered
+ * from bitmap indexes.
+ *
+ * @param[in]  c     The collection.
+ * @param[in]  query Query filter, flattened by query_flatten().
+ * @return The slots of the candidate documents (caller frees), or NULL if no
+ *         bitmap index can answer or memory ran out.
+ * @note Must be called within a locked mutex context.
+ */
+static bitmap_t *_find_bitmaps(const collection_t *c, const cJSON *query)
+{
+    /* Branches of an `$or` are answered like queries of their own, then merged */
+    bitmap_t *set = NULL;
+    const cJSON *either = cJSON_GetObjectItemCaseSensitive(query, "$or");
+    if (cJSON_IsArray(either) && either->child)
+        set = bitmap_create();
+    for (const cJSON *branch = set ? either->child : NULL; branch; branch = branch->next) {
+        cJSON *plan = cJSON_IsObject(branch) ? query_flatten(branch) : NULL;
+        bitmap_t *part = plan ? _find_bitmaps(c, plan) : NULL;
+        cJSON_Delete(plan);
+        bool merged = part && bitmap_or(set, part);
+        bitmap_free(part);
+        if (!merged) {
+            bitmap_free(set);
+            set = NULL;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < c->sec_count; i++) {
+        size_t estimate;
+        if (!secondary_bitmap(c->secs[i]) ||
+            secondary_match(c->secs[i], query, &estimate) == SECONDARY_UNUSABLE)
+            continue;
+        bitmap_t *part = secondary_select(c->secs[i], query);
+        if (!part) {
+            bitmap_free(set);
+            return NULL;
+        }
+        if (set) {
+            bitmap_and(set, part);
+            bitmap_free(part);
+        } else {
+            set = part;
+        }
+    }
+    return set;
+}
+
+/**
+ * @brief An access path a find can take.
+ */
+typedef struct
+{
+    plan_t plan;      /**< Access path and cost. */
+    secondary_t *sec; /**< Index read (PLAN_INDEX). */
+    bool capped;      /**< The range was counted past the smallest exact count. */
+} find_option_t;
+
+/**
+ * @brief Access paths weighed by one find, with the one it takes.
+ */
+typedef struct
+{
+    find_option_t *options; /**< Weighed paths, in the order they were listed. */
+    size_t count;           /**< Entries used in options. */
+    size_t chosen;          /**< Entry of the cheapest path. */
+    bitmap_t *set;          /**< Candidates of the PLAN_INTERSECT path (owned, may be NULL). */
+    double matches;         /**< Expected matching documents. */
+} find_plan_t;
+
+/**
+ * @brief Documents picked for the statistics of a collection.
+ */
+typedef struct
+{
+    const cJSON *docs[PLANNER_SAMPLE]; /**< Sampled documents (decoded). */
+    cJSON *copies[PLANNER_SAMPLE];     /**< Decoded placeholders to free (NULL otherwise). */
+    size_t count;                      /**< Entries used in docs. */
+} stats_sample_t;
+
+/**
+ * @brief Adds a document of the `_id` index to a sample (index_visit_fn).
+ *
+ * Placeholders are decoded into copies, so a lazily loaded collection stays
+ * as it is.
+ *
+ * @param[in] key   Unused.
+ * @param[in] len   Unused.
+ * @param[in] value Stored document or placeholder.
+ * @param[in] ctx   The stats_sample_t being filled.
+ * @return false once the sample is full.
+ */
+static bool _stats_visit(const char *key, size_t len, void *value, void *ctx)
+{
+    (void) key;
+    (void) len;
+    stats_sample_t *sample = ctx;
+    const cJSON *item = value;
+    cJSON *copy = _lazy_doc(item) ? _lazy_decode(item, NULL) : NULL;
+    if (_lazy_doc(item) && !copy)
+        return true;
+    sample->copies[sample->count] = copy;
+    sample->docs[sample->count++] = copy ? copy : item;
+    return sample->count < PLANNER_SAMPLE;
+}
 
 /**
- * @brief Rebuilds the in-memory index for fast lookups.
+ * @brief Returns the statistics of a collection, sampling it when they are stale.
+ *
+ * The statistics are taken again once the collection has seen a tenth of its
+ * size in changes (at least 100) since the last sample. The sample is the
+ * first documents of the `_id` index: its slots are in hash order, unrelated
+ * to insertion order, so they spread over the collection without walking it.
+ * Single-field indexes then report the exact number of values of their field.
+ *
+ * @param[in] c The collection.
+ * @return The statistics, or NULL on allocation failure.
  * @note Must be called within a locked mutex context.
  */
-static void _rebuild_index(void)
+static const planner_stats_t *_coll_stats(collection_t *c)
 {
-    if (g_index)
-        cJSON_Delete(g_index);
-    g_index = cJSON_CreateObject();
+    size_t stale = c->count / 10 > 100 ? c->count / 10 : 100;
+    if (c->stats && c->changes - c->stats_changes < stale)
+        return c->stats;
+    stats_sample_t *sample = calloc(1, sizeof(*sample));
+    if (!sample || (!c->stats && !(c->stats = planner_stats_create()))) {
+        free(sample);
+        return NULL;
+    }
 
-    /* Safety Check */
-    if (!root)
-        return;
+    index_foreach(c->ids, _stats_visit, sample);
+    bool ok = planner_stats_sample(c->stats, sample->docs, sample->count, c->count);
+    for (size_t i = 0; i < sample->count; i++)
+        cJSON_Delete(sample->copies[i]);
+    free(sample);
 
-    cJSON *coll = root->child;
-    while (coll) {
-        cJSON *doc = coll->child;
-        while (doc) {
-            cJSON *id = cJSON_GetObjectItem(doc, "_id");
-            if (id && id->valuestring) {
-                /* Deep copy to ensure index stability */
-                cJSON_AddItemToObject(g_index, id->valuestring, cJSON_Duplicate(doc, 1));
-            }
-            doc = doc->next;
-        }
-        coll = coll->next;
+    for (size_t i = 0; ok && i < c->sec_count; i++) {
+        const secondary_t *sec = c->secs[i];
+        if (!secondary_text(sec) && cJSON_GetObjectItem(secondary_spec(sec), "field"))
+            ok = planner_stats_set(c->stats, secondary_field(sec), secondary_keys(sec),
+                                   secondary_entries(sec));
+    }
+    c->stats_changes = c->changes;
+    if (!ok) {
+        planner_stats_free(c->stats);
+        c->stats = NULL;
     }
+    return c->stats;
 }
 
 /**
- * @brief Creates a physical copy of the current database file with a timestamp.
- * * Provides a "restore point" by copying the production file to a new
- * timestamped file in the data directory.
- * * @note This is an internal helper called by _save_internal and db_force_snapshot.
+ * @brief Tells whether an index returns documents in the order a find sorts them.
+ *
+ * @param[in] sec  The index.
+ * @param[in] sort Sort field (may be NULL).
+ * @return true if @p sec is an ordered index whose first field is @p sort
+ *         (ignoring case).
  */
-static void _create_snapshot(void)
+static bool _find_on_sort(const secondary_t *sec, const char *sort)
 {
-    char backup_path[512];
-    time_t now = time(NULL);
-    const struct tm *t = localtime(&now);
-
-    /* Generate filename format: data/backup_YYYYMMDD_HHMM.json */
-    snprintf(backup_path, sizeof(backup_path), "data/backup_%04d%02d%02d_%02d%02d.json",
-             t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min);
-
-    FILE *src = fopen(g_db_path, "rb");
-    FILE *dst = fopen(backup_path, "wb");
-
-    if (src && dst) {
-        char buf[8192];
-        size_t n;
-        while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
-            fwrite(buf, 1, n, dst);
-        }
-
-        char log_msg[600];
-        snprintf(log_msg, sizeof(log_msg), "Snapshot created: %s", backup_path);
-        utils_log("INFO", log_msg);
-    }
+    return sort && secondary_ordered(sec) && query_field_equal(secondary_field(sec), sort);
+}
 
-    if (src)
-        fclose(src);
-    if (dst)
-        fclose(dst);
+/**
+ * @brief Appends an access path to a find plan.
+ *
+ * @param[in,out] fp         The plan.
+ * @param[in]     access     How candidates are read.
+ * @param[in]     sec        Index read (PLAN_INDEX), or NULL.
+ * @param[in]     candidates Documents read.
+ * @param[in]     ordered    Candidates come in sort order.
+ */
+static void _find_option(find_plan_t *fp, plan_access_t access, secondary_t *sec,
+                         size_t candidates, bool ordered)
+{
+    fp->options[fp->count++] = (find_option_t) {
+        .plan = {.access = access, .candidates = candidates, .ordered = ordered},
+        .sec = sec,
+    };
 }
 
 /**
- * @brief Persist database state to disk using an atomic write pattern.
+ * @brief Estimates the candidates of an index range counted past its cap.
  *
- * Writes data to a temporary file first and then performs a rename operation.
- * Also triggers a snapshot every 5 successful write operations.
+ * The walk stopped early, so the range holds at least the count it reached,
+ * and about as many documents as the conditions on the indexed fields select.
  *
- * @note This is an internal helper and does not handle its own locking.
+ * @param[in]     c      The collection.
+ * @param[in]     stats  Statistics of the collection (may be NULL).
+ * @param[in]     flat   Query filter, flattened by query_flatten().
+ * @param[in,out] option The range path; candidates is raised to the estimate.
  */
-static void _save_internal(void)
+static void _find_range_size(const collection_t *c, const planner_stats_t *stats,
+                             const cJSON *flat, find_option_t *option)
 {
-    if (!root)
-        return;
-
-    char *str = cJSON_Print(root);
-    if (!str)
-        return;
-
-    char tmp_path[300];
-    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", g_db_path);
-
-    FILE *fp = fopen(tmp_path, "w");
-    if (fp) {
-        fprintf(fp, "%s", str);
-        fflush(fp);
-        fclose(fp);
-
-        /* Atomic swap of temporary file with actual file */
-        if (rename(tmp_path, g_db_path) == 0) {
-            /* Trigger snapshotting logic every 5 operations unless in test mode */
-            if (!g_test_mode) {
-                g_op_counter++;
-                if (g_op_counter >= 5) {
-                    _create_snapshot();
-                    g_op_counter = 0;
-                }
-            }
-        } else {
-            perror("Failed to replace database file");
-        }
-    } else {
-        perror("Failed to write temporary database file");
+    cJSON *conds = cJSON_CreateObject();
+    for (cJSON *q = flat->child; conds && q; q = q->next) {
+        if (secondary_covers(option->sec, q->string))
+            cJSON_AddItemReferenceToObject(conds, q->string, q);
     }
-    free(str);
+    double guess = conds ? planner_selectivity(stats, conds) * (double) c->count : 0;
+    if (guess > (double) option->plan.candidates)
+        option->plan.candidates = (size_t) guess;
+    cJSON_Delete(conds);
 }
 
 /**
- * @brief Initializes the database engine and loads existing data.
+ * @brief Weighs the access paths a find can take and picks the cheapest.
+ *
+ * Equality keys and bitmap intersections are counted exactly. Index ranges
+ * are only counted up to the smallest exact count, since a range holding more
+ * candidates can only win by reading them in sort order and stopping at the
+ * limit; their size is then estimated (see _find_range_size()). An index
+ * the query does not narrow is weighed when it holds every document in sort
+ * order. The sampled statistics, capped by the exact counts, tell how many
+ * documents match, hence how early a limit stops each path (see
+ * planner_cost()). Ties go to the path listed first: equality indexes, then
+ * the intersection, ranges and the scan.
  *
- * @param[in] filepath Path to the JSON storage file.
+ * @param[in]  c        The collection.
+ * @param[in]  query    Query filter.
+ * @param[in]  flat     Query filter, flattened by query_flatten().
+ * @param[in]  opts     Find options (may be NULL).
+ * @param[in]  estimate Estimate the matches even when no limit needs them.
+ * @param[out] fp       Receives the plan (release with _find_plan_free()).
+ * @return false on allocation failure.
+ * @note Must be called within a locked mutex context.
  */
-void db_init(const char *filepath)
+static bool _find_plan(collection_t *c, const cJSON *query, const cJSON *flat,
+                       const db_find_options_t *opts, bool estimate, find_plan_t *fp)
 {
-    pthread_mutex_lock(&lock);
-    srand((unsigned int) time(NULL));
-
-    strncpy(g_db_path, filepath, sizeof(g_db_path) - 1);
+    const char *sort = opts ? opts->sort : NULL;
+    size_t limit = (opts && opts->limit > 0) ? (size_t) opts->limit : 0;
+    memset(fp, 0, sizeof(*fp));
+    fp->options = malloc((c->sec_count + 2) * sizeof(*fp->options));
+    if (!fp->options)
+        return false;
 
-    FILE *fp = fopen(g_db_path, "r");
-    if (fp) {
-        fseek(fp, 0, SEEK_END);
-        long len = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-
-        if (len > 0) {
-            char *data = malloc(len + 1);
-            if (data) {
-                fread(data, 1, len, fp);
-                data[len] = '\0';
-                root = cJSON_Parse(data);
-                free(data);
-            }
-        }
-        fclose(fp);
+    /* Exact counts come first: they bound the matches and the range walks */
+    size_t bound = c->count;
+    for (size_t i = 0; i < c->sec_count; i++) {
+        size_t count;
+        if (secondary_bitmap(c->secs[i]) ||
+            secondary_match(c->secs[i], flat, &count) != SECONDARY_EQUALITY)
+            continue;
+        _find_option(fp, PLAN_INDEX, c->secs[i], count, _find_on_sort(c->secs[i], sort));
+        bound = count < bound ? count : bound;
     }
-
-    if (!root) {
-        root = cJSON_CreateObject();
-        utils_log("INFO", "Initialized new database instance");
+    fp->set = c->slots ? _find_bitmaps(c, flat) : NULL;
+    if (fp->set) {
+        size_t count = bitmap_count(fp->set);
+        _find_option(fp, PLAN_INTERSECT, NULL, count, false);
+        bound = count < bound ? count : bound;
     }
+    for (size_t i = 0; i < c->sec_count; i++) {
+        secondary_t *sec = c->secs[i];
+        size_t count;
+        if (secondary_bitmap(sec))
+            continue;
+        secondary_match_t match = secondary_match(sec, flat, &count);
+        if (match == SECONDARY_RANGE) {
+            count = secondary_count(sec, flat, bound);
+            _find_option(fp, PLAN_INDEX, sec, count, _find_on_sort(sec, sort));
+            fp->options[fp->count - 1].capped = count > bound;
+            bound = count < bound ? count : bound;
+        } else if (match == SECONDARY_UNUSABLE && _find_on_sort(sec, sort) &&
+                   secondary_entries(sec) == c->count) {
+            _find_option(fp, PLAN_INDEX, sec, c->count, true);
+        }
+    }
+    _find_option(fp, PLAN_SCAN, NULL, c->count, false);
 
-    /* Build index for the first time */
-    _rebuild_index();
-
-    char msg[512];
-    snprintf(msg, sizeof(msg), "Storage loaded and indexed from: %s", g_db_path);
-    utils_log("INFO", msg);
-
-    pthread_mutex_unlock(&lock);
-}
-
-/**
- * @brief Shuts down the database engine.
- */
-void db_cleanup(void)
-{
-    pthread_mutex_lock(&lock);
-    if (root) {
-        cJSON_Delete(root);
-        root = NULL;
+    /* Without a limit every path examines all of its candidates */
+    fp->matches = (double) bound;
+    if (limit > 0 || estimate) {
+        const planner_stats_t *stats = _coll_stats(c);
+        double guess = planner_selectivity(stats, query) * (double) c->count;
+        fp->matches = guess < fp->matches ? guess : fp->matches;
+        for (size_t i = 0; i < fp->count; i++) {
+            if (fp->options[i].capped)
+                _find_range_size(c, stats, flat, &fp->options[i]);
+        }
     }
-    if (g_index) {
-        cJSON_Delete(g_index);
-        g_index = NULL;
+    for (size_t i = 0; i < fp->count; i++) {
+        planner_cost(&fp->options[i].plan, fp->matches, limit, sort != NULL);
+        if (fp->options[i].plan.examined < fp->options[fp->chosen].plan.examined)
+            fp->chosen = i;
     }
-    pthread_mutex_unlock(&lock);
+    return true;
 }
 
 /**
- * @brief Enables or disables testing mode.
+ * @brief Releases the access paths of a find plan.
  *
- * @param[in] enable True to suppress snapshots, false for normal operation.
+ * @param[in] fp The plan.
  */
-void db_set_test_mode(bool enable)
+static void _find_plan_free(find_plan_t *fp)
 {
-    pthread_mutex_lock(&lock);
-    g_test_mode = enable;
-    pthread_mutex_unlock(&lock);
+    free(fp->options);
+    bitmap_free(fp->set);
+    memset(fp, 0, sizeof(*fp));
 }
 
 /**
- * @brief Forces an immediate snapshot of the current database state.
- * * Manually triggers the creation of a restore point.
+ * @brief Describes an access path for explain output.
+ *
+ * @param[in] option The path.
+ * @return A new object (caller frees), or NULL on allocation failure.
  */
-void db_force_snapshot(void)
+static cJSON *_explain_option(const find_option_t *option)
 {
-    pthread_mutex_lock(&lock);
-    _create_snapshot();
-    pthread_mutex_unlock(&lock);
+    cJSON *info = cJSON_CreateObject();
+    if (!info)
+        return NULL;
+    cJSON_AddStringToObject(info, "access", planner_access_name(option->plan.access));
+    if (option->plan.access == PLAN_INDEX)
+        cJSON_AddStringToObject(info, "index", secondary_name(option->sec));
+    cJSON_AddBoolToObject(info, "ordered", option->plan.ordered);
+    cJSON_AddNumberToObject(info, "candidates", (double) option->plan.candidates);
+    cJSON_AddNumberToObject(info, "estimatedExamined", option->plan.examined);
+    return info;
 }
 
 /**
- * @brief Removes all collections and stored data.
+ * @brief Fills in how a find ran.
+ *
+ * @param[in] explain  Explain output.
+ * @param[in] examined Documents checked against the query.
+ * @param[in] returned Documents returned.
+ * @param[in] start    When the find started (CLOCK_MONOTONIC).
  */
-void db_drop_all(void)
+static void _explain_finish(cJSON *explain, size_t examined, size_t returned,
+                            const struct timespec *start)
 {
-    pthread_mutex_lock(&lock);
-    if (root)
-        cJSON_Delete(root);
-    if (g_index)
-        cJSON_Delete(g_index);
-
-    root = cJSON_CreateObject();
-    g_index = cJSON_CreateObject();
-    _save_internal();
-    pthread_mutex_unlock(&lock);
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (double) (end.tv_sec - start->tv_sec) * 1e3 +
+                (double) (end.tv_nsec - start->tv_nsec) / 1e6;
+    cJSON_AddNumberToObject(explain, "examined", (double) examined);
+    cJSON_AddNumberToObject(explain, "returned", (double) returned);
+    cJSON_AddNumberToObject(explain, "timeMs", ms);
 }
 
 /**
- * @brief Inserts a document into a collection.
- * * @note CRITICAL STABILITY FIX: This function now creates a DEEP COPY
- * of the input data before storing it. This prevents double-free corruption
- * when the server network layer frees the request payload.
+ * @brief Runs a find, describing how it ran when asked to.
  *
- * @param[in] coll_name Target collection name.
- * @param[in] data      JSON object representing the document.
- * @return true on success, false if input data is NULL.
+ * @param[in]  coll_name Target collection name.
+ * @param[in]  query     JSON object defining query conditions.
+ * @param[in]  opts      Sort order and limit (may be NULL).
+ * @param[out] explain   Receives the plan and its execution (NULL to skip).
+ * @return A new JSON array containing matched documents, or NULL if
+ *         @p explain is given and the collection does not exist.
  */
-bool db_insert(const char *coll_name, cJSON *data)
+static cJSON *_find(const char *coll_name, cJSON *query, const db_find_options_t *opts,
+                    cJSON *explain)
 {
-    if (!data)
-        return false;
-
+    struct timespec start;
     pthread_mutex_lock(&lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    collection_t *c = _coll_get(coll_name);
+    cJSON *result = (c || !explain) ? cJSON_CreateArray() : NULL;
+    if (!c) {
+        pthread_mutex_unlock(&lock);
+        return result;
+    }
+    bool shaped = opts && (opts->projection || opts->fields);
+    if (shaped && !(opts->projection ? db_projection_valid(opts->projection)
+                                     : _find_fields_valid(opts->fields))) {
+        utils_log("ERROR", "Invalid projection");
+        pthread_mutex_unlock(&lock);
+        return result;
+    }
 
-    cJSON *coll = cJSON_GetObjectItem(root, coll_name);
-    if (!coll) {
-        coll = cJSON_CreateArray();
-        cJSON_AddItemToObject(root, coll_name, coll);
+    /* Fast Path: an _id names at most one document, no other path can beat it */
+    cJSON *query_id = cJSON_GetObjectItem(query, "_id");
+    if (query_id && cJSON_IsString(query_id)) {
+        /* Placeholders are decoded into the copy without touching the collection */
+        cJSON *item = _coll_find(c, query_id->valuestring);
+        cJSON *found = item ? _copy_doc(item) : NULL;
+        if (found && query_match(found, query)) {
+            find_projection_t proj;
+            if (shaped) {
+                find_hit_t hit = {.doc = found, .owned = true};
+                found = _find_projection(opts, &proj) ? _find_output(&hit, &proj) : NULL;
+                _find_projection_free(&proj);
+                cJSON_Delete(hit.doc);
+            }
+            cJSON_AddItemToArray(result, found);
+        } else {
+            cJSON_Delete(found);
+        }
+        if (explain) {
+            find_option_t id = {.plan = {.access = PLAN_ID, .candidates = item != NULL}};
+            id.plan.examined = (double) id.plan.candidates;
+            cJSON_AddItemToObject(explain, "plan", _explain_option(&id));
+            _explain_finish(explain, id.plan.candidates, (size_t) cJSON_GetArraySize(result),
+                            &start);
+        }
+        pthread_mutex_unlock(&lock);
+        return result;
     }
 
-    /* Ensure ID exists */
-    if (!cJSON_HasObjectItem(data, "_id")) {
-        char *uuid = utils_gen_uuid();
-        cJSON_AddStringToObject(data, "_id", uuid);
-        free(uuid);
+    /*
+     * Scans compile the query once instead of walking it for every document;
+     * indexes are weighed from the conditions on single fields, `$and` included.
+     */
+    const char *sort = opts ? opts->sort : NULL;
+    bool descending = opts && opts->descending;
+    int limit = opts ? opts->limit : 0;
+    find_projection_t proj = {0};
+    find_plan_t fp = {0};
+    query_program_t *program = query_compile(query);
+    cJSON *plan = program ? query_flatten(query) : NULL;
+    query_path_t *sort_path = (plan && sort) ? query_path_create(sort) : NULL;
+    if (!plan || (sort && !sort_path) || (shaped && !_find_projection(opts, &proj)) ||
+        !_find_plan(c, query, plan, opts, explain != NULL, &fp)) {
+        utils_log("ERROR", "Not enough memory to compile the query");
+        _find_plan_free(&fp);
+        _find_projection_free(&proj);
+        query_path_free(sort_path);
+        cJSON_Delete(plan);
+        query_program_free(program);
+        pthread_mutex_unlock(&lock);
+        return result;
     }
+    const find_option_t *best = &fp.options[fp.chosen];
+    secondary_t *sec = best->plan.access == PLAN_INDEX ? best->sec : NULL;
+    bool ordered = best->plan.ordered;
 
-    /* Update index with a deep copy */
-    cJSON *id = cJSON_GetObjectItem(data, "_id");
-    if (id && id->valuestring) {
-        cJSON_AddItemToObject(g_index, id->valuestring, cJSON_Duplicate(data, 1));
+    /* Results that still need sorting are all collected before the limit applies */
+    find_ctx_t ctx = {.c = c, .program = program, .sec = sec};
+    if (limit > 0 && (!sort || ordered))
+        ctx.stop = (size_t) limit;
+    if (sec && shaped && _find_covered(sec, query, &proj, sort)) {
+        ctx.covered = true;
+        for (size_t i = 0; i < proj.count; i++)
+            ctx.want_id = ctx.want_id || strcmp(query_path_text(proj.paths[i]), "_id") == 0;
     }
 
-    /* Store DEEP COPY in collection to own the memory */
-    cJSON_AddItemToArray(coll, cJSON_Duplicate(data, 1));
+    if (best->plan.access == PLAN_INTERSECT) {
+        /* Bitmap Path: the slots every answering bitmap index selects */
+        secondary_slots_visit(c->slots, fp.set, _find_visit, &ctx);
+    } else if (sec) {
+        /* Index Path: materializing re-points the candidate in place, so the walk stays valid */
+        secondary_scan(sec, plan, descending, _find_visit, &ctx);
+    } else {
+        /* Slow Path: Linear scan */
+        cJSON *item = c->docs->child; /* Manual iteration for safety */
+        while (item) {
+            cJSON *next = item->next;
+            if (!_find_visit(item, NULL, &ctx))
+                break;
+            item = next;
+        }
+    }
+
+    if (sort && !ordered) {
+        for (size_t i = 0; i < ctx.count; i++) {
+            ctx.hits[i].key = query_path_get(sort_path, ctx.hits[i].doc);
+            ctx.hits[i].descending = descending;
+        }
+        /* Without matches the list was never allocated, and qsort() rejects NULL */
+        if (ctx.count > 1)
+            qsort(ctx.hits, ctx.count, sizeof(*ctx.hits), _hit_compare);
+    }
+    size_t n = (limit > 0 && ctx.count > (size_t) limit) ? (size_t) limit : ctx.count;
+    for (size_t i = 0; i < ctx.count; i++) {
+        if (i < n)
+            cJSON_AddItemToArray(result, _find_output(&ctx.hits[i], shaped ? &proj : NULL));
+        if (ctx.hits[i].owned)
+            cJSON_Delete(ctx.hits[i].doc);
+    }
+
+    if (explain) {
+        cJSON *plan_info = _explain_option(best);
+        cJSON_AddBoolToObject(plan_info, "limitPushedDown", ctx.stop != 0);
+        cJSON_AddItemToObject(explain, "plan", plan_info);
+        cJSON *rejected = cJSON_AddArrayToObject(explain, "rejected");
+        for (size_t i = 0; rejected && i < fp.count; i++) {
+            if (i != fp.chosen)
+                cJSON_AddItemToArray(rejected, _explain_option(&fp.options[i]));
+        }
+        cJSON_AddNumberToObject(explain, "estimatedMatches", fp.matches);
+        cJSON *stats = cJSON_AddObjectToObject(explain, "statistics");
+        if (stats) {
+            cJSON_AddNumberToObject(stats, "documents",
+                                    c->stats ? (double) planner_stats_docs(c->stats) : 0);
+            cJSON_AddItemToObject(stats, "fields",
+                                  c->stats ? planner_stats_describe(c->stats, plan)
+                                           : cJSON_CreateObject());
+        }
+        _explain_finish(explain, ctx.examined, n, &start);
+    }
 
-    _save_internal();
+    free(ctx.hits);
+    _find_plan_free(&fp);
+    _find_projection_free(&proj);
+    query_path_free(sort_path);
+    query_program_free(program);
+    cJSON_Delete(plan);
+    if (ctx.failed)
+        utils_log("ERROR", "Not enough memory to collect query results");
     pthread_mutex_unlock(&lock);
-    return true;
+    return result;
+}
+
+/**
+ * @brief Query documents from a collection, optionally sorted.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] query     JSON object defining query conditions.
+ * @param[in] opts      Sort order, limit and projection (NULL for collection order, no
+ *                      limit and whole documents).
+ * @return cJSON* A new JSON array containing matched documents.
+ */
+cJSON *db_find_ex(const char *coll_name, cJSON *query, const db_find_options_t *opts)
+{
+    return _find(coll_name, query, opts, NULL);
+}
+
+/**
+ * @brief Runs a query and describes the plan it took.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] query     JSON object defining query conditions.
+ * @param[in] opts      Sort order and limit (may be NULL).
+ * @return cJSON* A new object describing the plan and its execution, or NULL
+ *         if the collection does not exist.
+ */
+cJSON *db_explain(const char *coll_name, cJSON *query, const db_find_options_t *opts)
+{
+    cJSON *explain = cJSON_CreateObject();
+    if (!explain)
+        return NULL;
+    cJSON *result = _find(coll_name, query, opts, explain);
+    if (!result) {
+        cJSON_Delete(explain);
+        return NULL;
+    }
+    cJSON_Delete(result);
+    return explain;
 }
 
 /**
@@ -293,34 +4348,52 @@ bool db_insert(const char *coll_name, cJSON *data)
  */
 cJSON *db_find(const char *coll_name, cJSON *query, int limit)
 {
-    pthread_mutex_lock(&lock);
-    cJSON *result = cJSON_CreateArray();
+    db_find_options_t opts = {.limit = limit};
+    return db_find_ex(coll_name, query, &opts);
+}
 
-    /* Fast Path: If query is specifically for an _id, use the index */
-    cJSON *query_id = cJSON_GetObjectItem(query, "_id");
-    if (query_id && cJSON_IsString(query_id)) {
-        cJSON *found = cJSON_GetObjectItem(g_index, query_id->valuestring);
-        if (found) {
-            cJSON_AddItemToArray(result, cJSON_Duplicate(found, 1));
-            pthread_mutex_unlock(&lock);
-            return result;
-        }
-    }
+/**
+ * @brief Adds a copy of a ranked document to the results (fulltext_visit_fn).
+ *
+ * @param[in] item  Collection entry (regular document or placeholder).
+ * @param[in] score Relevance score, stored as `_score`.
+ * @param[in] arg   Result array.
+ * @return false to stop on allocation failure.
+ */
+static bool _search_visit(cJSON *item, double score, void *arg)
+{
+    cJSON *doc = _copy_doc(item);
+    if (!doc)
+        return false;
+    cJSON_DeleteItemFromObjectCaseSensitive(doc, "_score");
+    cJSON_AddNumberToObject(doc, "_score", score);
+    cJSON_AddItemToArray(arg, doc);
+    return true;
+}
 
-    /* Slow Path: Linear scan */
-    cJSON *coll = cJSON_GetObjectItem(root, coll_name);
-    if (coll && cJSON_IsArray(coll)) {
-        int count = 0;
-        cJSON *item = coll->child; /* Manual iteration for safety */
-        while (item) {
-            if (limit > 0 && count >= limit)
-                break;
-            if (query_match(item, query)) {
-                cJSON_AddItemToArray(result, cJSON_Duplicate(item, 1));
-                count++;
-            }
-            item = item->next;
-        }
+/**
+ * @brief Ranks documents against a search text through a text index.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] field     Field covered by the text index.
+ * @param[in] text      Search text.
+ * @param[in] limit     Maximum number of documents to return (0 for no limit).
+ * @return A new JSON array, best match first, or NULL if no text index can answer.
+ */
+cJSON *db_search(const char *coll_name, const char *field, const char *text, int limit)
+{
+    pthread_mutex_lock(&lock);
+    collection_t *c = _coll_get(coll_name);
+    secondary_t *sec = NULL;
+    for (size_t i = 0; c && !sec && i < c->sec_count; i++) {
+        if (secondary_text(c->secs[i]) && strcmp(secondary_field(c->secs[i]), field) == 0)
+            sec = c->secs[i];
+    }
+    cJSON *result = sec ? cJSON_CreateArray() : NULL;
+    if (result && !secondary_search(sec, text, limit > 0 ? (size_t) limit : 0, _search_visit,
+                                    result)) {
+        cJSON_Delete(result);
+        result = NULL;
     }
     pthread_mutex_unlock(&lock);
     return result;
@@ -338,72 +4411,24 @@ cJSON *db_find(const char *coll_name, cJSON *query, int limit)
  */
 bool db_update(const char *coll_name, const char *id, cJSON *data)
 {
+    t_last_error = DB_ERROR_NONE;
     if (!data || !id)
         return false;
 
     pthread_mutex_lock(&lock);
-
-    cJSON *coll = cJSON_GetObjectItem(root, coll_name);
-    if (!coll || !cJSON_IsArray(coll)) {
-        pthread_mutex_unlock(&lock);
-        return false;
-    }
-
-    /* Iterate safely through the linked list */
-    cJSON *existing_doc = coll->child;
-    while (existing_doc) {
-        cJSON *itemId = cJSON_GetObjectItem(existing_doc, "_id");
-
-        /* Check ID match */
-        if (itemId && cJSON_IsString(itemId) && strcmp(itemId->valuestring, id) == 0) {
-
-            /* 1. Create a Deep Copy of the existing document (Memory Isolation) */
-            cJSON *new_doc = cJSON_Duplicate(existing_doc, 1);
-            if (!new_doc) {
-                pthread_mutex_unlock(&lock);
-                return false;
-            }
-
-            /* 2. Selective Merge on the Copy */
-            cJSON *field = data->child;
-            while (field) {
-                if (field->string && strcmp(field->string, "_id") != 0) {
-                    cJSON *dup_field = cJSON_Duplicate(field, 1);
-                    if (cJSON_HasObjectItem(new_doc, field->string)) {
-                        cJSON_ReplaceItemInObject(new_doc, field->string, dup_field);
-                    } else {
-                        cJSON_AddItemToObject(new_doc, field->string, dup_field);
-                    }
-                }
-                field = field->next;
-            }
-
-            /* 3. Safe Swap Strategy: Detach old node, Append new node.
-             * This prevents corruption of 'next/prev' pointers in the middle of the list. */
-            cJSON_DetachItemViaPointer(coll, existing_doc);
-            cJSON_Delete(existing_doc); /* Free old memory */
-
-            cJSON_AddItemToArray(coll, new_doc); /* Append updated version to end */
-
-            /* 4. Sync Index */
-            cJSON_DeleteItemFromObject(g_index, id);
-            cJSON_AddItemToObject(g_index, id, cJSON_Duplicate(new_doc, 1));
-
-            _save_internal();
-            pthread_mutex_unlock(&lock);
-            return true;
-        }
-
-        existing_doc = existing_doc->next;
-    }
-
+    uint64_t lsn = 0;
+    bool ok = _update(coll_name, id, data, &lsn);
     pthread_mutex_unlock(&lock);
-    return false;
+    _commit(lsn);
+    return ok;
 }
 
 /**
  * @brief Updates an existing document or inserts it if not found.
  *
+ * Both steps run in one critical section, so concurrent upserts of the same
+ * `_id` cannot both insert.
+ *
  * @param[in] coll_name Target collection name.
  * @param[in] id        Document `_id` value (optional for insert).
  * @param[in] data      JSON object representing the document.
@@ -411,13 +4436,23 @@ bool db_update(const char *coll_name, const char *id, cJSON *data)
  */
 bool db_upsert(const char *coll_name, const char *id, cJSON *data)
 {
-    /* If ID is provided, try updating first */
-    if (id && db_update(coll_name, id, data)) {
-        return true;
-    }
+    t_last_error = DB_ERROR_NONE;
+    if (!data)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    uint64_t lsn = 0;
 
-    /* If update fails or ID is NULL, perform insert */
-    return db_insert(coll_name, data);
+    /* If ID is provided, try updating first; otherwise insert under that ID.
+     * An update rejected by a unique index must not turn into an insert. */
+    bool ok = id && _update(coll_name, id, data, &lsn);
+    if (!ok && (!id || t_last_error == DB_ERROR_NOT_FOUND)) {
+        t_last_error = DB_ERROR_NONE;
+        ok = _insert(coll_name, data, id, &lsn);
+    }
+    pthread_mutex_unlock(&lock);
+    _commit(lsn);
+    return ok;
 }
 
 /**
@@ -430,27 +4465,131 @@ bool db_upsert(const char *coll_name, const char *id, cJSON *data)
 bool db_delete(const char *coll_name, const char *id)
 {
     pthread_mutex_lock(&lock);
-    cJSON *coll = cJSON_GetObjectItem(root, coll_name);
-    if (coll && cJSON_IsArray(coll)) {
-        cJSON *item = coll->child;
-        while (item) {
-            cJSON *itemId = cJSON_GetObjectItem(item, "_id");
-            if (itemId && cJSON_IsString(itemId) && strcmp(itemId->valuestring, id) == 0) {
+    uint64_t lsn = 0;
+    bool deleted = _apply_delete(coll_name, id);
+    if (deleted)
+        lsn = _persist("delete", coll_name, NULL, id);
+    t_last_error = deleted ? DB_ERROR_NONE : DB_ERROR_NOT_FOUND;
+    pthread_mutex_unlock(&lock);
+    _commit(lsn);
+    return deleted;
+}
 
-                /* Safe deletion using detach */
-                cJSON_DetachItemViaPointer(coll, item);
-                cJSON_Delete(item);
+/**
+ * @brief Creates a secondary index and records it in the index catalog.
+ *
+ * @param[in] coll_name Target collection name (created if missing).
+ * @param[in] spec      Index specification (see secondary_create()).
+ * @return true if the index exists afterwards, false if the specification is
+ *         invalid, conflicts with an existing index, or the build failed.
+ */
+bool db_create_index(const char *coll_name, const cJSON *spec)
+{
+    t_last_error = DB_ERROR_NONE;
+    secondary_t *probe = secondary_create(spec);
+    if (!probe)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    bool ok = false;
+    collection_t *c = _coll_open(coll_name);
+    size_t i = c ? _sec_find(c, secondary_name(probe)) : 0;
+    if (c && i < c->sec_count) {
+        /* Creating an identical index again is a no-op */
+        ok = cJSON_Compare(secondary_spec(c->secs[i]), secondary_spec(probe), true);
+    } else if (c) {
+        cJSON *defs = cJSON_GetObjectItemCaseSensitive(g_index_defs, coll_name);
+        if (!defs)
+            defs = cJSON_AddArrayToObject(g_index_defs, coll_name);
+        secondary_t *sec = defs ? _sec_create(c, secondary_spec(probe)) : NULL;
+        if (sec) {
+            c->indexes_saved = false;
+            /* The next planned find samples again and reads the exact counts of the index */
+            planner_stats_free(c->stats);
+            c->stats = NULL;
+            cJSON_AddItemToArray(defs, cJSON_Duplicate(secondary_spec(sec), 1));
+            ok = _catalog_write();
+        } else if (defs && !defs->child) {
+            cJSON_Delete(cJSON_DetachItemViaPointer(g_index_defs, defs));
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    secondary_free(probe);
+    return ok;
+}
 
-                cJSON_DeleteItemFromObject(g_index, id);
-                _save_internal();
-                pthread_mutex_unlock(&lock);
-                return true;
+/**
+ * @brief Drops a secondary index and removes it from the index catalog.
+ *
+ * @param[in] coll_name Target collection name.
+ * @param[in] name      Index name.
+ * @return true if the index existed.
+ */
+bool db_drop_index(const char *coll_name, const char *name)
+{
+    pthread_mutex_lock(&lock);
+    collection_t *c = _coll_get(coll_name);
+    size_t i = c ? _sec_find(c, name) : 0;
+    bool found = c && i < c->sec_count;
+    if (found) {
+        /* Catalog entries may predate defaults added to the normalized form */
+        cJSON *defs = cJSON_GetObjectItemCaseSensitive(g_index_defs, coll_name);
+        for (cJSON *spec = defs ? defs->child : NULL; spec; spec = spec->next) {
+            secondary_t *probe = secondary_create(spec);
+            bool same = probe && strcmp(secondary_name(probe), name) == 0;
+            secondary_free(probe);
+            if (same) {
+                cJSON_Delete(cJSON_DetachItemViaPointer(defs, spec));
+                break;
             }
-            item = item->next;
+        }
+        if (defs && !defs->child)
+            cJSON_Delete(cJSON_DetachItemViaPointer(g_index_defs, defs));
+        _catalog_write();
+
+        /* Keep catalog order, which index files are saved in */
+        secondary_free(c->secs[i]);
+        memmove(&c->secs[i], &c->secs[i + 1], (c->sec_count - i - 1) * sizeof(*c->secs));
+        c->sec_count--;
+        c->indexes_saved = false;
+
+        /* The slot table goes with the last bitmap index */
+        bool bitmaps = false;
+        for (size_t j = 0; j < c->sec_count; j++)
+            bitmaps = bitmaps || secondary_bitmap(c->secs[j]);
+        if (!bitmaps) {
+            secondary_slots_free(c->slots);
+            c->slots = NULL;
         }
     }
     pthread_mutex_unlock(&lock);
-    return false;
+    return found;
+}
+
+/**
+ * @brief Lists the indexes of a collection.
+ *
+ * @param[in] coll_name Target collection name.
+ * @return A new array describing the `_id` index and every secondary index
+ *         (empty if the collection does not exist).
+ */
+cJSON *db_list_indexes(const char *coll_name)
+{
+    cJSON *list = cJSON_CreateArray();
+    pthread_mutex_lock(&lock);
+    collection_t *c = _coll_get(coll_name);
+    if (c) {
+        cJSON *ids = cJSON_CreateObject();
+        cJSON_AddStringToObject(ids, "field", "_id");
+        cJSON_AddStringToObject(ids, "name", "_id");
+        cJSON_AddNumberToObject(ids, "keys", (double) index_count(c->ids));
+        cJSON_AddNumberToObject(ids, "entries", (double) index_count(c->ids));
+        cJSON_AddItemToArray(list, ids);
+        for (size_t i = 0; i < c->sec_count; i++)
+            cJSON_AddItemToArray(list, secondary_describe(c->secs[i]));
+    }
+    pthread_mutex_unlock(&lock);
+    return list;
 }
 
 /**
@@ -462,8 +4601,8 @@ bool db_delete(const char *coll_name, const char *id)
 int db_count(const char *coll_name)
 {
     pthread_mutex_lock(&lock);
-    cJSON *coll = cJSON_GetObjectItem(root, coll_name);
-    int cnt = (coll && cJSON_IsArray(coll)) ? cJSON_GetArraySize(coll) : 0;
+    collection_t *c = _coll_get(coll_name);
+    int cnt = c ? (int) c->count : 0;
     pthread_mutex_unlock(&lock);
     return cnt;
 }
@@ -0,0 +1,841 @@
+/**
+ * @file fulltext.c
+ * @brief Inverted index over the words of a text field.
+ *
+ * Implements the index declared in fulltext.h. Documents get increasing
+ * numbers as they are added, so every posting list only grows at its end and
+ * its entries can be gap-encoded. Removed documents leave their number
+ * behind as a dead slot that searches skip; once dead slots outnumber live
+ * ones, the lists are rewritten in place without them and the surviving
+ * documents are renumbered densely.
+ */
+
+#include "../include/fulltext.h"
+
+#include "../include/index.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief BM25 term frequency saturation.
+ */
+#define BM25_K1 1.2
+
+/**
+ * @brief BM25 document length normalization.
+ */
+#define BM25_B 0.75
+
+/**
+ * @brief Dead slots tolerated before a compaction is considered.
+ */
+#define COMPACT_MIN_DEAD 64
+
+/**
+ * @brief A token of a text, pointing into its lowercased copy.
+ */
+typedef struct
+{
+    const char *data; /**< Token bytes. */
+    size_t len;       /**< Token length in bytes. */
+} token_t;
+
+/**
+ * @brief Posting list of one token.
+ *
+ * Entries are pairs of varints: the gap to the previous document number
+ * (the number itself for the first entry) and the occurrence count.
+ */
+typedef struct
+{
+    unsigned char *data; /**< Encoded entries. */
+    size_t len;          /**< Bytes used. */
+    size_t cap;          /**< Bytes allocated. */
+    size_t count;        /**< Entries, dead documents included. */
+    size_t df;           /**< Live documents holding the token. */
+    size_t last;         /**< Document number of the last entry. */
+    size_t token_len;    /**< Length of token. */
+    char token[];        /**< Token bytes. */
+} term_t;
+
+/**
+ * @brief A numbered document.
+ */
+typedef struct
+{
+    cJSON *doc;    /**< Stored document (NULL once removed). */
+    size_t length; /**< Number of tokens in its text. */
+} slot_t;
+
+/**
+ * @brief Inverted index state.
+ */
+struct fulltext
+{
+    index_t *terms;        /**< Token -> term_t. */
+    term_t **list;         /**< Every term, for compactions. */
+    size_t term_count;     /**< Entries used in list. */
+    size_t term_cap;       /**< Entries allocated in list. */
+    index_t *numbers;      /**< Stored pointer -> document number + 1. */
+    slot_t *docs;          /**< Documents by number. */
+    size_t doc_count;      /**< Numbers handed out. */
+    size_t doc_cap;        /**< Entries allocated in docs. */
+    size_t live;           /**< Documents not removed. */
+    uint64_t total_length; /**< Tokens in live documents. */
+    size_t bytes;          /**< Bytes used by posting lists. */
+};
+
+/**
+ * @brief A scored document during a search.
+ */
+typedef struct
+{
+    double score;  /**< Relevance score. */
+    size_t number; /**< Document number. */
+} hit_t;
+
+/**
+ * @brief Tells whether a byte belongs to a token.
+ *
+ * @param[in] c The byte.
+ * @return true for ASCII letters and digits and non-ASCII bytes.
+ */
+static bool _token_byte(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+/**
+ * @brief Orders tokens so equal ones are adjacent (qsort comparator).
+ *
+ * @param[in] a First token.
+ * @param[in] b Second token.
+ * @return A negative, zero or positive value.
+ */
+static int _token_compare(const void *a, const void *b)
+{
+    const token_t *x = a, *y = b;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    return memcmp(x->data, y->data, x->len);
+}
+
+/**
+ * @brief Splits a text into sorted tokens.
+ *
+ * @param[in]  text   The text.
+ * @param[out] lower  Receives the lowercased copy the tokens point into (caller frees).
+ * @param[out] tokens Receives the tokens (caller frees, may be NULL when empty).
+ * @param[out] count  Receives the number of tokens.
+ * @return false on allocation failure.
+ */
+static bool _tokenize(const char *text, char **lower, token_t **tokens, size_t *count)
+{
+    *tokens = NULL;
+    *count = 0;
+    *lower = strdup(text);
+    if (!*lower)
+        return false;
+
+    size_t cap = 0;
+    char *p = *lower;
+    while (*p) {
+        if (!_token_byte((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+        char *start = p;
+        for (; *p && _token_byte((unsigned char) *p); p++) {
+            if (*p >= 'A' && *p <= 'Z')
+                *p = (char) (*p - 'A' + 'a');
+        }
+        size_t len = (size_t) (p - start);
+        if (len > FULLTEXT_MAX_TOKEN)
+            continue;
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 16;
+            token_t *grown = realloc(*tokens, cap * sizeof(*grown));
+            if (!grown) {
+                free(*tokens);
+                free(*lower);
+                *tokens = NULL;
+                *lower = NULL;
+                return false;
+            }
+            *tokens = grown;
+        }
+        (*tokens)[(*count)++] = (token_t){start, len};
+    }
+    if (*count > 1)
+        qsort(*tokens, *count, sizeof(**tokens), _token_compare);
+    return true;
+}
+
+/**
+ * @brief Encodes a varint (7 bits per byte, low bits first).
+ *
+ * @param[out] out   Destination (room for 10 bytes).
+ * @param[in]  value Value to encode.
+ * @return Number of bytes written.
+ */
+static size_t _varint_put(unsigned char *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+/**
+ * @brief Reads a varint.
+ *
+ * @param[in,out] p Read position, advanced past the value.
+ * @return The decoded value.
+ */
+static uint64_t _varint_get(const unsigned char **p)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        value |= (uint64_t) (**p & 0x7F) << shift;
+        shift += 7;
+        (*p)++;
+    }
+    value |= (uint64_t) **p << shift;
+    (*p)++;
+    return value;
+}
+
+/**
+ * @brief Looks up the posting list of a token, creating it if needed.
+ *
+ * @param[in] ft    The index.
+ * @param[in] token The token.
+ * @return The posting list, or NULL on allocation failure.
+ */
+static term_t *_term_open(fulltext_t *ft, const token_t *token)
+{
+    term_t *term = index_get(ft->terms, token->data, token->len);
+    if (term)
+        return term;
+
+    if (ft->term_count == ft->term_cap) {
+        size_t cap = ft->term_cap ? ft->term_cap * 2 : 64;
+        term_t **list = realloc(ft->list, cap * sizeof(*list));
+        if (!list)
+            return NULL;
+        ft->list = list;
+        ft->term_cap = cap;
+    }
+    term = calloc(1, sizeof(*term) + token->len);
+    if (!term)
+        return NULL;
+    memcpy(term->token, token->data, token->len);
+    term->token_len = token->len;
+    if (!index_put(ft->terms, term->token, term->token_len, term, NULL)) {
+        free(term);
+        return NULL;
+    }
+    ft->list[ft->term_count++] = term;
+    return term;
+}
+
+/**
+ * @brief Appends a document to a posting list.
+ *
+ * @param[in] ft     The index.
+ * @param[in] term   The posting list.
+ * @param[in] number Document number (above every number in the list).
+ * @param[in] tf     Occurrences of the token in the document.
+ * @return false on allocation failure.
+ */
+static bool _term_append(fulltext_t *ft, term_t *term, size_t number, size_t tf)
+{
+    if (term->len + 20 > term->cap) {
+        size_t cap = term->cap ? term->cap * 2 : 16;
+        unsigned char *data = realloc(term->data, cap);
+        if (!data)
+            return false;
+        term->data = data;
+        term->cap = cap;
+    }
+    size_t gap = term->count ? number - term->last : number;
+    size_t n = _varint_put(term->data + term->len, gap);
+    n += _varint_put(term->data + term->len + n, tf);
+    term->len += n;
+    term->count++;
+    term->df++;
+    term->last = number;
+    ft->bytes += n;
+    return true;
+}
+
+/**
+ * @brief Lowers the document frequency of every token of a text.
+ *
+ * @param[in] ft     The index.
+ * @param[in] tokens Sorted tokens.
+ * @param[in] count  Number of tokens to consider.
+ */
+static void _terms_release(fulltext_t *ft, const token_t *tokens, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && _token_compare(&tokens[i - 1], &tokens[i]) == 0)
+            continue;
+        term_t *term = index_get(ft->terms, tokens[i].data, tokens[i].len);
+        if (term && term->df > 0)
+            term->df--;
+    }
+}
+
+/**
+ * @brief Drops dead documents from every posting list and renumbers the rest.
+ *
+ * Entries are rewritten in place: a kept entry never needs more bytes than
+ * the entries it replaces, since gaps only shrink. Lists left empty are
+ * freed. Does nothing if memory is exhausted.
+ *
+ * @param[in] ft The index.
+ */
+static void _compact(fulltext_t *ft)
+{
+    size_t *renumber = malloc(ft->doc_count * sizeof(*renumber));
+    if (!renumber)
+        return;
+    size_t next = 0;
+    for (size_t i = 0; i < ft->doc_count; i++)
+        renumber[i] = ft->docs[i].doc ? next++ : SIZE_MAX;
+
+    size_t kept_terms = 0;
+    ft->bytes = 0;
+    for (size_t t = 0; t < ft->term_count; t++) {
+        term_t *term = ft->list[t];
+        const unsigned char *p = term->data;
+        const unsigned char *end = term->data + term->len;
+        size_t number = 0, len = 0, count = 0, last = 0;
+        while (p < end) {
+            number += (size_t) _varint_get(&p);
+            size_t tf = (size_t) _varint_get(&p);
+            if (renumber[number] == SIZE_MAX)
+                continue;
+            size_t gap = count ? renumber[number] - last : renumber[number];
+            len += _varint_put(term->data + len, gap);
+            len += _varint_put(term->data + len, tf);
+            last = renumber[number];
+            count++;
+        }
+        if (count == 0) {
+            index_remove(ft->terms, term->token, term->token_len);
+            free(term->data);
+            free(term);
+            continue;
+        }
+        term->len = len;
+        term->count = count;
+        term->last = last;
+        ft->bytes += len;
+        ft->list[kept_terms++] = term;
+    }
+    ft->term_count = kept_terms;
+
+    for (size_t i = 0; i < ft->doc_count; i++) {
+        if (renumber[i] == SIZE_MAX)
+            continue;
+        cJSON *doc = ft->docs[i].doc;
+        ft->docs[renumber[i]] = ft->docs[i];
+        index_put(ft->numbers, (const char *) &doc, sizeof(doc),
+                  (void *) (uintptr_t) (renumber[i] + 1), NULL);
+    }
+    ft->doc_count = next;
+    free(renumber);
+}
+
+/**
+ * @brief Creates an empty index.
+ *
+ * @return The new index, or NULL on allocation failure.
+ */
+fulltext_t *fulltext_create(void)
+{
+    fulltext_t *ft = calloc(1, sizeof(*ft));
+    if (!ft)
+        return NULL;
+    ft->terms = index_create(0);
+    ft->numbers = index_create(0);
+    if (!ft->terms || !ft->numbers) {
+        fulltext_free(ft);
+        return NULL;
+    }
+    return ft;
+}
+
+/**
+ * @brief Releases an index.
+ *
+ * @param[in] ft The index (may be NULL).
+ */
+void fulltext_free(fulltext_t *ft)
+{
+    if (!ft)
+        return;
+    for (size_t i = 0; i < ft->term_count; i++) {
+        free(ft->list[i]->data);
+        free(ft->list[i]);
+    }
+    free(ft->list);
+    index_free(ft->terms, NULL);
+    index_free(ft->numbers, NULL);
+    free(ft->docs);
+    free(ft);
+}
+
+/**
+ * @brief Returns the number of distinct tokens in the index.
+ *
+ * @param[in] ft The index.
+ * @return Token count.
+ */
+size_t fulltext_terms(const fulltext_t *ft)
+{
+    return ft->term_count;
+}
+
+/**
+ * @brief Returns the size of the compressed posting lists.
+ *
+ * @param[in] ft The index.
+ * @return Size in bytes.
+ */
+size_t fulltext_bytes(const fulltext_t *ft)
+{
+    return ft->bytes;
+}
+
+/**
+ * @brief Adds the text of a stored document.
+ *
+ * On failure the document number is spent as a dead slot, so entries already
+ * appended for it are skipped by searches and dropped by the next compaction.
+ *
+ * @param[in] ft     The index.
+ * @param[in] text   Text to index.
+ * @param[in] stored Pointer to record.
+ * @return false on allocation failure.
+ */
+bool fulltext_add(fulltext_t *ft, const char *text, cJSON *stored)
+{
+    if (ft->doc_count == ft->doc_cap) {
+        size_t cap = ft->doc_cap ? ft->doc_cap * 2 : 64;
+        slot_t *docs = realloc(ft->docs, cap * sizeof(*docs));
+        if (!docs)
+            return false;
+        ft->docs = docs;
+        ft->doc_cap = cap;
+    }
+
+    char *lower;
+    token_t *tokens;
+    size_t count;
+    if (!_tokenize(text, &lower, &tokens, &count))
+        return false;
+
+    size_t number = ft->doc_count++;
+    ft->docs[number] = (slot_t){NULL, count};
+    bool ok = true;
+    size_t i = 0;
+    while (ok && i < count) {
+        size_t j = i + 1;
+        while (j < count && _token_compare(&tokens[i], &tokens[j]) == 0)
+            j++;
+        term_t *term = _term_open(ft, &tokens[i]);
+        ok = term && _term_append(ft, term, number, j - i);
+        if (ok)
+            i = j;
+    }
+    ok = ok && index_put(ft->numbers, (const char *) &stored, sizeof(stored),
+                         (void *) (uintptr_t) (number + 1), NULL);
+    if (ok) {
+        ft->docs[number].doc = stored;
+        ft->live++;
+        ft->total_length += count;
+    } else {
+        _terms_release(ft, tokens, i);
+    }
+    free(tokens);
+    free(lower);
+    return ok;
+}
+
+/**
+ * @brief Removes a stored document.
+ *
+ * @param[in] ft     The index.
+ * @param[in] text   Text the document was added with.
+ * @param[in] stored Pointer recorded when it was added.
+ * @return true if the document was indexed.
+ */
+bool fulltext_remove(fulltext_t *ft, const char *text, const cJSON *stored)
+{
+    uintptr_t slot = (uintptr_t) index_remove(ft->numbers, (const char *) &stored, sizeof(stored));
+    if (slot == 0)
+        return false;
+
+    size_t number = (size_t) slot - 1;
+    char *lower;
+    token_t *tokens;
+    size_t count;
+    if (_tokenize(text, &lower, &tokens, &count)) {
+        _terms_release(ft, tokens, count);
+        free(tokens);
+        free(lower);
+    }
+    ft->docs[number].doc = NULL;
+    ft->live--;
+    ft->total_length -= ft->docs[number].length;
+
+    size_t dead = ft->doc_count - ft->live;
+    if (dead >= COMPACT_MIN_DEAD && dead > ft->live)
+        _compact(ft);
+    return true;
+}
+
+/**
+ * @brief Swaps the pointer recorded for a document.
+ *
+ * @param[in] ft     The index.
+ * @param[in] old    Pointer recorded so far.
+ * @param[in] stored Pointer to record instead.
+ */
+void fulltext_replace(fulltext_t *ft, const cJSON *old, cJSON *stored)
+{
+    void *slot = index_remove(ft->numbers, (const char *) &old, sizeof(old));
+    if (!slot)
+        return;
+    size_t number = (size_t) (uintptr_t) slot - 1;
+    if (index_put(ft->numbers, (const char *) &stored, sizeof(stored), slot, NULL)) {
+        ft->docs[number].doc = stored;
+        return;
+    }
+
+    /* Without a mapping the document could not be removed later */
+    ft->docs[number].doc = NULL;
+    ft->live--;
+    ft->total_length -= ft->docs[number].length;
+}
+
+/**
+ * @brief Tells whether a hit ranks below another one.
+ *
+ * @param[in] a First hit.
+ * @param[in] b Second hit.
+ * @return true if @p a has a lower score, or the same score and a later number.
+ */
+static bool _hit_worse(const hit_t *a, const hit_t *b)
+{
+    return a->score < b->score || (a->score == b->score && a->number > b->number);
+}
+
+/**
+ * @brief Restores the min-heap property below a position.
+ *
+ * @param[in] heap  Hits, worst at the root.
+ * @param[in] count Hits in the heap.
+ * @param[in] i     Position to sift down.
+ */
+static void _heap_down(hit_t *heap, size_t count, size_t i)
+{
+    for (;;) {
+        size_t worst = i, l = 2 * i + 1, r = l + 1;
+        if (l < count && _hit_worse(&heap[l], &heap[worst]))
+            worst = l;
+        if (r < count && _hit_worse(&heap[r], &heap[worst]))
+            worst = r;
+        if (worst == i)
+            return;
+        hit_t tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+/**
+ * @brief Visits the documents holding any token of a search text, best first.
+ *
+ * Scores are accumulated term at a time into an array indexed by document
+ * number, then the best @p limit are kept in a min-heap.
+ *
+ * @param[in] ft    The index.
+ * @param[in] text  Search text.
+ * @param[in] limit Maximum number of results (0 for all).
+ * @param[in] visit Visitor.
+ * @param[in] ctx   Visitor context.
+ * @return false on allocation failure.
+ */
+bool fulltext_search(const fulltext_t *ft, const char *text, size_t limit,
+                     fulltext_visit_fn visit, void *ctx)
+{
+    char *lower;
+    token_t *tokens;
+    size_t count;
+    if (!_tokenize(text, &lower, &tokens, &count))
+        return false;
+
+    double *scores = count && ft->live ? calloc(ft->doc_count, sizeof(*scores)) : NULL;
+    hit_t *hits = NULL;
+    size_t hit_count = 0, hit_cap = 0;
+    bool ok = !(count && ft->live) || scores;
+    double avg_length = ft->live ? (double) ft->total_length / (double) ft->live : 0;
+    if (avg_length <= 0)
+        avg_length = 1;
+
+    for (size_t i = 0; ok && scores && i < count; i++) {
+        if (i > 0 && _token_compare(&tokens[i - 1], &tokens[i]) == 0)
+            continue;
+        const term_t *term = index_get(ft->terms, tokens[i].data, tokens[i].len);
+        if (!term || term->df == 0)
+            continue;
+
+        double df = (double) (term->df < ft->live ? term->df : ft->live);
+        double idf = log(1 + ((double) ft->live - df + 0.5) / (df + 0.5));
+        const unsigned char *p = term->data;
+        const unsigned char *end = term->data + term->len;
+        size_t number = 0;
+        while (ok && p < end) {
+            number += (size_t) _varint_get(&p);
+            double tf = (double) _varint_get(&p);
+            const slot_t *slot = &ft->docs[number];
+            if (!slot->doc)
+                continue;
+            if (scores[number] == 0) {
+                /* First token of this document: remember it */
+                if (hit_count == hit_cap) {
+                    hit_cap = hit_cap ? hit_cap * 2 : 64;
+                    hit_t *grown = realloc(hits, hit_cap * sizeof(*grown));
+                    ok = grown != NULL;
+                    hits = ok ? grown : hits;
+                }
+                if (ok)
+                    hits[hit_count++].number = number;
+            }
+            double norm = 1 - BM25_B + BM25_B * (double) slot->length / avg_length;
+            scores[number] += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * norm);
+        }
+    }
+
+    if (ok && hit_count > 0) {
+        for (size_t i = 0; i < hit_count; i++)
+            hits[i].score = scores[hits[i].number];
+
+        /* Keep the best `limit` hits in a min-heap, then sort them */
+        size_t keep = limit && limit < hit_count ? limit : hit_count;
+        for (size_t i = keep / 2; i-- > 0;)
+            _heap_down(hits, keep, i);
+        for (size_t i = keep; i < hit_count; i++) {
+            if (_hit_worse(&hits[0], &hits[i])) {
+                hits[0] = hits[i];
+                _heap_down(hits, keep, 0);
+            }
+        }
+        for (size_t n = keep; n > 1; n--) {
+            hit_t tmp = hits[0];
+            hits[0] = hits[n - 1];
+            hits[n - 1] = tmp;
+            _heap_down(hits, n - 1, 0);
+        }
+        for (size_t i = 0; i < keep; i++) {
+            if (!visit(ft->docs[hits[i].number].doc, hits[i].score, ctx))
+                break;
+        }
+    }
+    free(hits);
+    free(scores);
+    free(tokens);
+    free(lower);
+    return ok;
+}
+
+/**
+ * @brief Writes a little-endian integer of @p size bytes.
+ *
+ * @param[in] fp    Destination stream.
+ * @param[in] value Value to write.
+ * @param[in] size  Number of bytes (4 or 8).
+ * @return false on a write error.
+ */
+static bool _write_uint(FILE *fp, uint64_t value, size_t size)
+{
+    unsigned char b[8];
+    for (size_t i = 0; i < size; i++)
+        b[i] = (unsigned char) (value >> (8 * i));
+    return fwrite(b, 1, size, fp) == size;
+}
+
+/**
+ * @brief Reads a little-endian integer of @p size bytes.
+ *
+ * @param[in]  fp    Source stream.
+ * @param[out] value Receives the value.
+ * @param[in]  size  Number of bytes (4 or 8).
+ * @return false if the stream ends first.
+ */
+static bool _read_uint(FILE *fp, uint64_t *value, size_t size)
+{
+    unsigned char b[8];
+    if (fread(b, 1, size, fp) != size)
+        return false;
+    *value = 0;
+    for (size_t i = 0; i < size; i++)
+        *value |= (uint64_t) b[i] << (8 * i);
+    return true;
+}
+
+/**
+ * @brief Checks that a loaded posting list decodes within its bytes.
+ *
+ * Searches and compactions read the lists without bounds checks, so a list
+ * is only accepted if its entries end exactly at its length, number existing
+ * documents and agree with its counters.
+ *
+ * @param[in] term      The posting list.
+ * @param[in] doc_count Document numbers handed out.
+ * @return true if the list is well-formed.
+ */
+static bool _term_valid(const term_t *term, size_t doc_count)
+{
+    const unsigned char *p = term->data;
+    const unsigned char *end = term->data + term->len;
+    uint64_t number = 0;
+    size_t count = 0;
+    while (p < end) {
+        for (int field = 0; field < 2; field++) {
+            uint64_t value = 0;
+            int shift = 0;
+            do {
+                if (p == end || shift > 63)
+                    return false;
+                value |= (uint64_t) (*p & 0x7F) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+            if (field == 0)
+                number = count ? number + value : value;
+        }
+        if (number >= doc_count)
+            return false;
+        count++;
+    }
+    return count == term->count && count > 0 && number == term->last && term->df <= count;
+}
+
+/**
+ * @brief Writes an index to a stream.
+ *
+ * Layout (little-endian): u64 document numbers, then per number the u32
+ * position of its document (UINT32_MAX once removed) and u32 token count;
+ * u64 terms, then per term the u32 token length, the token, u64 entries,
+ * live documents and last number, u64 byte length and the encoded entries.
+ *
+ * @param[in] ft      The index.
+ * @param[in] fp      Destination stream.
+ * @param[in] numbers Positions of the stored documents.
+ * @return false on a write error or an unknown document.
+ */
+bool fulltext_save(const fulltext_t *ft, FILE *fp, const index_t *numbers)
+{
+    bool ok = _write_uint(fp, ft->doc_count, 8);
+    for (size_t i = 0; ok && i < ft->doc_count; i++) {
+        const cJSON *doc = ft->docs[i].doc;
+        uintptr_t number =
+            doc ? (uintptr_t) index_get(numbers, (const char *) &doc, sizeof(doc)) : 0;
+        uint64_t position = doc ? (uint64_t) number - 1 : UINT32_MAX;
+        ok = (!doc || number > 0) && _write_uint(fp, position, 4) &&
+             _write_uint(fp, ft->docs[i].length, 4);
+    }
+
+    ok = ok && _write_uint(fp, ft->term_count, 8);
+    for (size_t t = 0; ok && t < ft->term_count; t++) {
+        const term_t *term = ft->list[t];
+        ok = _write_uint(fp, term->token_len, 4) &&
+             fwrite(term->token, 1, term->token_len, fp) == term->token_len &&
+             _write_uint(fp, term->count, 8) && _write_uint(fp, term->df, 8) &&
+             _write_uint(fp, term->last, 8) && _write_uint(fp, term->len, 8) &&
+             fwrite(term->data, 1, term->len, fp) == term->len;
+    }
+    return ok;
+}
+
+/**
+ * @brief Reads an index written by fulltext_save() into an empty one.
+ *
+ * @param[in] ft    An empty index.
+ * @param[in] fp    Source stream.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false if the stream is truncated or malformed or memory is exhausted.
+ */
+bool fulltext_load(fulltext_t *ft, FILE *fp, cJSON *const *docs, size_t count)
+{
+    uint64_t doc_count, term_count;
+    if (!_read_uint(fp, &doc_count, 8) || doc_count > SIZE_MAX / sizeof(slot_t))
+        return false;
+    ft->docs = doc_count ? malloc((size_t) doc_count * sizeof(*ft->docs)) : NULL;
+    if (doc_count && !ft->docs)
+        return false;
+    ft->doc_cap = (size_t) doc_count;
+    if (!index_reserve(ft->numbers, (size_t) doc_count))
+        return false;
+
+    for (; ft->doc_count < doc_count; ft->doc_count++) {
+        uint64_t position, length;
+        if (!_read_uint(fp, &position, 4) || !_read_uint(fp, &length, 4))
+            return false;
+        slot_t *slot = &ft->docs[ft->doc_count];
+        *slot = (slot_t) {NULL, (size_t) length};
+        if (position == UINT32_MAX)
+            continue;
+        if (position >= count)
+            return false;
+        slot->doc = docs[position];
+        if (!index_put(ft->numbers, (const char *) &slot->doc, sizeof(slot->doc),
+                       (void *) (uintptr_t) (ft->doc_count + 1), NULL))
+            return false;
+        ft->live++;
+        ft->total_length += length;
+    }
+
+    if (!_read_uint(fp, &term_count, 8))
+        return false;
+    for (uint64_t t = 0; t < term_count; t++) {
+        uint64_t token_len, entries, df, last, len;
+        if (!_read_uint(fp, &token_len, 4) || token_len == 0 || token_len > FULLTEXT_MAX_TOKEN)
+            return false;
+        char token[FULLTEXT_MAX_TOKEN];
+        if (fread(token, 1, (size_t) token_len, fp) != token_len)
+            return false;
+        token_t key = {token, (size_t) token_len};
+        if (index_get(ft->terms, token, key.len))
+            return false;
+        term_t *term = _term_open(ft, &key);
+        if (!term || !_read_uint(fp, &entries, 8) || !_read_uint(fp, &df, 8) ||
+            !_read_uint(fp, &last, 8) || !_read_uint(fp, &len, 8) || len > SIZE_MAX)
+            return false;
+        term->data = len ? malloc((size_t) len) : NULL;
+        if (len && !term->data)
+            return false;
+        term->cap = term->len = (size_t) len;
+        term->count = (size_t) entries;
+        term->df = (size_t) df;
+        term->last = (size_t) last;
+        if (fread(term->data, 1, term->len, fp) != term->len ||
+            !_term_valid(term, ft->doc_count))
+            return false;
+        ft->bytes += term->len;
+    }
+    return true;
+}
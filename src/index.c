@@ -0,0 +1,328 @@
+/**
+ * @file index.c
+ * @brief Open-addressing hash table for key lookups.
+ *
+ * Implements the table declared in index.h. Entries live in one flat array
+ * whose size is a power of two; collisions are resolved by linear probing,
+ * and deletions shift the following entries back instead of leaving
+ * tombstones, so probe sequences stay short under churn. Each slot caches the
+ * full 64-bit hash, which rejects nearly all non-matching slots without
+ * touching their keys.
+ */
+
+#include "../include/index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Smallest number of slots allocated.
+ */
+#define INDEX_MIN_SLOTS 16
+
+/**
+ * @brief Multiplicative constant of the hash (2^64 / golden ratio).
+ */
+#define INDEX_HASH_MUL 0x9E3779B97F4A7C15ULL
+
+/**
+ * @brief One table slot; a NULL key marks it as empty.
+ */
+typedef struct
+{
+    uint64_t hash; /**< Cached hash of the key. */
+    char *key;     /**< Owned, NUL-terminated copy of the key. */
+    size_t len;    /**< Key length in bytes. */
+    void *value;   /**< Stored value. */
+} index_slot_t;
+
+/**
+ * @brief Hash table state.
+ */
+struct index_table
+{
+    index_slot_t *slots; /**< Slot array (cap entries). */
+    size_t cap;          /**< Number of slots, a power of two. */
+    size_t count;        /**< Number of occupied slots. */
+};
+
+/**
+ * @brief Final avalanche step of the hash (from MurmurHash3's fmix64).
+ *
+ * @param[in] x Value to mix.
+ * @return Mixed value.
+ */
+static uint64_t _mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief Hashes a key eight bytes at a time.
+ *
+ * @param[in] key Key bytes.
+ * @param[in] len Key length in bytes.
+ * @return 64-bit hash.
+ */
+uint64_t index_hash(const char *key, size_t len)
+{
+    uint64_t h = (uint64_t) len * INDEX_HASH_MUL;
+    while (len >= 8) {
+        uint64_t k;
+        memcpy(&k, key, 8);
+        h = (h ^ _mix(k)) * INDEX_HASH_MUL;
+        key += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t k = 0;
+        memcpy(&k, key, len);
+        h = (h ^ _mix(k)) * INDEX_HASH_MUL;
+    }
+    return _mix(h);
+}
+
+/**
+ * @brief Returns the number of slots needed for @p count entries (load factor <= 3/4).
+ *
+ * @param[in] count Number of entries.
+ * @return A power of two.
+ */
+static size_t _slots_for(size_t count)
+{
+    size_t cap = INDEX_MIN_SLOTS;
+    while (cap - cap / 4 < count)
+        cap *= 2;
+    return cap;
+}
+
+/**
+ * @brief Finds the slot holding a key, or the empty slot where it would go.
+ *
+ * @param[in] idx  The table.
+ * @param[in] hash Hash of the key.
+ * @param[in] key  Key bytes.
+ * @param[in] len  Key length in bytes.
+ * @return Slot position.
+ */
+static size_t _probe(const index_t *idx, uint64_t hash, const char *key, size_t len)
+{
+    size_t mask = idx->cap - 1;
+    size_t i = (size_t) hash & mask;
+    for (;;) {
+        const index_slot_t *slot = &idx->slots[i];
+        if (!slot->key)
+            return i;
+        if (slot->hash == hash && slot->len == len && memcmp(slot->key, key, len) == 0)
+            return i;
+        i = (i + 1) & mask;
+    }
+}
+
+/**
+ * @brief Moves every entry into a new slot array.
+ *
+ * @param[in] idx The table.
+ * @param[in] cap New number of slots (a power of two above the entry count).
+ * @return false on allocation failure.
+ */
+static bool _rehash(index_t *idx, size_t cap)
+{
+    index_slot_t *slots = calloc(cap, sizeof(*slots));
+    if (!slots)
+        return false;
+
+    size_t mask = cap - 1;
+    for (size_t i = 0; i < idx->cap; i++) {
+        if (!idx->slots[i].key)
+            continue;
+        size_t j = (size_t) idx->slots[i].hash & mask;
+        while (slots[j].key)
+            j = (j + 1) & mask;
+        slots[j] = idx->slots[i];
+    }
+    free(idx->slots);
+    idx->slots = slots;
+    idx->cap = cap;
+    return true;
+}
+
+/**
+ * @brief Creates an empty table.
+ *
+ * @param[in] expected Number of entries to size the table for.
+ * @return The new table, or NULL on allocation failure.
+ */
+index_t *index_create(size_t expected)
+{
+    index_t *idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        return NULL;
+    idx->cap = _slots_for(expected);
+    idx->slots = calloc(idx->cap, sizeof(*idx->slots));
+    if (!idx->slots) {
+        free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/**
+ * @brief Releases a table, its keys and optionally its values.
+ *
+ * @param[in] idx        The table (may be NULL).
+ * @param[in] free_value Value destructor (may be NULL).
+ */
+void index_free(index_t *idx, index_free_fn free_value)
+{
+    if (!idx)
+        return;
+    for (size_t i = 0; i < idx->cap; i++) {
+        if (!idx->slots[i].key)
+            continue;
+        if (free_value)
+            free_value(idx->slots[i].value);
+        free(idx->slots[i].key);
+    }
+    free(idx->slots);
+    free(idx);
+}
+
+/**
+ * @brief Returns the number of entries in the table.
+ *
+ * @param[in] idx The table.
+ * @return Entry count.
+ */
+size_t index_count(const index_t *idx)
+{
+    return idx->count;
+}
+
+/**
+ * @brief Grows the table ahead of a bulk insert.
+ *
+ * @param[in] idx   The table.
+ * @param[in] count Expected number of entries.
+ * @return false on allocation failure.
+ */
+bool index_reserve(index_t *idx, size_t count)
+{
+    size_t cap = _slots_for(count);
+    return cap <= idx->cap || _rehash(idx, cap);
+}
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param[in] idx The table.
+ * @param[in] key Key bytes.
+ * @param[in] len Key length in bytes.
+ * @return The stored value, or NULL if absent.
+ */
+void *index_get(const index_t *idx, const char *key, size_t len)
+{
+    const index_slot_t *slot = &idx->slots[_probe(idx, index_hash(key, len), key, len)];
+    return slot->key ? slot->value : NULL;
+}
+
+/**
+ * @brief Inserts a key or replaces its value.
+ *
+ * @param[in]  idx   The table.
+ * @param[in]  key   Key bytes (copied).
+ * @param[in]  len   Key length in bytes.
+ * @param[in]  value Value to store.
+ * @param[out] old   Receives the replaced value or NULL (may be NULL).
+ * @return false on allocation failure.
+ */
+bool index_put(index_t *idx, const char *key, size_t len, void *value, void **old)
+{
+    uint64_t hash = index_hash(key, len);
+    size_t i = _probe(idx, hash, key, len);
+    index_slot_t *slot = &idx->slots[i];
+    if (slot->key) {
+        if (old)
+            *old = slot->value;
+        slot->value = value;
+        return true;
+    }
+
+    /* Grow before the load factor passes 3/4, then find the new position */
+    if (idx->count + 1 > idx->cap - idx->cap / 4) {
+        if (!_rehash(idx, idx->cap * 2))
+            return false;
+        slot = &idx->slots[_probe(idx, hash, key, len)];
+    }
+
+    char *copy = malloc(len + 1);
+    if (!copy)
+        return false;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+
+    *slot = (index_slot_t) {hash, copy, len, value};
+    idx->count++;
+    if (old)
+        *old = NULL;
+    return true;
+}
+
+/**
+ * @brief Removes a key, shifting later entries of its probe run back.
+ *
+ * @param[in] idx The table.
+ * @param[in] key Key bytes.
+ * @param[in] len Key length in bytes.
+ * @return The removed value, or NULL if absent.
+ */
+void *index_remove(index_t *idx, const char *key, size_t len)
+{
+    size_t mask = idx->cap - 1;
+    size_t i = _probe(idx, index_hash(key, len), key, len);
+    if (!idx->slots[i].key)
+        return NULL;
+
+    void *value = idx->slots[i].value;
+    free(idx->slots[i].key);
+    idx->count--;
+
+    /* Backward shift: pull entries into the hole unless it lies before their home slot */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!idx->slots[j].key)
+            break;
+        size_t home = (size_t) idx->slots[j].hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            idx->slots[i] = idx->slots[j];
+            i = j;
+        }
+    }
+    idx->slots[i] = (index_slot_t) {0, NULL, 0, NULL};
+    return value;
+}
+
+/**
+ * @brief Visits every occupied slot in slot order.
+ *
+ * @param[in] idx   The table.
+ * @param[in] visit Visitor.
+ * @param[in] ctx   Visitor context.
+ * @return false if the visitor stopped the walk.
+ */
+bool index_foreach(const index_t *idx, index_visit_fn visit, void *ctx)
+{
+    for (size_t i = 0; i < idx->cap; i++) {
+        const index_slot_t *slot = &idx->slots[i];
+        if (slot->key && !visit(slot->key, slot->len, slot->value, ctx))
+            return false;
+    }
+    return true;
+}
@@ -14,6 +14,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * @brief Handles termination signals (e.g., SIGINT).
@@ -39,16 +40,35 @@ void sig_handler(int sig)
  * @brief Main program entry point.
  * * Sets up the execution environment, initializes persistent storage,
  * and binds the network server to the designated port.
+ * * `xdb --restore <snapshot> <database>` instead rebuilds a database from a
+ * snapshot directory and exits.
  *
+ * @param[in] argc Argument count.
+ * @param[in] argv Argument vector.
  * @return int Exit status code (0 on successful termination).
  */
-int main(void)
+int main(int argc, char **argv)
 {
+    /* Offline restore tool */
+    if (argc > 1 && strcmp(argv[1], "--restore") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Usage: %s --restore <snapshot directory> <database path>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        return db_restore_snapshot(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     /* Register signal handler for Ctrl+C and other interrupts */
     signal(SIGINT, sig_handler);
 
     utils_log("INFO", "Starting XDB Server...");
 
+    /* Log mutations instead of rewriting the whole data file on every write */
+    db_set_wal_mode(true);
+
+    /* Serve requests right away and decode documents as they are first touched */
+    db_set_lazy_load(true);
+
     /* Initialize the database with the production data file */
     db_init("data/production.json");
 
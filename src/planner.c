@@ -0,0 +1,558 @@
+/**
+ * @file planner.c
+ * @brief Statistics and cost model used to choose how a find reads a collection.
+ *
+ * Implements the planner declared in planner.h. A sample is walked once:
+ * every value found under a field path is hashed into the accumulator of the
+ * path, and the hashes are sorted afterwards to count how many values the
+ * sample holds once and how many it holds several times, which is all the
+ * distinct value estimator needs.
+ */
+
+#include "../include/planner.h"
+
+#include "../include/index.h"
+#include "../include/query.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Most fields a sample records; further paths are ignored.
+ */
+#define PLANNER_FIELDS 256
+
+/**
+ * @brief Deepest level of nested objects a sample descends into.
+ */
+#define PLANNER_DEPTH 4
+
+/**
+ * @brief Longest field path a sample records, in bytes.
+ */
+#define PLANNER_PATH 256
+
+/**
+ * @brief Distinct values assumed for a field without statistics.
+ */
+#define PLANNER_DEFAULT_DISTINCT 10.0
+
+/**
+ * @brief Statistics of one field.
+ */
+typedef struct
+{
+    char *name;      /**< Field path. */
+    double present;  /**< Fraction of documents holding the field. */
+    double distinct; /**< Estimated distinct values among them. */
+    double min;      /**< Smallest number held (valid if numbers). */
+    double max;      /**< Largest number held (valid if numbers). */
+    bool numbers;    /**< The field holds numbers. */
+} field_stats_t;
+
+/**
+ * @brief Statistics state.
+ */
+struct planner_stats
+{
+    field_stats_t *fields; /**< Known fields. */
+    size_t count;          /**< Entries used in fields. */
+    size_t cap;            /**< Entries allocated in fields. */
+    size_t docs;           /**< Documents in the collection. */
+};
+
+/**
+ * @brief Values sampled for one field.
+ */
+typedef struct
+{
+    uint64_t *hashes; /**< Hash of every value. */
+    size_t count;     /**< Entries used in hashes. */
+    size_t cap;       /**< Entries allocated in hashes. */
+} sample_values_t;
+
+/**
+ * @brief State of a sampling pass.
+ */
+typedef struct
+{
+    planner_stats_t *stats;  /**< Statistics being built. */
+    index_t *positions;      /**< Field path -> position in fields + 1. */
+    sample_values_t *values; /**< Sampled values, one entry per field. */
+    char path[PLANNER_PATH]; /**< Path of the value being visited. */
+    bool failed;             /**< An allocation failed. */
+} sample_t;
+
+/**
+ * @brief Creates empty statistics.
+ *
+ * @return The statistics, or NULL on allocation failure.
+ */
+planner_stats_t *planner_stats_create(void)
+{
+    return calloc(1, sizeof(planner_stats_t));
+}
+
+/**
+ * @brief Forgets every field.
+ *
+ * @param[in] stats The statistics.
+ */
+static void _stats_clear(planner_stats_t *stats)
+{
+    for (size_t i = 0; i < stats->count; i++)
+        free(stats->fields[i].name);
+    stats->count = 0;
+}
+
+/**
+ * @brief Releases statistics.
+ *
+ * @param[in] stats The statistics (may be NULL).
+ */
+void planner_stats_free(planner_stats_t *stats)
+{
+    if (!stats)
+        return;
+    _stats_clear(stats);
+    free(stats->fields);
+    free(stats);
+}
+
+/**
+ * @brief Adds a field with no statistics yet.
+ *
+ * @param[in] stats The statistics.
+ * @param[in] name  Field path.
+ * @return The field, or NULL on allocation failure.
+ */
+static field_stats_t *_field_add(planner_stats_t *stats, const char *name)
+{
+    if (stats->count == stats->cap) {
+        size_t cap = stats->cap ? stats->cap * 2 : 16;
+        field_stats_t *fields = realloc(stats->fields, cap * sizeof(*fields));
+        if (!fields)
+            return NULL;
+        stats->fields = fields;
+        stats->cap = cap;
+    }
+    field_stats_t *f = &stats->fields[stats->count];
+    memset(f, 0, sizeof(*f));
+    if (!(f->name = strdup(name)))
+        return NULL;
+    stats->count++;
+    return f;
+}
+
+/**
+ * @brief Folds an ASCII letter to lower case, like query.c does.
+ *
+ * @param[in] c The character.
+ * @return The lowercase letter, or @p c if it is not an uppercase letter.
+ */
+static inline unsigned char _fold(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char) (c + ('a' - 'A')) : c;
+}
+
+/**
+ * @brief Finds the statistics of a field.
+ *
+ * @param[in] stats The statistics (may be NULL).
+ * @param[in] name  Field path, compared ignoring case like documents are searched.
+ * @return The field, or NULL if it is unknown.
+ */
+static const field_stats_t *_field_find(const planner_stats_t *stats, const char *name)
+{
+    for (size_t i = 0; stats && i < stats->count; i++) {
+        const unsigned char *a = (const unsigned char *) stats->fields[i].name;
+        const unsigned char *b = (const unsigned char *) name;
+        while (*a && _fold(*a) == _fold(*b)) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0')
+            return &stats->fields[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hashes a value, so equal values and only those share a hash (most likely).
+ *
+ * Arrays and objects all hash alike; they are counted as one value.
+ *
+ * @param[in] value The value.
+ * @return The hash.
+ */
+static uint64_t _value_hash(const cJSON *value)
+{
+    if (cJSON_IsString(value))
+        return index_hash(value->valuestring, strlen(value->valuestring)) ^ 0x9e3779b97f4a7c15ULL;
+    if (cJSON_IsNumber(value)) {
+        double d = value->valuedouble == 0 ? 0 : value->valuedouble;
+        return index_hash((const char *) &d, sizeof(d)) ^ 0xc2b2ae3d27d4eb4fULL;
+    }
+    if (cJSON_IsBool(value))
+        return cJSON_IsTrue(value) ? 1 : 2;
+    return cJSON_IsNull(value) ? 3 : 4;
+}
+
+/**
+ * @brief Records one value found in a sampled document.
+ *
+ * @param[in,out] sample The sampling pass.
+ * @param[in]     value  The value, found under sample->path.
+ */
+static void _sample_value(sample_t *sample, const cJSON *value)
+{
+    size_t len = strlen(sample->path);
+    uintptr_t pos = (uintptr_t) index_get(sample->positions, sample->path, len);
+    if (pos == 0) {
+        if (sample->stats->count == PLANNER_FIELDS)
+            return;
+        field_stats_t *f = _field_add(sample->stats, sample->path);
+        if (!f || !index_put(sample->positions, sample->path, len,
+                             (void *) (uintptr_t) sample->stats->count, NULL)) {
+            sample->failed = true;
+            return;
+        }
+        pos = sample->stats->count;
+    }
+
+    field_stats_t *f = &sample->stats->fields[pos - 1];
+    sample_values_t *v = &sample->values[pos - 1];
+    if (v->count == v->cap) {
+        size_t cap = v->cap ? v->cap * 2 : 16;
+        uint64_t *hashes = realloc(v->hashes, cap * sizeof(*hashes));
+        if (!hashes) {
+            sample->failed = true;
+            return;
+        }
+        v->hashes = hashes;
+        v->cap = cap;
+    }
+    v->hashes[v->count++] = _value_hash(value);
+    if (cJSON_IsNumber(value)) {
+        if (!f->numbers || value->valuedouble < f->min)
+            f->min = value->valuedouble;
+        if (!f->numbers || value->valuedouble > f->max)
+            f->max = value->valuedouble;
+        f->numbers = true;
+    }
+}
+
+/**
+ * @brief Records every member of a sampled object, nested objects included.
+ *
+ * @param[in,out] sample The sampling pass.
+ * @param[in]     object The object; sample->path holds its path ("" at the top).
+ * @param[in]     depth  Nesting level of the object.
+ */
+static void _sample_object(sample_t *sample, const cJSON *object, int depth)
+{
+    size_t base = strlen(sample->path);
+    for (const cJSON *item = object->child; item && !sample->failed; item = item->next) {
+        if (!item->string)
+            continue;
+        size_t len = strlen(item->string);
+        if (base + (base > 0) + len >= sizeof(sample->path))
+            continue;
+        if (base > 0)
+            sample->path[base] = '.';
+        memcpy(sample->path + base + (base > 0), item->string, len + 1);
+        _sample_value(sample, item);
+        if (cJSON_IsObject(item) && depth + 1 < PLANNER_DEPTH)
+            _sample_object(sample, item, depth + 1);
+        sample->path[base] = '\0';
+    }
+}
+
+/**
+ * @brief Orders value hashes (qsort callback).
+ *
+ * @param[in] a First hash.
+ * @param[in] b Second hash.
+ * @return A negative, zero or positive value.
+ */
+static int _hash_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Estimates the distinct values of a field from its sampled values.
+ *
+ * @param[in] v     Sampled values (sorted in place).
+ * @param[in] n     Sampled documents.
+ * @param[in] total Documents in the collection.
+ * @return The estimate.
+ */
+static double _distinct(sample_values_t *v, size_t n, size_t total)
+{
+    qsort(v->hashes, v->count, sizeof(*v->hashes), _hash_compare);
+    double once = 0, repeated = 0;
+    for (size_t i = 0; i < v->count;) {
+        size_t j = i + 1;
+        while (j < v->count && v->hashes[j] == v->hashes[i])
+            j++;
+        if (j - i == 1)
+            once++;
+        else
+            repeated++;
+        i = j;
+    }
+    double d = sqrt((double) total / (double) n) * once + repeated;
+    double holders = (double) v->count * (double) total / (double) n;
+    return d > holders ? holders : d;
+}
+
+/**
+ * @brief Replaces the statistics with those of a sample.
+ *
+ * @param[in] stats The statistics.
+ * @param[in] docs  Sampled documents.
+ * @param[in] n     Entries in docs.
+ * @param[in] total Documents in the collection.
+ * @return false on allocation failure.
+ */
+bool planner_stats_sample(planner_stats_t *stats, const cJSON *const *docs, size_t n,
+                          size_t total)
+{
+    _stats_clear(stats);
+    stats->docs = total;
+    if (n == 0)
+        return true;
+
+    sample_t sample = {.stats = stats};
+    sample.positions = index_create(PLANNER_FIELDS);
+    sample.values = calloc(PLANNER_FIELDS, sizeof(*sample.values));
+    sample.failed = !sample.positions || !sample.values;
+    for (size_t i = 0; i < n && !sample.failed; i++) {
+        if (cJSON_IsObject(docs[i]))
+            _sample_object(&sample, docs[i], 0);
+    }
+
+    for (size_t i = 0; i < stats->count; i++) {
+        field_stats_t *f = &stats->fields[i];
+        sample_values_t *v = &sample.values[i];
+        if (!sample.failed) {
+            f->present = (double) v->count / (double) n;
+            f->distinct = _distinct(v, n, total);
+        }
+        free(v->hashes);
+    }
+    free(sample.values);
+    index_free(sample.positions, NULL);
+    if (sample.failed)
+        _stats_clear(stats);
+    return !sample.failed;
+}
+
+/**
+ * @brief Records the exact number of distinct values of a field.
+ *
+ * @param[in] stats    The statistics.
+ * @param[in] field    Field path.
+ * @param[in] distinct Distinct values.
+ * @param[in] holders  Documents holding the field.
+ * @return false on allocation failure.
+ */
+bool planner_stats_set(planner_stats_t *stats, const char *field, size_t distinct,
+                       size_t holders)
+{
+    field_stats_t *f = (field_stats_t *) _field_find(stats, field);
+    if (!f && !(f = _field_add(stats, field)))
+        return false;
+    size_t docs = stats->docs > holders ? stats->docs : holders;
+    f->distinct = (double) distinct;
+    f->present = docs ? (double) holders / (double) docs : 0;
+    return true;
+}
+
+/**
+ * @brief Returns the collection size the statistics describe.
+ *
+ * @param[in] stats The statistics.
+ * @return Documents in the collection when they were taken.
+ */
+size_t planner_stats_docs(const planner_stats_t *stats)
+{
+    return stats->docs;
+}
+
+/**
+ * @brief Describes the statistics of some fields.
+ *
+ * @param[in] stats  The statistics.
+ * @param[in] fields Object naming the fields to describe, or NULL for all.
+ * @return A new object, or NULL on allocation failure.
+ */
+cJSON *planner_stats_describe(const planner_stats_t *stats, const cJSON *fields)
+{
+    cJSON *out = cJSON_CreateObject();
+    for (size_t i = 0; out && i < stats->count; i++) {
+        const field_stats_t *f = &stats->fields[i];
+        bool wanted = !fields;
+        for (const cJSON *item = fields ? fields->child : NULL; !wanted && item; item = item->next)
+            wanted = item->string && _field_find(stats, item->string) == f;
+        if (!wanted)
+            continue;
+        cJSON *info = cJSON_AddObjectToObject(out, f->name);
+        bool ok = info && cJSON_AddNumberToObject(info, "present", f->present) &&
+                  cJSON_AddNumberToObject(info, "distinct", round(f->distinct));
+        if (ok && f->numbers) {
+            ok = cJSON_AddNumberToObject(info, "min", f->min) &&
+                 cJSON_AddNumberToObject(info, "max", f->max);
+        }
+        if (!ok) {
+            cJSON_Delete(out);
+            return NULL;
+        }
+    }
+    return out;
+}
+
+static double _filter_selectivity(const planner_stats_t *stats, const cJSON *filter);
+
+/**
+ * @brief Estimates the fraction of documents a condition on a field matches.
+ *
+ * @param[in] stats The statistics (may be NULL).
+ * @param[in] field Field path.
+ * @param[in] cond  A value to equal or an operator expression.
+ * @return A fraction in [0, 1].
+ */
+static double _condition_selectivity(const planner_stats_t *stats, const char *field,
+                                     const cJSON *cond)
+{
+    const field_stats_t *f = _field_find(stats, field);
+    double present = f ? f->present : 1;
+    double distinct = f ? (f->distinct < 1 ? 1 : f->distinct) : PLANNER_DEFAULT_DISTINCT;
+    double equal = present / distinct;
+    if (!query_is_operator(cond))
+        return equal;
+
+    double sel = 1, lo = -INFINITY, hi = INFINITY;
+    bool range = false, numeric = true;
+    for (const cJSON *op = cond->child; op; op = op->next) {
+        const char *name = op->string ? op->string : "";
+        if (strcmp(name, "$eq") == 0) {
+            sel *= equal;
+        } else if (strcmp(name, "$ne") == 0) {
+            sel *= 1 - equal;
+        } else if (strcmp(name, "$in") == 0 || strcmp(name, "$nin") == 0) {
+            double in = equal * cJSON_GetArraySize(op);
+            in = in > present ? present : in;
+            sel *= name[1] == 'i' ? in : 1 - in;
+        } else if (strcmp(name, "$exists") == 0) {
+            sel *= cJSON_IsTrue(op) || (cJSON_IsNumber(op) && op->valuedouble != 0) ? present
+                                                                                  : 1 - present;
+        } else if (strcmp(name, "$not") == 0) {
+            sel *= 1 - _condition_selectivity(stats, field, op);
+        } else if (strcmp(name, "$gt") == 0 || strcmp(name, "$gte") == 0 ||
+                   strcmp(name, "$lt") == 0 || strcmp(name, "$lte") == 0) {
+            range = true;
+            numeric = numeric && cJSON_IsNumber(op);
+            if (cJSON_IsNumber(op) && name[1] == 'g' && op->valuedouble > lo)
+                lo = op->valuedouble;
+            else if (cJSON_IsNumber(op) && name[1] == 'l' && op->valuedouble < hi)
+                hi = op->valuedouble;
+        } else {
+            return 0; /* Unknown operators never match */
+        }
+    }
+    if (!range)
+        return sel;
+
+    /* Numeric ranges cover part of the sampled range, others a third of it */
+    double part = 1.0 / 3;
+    if (numeric && f && f->numbers) {
+        double from = lo > f->min ? lo : f->min, to = hi < f->max ? hi : f->max;
+        if (f->max > f->min)
+            part = to < from ? 0 : (to - from) / (f->max - f->min);
+        else
+            part = (from <= to) ? 1 : 0;
+        double floor = stats->docs ? 0.5 / (double) stats->docs : 0;
+        part = part < floor ? floor : part;
+    }
+    return sel * present * part;
+}
+
+/**
+ * @brief Estimates the fraction of documents every member of a filter matches.
+ *
+ * @param[in] stats  The statistics (may be NULL).
+ * @param[in] filter The filter.
+ * @return A fraction in [0, 1].
+ */
+static double _filter_selectivity(const planner_stats_t *stats, const cJSON *filter)
+{
+    double sel = 1;
+    for (const cJSON *item = filter->child; item; item = item->next) {
+        if (!item->string)
+            return 0;
+        if (strcmp(item->string, "$and") == 0 || strcmp(item->string, "$or") == 0) {
+            bool and = item->string[1] == 'a';
+            double part = and ? 1 : 0;
+            for (const cJSON *sub = cJSON_IsArray(item) ? item->child : NULL; sub;
+                 sub = sub->next) {
+                double s = cJSON_IsObject(sub) ? _filter_selectivity(stats, sub) : 0;
+                part = and ? part * s : 1 - (1 - part) * (1 - s);
+            }
+            sel *= part;
+        } else if (strcmp(item->string, "$not") == 0) {
+            sel *= cJSON_IsObject(item) ? 1 - _filter_selectivity(stats, item) : 0;
+        } else {
+            sel *= _condition_selectivity(stats, item->string, item);
+        }
+    }
+    return sel < 0 ? 0 : sel > 1 ? 1 : sel;
+}
+
+/**
+ * @brief Estimates the fraction of documents a query matches.
+ *
+ * @param[in] stats The statistics (may be NULL).
+ * @param[in] query The filter (NULL matches all).
+ * @return A fraction in [0, 1].
+ */
+double planner_selectivity(const planner_stats_t *stats, const cJSON *query)
+{
+    return query ? _filter_selectivity(stats, query) : 1;
+}
+
+/**
+ * @brief Computes the documents an access path is expected to examine.
+ *
+ * @param[in,out] plan    The access path.
+ * @param[in]     matches Expected matching documents.
+ * @param[in]     limit   Results wanted (0 for all).
+ * @param[in]     sorted  Results are sorted.
+ */
+void planner_cost(plan_t *plan, double matches, size_t limit, bool sorted)
+{
+    double candidates = (double) plan->candidates;
+    plan->examined = candidates;
+    if (limit == 0 || (sorted && !plan->ordered) || candidates == 0 || matches <= 0)
+        return;
+    double rate = matches < candidates ? matches / candidates : 1;
+    double needed = (double) limit / rate;
+    if (needed < candidates)
+        plan->examined = needed;
+}
+
+/**
+ * @brief Names an access path.
+ *
+ * @param[in] access The access path.
+ * @return Its name.
+ */
+const char *planner_access_name(plan_access_t access)
+{
+    static const char *names[] = {"scan", "id", "index", "intersect"};
+    return names[access];
+}
@@ -5,24 +5,727 @@
  * This module provides the implementation for comparing database documents
  * against specific JSON filter criteria. It serves as the primary filtering
  * logic for the find and delete operations.
+ *
+ * Besides query_match(), which walks the query for every document, a query
+ * can be compiled once into a program: the fields it names become slots, its
+ * values become typed constants and its comparisons become opcodes. Every
+ * instruction names the instruction to run next when its comparison holds
+ * and when it does not, so `$and`, `$or`, `$not` and the negated operators
+ * compile into jumps instead of nested evaluation.
+ *
+ * Field names are paths: dotted segments that name a member of an object or,
+ * as decimal numbers, an element of an array. A program parses each of them
+ * once, and projections and indexes keep parsed paths too.
  */
 
 #include "../include/query.h"
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Jump targets ending a program run.
+ */
+#define PROG_MATCH SIZE_MAX
+#define PROG_FAIL (SIZE_MAX - 1)
+
+/**
+ * @brief Query operators.
+ */
+typedef enum
+{
+    QUERY_EQ,      /**< `$eq`: equal to the operand. */
+    QUERY_NE,      /**< `$ne`: missing or not equal to the operand. */
+    QUERY_GT,      /**< `$gt`: above the operand. */
+    QUERY_GTE,     /**< `$gte`: at or above the operand. */
+    QUERY_LT,      /**< `$lt`: below the operand. */
+    QUERY_LTE,     /**< `$lte`: at or below the operand. */
+    QUERY_IN,      /**< `$in`: equal to a value of the operand array. */
+    QUERY_NIN,     /**< `$nin`: missing or equal to no value of the operand array. */
+    QUERY_EXISTS,  /**< `$exists`: present or missing, as the operand says. */
+    QUERY_NOT,     /**< `$not`: the operand condition does not hold. */
+    QUERY_UNKNOWN  /**< Anything else (never matches). */
+} query_operator_t;
+
+/**
+ * @brief Comparison performed by a program instruction.
+ *
+ * Every comparison fails on a missing field; the negated operators swap the
+ * jump targets of the comparison they negate.
+ */
+typedef enum
+{
+    OP_EQ_NUMBER,  /**< Number equal to the constant. */
+    OP_EQ_STRING,  /**< String equal to the constant. */
+    OP_EQ_BOOL,    /**< Boolean equal to the constant. */
+    OP_EQ_NULL,    /**< Null. */
+    OP_EQ_VALUE,   /**< Array or object equal to the constant. */
+    OP_GT_NUMBER,  /**< Number above the constant. */
+    OP_GTE_NUMBER, /**< Number at or above the constant. */
+    OP_LT_NUMBER,  /**< Number below the constant. */
+    OP_LTE_NUMBER, /**< Number at or below the constant. */
+    OP_GT_STRING,  /**< String after the constant. */
+    OP_GTE_STRING, /**< String at or after the constant. */
+    OP_LT_STRING,  /**< String before the constant. */
+    OP_LTE_STRING, /**< String at or before the constant. */
+    OP_EXISTS      /**< Any value. */
+} query_op_t;
+
+/**
+ * @brief One comparison of a compiled query.
+ */
+typedef struct
+{
+    query_op_t op; /**< Comparison. */
+    size_t slot;   /**< Field the comparison reads. */
+    size_t pass;   /**< Instruction to run if it holds (or PROG_MATCH / PROG_FAIL). */
+    size_t fail;   /**< Instruction to run otherwise (or PROG_MATCH / PROG_FAIL). */
+    double number; /**< Constant of number and boolean comparisons. */
+    char *string;  /**< Constant of string comparisons (owned by the program). */
+    cJSON *value;  /**< Constant of array and object comparisons (owned by the program). */
+} query_insn_t;
+
+/**
+ * @brief One segment of a field path.
+ */
+typedef struct
+{
+    const char *name; /**< Segment, NUL-terminated. */
+    size_t len;       /**< Segment length in bytes. */
+    size_t index;     /**< Array position it names (SIZE_MAX unless it is a decimal number). */
+} query_step_t;
+
+/**
+ * @brief Parsed field path.
+ */
+struct query_path
+{
+    char *text;          /**< The path as written. */
+    char *names;         /**< Copy of text with every '.' replaced by a NUL. */
+    query_step_t *steps; /**< Segments, outermost first. */
+    size_t count;        /**< Entries in steps. */
+};
+
+/**
+ * @brief Compiled query state.
+ */
+struct query_program
+{
+    query_path_t **paths; /**< Field paths (one per slot). */
+    size_t path_count;    /**< Slots used. */
+    query_insn_t *insns;  /**< Comparisons. */
+    size_t count;         /**< Comparisons used. */
+    size_t cap;           /**< Comparisons allocated. */
+    size_t start;         /**< First instruction (or PROG_MATCH / PROG_FAIL). */
+    bool filter;          /**< A query was given, so a NULL document does not match. */
+};
+
+/**
+ * @brief Returns the sort rank of a value's type.
+ *
+ * @param[in] value Value (may be NULL).
+ * @return 1 for numbers, 2 for strings, 3 for booleans, 0 for anything else.
+ */
+static int _type_rank(const cJSON *value)
+{
+    if (cJSON_IsNumber(value))
+        return 1;
+    if (cJSON_IsString(value))
+        return 2;
+    if (cJSON_IsBool(value))
+        return 3;
+    return 0;
+}
+
+/**
+ * @brief Orders two values the way sorts and ordered indexes do.
+ *
+ * @param[in] a First value (may be NULL).
+ * @param[in] b Second value (may be NULL).
+ * @return A negative, zero or positive value as @p a sorts before, equal to or after @p b.
+ */
+int query_compare(const cJSON *a, const cJSON *b)
+{
+    int ra = _type_rank(a), rb = _type_rank(b);
+    if (ra != rb)
+        return ra - rb;
+    switch (ra) {
+        case 1:
+            return (a->valuedouble > b->valuedouble) - (a->valuedouble < b->valuedouble);
+        case 2:
+            return strcmp(a->valuestring, b->valuestring);
+        case 3:
+            return cJSON_IsTrue(a) - cJSON_IsTrue(b);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Tells whether a query value is an operator expression.
+ *
+ * @param[in] item Query value.
+ * @return true for an object whose first member starts with '$'.
+ */
+bool query_is_operator(const cJSON *item)
+{
+    return cJSON_IsObject(item) && item->child && item->child->string &&
+           item->child->string[0] == '$';
+}
+
+/**
+ * @brief Folds an ASCII letter to lower case.
+ *
+ * The process never calls setlocale(), so this is what tolower() does.
+ *
+ * @param[in] c The character.
+ * @return The lowercase letter, or @p c if it is not an uppercase letter.
+ */
+static inline unsigned char _fold(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char) (c + ('a' - 'A')) : c;
+}
+
+/**
+ * @brief Tells whether two field names are the same field.
+ *
+ * @param[in] a First field name.
+ * @param[in] b Second field name.
+ * @return true if the names only differ in case.
+ */
+bool query_field_equal(const char *a, const char *b)
+{
+    const unsigned char *x = (const unsigned char *) a, *y = (const unsigned char *) b;
+    while (*x && _fold(*x) == _fold(*y)) {
+        x++;
+        y++;
+    }
+    return *x == '\0' && *y == '\0';
+}
+
+/**
+ * @brief Reads the array position a path segment names.
+ *
+ * @param[in] name Segment.
+ * @param[in] len  Segment length in bytes.
+ * @return The position, or SIZE_MAX unless the segment is 1 to 9 decimal digits.
+ */
+static size_t _index(const char *name, size_t len)
+{
+    if (len == 0 || len > 9)
+        return SIZE_MAX;
+    size_t index = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] < '0' || name[i] > '9')
+            return SIZE_MAX;
+        index = index * 10 + (size_t) (name[i] - '0');
+    }
+    return index;
+}
+
+/**
+ * @brief Finds a member of an object by name, ignoring case.
+ *
+ * Matches the member cJSON_GetObjectItem() would return, without folding the
+ * case of names that already agree byte for byte.
+ *
+ * @param[in] object The object.
+ * @param[in] name   Member name (need not be NUL-terminated).
+ * @param[in] len    Length of @p name in bytes.
+ * @return The first member with that name ignoring case, or NULL.
+ */
+static const cJSON *_lookup(const cJSON *object, const char *name, size_t len)
+{
+    const unsigned char *b = (const unsigned char *) name;
+    for (const cJSON *item = object->child; item; item = item->next) {
+        const unsigned char *a = (const unsigned char *) item->string;
+        if (!a)
+            continue;
+        size_t i = 0;
+        while (i < len && (a[i] == b[i] || _fold(a[i]) == _fold(b[i])))
+            i++;
+        if (i == len && a[i] == '\0')
+            return item;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Follows one path segment.
+ *
+ * @param[in] node The value reached so far (may be NULL).
+ * @param[in] step The segment.
+ * @return The member of an object named by the segment, or the element of an
+ *         array at the position it names; NULL if there is none.
+ */
+static const cJSON *_step(const cJSON *node, const query_step_t *step)
+{
+    if (cJSON_IsObject(node))
+        return _lookup(node, step->name, step->len);
+    if (!cJSON_IsArray(node) || step->index == SIZE_MAX)
+        return NULL;
+    const cJSON *item = node->child;
+    for (size_t i = step->index; item && i > 0; i--)
+        item = item->next;
+    return item;
+}
+
+/**
+ * @brief Resolves a dotted field name without parsing it ahead of time.
+ *
+ * @param[in] doc   The document.
+ * @param[in] field Field name, e.g. `address.city` or `items.0.sku`.
+ * @return The value, or NULL if the document does not hold it.
+ */
+static const cJSON *_get(const cJSON *doc, const char *field)
+{
+    const cJSON *node = doc;
+    for (;;) {
+        const char *dot = strchr(field, '.');
+        query_step_t step = {field, dot ? (size_t) (dot - field) : strlen(field), SIZE_MAX};
+        if (cJSON_IsArray(node))
+            step.index = _index(step.name, step.len);
+        node = _step(node, &step);
+        if (!node || !dot)
+            return node;
+        field = dot + 1;
+    }
+}
+
+/**
+ * @brief Parses a dotted field name.
+ *
+ * @param[in] field Field name.
+ * @return The path (release with query_path_free()), or NULL on allocation failure.
+ */
+query_path_t *query_path_create(const char *field)
+{
+    size_t count = 1;
+    for (const char *p = field; *p; p++)
+        count += *p == '.';
+
+    query_path_t *path = calloc(1, sizeof(*path));
+    if (!path)
+        return NULL;
+    path->text = strdup(field);
+    path->names = strdup(field);
+    path->steps = calloc(count, sizeof(*path->steps));
+    if (!path->text || !path->names || !path->steps) {
+        query_path_free(path);
+        return NULL;
+    }
+
+    char *name = path->names;
+    for (; path->count < count; path->count++) {
+        char *dot = strchr(name, '.');
+        if (dot)
+            *dot = '\0';
+        query_step_t *step = &path->steps[path->count];
+        step->name = name;
+        step->len = strlen(name);
+        step->index = _index(name, step->len);
+        name += step->len + 1;
+    }
+    return path;
+}
+
+/**
+ * @brief Releases a parsed path.
+ *
+ * @param[in] path The path (may be NULL).
+ */
+void query_path_free(query_path_t *path)
+{
+    if (!path)
+        return;
+    free(path->text);
+    free(path->names);
+    free(path->steps);
+    free(path);
+}
+
+/**
+ * @brief Returns the field name a path was parsed from.
+ *
+ * @param[in] path The path.
+ * @return The field name.
+ */
+const char *query_path_text(const query_path_t *path)
+{
+    return path->text;
+}
+
+/**
+ * @brief Resolves a path in a document.
+ *
+ * @param[in] path The path.
+ * @param[in] doc  The document (may be NULL).
+ * @return The value, or NULL if the document does not hold it.
+ */
+const cJSON *query_path_get(const query_path_t *path, const cJSON *doc)
+{
+    const cJSON *node = doc;
+    for (size_t i = 0; node && i < path->count; i++)
+        node = _step(node, &path->steps[i]);
+    return node;
+}
+
+/**
+ * @brief Detaches the value a path names from a document.
+ *
+ * @param[in] path The path.
+ * @param[in] doc  The document.
+ * @return The detached value (caller frees), or NULL if the document does not
+ *         hold it.
+ */
+cJSON *query_path_detach(const query_path_t *path, cJSON *doc)
+{
+    const cJSON *parent = doc;
+    for (size_t i = 0; parent && i + 1 < path->count; i++)
+        parent = _step(parent, &path->steps[i]);
+    const cJSON *item = parent ? _step(parent, &path->steps[path->count - 1]) : NULL;
+    return item ? cJSON_DetachItemViaPointer((cJSON *) parent, (cJSON *) item) : NULL;
+}
+
+/**
+ * @brief Stores a value under a path, creating the objects leading to it.
+ *
+ * @param[in] path  The path.
+ * @param[in] doc   The object to store into.
+ * @param[in] value The value (owned by @p doc on success).
+ * @return false if a segment leading to the value holds something other than
+ *         an object, the last one already holds a value, or on allocation
+ *         failure.
+ */
+bool query_path_put(const query_path_t *path, cJSON *doc, cJSON *value)
+{
+    cJSON *node = doc;
+    for (size_t i = 0; i + 1 < path->count; i++) {
+        const query_step_t *step = &path->steps[i];
+        cJSON *next = (cJSON *) _lookup(node, step->name, step->len);
+        if (!next && !(next = cJSON_AddObjectToObject(node, step->name)))
+            return false;
+        if (!cJSON_IsObject(next))
+            return false;
+        node = next;
+    }
+    const query_step_t *last = &path->steps[path->count - 1];
+    if (_lookup(node, last->name, last->len))
+        return false;
+    return cJSON_AddItemToObject(node, last->name, value);
+}
+
+/**
+ * @brief Copies a value, leaving out what some paths name below it.
+ *
+ * @param[in] value The value the first @p depth segments of every path lead to.
+ * @param[in] paths The paths.
+ * @param[in] count Entries in paths.
+ * @param[in] depth Segments already followed.
+ * @return The copy (caller frees), or NULL on allocation failure.
+ */
+static cJSON *_copy_except(const cJSON *value, query_path_t *const *paths, size_t count,
+                           size_t depth)
+{
+    if (!cJSON_IsObject(value) && !cJSON_IsArray(value))
+        return cJSON_Duplicate(value, 1);
+
+    /* Resolve each next segment once, then compare members by address */
+    const cJSON **targets = malloc(count * sizeof(*targets));
+    query_path_t **below = malloc(count * sizeof(*below));
+    cJSON *copy = (targets && below)
+                      ? (cJSON_IsArray(value) ? cJSON_CreateArray() : cJSON_CreateObject())
+                      : NULL;
+    for (size_t i = 0; copy && i < count; i++)
+        targets[i] = _step(value, &paths[i]->steps[depth]);
+
+    for (const cJSON *child = copy ? value->child : NULL; child; child = child->next) {
+        size_t n = 0;
+        bool drop = false;
+        for (size_t i = 0; i < count && !drop; i++) {
+            if (targets[i] != child)
+                continue;
+            if (depth + 1 == paths[i]->count)
+                drop = true;
+            else
+                below[n++] = paths[i];
+        }
+        if (drop)
+            continue;
+
+        /* Plain copies keep their member name, partial ones are added under it */
+        cJSON *item = n ? _copy_except(child, below, n, depth + 1) : cJSON_Duplicate(child, 1);
+        bool named = n && child->string;
+        bool added = item && (named ? cJSON_AddItemToObject(copy, child->string, item)
+                                    : cJSON_AddItemToArray(copy, item));
+        if (!added) {
+            cJSON_Delete(item);
+            cJSON_Delete(copy);
+            copy = NULL;
+            break;
+        }
+    }
+    free(targets);
+    free(below);
+    return copy;
+}
+
+/**
+ * @brief Copies a document without the values some paths name.
+ *
+ * @param[in] doc   The document.
+ * @param[in] paths Paths of the values to leave out.
+ * @param[in] count Entries in paths.
+ * @return The copy (caller frees), or NULL on allocation failure.
+ */
+cJSON *query_path_copy_except(const cJSON *doc, query_path_t *const *paths, size_t count)
+{
+    return count ? _copy_except(doc, paths, count, 0) : cJSON_Duplicate(doc, 1);
+}
+
+/**
+ * @brief Tells whether a field name can address an array element.
+ *
+ * @param[in] field Field name.
+ * @return true if a segment is an array index, as in `items.0.sku`.
+ */
+bool query_field_positional(const char *field)
+{
+    for (;;) {
+        const char *dot = strchr(field, '.');
+        size_t len = dot ? (size_t) (dot - field) : strlen(field);
+        if (_index(field, len) != SIZE_MAX)
+            return true;
+        if (!dot)
+            return false;
+        field = dot + 1;
+    }
+}
+
+/**
+ * @brief Tells whether a path leads through or to the value of another.
+ *
+ * @param[in] path  The path.
+ * @param[in] outer The enclosing path.
+ * @return true if @p outer names @p path or one of the values leading to it,
+ *         comparing segments like documents are searched (ignoring case).
+ */
+bool query_path_within(const query_path_t *path, const query_path_t *outer)
+{
+    if (outer->count > path->count)
+        return false;
+    for (size_t i = 0; i < outer->count; i++) {
+        const query_step_t *a = &outer->steps[i], *b = &path->steps[i];
+        if (a->len != b->len)
+            return false;
+        for (size_t j = 0; j < a->len; j++) {
+            if (_fold((unsigned char) a->name[j]) != _fold((unsigned char) b->name[j]))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Identifies an operator by name.
+ *
+ * @param[in] name Member name of the operator expression.
+ * @return The operator, or QUERY_UNKNOWN.
+ */
+static query_operator_t _operator(const char *name)
+{
+    static const char *names[] = {"$eq", "$ne",  "$gt",     "$gte", "$lt",
+                                  "$lte", "$in", "$nin", "$exists", "$not"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0)
+            return (query_operator_t) i;
+    }
+    return QUERY_UNKNOWN;
+}
+
+/**
+ * @brief Tells whether a document value equals a query value.
+ *
+ * Strings, numbers, booleans and null compare by type and value; arrays
+ * element by element; objects member by member, by exact name and in any
+ * order.
+ *
+ * @param[in] value Document value (NULL when the field is missing).
+ * @param[in] query Query value.
+ * @return true if both are equal.
+ */
+static bool _equal(const cJSON *value, const cJSON *query)
+{
+    if (!value)
+        return false;
+    if (cJSON_IsString(query))
+        return cJSON_IsString(value) && strcmp(value->valuestring, query->valuestring) == 0;
+    if (cJSON_IsNumber(query))
+        return cJSON_IsNumber(value) && value->valuedouble == query->valuedouble;
+    if (cJSON_IsBool(query))
+        return cJSON_IsBool(value) && cJSON_IsTrue(value) == cJSON_IsTrue(query);
+    if (cJSON_IsNull(query))
+        return cJSON_IsNull(value);
+
+    if (cJSON_IsArray(query)) {
+        if (!cJSON_IsArray(value))
+            return false;
+        const cJSON *a = value->child, *b = query->child;
+        for (; a && b; a = a->next, b = b->next) {
+            if (!_equal(a, b))
+                return false;
+        }
+        return !a && !b;
+    }
+    if (cJSON_IsObject(query)) {
+        if (!cJSON_IsObject(value) || cJSON_GetArraySize(value) != cJSON_GetArraySize(query))
+            return false;
+        for (const cJSON *b = query->child; b; b = b->next) {
+            if (!b->string || !_equal(cJSON_GetObjectItemCaseSensitive(value, b->string), b))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Tells whether a document value equals a value of a query array.
+ *
+ * @param[in] value Document value (may be NULL).
+ * @param[in] list  Query array.
+ * @return true if some element equals @p value.
+ */
+static bool _equal_any(const cJSON *value, const cJSON *list)
+{
+    for (const cJSON *item = list->child; item; item = item->next) {
+        if (_equal(value, item))
+            return true;
+    }
+    return false;
+}
+
+static bool _match_condition(const cJSON *value, const cJSON *cond);
+
+/**
+ * @brief Evaluates one operator against a document value.
+ *
+ * Range operators compare numbers with numbers and strings with strings;
+ * any other pairing does not match. `$ne`, `$nin`, `$exists: false` and
+ * `$not` match missing fields. Operands of the wrong type never match.
+ *
+ * @param[in] value Document value (NULL when the field is missing).
+ * @param[in] op    The operator, e.g. `"$gte": 10`.
+ * @return true if the operator holds.
+ */
+static bool _match_operator(const cJSON *value, const cJSON *op)
+{
+    query_operator_t kind = _operator(op->string);
+    switch (kind) {
+        case QUERY_EQ:
+            return _equal(value, op);
+        case QUERY_NE:
+            return !_equal(value, op);
+        case QUERY_IN:
+        case QUERY_NIN:
+            if (!cJSON_IsArray(op))
+                return false;
+            return _equal_any(value, op) == (kind == QUERY_IN);
+        case QUERY_EXISTS:
+            if (!cJSON_IsBool(op) && !cJSON_IsNumber(op))
+                return false;
+            return (value != NULL) == (cJSON_IsBool(op) ? cJSON_IsTrue(op) : op->valuedouble != 0);
+        case QUERY_NOT:
+            return !_match_condition(value, op);
+        case QUERY_GT:
+        case QUERY_GTE:
+        case QUERY_LT:
+        case QUERY_LTE:
+            break;
+        default:
+            return false; /* Unknown operator */
+    }
+
+    bool same_type = (cJSON_IsNumber(op) && cJSON_IsNumber(value)) ||
+                     (cJSON_IsString(op) && cJSON_IsString(value));
+    if (!same_type)
+        return false;
+    int c = query_compare(value, op);
+    return kind == QUERY_GT    ? c > 0
+           : kind == QUERY_GTE ? c >= 0
+           : kind == QUERY_LT  ? c < 0
+                               : c <= 0;
+}
+
+/**
+ * @brief Evaluates the condition a query places on a field.
+ *
+ * @param[in] value Document value (NULL when the field is missing).
+ * @param[in] cond  A value to equal, or an operator expression whose every
+ *                  operator must hold.
+ * @return true if the condition holds.
+ */
+static bool _match_condition(const cJSON *value, const cJSON *cond)
+{
+    if (!query_is_operator(cond))
+        return _equal(value, cond);
+    for (const cJSON *op = cond->child; op; op = op->next) {
+        if (!op->string || !_match_operator(value, op))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Evaluates every member of a filter against a document.
+ *
+ * @param[in] doc    The document.
+ * @param[in] filter The filter (its members are read; nested filters must be
+ *                   objects).
+ * @return true if every member holds.
+ */
+static bool _match_filter(const cJSON *doc, const cJSON *filter)
+{
+    for (const cJSON *item = filter->child; item; item = item->next) {
+        bool ok;
+        if (!item->string) {
+            ok = false;
+        } else if (strcmp(item->string, "$and") == 0) {
+            ok = cJSON_IsArray(item);
+            for (const cJSON *sub = ok ? item->child : NULL; ok && sub; sub = sub->next)
+                ok = cJSON_IsObject(sub) && _match_filter(doc, sub);
+        } else if (strcmp(item->string, "$or") == 0) {
+            ok = false;
+            for (const cJSON *sub = cJSON_IsArray(item) ? item->child : NULL; !ok && sub;
+                 sub = sub->next)
+                ok = cJSON_IsObject(sub) && _match_filter(doc, sub);
+        } else if (strcmp(item->string, "$not") == 0) {
+            ok = cJSON_IsObject(item) && !_match_filter(doc, item);
+        } else {
+            ok = _match_condition(_get(doc, item->string), item);
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
 /**
  * @brief Evaluates if a document matches a given query filter.
- * * Performs a field-by-field comparison between the document and the query.
- * Supported types for matching include Strings, Numbers, and Booleans.
- * For a match to be successful, every key in the query must exist in the
- * document with a matching value and type.
+ * * Every member of the query must hold. A member names a field and either a
+ * value the field must equal (strings, numbers, booleans and null by type and
+ * value, arrays and objects in full) or an operator expression (`$eq`, `$ne`,
+ * `$gt`, `$gte`, `$lt`, `$lte`, `$in`, `$nin`, `$exists`, `$not`). The
+ * members `$and` and `$or` take an array of filters, and `$not` a filter.
  * * @param[in] doc   The source JSON document to evaluate.
  * @param[in] query The JSON object containing filter criteria (NULL matches all).
  * @return true if the document satisfies all query conditions or if query is NULL.
- * @return false if any field value/type differs or if a required field is missing.
- * @note This implementation performs shallow matching; nested objects or
- * arrays are treated as type mismatches.
+ * @return false if any condition fails, e.g. a field compared with a value is
+ * missing or holds a value of another type.
+ * @note Field names are matched case-insensitively, like cJSON_GetObjectItem()
+ * does. A dotted name such as `address.city` or `items.0.sku` descends into
+ * objects by member name and into arrays by position.
  */
 bool query_match(cJSON *doc, cJSON *query)
 {
@@ -36,44 +739,519 @@ bool query_match(cJSON *doc, cJSON *query)
         return false;
     }
 
-    cJSON *item = NULL;
-
-    /* Iterate through every field defined in the query object */
-    cJSON_ArrayForEach(item, query)
-    {
-        cJSON *doc_val = cJSON_GetObjectItem(doc, item->string);
+    return _match_filter(doc, query);
+}
 
-        /* 1. Check if the required field exists in the document */
-        if (!doc_val) {
-            return false;
+/**
+ * @brief Collects the conditions of a filter into a flat object.
+ *
+ * @param[in,out] out    The object being built.
+ * @param[in]     filter The filter.
+ * @return false on allocation failure.
+ */
+static bool _flatten(cJSON *out, const cJSON *filter)
+{
+    for (const cJSON *item = filter->child; item; item = item->next) {
+        if (!item->string || strcmp(item->string, "$not") == 0)
+            continue;
+        if (strcmp(item->string, "$and") == 0) {
+            const cJSON *sub = cJSON_IsArray(item) ? item->child : NULL;
+            for (; sub; sub = sub->next) {
+                if (cJSON_IsObject(sub) && !_flatten(out, sub))
+                    return false;
+            }
+            continue;
         }
 
-        /* 2. Compare based on JSON type */
-
-        /* String Comparison */
-        if (cJSON_IsString(item) && cJSON_IsString(doc_val)) {
-            if (strcmp(item->valuestring, doc_val->valuestring) != 0) {
+        /* The first condition on a field is kept; operators on it are merged */
+        cJSON *kept = cJSON_GetObjectItem(out, item->string);
+        cJSON *copy = NULL;
+        if (!kept) {
+            copy = cJSON_Duplicate(item, 1);
+            if (!copy || !cJSON_AddItemToObject(out, item->string, copy)) {
+                cJSON_Delete(copy);
                 return false;
             }
-        }
-        /* Number Comparison (Double Precision) */
-        else if (cJSON_IsNumber(item) && cJSON_IsNumber(doc_val)) {
-            if (item->valuedouble != doc_val->valuedouble) {
-                return false;
+        } else if (query_is_operator(kept) && strcmp(item->string, "$or") != 0) {
+            bool merge = query_is_operator(item);
+            for (const cJSON *op = merge ? item->child : item; op; op = merge ? op->next : NULL) {
+                copy = cJSON_Duplicate(op, 1);
+                if (!copy || !cJSON_AddItemToObject(kept, merge ? op->string : "$eq", copy)) {
+                    cJSON_Delete(copy);
+                    return false;
+                }
             }
         }
-        /* Boolean Comparison */
-        else if (cJSON_IsBool(item) && cJSON_IsBool(doc_val)) {
-            if (cJSON_IsTrue(item) != cJSON_IsTrue(doc_val)) {
-                return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Collects the conditions a query places on single fields.
+ *
+ * @param[in] query The filter (may be NULL).
+ * @return A new object (caller frees), or NULL on allocation failure.
+ */
+cJSON *query_flatten(const cJSON *query)
+{
+    cJSON *out = cJSON_CreateObject();
+    if (out && query && !_flatten(out, query)) {
+        cJSON_Delete(out);
+        return NULL;
+    }
+    return out;
+}
+
+/**
+ * @brief Returns the slot of a field, adding it if needed.
+ *
+ * Fields are named case-insensitively, like documents are searched.
+ *
+ * @param[in,out] prog The program being compiled.
+ * @param[in]     name Field name.
+ * @return The slot, or SIZE_MAX on allocation failure.
+ */
+static size_t _slot(query_program_t *prog, const char *name)
+{
+    for (size_t i = 0; i < prog->path_count; i++) {
+        if (query_field_equal(prog->paths[i]->text, name))
+            return i;
+    }
+
+    query_path_t *path = query_path_create(name);
+    query_path_t **paths =
+        path ? realloc(prog->paths, (prog->path_count + 1) * sizeof(*paths)) : NULL;
+    if (!paths) {
+        query_path_free(path);
+        return SIZE_MAX;
+    }
+    prog->paths = paths;
+    prog->paths[prog->path_count] = path;
+    return prog->path_count++;
+}
+
+/**
+ * @brief Appends a comparison to a program.
+ *
+ * @param[in,out] prog     The program being compiled.
+ * @param[in]     op       Comparison.
+ * @param[in]     slot     Field the comparison reads.
+ * @param[in]     constant Query value to compare with (NULL for OP_EXISTS).
+ * @param[in]     pass     Instruction to run if the comparison holds.
+ * @param[in]     fail     Instruction to run otherwise.
+ * @param[out]    start    Receives the index of the new instruction.
+ * @return false on allocation failure.
+ */
+static bool _emit(query_program_t *prog, query_op_t op, size_t slot, const cJSON *constant,
+                  size_t pass, size_t fail, size_t *start)
+{
+    if (prog->count == prog->cap) {
+        size_t cap = prog->cap ? prog->cap * 2 : 8;
+        query_insn_t *insns = realloc(prog->insns, cap * sizeof(*insns));
+        if (!insns)
+            return false;
+        prog->insns = insns;
+        prog->cap = cap;
+    }
+
+    query_insn_t *insn = &prog->insns[prog->count];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->slot = slot;
+    insn->pass = pass;
+    insn->fail = fail;
+    if (cJSON_IsBool(constant))
+        insn->number = cJSON_IsTrue(constant);
+    else if (cJSON_IsNumber(constant))
+        insn->number = constant->valuedouble;
+    else if (cJSON_IsString(constant) && !(insn->string = strdup(constant->valuestring)))
+        return false;
+    else if (op == OP_EQ_VALUE && !(insn->value = cJSON_Duplicate(constant, 1)))
+        return false;
+    *start = prog->count++;
+    return true;
+}
+
+/**
+ * @brief Lists the children of a node, so they can be compiled last to first.
+ *
+ * @param[in]  node  Object or array.
+ * @param[out] count Receives the number of children.
+ * @return The children (caller frees; NULL when there are none), or NULL on
+ *         allocation failure with @p count set to SIZE_MAX.
+ */
+static const cJSON **_children(const cJSON *node, size_t *count)
+{
+    size_t n = 0;
+    for (const cJSON *item = node->child; item; item = item->next)
+        n++;
+    *count = n;
+    if (n == 0)
+        return NULL;
+    const cJSON **items = malloc(n * sizeof(*items));
+    if (!items) {
+        *count = SIZE_MAX;
+        return NULL;
+    }
+    n = 0;
+    for (const cJSON *item = node->child; item; item = item->next)
+        items[n++] = item;
+    return items;
+}
+
+/**
+ * @brief Compiles an equality with a query value.
+ *
+ * @param[in,out] prog  The program being compiled.
+ * @param[in]     slot  Field compared.
+ * @param[in]     value Query value.
+ * @param[in]     pass  Where to go if the field equals the value.
+ * @param[in]     fail  Where to go otherwise.
+ * @param[out]    start Receives the entry point of the code.
+ * @return false on allocation failure.
+ */
+static bool _compile_equal(query_program_t *prog, size_t slot, const cJSON *value, size_t pass,
+                           size_t fail, size_t *start)
+{
+    query_op_t op;
+    if (cJSON_IsString(value))
+        op = OP_EQ_STRING;
+    else if (cJSON_IsNumber(value))
+        op = OP_EQ_NUMBER;
+    else if (cJSON_IsBool(value))
+        op = OP_EQ_BOOL;
+    else if (cJSON_IsNull(value))
+        op = OP_EQ_NULL;
+    else if (cJSON_IsArray(value) || cJSON_IsObject(value))
+        op = OP_EQ_VALUE;
+    else {
+        *start = fail; /* Never equal */
+        return true;
+    }
+    return _emit(prog, op, slot, value, pass, fail, start);
+}
+
+static bool _compile_condition(query_program_t *prog, size_t slot, const cJSON *cond, size_t pass,
+                               size_t fail, size_t *start);
+
+/**
+ * @brief Compiles one operator, as _match_operator() evaluates it.
+ *
+ * @param[in,out] prog  The program being compiled.
+ * @param[in]     slot  Field the operator applies to.
+ * @param[in]     op    The operator.
+ * @param[in]     pass  Where to go if it holds.
+ * @param[in]     fail  Where to go otherwise.
+ * @param[out]    start Receives the entry point of the code.
+ * @return false on allocation failure.
+ */
+static bool _compile_operator(query_program_t *prog, size_t slot, const cJSON *op, size_t pass,
+                              size_t fail, size_t *start)
+{
+    static const query_op_t ranges[][2] = {
+        [QUERY_GT] = {OP_GT_NUMBER, OP_GT_STRING},
+        [QUERY_GTE] = {OP_GTE_NUMBER, OP_GTE_STRING},
+        [QUERY_LT] = {OP_LT_NUMBER, OP_LT_STRING},
+        [QUERY_LTE] = {OP_LTE_NUMBER, OP_LTE_STRING},
+    };
+
+    query_operator_t kind = _operator(op->string);
+    switch (kind) {
+        case QUERY_EQ:
+            return _compile_equal(prog, slot, op, pass, fail, start);
+        case QUERY_NE:
+            return _compile_equal(prog, slot, op, fail, pass, start);
+        case QUERY_IN:
+        case QUERY_NIN: {
+            if (!cJSON_IsArray(op)) {
+                *start = fail;
+                return true;
             }
+            /* One equality per value, each falling through to the next */
+            size_t hit = kind == QUERY_IN ? pass : fail, miss = kind == QUERY_IN ? fail : pass;
+            size_t n;
+            const cJSON **values = _children(op, &n);
+            if (n == SIZE_MAX)
+                return false;
+            bool ok = true;
+            *start = miss;
+            while (ok && n-- > 0)
+                ok = _compile_equal(prog, slot, values[n], hit, *start, start);
+            free(values);
+            return ok;
+    }
+    case QUERY_EXISTS:
+        if (!cJSON_IsBool(op) && !cJSON_IsNumber(op)) {
+            *start = fail;
+            return true;
         }
-        /* Mismatching types or unsupported types (Arrays/Objects) */
-        else {
-            return false;
+        if (cJSON_IsBool(op) ? cJSON_IsTrue(op) : op->valuedouble != 0)
+            return _emit(prog, OP_EXISTS, slot, NULL, pass, fail, start);
+        return _emit(prog, OP_EXISTS, slot, NULL, fail, pass, start);
+    case QUERY_NOT:
+        return _compile_condition(prog, slot, op, fail, pass, start);
+    case QUERY_GT:
+    case QUERY_GTE:
+    case QUERY_LT:
+    case QUERY_LTE:
+        if (cJSON_IsNumber(op) || cJSON_IsString(op))
+            return _emit(prog, ranges[kind][cJSON_IsString(op)], slot, op, pass, fail, start);
+        *start = fail;
+        return true;
+    default:
+        *start = fail; /* Unknown operator */
+        return true;
+    }
+}
+
+/**
+ * @brief Compiles the condition a query places on a field.
+ *
+ * @param[in,out] prog  The program being compiled.
+ * @param[in]     slot  Field the condition applies to.
+ * @param[in]     cond  A value or an operator expression.
+ * @param[in]     pass  Where to go if it holds.
+ * @param[in]     fail  Where to go otherwise.
+ * @param[out]    start Receives the entry point of the code.
+ * @return false on allocation failure.
+ */
+static bool _compile_condition(query_program_t *prog, size_t slot, const cJSON *cond, size_t pass,
+                               size_t fail, size_t *start)
+{
+    if (!query_is_operator(cond))
+        return _compile_equal(prog, slot, cond, pass, fail, start);
+
+    size_t n;
+    const cJSON **ops = _children(cond, &n);
+    if (n == SIZE_MAX)
+        return false;
+    bool ok = true;
+    *start = pass;
+    while (ok && n-- > 0) {
+        if (ops[n]->string)
+            ok = _compile_operator(prog, slot, ops[n], *start, fail, start);
+        else
+            *start = fail;
+    }
+    free(ops);
+    return ok;
+}
+
+static bool _compile_filter(query_program_t *prog, const cJSON *filter, size_t pass, size_t fail,
+                            size_t *start);
+
+/**
+ * @brief Compiles one member of a filter.
+ *
+ * @param[in,out] prog  The program being compiled.
+ * @param[in]     item  The member.
+ * @param[in]     slot  Slot of the field it names (unused for `$and`, `$or`, `$not`).
+ * @param[in]     pass  Where to go if it holds.
+ * @param[in]     fail  Where to go otherwise.
+ * @param[out]    start Receives the entry point of the code.
+ * @return false on allocation failure.
+ */
+static bool _compile_member(query_program_t *prog, const cJSON *item, size_t slot, size_t pass,
+                            size_t fail, size_t *start)
+{
+    bool and = strcmp(item->string, "$and") == 0;
+    if (!and && strcmp(item->string, "$or") != 0) {
+        if (strcmp(item->string, "$not") != 0)
+            return _compile_condition(prog, slot, item, pass, fail, start);
+        if (!cJSON_IsObject(item)) {
+            *start = fail;
+            return true;
         }
+        return _compile_filter(prog, item, fail, pass, start);
     }
 
-    /* All query conditions were satisfied */
-    return true;
+    if (!cJSON_IsArray(item)) {
+        *start = fail;
+        return true;
+    }
+    size_t n;
+    const cJSON **subs = _children(item, &n);
+    if (n == SIZE_MAX)
+        return false;
+    bool ok = true;
+    *start = and ? pass : fail;
+    while (ok && n-- > 0) {
+        if (!cJSON_IsObject(subs[n]))
+            *start = and ? fail : *start;
+        else if (and)
+            ok = _compile_filter(prog, subs[n], *start, fail, start);
+        else
+            ok = _compile_filter(prog, subs[n], pass, *start, start);
+    }
+    free(subs);
+    return ok;
+}
+
+/**
+ * @brief Compiles every member of a filter.
+ *
+ * Members on the same field are compiled next to each other, so the field is
+ * looked up once; `$and`, `$or` and `$not` come last.
+ *
+ * @param[in,out] prog   The program being compiled.
+ * @param[in]     filter The filter.
+ * @param[in]     pass   Where to go if every member holds.
+ * @param[in]     fail   Where to go otherwise.
+ * @param[out]    start  Receives the entry point of the code.
+ * @return false on allocation failure.
+ */
+static bool _compile_filter(query_program_t *prog, const cJSON *filter, size_t pass, size_t fail,
+                            size_t *start)
+{
+    size_t n;
+    const cJSON **items = _children(filter, &n);
+    if (n == SIZE_MAX)
+        return false;
+    size_t *slots = n ? malloc(n * sizeof(*slots)) : NULL;
+    bool ok = n == 0 || slots;
+
+    /* Insertion sort by slot keeps members on one field in query order */
+    for (size_t i = 0; ok && i < n; i++) {
+        const cJSON *item = items[i];
+        size_t slot = SIZE_MAX;
+        if (item->string && strcmp(item->string, "$and") != 0 &&
+            strcmp(item->string, "$or") != 0 && strcmp(item->string, "$not") != 0) {
+            slot = _slot(prog, item->string);
+            ok = slot != SIZE_MAX;
+        }
+        size_t j = i;
+        for (; j > 0 && slots[j - 1] > slot; j--) {
+            items[j] = items[j - 1];
+            slots[j] = slots[j - 1];
+        }
+        items[j] = item;
+        slots[j] = slot;
+    }
+
+    *start = pass;
+    while (ok && n-- > 0) {
+        if (items[n]->string)
+            ok = _compile_member(prog, items[n], slots[n], *start, fail, start);
+        else
+            *start = fail;
+    }
+    free(slots);
+    free(items);
+    return ok;
+}
+
+/**
+ * @brief Compiles a query filter into a program.
+ *
+ * Code is generated from the last condition backwards, so every instruction
+ * knows where to go next when it is emitted.
+ *
+ * @param[in] query The filter (NULL matches all).
+ * @return The program (release with query_program_free()), or NULL on
+ *         allocation failure.
+ */
+query_program_t *query_compile(const cJSON *query)
+{
+    query_program_t *prog = calloc(1, sizeof(*prog));
+    if (!prog)
+        return NULL;
+    prog->filter = query != NULL;
+    prog->start = PROG_MATCH;
+    if (query && !_compile_filter(prog, query, PROG_MATCH, PROG_FAIL, &prog->start)) {
+        query_program_free(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/**
+ * @brief Releases a compiled query.
+ *
+ * @param[in] prog The program (may be NULL).
+ */
+void query_program_free(query_program_t *prog)
+{
+    if (!prog)
+        return;
+    for (size_t i = 0; i < prog->path_count; i++)
+        query_path_free(prog->paths[i]);
+    for (size_t i = 0; i < prog->count; i++) {
+        free(prog->insns[i].string);
+        cJSON_Delete(prog->insns[i].value);
+    }
+    free(prog->paths);
+    free(prog->insns);
+    free(prog);
+}
+
+/**
+ * @brief Performs the comparison of one instruction.
+ *
+ * @param[in] insn  The instruction.
+ * @param[in] value Value of its field (NULL when missing).
+ * @return true if the comparison holds.
+ */
+static inline bool _test(const query_insn_t *insn, const cJSON *value)
+{
+    if (!value)
+        return false;
+    switch (insn->op) {
+        case OP_EQ_NUMBER:
+            return cJSON_IsNumber(value) && value->valuedouble == insn->number;
+        case OP_EQ_STRING:
+            return cJSON_IsString(value) && strcmp(value->valuestring, insn->string) == 0;
+        case OP_EQ_BOOL:
+            return cJSON_IsBool(value) && cJSON_IsTrue(value) == (insn->number != 0);
+        case OP_EQ_NULL:
+            return cJSON_IsNull(value);
+        case OP_EQ_VALUE:
+            return _equal(value, insn->value);
+        case OP_GT_NUMBER:
+            return cJSON_IsNumber(value) && value->valuedouble > insn->number;
+        case OP_GTE_NUMBER:
+            return cJSON_IsNumber(value) && value->valuedouble >= insn->number;
+        case OP_LT_NUMBER:
+            return cJSON_IsNumber(value) && value->valuedouble < insn->number;
+        case OP_LTE_NUMBER:
+            return cJSON_IsNumber(value) && value->valuedouble <= insn->number;
+        case OP_GT_STRING:
+            return cJSON_IsString(value) && strcmp(value->valuestring, insn->string) > 0;
+        case OP_GTE_STRING:
+            return cJSON_IsString(value) && strcmp(value->valuestring, insn->string) >= 0;
+        case OP_LT_STRING:
+            return cJSON_IsString(value) && strcmp(value->valuestring, insn->string) < 0;
+        case OP_LTE_STRING:
+            return cJSON_IsString(value) && strcmp(value->valuestring, insn->string) <= 0;
+        case OP_EXISTS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Runs a compiled query against a document.
+ *
+ * @param[in] prog The program.
+ * @param[in] doc  The document (may be NULL).
+ * @return Whatever query_match() returns for the compiled query.
+ */
+bool query_run(const query_program_t *prog, const cJSON *doc)
+{
+    if (!doc)
+        return !prog->filter;
+
+    /* The last field read is kept, as consecutive instructions mostly share it */
+    const cJSON *value = NULL;
+    size_t slot = SIZE_MAX;
+    size_t pc = prog->start;
+    while (pc < prog->count) {
+        const query_insn_t *insn = &prog->insns[pc];
+        if (insn->slot != slot) {
+            slot = insn->slot;
+            value = query_path_get(prog->paths[slot], doc);
+        }
+        pc = _test(insn, value) ? insn->pass : insn->fail;
+    }
+    return pc == PROG_MATCH;
 }
@@ -0,0 +1,1974 @@
+/**
+ * @file secondary.c
+ * @brief Hash, ordered, text and bitmap secondary indexes over document fields.
+ *
+ * Implements the indexes declared in secondary.h. The values of the indexed
+ * fields are encoded into one order-preserving byte key (a type tag followed
+ * by the value, for each field in turn) and mapped to a posting list: the
+ * array of stored documents holding those values, kept in insertion order so
+ * indexed reads return documents in collection order. Hash indexes keep the
+ * keys in the table of index.c, ordered indexes in the skiplist of skiplist.c.
+ * Text indexes delegate to the inverted index of fulltext.c. Bitmap indexes
+ * keep their keys in a skiplist too, but map them to bitmaps of slots: small
+ * integers handed out per stored document by the slot table the indexes of a
+ * collection share, so the bitmaps of different indexes can be intersected.
+ */
+
+#include "../include/secondary.h"
+
+#include "../include/bitmap.h"
+#include "../include/index.h"
+#include "../include/query.h"
+#include "../include/skiplist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Keys up to this size are encoded on the stack.
+ */
+#define KEY_INLINE 128
+
+/**
+ * @brief Most key ranges a query is split into before the remaining fields
+ *        are left to the query.
+ */
+#define RANGES_MAX 1024
+
+/**
+ * @brief Type tags leading every key component.
+ *
+ * Indexable types are ordered like query_compare(). A component is never a
+ * prefix of another one (numbers have a fixed size, strings end with a NUL
+ * byte JSON strings cannot hold), so TAG_END sorts after every key extending
+ * a given prefix and closes ranges over it.
+ */
+#define TAG_MISSING 0x00
+#define TAG_NUMBER 0x01
+#define TAG_STRING 0x02
+#define TAG_FALSE 0x03
+#define TAG_TRUE 0x04
+#define TAG_OTHER 0x05
+#define TAG_END 0x06
+
+/**
+ * @brief Slot numbers of the stored documents, shared by bitmap indexes.
+ *
+ * A document takes a slot when the first bitmap index adds it and gives it
+ * back when the last one removes it; freed slots are reused first, which
+ * keeps the numbers, and so the bitmaps, dense.
+ */
+struct secondary_slots
+{
+    index_t *numbers;    /**< Stored pointer -> slot + 1. */
+    cJSON **docs;        /**< Stored pointer of every slot (NULL when free). */
+    uint32_t *refs;      /**< Bitmap indexes holding every slot. */
+    uint32_t *free;      /**< Freed slots, reused last in first out. */
+    uint32_t count;      /**< Slots handed out so far. */
+    uint32_t cap;        /**< Entries allocated in docs, refs and free. */
+    uint32_t free_count; /**< Entries used in free. */
+};
+
+/**
+ * @brief Documents holding one key.
+ */
+typedef struct
+{
+    cJSON **docs; /**< Stored documents, in insertion order. */
+    size_t count; /**< Entries used in docs. */
+    size_t cap;   /**< Entries allocated in docs. */
+} posting_t;
+
+/**
+ * @brief An encoded key, stored inline while short.
+ */
+typedef struct
+{
+    char *data;           /**< Key bytes (buf or a heap block). */
+    size_t len;           /**< Bytes used. */
+    size_t cap;           /**< Bytes allocated at data. */
+    char buf[KEY_INLINE]; /**< Inline storage. */
+} key_buf_t;
+
+/**
+ * @brief The key of a visited posting list.
+ */
+struct secondary_key
+{
+    const char *data; /**< Key bytes. */
+    size_t len;       /**< Key length in bytes. */
+};
+
+/**
+ * @brief One key range of a query, [lo, hi).
+ */
+typedef struct
+{
+    size_t lo_off;      /**< Offset of the lower bound in the bytes of the set. */
+    size_t hi_off;      /**< Offset of the upper bound in the bytes of the set. */
+    secondary_key_t lo; /**< Lower bound (inclusive); data is set once the set is sealed. */
+    secondary_key_t hi; /**< Upper bound (exclusive); data is set once the set is sealed. */
+} key_range_t;
+
+/**
+ * @brief The key ranges a query narrows an index to.
+ *
+ * The bounds are kept in one block, addressed by offset while ranges are
+ * added, so the block can grow without invalidating them.
+ */
+typedef struct
+{
+    char *bytes;         /**< Bytes of every bound. */
+    size_t len;          /**< Bytes used. */
+    size_t size;         /**< Bytes allocated. */
+    key_range_t *ranges; /**< The ranges. */
+    size_t count;        /**< Ranges used. */
+    size_t cap;          /**< Ranges allocated. */
+} key_ranges_t;
+
+/**
+ * @brief Secondary index state.
+ */
+struct secondary_index
+{
+    char *name;               /**< Index name (the fields joined by commas). */
+    char **fields;            /**< Indexed fields, most significant first. */
+    query_path_t **paths;     /**< Parsed fields (one per entry in fields). */
+    size_t field_count;       /**< Entries in fields. */
+    cJSON *spec;              /**< Normalized specification. */
+    index_t *values;          /**< Encoded key -> posting_t (hash indexes). */
+    skiplist_t *ordered;      /**< Encoded key -> posting_t (ordered indexes). */
+    fulltext_t *text;         /**< Inverted index (text indexes). */
+    skiplist_t *bitmaps;      /**< Encoded key -> bitmap_t of slots (bitmap indexes). */
+    secondary_slots_t *slots; /**< Slot table of the collection (bitmap indexes). */
+    size_t entries;           /**< Documents referenced by the index. */
+    double ttl;               /**< Seconds documents live past their field value (-1 for none). */
+    bool unique;              /**< Writes must not store two documents under one key. */
+    bool broken;              /**< An update was lost to an allocation failure. */
+};
+
+/**
+ * @brief Releases a posting list (index_free_fn / skiplist_free_fn).
+ *
+ * @param[in] value The posting list.
+ */
+static void _posting_free(void *value)
+{
+    posting_t *posting = value;
+    if (!posting)
+        return;
+    free(posting->docs);
+    free(posting);
+}
+
+/**
+ * @brief Tells whether a field value can be indexed.
+ *
+ * @param[in] value Field value (may be NULL).
+ * @return true for strings, numbers and booleans.
+ */
+static bool _indexable(const cJSON *value)
+{
+    return cJSON_IsString(value) || cJSON_IsNumber(value) || cJSON_IsBool(value);
+}
+
+/**
+ * @brief Prepares an empty key.
+ *
+ * @param[out] key The key.
+ */
+static void _key_init(key_buf_t *key)
+{
+    key->data = key->buf;
+    key->len = 0;
+    key->cap = KEY_INLINE;
+}
+
+/**
+ * @brief Releases the heap block of a key, if any, and empties it.
+ *
+ * @param[in] key The key.
+ */
+static void _key_release(key_buf_t *key)
+{
+    if (key->data != key->buf)
+        free(key->data);
+    _key_init(key);
+}
+
+/**
+ * @brief Appends bytes to a key.
+ *
+ * @param[in] key   The key.
+ * @param[in] bytes Bytes to append.
+ * @param[in] n     Number of bytes.
+ * @return false on allocation failure.
+ */
+static bool _key_append(key_buf_t *key, const void *bytes, size_t n)
+{
+    if (key->len + n > key->cap) {
+        size_t cap = key->cap * 2 > key->len + n ? key->cap * 2 : key->len + n;
+        char *data = key->data == key->buf ? malloc(cap) : realloc(key->data, cap);
+        if (!data)
+            return false;
+        if (key->data == key->buf)
+            memcpy(data, key->buf, key->len);
+        key->data = data;
+        key->cap = cap;
+    }
+    memcpy(key->data + key->len, bytes, n);
+    key->len += n;
+    return true;
+}
+
+/**
+ * @brief Appends one tag byte to a key.
+ *
+ * @param[in] key The key.
+ * @param[in] tag Tag byte.
+ * @return false on allocation failure.
+ */
+static bool _key_tag(key_buf_t *key, int tag)
+{
+    char byte = (char) tag;
+    return _key_append(key, &byte, 1);
+}
+
+/**
+ * @brief Appends the encoding of a field value to a key.
+ *
+ * Numbers are stored as the big-endian bits of the double, with the sign bit
+ * flipped for positive values and every bit flipped for negative ones, so
+ * memcmp() orders them numerically (-0 is folded into 0 first). Strings are
+ * stored verbatim, which memcmp() orders like strcmp(), followed by a NUL.
+ *
+ * @param[in] key   The key.
+ * @param[in] value Field value (NULL when the field is missing).
+ * @return false on allocation failure.
+ */
+static bool _key_value(key_buf_t *key, const cJSON *value)
+{
+    if (cJSON_IsString(value)) {
+        return _key_tag(key, TAG_STRING) &&
+               _key_append(key, value->valuestring, strlen(value->valuestring) + 1);
+    }
+    if (cJSON_IsNumber(value)) {
+        double d = value->valuedouble == 0 ? 0 : value->valuedouble;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        bits = (bits >> 63) ? ~bits : bits | (1ULL << 63);
+        char bytes[8];
+        for (int i = 0; i < 8; i++)
+            bytes[i] = (char) (bits >> (56 - 8 * i));
+        return _key_tag(key, TAG_NUMBER) && _key_append(key, bytes, sizeof(bytes));
+    }
+    if (cJSON_IsBool(value))
+        return _key_tag(key, cJSON_IsTrue(value) ? TAG_TRUE : TAG_FALSE);
+    return _key_tag(key, value ? TAG_OTHER : TAG_MISSING);
+}
+
+/**
+ * @brief Encodes the key of a document.
+ *
+ * @param[in]  sec  The index.
+ * @param[in]  view Decoded document.
+ * @param[out] key  Receives the key (release with _key_release()).
+ * @return false if the document is not indexed (its first field is missing or
+ *         not indexable) or on allocation failure.
+ */
+static bool _doc_key(const secondary_t *sec, const cJSON *view, key_buf_t *key)
+{
+    _key_init(key);
+    if (!_indexable(query_path_get(sec->paths[0], view)))
+        return false;
+    for (size_t i = 0; i < sec->field_count; i++) {
+        if (!_key_value(key, query_path_get(sec->paths[i], view))) {
+            _key_release(key);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Looks up the posting list stored under a key.
+ *
+ * @param[in] sec The index.
+ * @param[in] key Encoded key.
+ * @return The posting list, or NULL.
+ */
+static posting_t *_map_get(const secondary_t *sec, const key_buf_t *key)
+{
+    return sec->ordered ? skiplist_get(sec->ordered, key->data, key->len)
+                        : index_get(sec->values, key->data, key->len);
+}
+
+/**
+ * @brief Finds the position of a stored document in a posting list.
+ *
+ * Searches from the end: recently written documents are the likeliest to
+ * be replaced or deleted.
+ *
+ * @param[in] posting The posting list.
+ * @param[in] stored  Pointer to look for.
+ * @return The position, or posting->count if absent.
+ */
+static size_t _posting_find(const posting_t *posting, const cJSON *stored)
+{
+    for (size_t i = posting->count; i-- > 0;) {
+        if (posting->docs[i] == stored)
+            return i;
+    }
+    return posting->count;
+}
+
+/**
+ * @brief Visits the documents of one posting list.
+ *
+ * @param[in] posting The posting list.
+ * @param[in] key     Its key.
+ * @param[in] visit   Visitor.
+ * @param[in] ctx     Visitor context.
+ * @return false if the visitor stopped the scan.
+ */
+static bool _posting_visit(const posting_t *posting, const secondary_key_t *key,
+                           secondary_visit_fn visit, void *ctx)
+{
+    for (size_t i = 0; i < posting->count; i++) {
+        if (!visit(posting->docs[i], key, ctx))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Releases a bitmap of slots (skiplist_free_fn).
+ *
+ * @param[in] value The bitmap.
+ */
+static void _bitmap_free(void *value)
+{
+    bitmap_free(value);
+}
+
+/**
+ * @brief Looks up the slot of a stored document.
+ *
+ * @param[in]  slots  The slot table.
+ * @param[in]  stored Stored pointer.
+ * @param[out] slot   Receives the slot.
+ * @return true if the document holds a slot.
+ */
+static bool _slot_find(const secondary_slots_t *slots, const cJSON *stored, uint32_t *slot)
+{
+    uintptr_t number = (uintptr_t) index_get(slots->numbers, (const char *) &stored,
+                                             sizeof(stored));
+    *slot = (uint32_t) (number - 1);
+    return number != 0;
+}
+
+/**
+ * @brief Takes a reference on the slot of a stored document, assigning one if needed.
+ *
+ * @param[in]  slots  The slot table.
+ * @param[in]  stored Stored pointer.
+ * @param[out] slot   Receives the slot.
+ * @return false on allocation failure.
+ */
+static bool _slot_acquire(secondary_slots_t *slots, cJSON *stored, uint32_t *slot)
+{
+    if (_slot_find(slots, stored, slot)) {
+        slots->refs[*slot]++;
+        return true;
+    }
+
+    if (slots->free_count == 0 && slots->count == slots->cap) {
+        if (slots->cap > UINT32_MAX / 2)
+            return false;
+        uint32_t cap = slots->cap ? slots->cap * 2 : 64;
+        cJSON **docs = realloc(slots->docs, cap * sizeof(*docs));
+        if (docs)
+            slots->docs = docs;
+        uint32_t *refs = docs ? realloc(slots->refs, cap * sizeof(*refs)) : NULL;
+        if (refs)
+            slots->refs = refs;
+        uint32_t *free_slots = refs ? realloc(slots->free, cap * sizeof(*free_slots)) : NULL;
+        if (!free_slots)
+            return false;
+        slots->free = free_slots;
+        slots->cap = cap;
+    }
+
+    bool reused = slots->free_count > 0;
+    *slot = reused ? slots->free[--slots->free_count] : slots->count++;
+    if (!index_put(slots->numbers, (const char *) &stored, sizeof(stored),
+                   (void *) (uintptr_t) (*slot + 1), NULL)) {
+        if (reused)
+            slots->free_count++;
+        else
+            slots->count--;
+        return false;
+    }
+    slots->docs[*slot] = stored;
+    slots->refs[*slot] = 1;
+    return true;
+}
+
+/**
+ * @brief Drops a reference on a slot, freeing it with the last one.
+ *
+ * @param[in] slots The slot table.
+ * @param[in] slot  The slot.
+ */
+static void _slot_release(secondary_slots_t *slots, uint32_t slot)
+{
+    if (--slots->refs[slot] > 0)
+        return;
+    const cJSON *doc = slots->docs[slot];
+    if (doc)
+        index_remove(slots->numbers, (const char *) &doc, sizeof(doc));
+    slots->docs[slot] = NULL;
+    slots->free[slots->free_count++] = slot;
+}
+
+/**
+ * @brief Drops the slot reference of a value (bitmap_visit_fn).
+ *
+ * @param[in] value The slot.
+ * @param[in] ctx   The slot table.
+ * @return true, to visit every slot.
+ */
+static bool _slot_unref(uint32_t value, void *ctx)
+{
+    _slot_release(ctx, value);
+    return true;
+}
+
+/**
+ * @brief State of a walk over the documents of a bitmap.
+ */
+typedef struct
+{
+    const secondary_slots_t *slots; /**< Slot table. */
+    const secondary_key_t *key;     /**< Key of the bitmap (NULL for a computed set). */
+    secondary_visit_fn visit;       /**< Caller visitor. */
+    void *ctx;                      /**< Caller context. */
+} slot_walk_t;
+
+/**
+ * @brief Visits the document of a slot (bitmap_visit_fn).
+ *
+ * Slots whose pointer was lost to an allocation failure are skipped.
+ *
+ * @param[in] value The slot.
+ * @param[in] ctx   The slot_walk_t of the walk.
+ * @return false if the visitor stopped the walk.
+ */
+static bool _slot_visit(uint32_t value, void *ctx)
+{
+    const slot_walk_t *walk = ctx;
+    cJSON *doc = walk->slots->docs[value];
+    return !doc || walk->visit(doc, walk->key, walk->ctx);
+}
+
+/**
+ * @brief Visits the documents stored under one key.
+ *
+ * @param[in] sec   The index.
+ * @param[in] value Posting list or bitmap stored under the key.
+ * @param[in] key   The key.
+ * @param[in] visit Visitor.
+ * @param[in] ctx   Visitor context.
+ * @return false if the visitor stopped the scan.
+ */
+static bool _entry_visit(const secondary_t *sec, const void *value, const secondary_key_t *key,
+                         secondary_visit_fn visit, void *ctx)
+{
+    if (!sec->bitmaps)
+        return _posting_visit(value, key, visit, ctx);
+    slot_walk_t walk = {sec->slots, key, visit, ctx};
+    return bitmap_foreach(value, _slot_visit, &walk);
+}
+
+/**
+ * @brief Reads the indexed fields of a specification.
+ *
+ * @param[in]  spec  Index specification.
+ * @param[out] count Receives the number of fields.
+ * @return The `field` string or the `fields` array, or NULL if neither is
+ *         valid (both given, no fields, empty or repeated names).
+ */
+static const cJSON *_spec_fields(const cJSON *spec, size_t *count)
+{
+    const cJSON *field = cJSON_GetObjectItem(spec, "field");
+    const cJSON *fields = cJSON_GetObjectItem(spec, "fields");
+    if (field && !fields) {
+        *count = 1;
+        return (cJSON_IsString(field) && field->valuestring[0] != '\0') ? field : NULL;
+    }
+    if (field || !cJSON_IsArray(fields) || !fields->child)
+        return NULL;
+
+    *count = 0;
+    for (const cJSON *f = fields->child; f; f = f->next, (*count)++) {
+        if (!cJSON_IsString(f) || f->valuestring[0] == '\0')
+            return NULL;
+        for (const cJSON *g = fields->child; g != f; g = g->next) {
+            if (strcmp(g->valuestring, f->valuestring) == 0)
+                return NULL;
+        }
+    }
+    return fields;
+}
+
+/**
+ * @brief Creates an empty index from its specification.
+ *
+ * @param[in] spec Index specification.
+ * @return The new index, or NULL if the specification is invalid.
+ */
+secondary_t *secondary_create(const cJSON *spec)
+{
+    size_t count;
+    const cJSON *fields = _spec_fields(spec, &count);
+    const cJSON *type = cJSON_GetObjectItem(spec, "type");
+    const cJSON *unique = cJSON_GetObjectItem(spec, "unique");
+    const cJSON *ttl = cJSON_GetObjectItem(spec, "expireAfterSeconds");
+    if (!fields || (unique && !cJSON_IsBool(unique)))
+        return NULL;
+    if (ttl && (!cJSON_IsNumber(ttl) || !(ttl->valuedouble >= 0) || count != 1))
+        return NULL;
+    if (type && (!cJSON_IsString(type) || (strcmp(type->valuestring, "hash") != 0 &&
+                                           strcmp(type->valuestring, "ordered") != 0 &&
+                                           strcmp(type->valuestring, "text") != 0 &&
+                                           strcmp(type->valuestring, "bitmap") != 0)))
+        return NULL;
+    /* TTL indexes are ordered, so expired documents are a range of keys */
+    bool ordered = (ttl && !type) || (type && strcmp(type->valuestring, "ordered") == 0);
+    if (ttl && !ordered)
+        return NULL;
+    bool text = type && strcmp(type->valuestring, "text") == 0;
+    bool bitmap = type && strcmp(type->valuestring, "bitmap") == 0;
+    if ((text || bitmap) && (count != 1 || cJSON_IsTrue(unique)))
+        return NULL;
+
+    secondary_t *sec = calloc(1, sizeof(*sec));
+    if (!sec)
+        return NULL;
+    sec->unique = cJSON_IsTrue(unique);
+    sec->ttl = ttl ? ttl->valuedouble : -1;
+    sec->fields = calloc(count, sizeof(*sec->fields));
+    sec->paths = calloc(count, sizeof(*sec->paths));
+    sec->spec = cJSON_CreateObject();
+    if (!sec->fields || !sec->paths || !sec->spec) {
+        secondary_free(sec);
+        return NULL;
+    }
+
+    /* Copy the field names and join them into the index name */
+    const cJSON *f = cJSON_IsArray(fields) ? fields->child : fields;
+    size_t name_len = 0;
+    for (; f && sec->field_count < count; f = f->next) {
+        sec->fields[sec->field_count] = strdup(f->valuestring);
+        sec->paths[sec->field_count] = query_path_create(f->valuestring);
+        if (!sec->fields[sec->field_count] || !sec->paths[sec->field_count]) {
+            free(sec->fields[sec->field_count]);
+            query_path_free(sec->paths[sec->field_count]);
+            secondary_free(sec);
+            return NULL;
+        }
+        name_len += strlen(f->valuestring) + 1;
+        sec->field_count++;
+    }
+    const char *suffix = text ? ":text" : bitmap ? ":bitmap" : "";
+    name_len += strlen(suffix);
+    sec->name = malloc(name_len);
+    if (!sec->name) {
+        secondary_free(sec);
+        return NULL;
+    }
+    sec->name[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0)
+            strcat(sec->name, ",");
+        strcat(sec->name, sec->fields[i]);
+    }
+    strcat(sec->name, suffix);
+
+    /* Single fields keep the short form */
+    bool ok;
+    if (count == 1) {
+        ok = cJSON_AddStringToObject(sec->spec, "field", sec->fields[0]) != NULL;
+    } else {
+        cJSON *names = cJSON_AddArrayToObject(sec->spec, "fields");
+        ok = names != NULL;
+        for (size_t i = 0; ok && i < count; i++) {
+            cJSON *name = cJSON_CreateString(sec->fields[i]);
+            ok = name && cJSON_AddItemToArray(names, name);
+        }
+    }
+    ok = ok && cJSON_AddStringToObject(sec->spec, "type",
+                                       ordered  ? "ordered"
+                                       : text   ? "text"
+                                       : bitmap ? "bitmap"
+                                                : "hash");
+    if (sec->unique)
+        ok = ok && cJSON_AddTrueToObject(sec->spec, "unique");
+    if (ttl)
+        ok = ok && cJSON_AddNumberToObject(sec->spec, "expireAfterSeconds", sec->ttl);
+    if (ordered)
+        sec->ordered = skiplist_create();
+    else if (text)
+        sec->text = fulltext_create();
+    else if (bitmap)
+        sec->bitmaps = skiplist_create();
+    else
+        sec->values = index_create(0);
+    if (!ok || (!sec->ordered && !sec->text && !sec->bitmaps && !sec->values)) {
+        secondary_free(sec);
+        return NULL;
+    }
+    return sec;
+}
+
+/**
+ * @brief Releases an index.
+ *
+ * @param[in] sec The index (may be NULL).
+ */
+void secondary_free(secondary_t *sec)
+{
+    if (!sec)
+        return;
+    index_free(sec->values, _posting_free);
+    skiplist_free(sec->ordered, _posting_free);
+    fulltext_free(sec->text);
+    if (sec->bitmaps && sec->slots) {
+        /* Give back the slots of every document the index holds */
+        for (skiplist_node_t *node = skiplist_lower(sec->bitmaps, NULL, 0, true); node;
+             node = skiplist_next(node))
+            bitmap_foreach(skiplist_value(node), _slot_unref, sec->slots);
+    }
+    skiplist_free(sec->bitmaps, _bitmap_free);
+    cJSON_Delete(sec->spec);
+    for (size_t i = 0; i < sec->field_count; i++) {
+        free(sec->fields[i]);
+        query_path_free(sec->paths[i]);
+    }
+    free(sec->fields);
+    free(sec->paths);
+    free(sec->name);
+    free(sec);
+}
+
+/**
+ * @brief Returns the name of an index.
+ *
+ * @param[in] sec The index.
+ * @return The indexed fields joined by commas.
+ */
+const char *secondary_name(const secondary_t *sec)
+{
+    return sec->name;
+}
+
+/**
+ * @brief Returns the first indexed field.
+ *
+ * @param[in] sec The index.
+ * @return The field name.
+ */
+const char *secondary_field(const secondary_t *sec)
+{
+    return sec->fields[0];
+}
+
+/**
+ * @brief Tells whether a field is part of an index.
+ *
+ * @param[in] sec   The index.
+ * @param[in] field Field name.
+ * @return true if @p field is one of the indexed fields (ignoring case).
+ */
+bool secondary_covers(const secondary_t *sec, const char *field)
+{
+    for (size_t i = 0; i < sec->field_count; i++) {
+        if (query_field_equal(sec->fields[i], field))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Tells whether an index keeps its keys in order.
+ *
+ * @param[in] sec The index.
+ * @return true for ordered indexes.
+ */
+bool secondary_ordered(const secondary_t *sec)
+{
+    return sec->ordered != NULL;
+}
+
+/**
+ * @brief Tells whether an index is a text index.
+ *
+ * @param[in] sec The index.
+ * @return true for text indexes.
+ */
+bool secondary_text(const secondary_t *sec)
+{
+    return sec->text != NULL;
+}
+
+/**
+ * @brief Tells whether an index is a bitmap index.
+ *
+ * @param[in] sec The index.
+ * @return true for bitmap indexes.
+ */
+bool secondary_bitmap(const secondary_t *sec)
+{
+    return sec->bitmaps != NULL;
+}
+
+/**
+ * @brief Creates an empty slot table.
+ *
+ * @return The new table, or NULL on allocation failure.
+ */
+secondary_slots_t *secondary_slots_create(void)
+{
+    secondary_slots_t *slots = calloc(1, sizeof(*slots));
+    if (!slots)
+        return NULL;
+    slots->numbers = index_create(0);
+    if (!slots->numbers) {
+        free(slots);
+        return NULL;
+    }
+    return slots;
+}
+
+/**
+ * @brief Releases a slot table.
+ *
+ * @param[in] slots The table (may be NULL).
+ */
+void secondary_slots_free(secondary_slots_t *slots)
+{
+    if (!slots)
+        return;
+    index_free(slots->numbers, NULL);
+    free(slots->docs);
+    free(slots->refs);
+    free(slots->free);
+    free(slots);
+}
+
+/**
+ * @brief Attaches a bitmap index to the slot table of its collection.
+ *
+ * @param[in] sec   The index.
+ * @param[in] slots The slot table.
+ */
+void secondary_bind(secondary_t *sec, secondary_slots_t *slots)
+{
+    sec->slots = slots;
+}
+
+/**
+ * @brief Visits the documents whose slots a bitmap holds.
+ *
+ * @param[in] slots The slot table.
+ * @param[in] set   Slots to visit.
+ * @param[in] visit Visitor (passed a NULL key).
+ * @param[in] ctx   Visitor context.
+ */
+void secondary_slots_visit(const secondary_slots_t *slots, const bitmap_t *set,
+                           secondary_visit_fn visit, void *ctx)
+{
+    slot_walk_t walk = {slots, NULL, visit, ctx};
+    bitmap_foreach(set, _slot_visit, &walk);
+}
+
+/**
+ * @brief Tells whether an index rejects duplicate keys.
+ *
+ * @param[in] sec The index.
+ * @return true for unique indexes.
+ */
+bool secondary_unique(const secondary_t *sec)
+{
+    return sec->unique;
+}
+
+/**
+ * @brief Returns how long documents of a TTL index live.
+ *
+ * @param[in] sec The index.
+ * @return The `expireAfterSeconds` of the index, or a negative value if it is
+ *         not a TTL index.
+ */
+double secondary_ttl(const secondary_t *sec)
+{
+    return sec->ttl;
+}
+
+/**
+ * @brief Tells whether storing a document would break a unique index.
+ *
+ * @param[in] sec  The index.
+ * @param[in] view Decoded contents of the document to store.
+ * @param[in] self Stored pointer of the version being replaced (may be NULL).
+ * @return true if another document is stored under the same key.
+ */
+bool secondary_conflicts(const secondary_t *sec, const cJSON *view, const cJSON *self)
+{
+    if (!sec->unique)
+        return false;
+
+    /* Keys cannot tell null, array and object values apart */
+    for (size_t i = 0; i < sec->field_count; i++) {
+        const cJSON *value = query_path_get(sec->paths[i], view);
+        if (value && !_indexable(value))
+            return false;
+    }
+
+    key_buf_t key;
+    if (!_doc_key(sec, view, &key))
+        return false;
+    const posting_t *posting = _map_get(sec, &key);
+    _key_release(&key);
+    for (size_t i = 0; posting && i < posting->count; i++) {
+        if (posting->docs[i] != self)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Returns the number of documents referenced by an index.
+ *
+ * @param[in] sec The index.
+ * @return Entry count.
+ */
+size_t secondary_entries(const secondary_t *sec)
+{
+    return sec->entries;
+}
+
+/**
+ * @brief Returns the normalized specification of an index.
+ *
+ * @param[in] sec The index.
+ * @return The specification.
+ */
+const cJSON *secondary_spec(const secondary_t *sec)
+{
+    return sec->spec;
+}
+
+/**
+ * @brief Adds an indexable document to a bitmap index.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded document.
+ * @param[in] stored Pointer to record.
+ * @return false if the index is not bound to a slot table or on allocation failure.
+ */
+static bool _bitmap_add(secondary_t *sec, const cJSON *view, cJSON *stored)
+{
+    key_buf_t key;
+    _key_init(&key);
+    bool ok = sec->slots && _doc_key(sec, view, &key);
+    bitmap_t *bitmap = ok ? skiplist_get(sec->bitmaps, key.data, key.len) : NULL;
+    if (ok && !bitmap) {
+        bitmap = bitmap_create();
+        ok = bitmap && skiplist_put(sec->bitmaps, key.data, key.len, bitmap, NULL);
+        if (!ok) {
+            bitmap_free(bitmap);
+            bitmap = NULL;
+        }
+    }
+    _key_release(&key);
+
+    uint32_t slot;
+    ok = ok && _slot_acquire(sec->slots, stored, &slot);
+    if (ok && !bitmap_add(bitmap, slot)) {
+        _slot_release(sec->slots, slot);
+        ok = false;
+    }
+    if (!ok) {
+        sec->broken = true;
+        return false;
+    }
+    sec->entries++;
+    return true;
+}
+
+/**
+ * @brief Adds a stored document to the index.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded document.
+ * @param[in] stored Pointer to record.
+ * @return false on allocation failure.
+ */
+bool secondary_add(secondary_t *sec, const cJSON *view, cJSON *stored)
+{
+    if (sec->text) {
+        const cJSON *value = query_path_get(sec->paths[0], view);
+        if (!cJSON_IsString(value))
+            return true;
+        if (!fulltext_add(sec->text, value->valuestring, stored)) {
+            sec->broken = true;
+            return false;
+        }
+        sec->entries++;
+        return true;
+    }
+    if (!_indexable(query_path_get(sec->paths[0], view)))
+        return true;
+    if (sec->bitmaps)
+        return _bitmap_add(sec, view, stored);
+
+    key_buf_t key;
+    bool ok = _doc_key(sec, view, &key);
+    posting_t *posting = ok ? _map_get(sec, &key) : NULL;
+    if (ok && !posting) {
+        posting = calloc(1, sizeof(*posting));
+        ok = posting && (sec->ordered
+                             ? skiplist_put(sec->ordered, key.data, key.len, posting, NULL)
+                             : index_put(sec->values, key.data, key.len, posting, NULL));
+        if (!ok) {
+            free(posting);
+            posting = NULL;
+        }
+    }
+    _key_release(&key);
+
+    if (ok && posting->count == posting->cap) {
+        size_t cap = posting->cap ? posting->cap * 2 : 1;
+        cJSON **docs = realloc(posting->docs, cap * sizeof(*docs));
+        ok = docs != NULL;
+        if (ok) {
+            posting->docs = docs;
+            posting->cap = cap;
+        }
+    }
+    if (!ok) {
+        sec->broken = true;
+        return false;
+    }
+    posting->docs[posting->count++] = stored;
+    sec->entries++;
+    return true;
+}
+
+/**
+ * @brief Removes a document from a bitmap index.
+ *
+ * Empty bitmaps are freed.
+ *
+ * @param[in] sec    The index.
+ * @param[in] key    Key of the document.
+ * @param[in] stored Pointer recorded when it was added.
+ */
+static void _bitmap_remove(secondary_t *sec, const key_buf_t *key, const cJSON *stored)
+{
+    bitmap_t *bitmap = skiplist_get(sec->bitmaps, key->data, key->len);
+    uint32_t slot;
+    if (!bitmap || !sec->slots || !_slot_find(sec->slots, stored, &slot) ||
+        !bitmap_remove(bitmap, slot))
+        return;
+    _slot_release(sec->slots, slot);
+    sec->entries--;
+    if (bitmap_count(bitmap) == 0)
+        bitmap_free(skiplist_remove(sec->bitmaps, key->data, key->len));
+}
+
+/**
+ * @brief Removes a stored document from the index.
+ *
+ * Keeps the order of the remaining documents; empty posting lists are freed.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded document.
+ * @param[in] stored Pointer recorded when it was added.
+ */
+void secondary_remove(secondary_t *sec, const cJSON *view, const cJSON *stored)
+{
+    if (sec->text) {
+        const cJSON *value = query_path_get(sec->paths[0], view);
+        if (cJSON_IsString(value) && fulltext_remove(sec->text, value->valuestring, stored))
+            sec->entries--;
+        return;
+    }
+
+    key_buf_t key;
+    if (!_doc_key(sec, view, &key))
+        return;
+    if (sec->bitmaps) {
+        _bitmap_remove(sec, &key, stored);
+        _key_release(&key);
+        return;
+    }
+    posting_t *posting = _map_get(sec, &key);
+    size_t i = posting ? _posting_find(posting, stored) : 0;
+    if (posting && i < posting->count) {
+        memmove(&posting->docs[i], &posting->docs[i + 1],
+                (posting->count - i - 1) * sizeof(*posting->docs));
+        posting->count--;
+        sec->entries--;
+
+        if (posting->count == 0) {
+            _posting_free(sec->ordered ? skiplist_remove(sec->ordered, key.data, key.len)
+                                       : index_remove(sec->values, key.data, key.len));
+        }
+    }
+    _key_release(&key);
+}
+
+/**
+ * @brief Swaps the pointer recorded for a document.
+ *
+ * @param[in] sec    The index.
+ * @param[in] view   Decoded document.
+ * @param[in] old    Pointer recorded so far.
+ * @param[in] stored Pointer to record instead.
+ */
+void secondary_replace(secondary_t *sec, const cJSON *view, const cJSON *old, cJSON *stored)
+{
+    if (sec->text) {
+        fulltext_replace(sec->text, old, stored);
+        return;
+    }
+    if (sec->bitmaps) {
+        /* The first bitmap index of the collection moves the shared slot */
+        uint32_t slot;
+        if (!sec->slots || !_slot_find(sec->slots, old, &slot))
+            return;
+        index_remove(sec->slots->numbers, (const char *) &old, sizeof(old));
+        bool ok = index_put(sec->slots->numbers, (const char *) &stored, sizeof(stored),
+                            (void *) (uintptr_t) (slot + 1), NULL);
+        /* Without a mapping the slot could not be released; it is skipped from now on */
+        sec->slots->docs[slot] = ok ? stored : NULL;
+        return;
+    }
+
+    key_buf_t key;
+    if (!_doc_key(sec, view, &key))
+        return;
+    posting_t *posting = _map_get(sec, &key);
+    _key_release(&key);
+    if (!posting)
+        return;
+    size_t i = _posting_find(posting, old);
+    if (i < posting->count)
+        posting->docs[i] = stored;
+}
+
+/**
+ * @brief Keeps the tighter of two range bounds.
+ *
+ * @param[in,out] bound Current bound (empty if not set yet).
+ * @param[in]     cand  Candidate bound (released).
+ * @param[in]     lower True to keep the larger key, false for the smaller one.
+ * @return false on allocation failure.
+ */
+static bool _tighten(key_buf_t *bound, key_buf_t *cand, bool lower)
+{
+    bool ok = true;
+    int c = skiplist_compare(cand->data, cand->len, bound->data, bound->len);
+    if (bound->len == 0 || (lower ? c > 0 : c < 0)) {
+        bound->len = 0;
+        ok = _key_append(bound, cand->data, cand->len);
+    }
+    _key_release(cand);
+    return ok;
+}
+
+/**
+ * @brief Computes the bounds of a range operator expression.
+ *
+ * Every range operator must compare with numbers or every one with strings;
+ * the range is then clamped to keys of that type, which are the only ones
+ * query_match() lets through. Other operators of the expression are left to
+ * the query and do not narrow the range. Lower bounds are inclusive and upper
+ * bounds exclusive: `$gt v` becomes `>= prefix+v+TAG_END` and `$lte v` becomes
+ * `< prefix+v+TAG_END`, which step over every key extending prefix+v.
+ *
+ * @param[in]  ops    Operator expression.
+ * @param[in]  prefix Encoded equality prefix.
+ * @param[out] lo     Receives the lower bound (empty on entry).
+ * @param[out] hi     Receives the upper bound (empty on entry).
+ * @return false if the expression holds no range operator, cannot be
+ *         answered or memory ran out.
+ */
+static bool _range_bounds(const cJSON *ops, const key_buf_t *prefix, key_buf_t *lo,
+                          key_buf_t *hi)
+{
+    int type = 0;
+    for (const cJSON *op = ops->child; op; op = op->next) {
+        bool lower = strcmp(op->string, "$gt") == 0 || strcmp(op->string, "$gte") == 0;
+        bool past = strcmp(op->string, "$gt") == 0 || strcmp(op->string, "$lte") == 0;
+        if (!lower && strcmp(op->string, "$lt") != 0 && strcmp(op->string, "$lte") != 0)
+            continue;
+
+        int t = cJSON_IsNumber(op) ? TAG_NUMBER : cJSON_IsString(op) ? TAG_STRING : 0;
+        if (t == 0 || (type && t != type))
+            return false;
+        type = t;
+
+        key_buf_t cand;
+        _key_init(&cand);
+        if (!_key_append(&cand, prefix->data, prefix->len) || !_key_value(&cand, op) ||
+            (past && !_key_tag(&cand, TAG_END))) {
+            _key_release(&cand);
+            return false;
+        }
+        if (!_tighten(lower ? lo : hi, &cand, lower))
+            return false;
+    }
+    if (type == 0)
+        return false;
+
+    /* Clamp open ends to the keys of the compared type */
+    key_buf_t *ends[2] = {lo, hi};
+    for (int i = 0; i < 2; i++) {
+        if (ends[i]->len == 0 &&
+            (!_key_append(ends[i], prefix->data, prefix->len) || !_key_tag(ends[i], type + i)))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Finds the values a condition allows a field to take, if it lists them.
+ *
+ * A plain value allows itself, `$eq` its operand and `$in` the values of its
+ * array, provided they are all indexable; other operators of the expression
+ * are left to the query.
+ *
+ * @param[in]  cond  Condition on the field (may be NULL).
+ * @param[out] first Receives the first value; the others follow it.
+ * @param[out] count Receives the number of values.
+ * @return false if the condition does not list the values of the field.
+ */
+static bool _points(const cJSON *cond, const cJSON **first, size_t *count)
+{
+    if (_indexable(cond)) {
+        *first = cond;
+        *count = 1;
+        return true;
+    }
+    if (!query_is_operator(cond))
+        return false;
+
+    const cJSON *eq = cJSON_GetObjectItemCaseSensitive(cond, "$eq");
+    if (_indexable(eq)) {
+        *first = eq;
+        *count = 1;
+        return true;
+    }
+    const cJSON *in = cJSON_GetObjectItemCaseSensitive(cond, "$in");
+    if (!cJSON_IsArray(in))
+        return false;
+    size_t n = 0;
+    for (const cJSON *value = in->child; value; value = value->next, n++) {
+        if (!_indexable(value))
+            return false;
+    }
+    *first = in->child;
+    *count = n;
+    return true;
+}
+
+/**
+ * @brief Releases the ranges of a query and empties them.
+ *
+ * @param[in] r The ranges.
+ */
+static void _ranges_release(key_ranges_t *r)
+{
+    free(r->bytes);
+    free(r->ranges);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * @brief Appends a range to a set of ranges.
+ *
+ * @param[in,out] r  The ranges.
+ * @param[in]     lo Lower bound (inclusive).
+ * @param[in]     hi Upper bound (exclusive; NULL for an empty one).
+ * @return false on allocation failure.
+ */
+static bool _ranges_add(key_ranges_t *r, const key_buf_t *lo, const key_buf_t *hi)
+{
+    size_t hi_len = hi ? hi->len : 0;
+    if (r->count == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 4;
+        key_range_t *ranges = realloc(r->ranges, cap * sizeof(*ranges));
+        if (!ranges)
+            return false;
+        r->ranges = ranges;
+        r->cap = cap;
+    }
+    size_t need = r->len + lo->len + hi_len;
+    if (!r->bytes || need > r->size) {
+        size_t size = r->size ? r->size * 2 : KEY_INLINE;
+        size = size > need ? size : need;
+        char *bytes = realloc(r->bytes, size);
+        if (!bytes)
+            return false;
+        r->bytes = bytes;
+        r->size = size;
+    }
+
+    key_range_t *range = &r->ranges[r->count++];
+    range->lo_off = r->len;
+    range->lo.len = lo->len;
+    if (lo->len)
+        memcpy(r->bytes + r->len, lo->data, lo->len);
+    r->len += lo->len;
+    range->hi_off = r->len;
+    range->hi.len = hi_len;
+    if (hi_len)
+        memcpy(r->bytes + r->len, hi->data, hi_len);
+    r->len += hi_len;
+    return true;
+}
+
+/**
+ * @brief Orders ranges by lower bound (qsort callback).
+ *
+ * @param[in] a First range.
+ * @param[in] b Second range.
+ * @return A negative, zero or positive value.
+ */
+static int _range_compare(const void *a, const void *b)
+{
+    const key_range_t *x = a, *y = b;
+    return skiplist_compare(x->lo.data, x->lo.len, y->lo.data, y->lo.len);
+}
+
+/**
+ * @brief Points the ranges at their bytes, sorts them and drops repeats.
+ *
+ * Ranges built from distinct values never overlap, so once sorted they can
+ * be walked in key order without visiting a document twice.
+ *
+ * @param[in,out] r The ranges.
+ */
+static void _ranges_seal(key_ranges_t *r)
+{
+    for (size_t i = 0; i < r->count; i++) {
+        r->ranges[i].lo.data = r->bytes + r->ranges[i].lo_off;
+        r->ranges[i].hi.data = r->bytes + r->ranges[i].hi_off;
+    }
+    if (r->count < 2)
+        return;
+    qsort(r->ranges, r->count, sizeof(*r->ranges), _range_compare);
+    size_t n = 1;
+    for (size_t i = 1; i < r->count; i++) {
+        if (_range_compare(&r->ranges[n - 1], &r->ranges[i]) != 0)
+            r->ranges[n++] = r->ranges[i];
+    }
+    r->count = n;
+}
+
+/**
+ * @brief Extends every prefix of a set with every value a field may take.
+ *
+ * @param[in]  prefixes Encoded prefixes (their lower bounds).
+ * @param[in]  first    First value.
+ * @param[in]  count    Number of values.
+ * @param[out] out      Receives the longer prefixes (empty on entry).
+ * @return false on allocation failure.
+ */
+static bool _ranges_extend(const key_ranges_t *prefixes, const cJSON *first, size_t count,
+                           key_ranges_t *out)
+{
+    for (size_t i = 0; i < prefixes->count; i++) {
+        const cJSON *value = first;
+        for (size_t j = 0; j < count; j++, value = value->next) {
+            key_buf_t key;
+            _key_init(&key);
+            bool ok = _key_append(&key, prefixes->bytes + prefixes->ranges[i].lo_off,
+                                  prefixes->ranges[i].lo.len) &&
+                      _key_value(&key, value) && _ranges_add(out, &key, NULL);
+            _key_release(&key);
+            if (!ok)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Closes every prefix of a set into the range of the keys extending it.
+ *
+ * @param[in]  prefixes Encoded prefixes (their lower bounds).
+ * @param[in]  ops      Range operators on the next field, or NULL to take
+ *                      every key extending a prefix.
+ * @param[out] out      Receives the ranges (empty on entry).
+ * @return false if the operators cannot be answered or memory ran out.
+ */
+static bool _ranges_close(const key_ranges_t *prefixes, const cJSON *ops, key_ranges_t *out)
+{
+    for (size_t i = 0; i < prefixes->count; i++) {
+        key_buf_t prefix, lo, hi;
+        _key_init(&prefix);
+        _key_init(&lo);
+        _key_init(&hi);
+        bool ok = _key_append(&prefix, prefixes->bytes + prefixes->ranges[i].lo_off,
+                              prefixes->ranges[i].lo.len);
+        if (ops) {
+            ok = ok && _range_bounds(ops, &prefix, &lo, &hi);
+        } else {
+            ok = ok && _key_append(&lo, prefix.data, prefix.len) &&
+                 _key_append(&hi, prefix.data, prefix.len) && _key_tag(&hi, TAG_END);
+        }
+        ok = ok && _ranges_add(out, &lo, &hi);
+        _key_release(&prefix);
+        _key_release(&lo);
+        _key_release(&hi);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Turns the predicates on the indexed fields into key ranges.
+ *
+ * Fields are consumed in index order while the query lists the values they
+ * may take (a value, `$eq` or `$in`), each listed value multiplying the
+ * prefixes, up to RANGES_MAX of them. Ordered and bitmap indexes then accept
+ * range operators on the next field, or a bare prefix. Every range is
+ * [lo, hi), and the ranges come sorted without overlaps.
+ *
+ * @param[in]  sec   The index.
+ * @param[in]  query Query object (may be NULL).
+ * @param[out] out   Receives the ranges (release with _ranges_release()).
+ * @return The kind of predicate found.
+ */
+static secondary_match_t _range(const secondary_t *sec, const cJSON *query, key_ranges_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    key_ranges_t prefixes = {0};
+    key_buf_t empty;
+    _key_init(&empty);
+    if (!_ranges_add(&prefixes, &empty, NULL))
+        return SECONDARY_UNUSABLE;
+
+    size_t k = 0;
+    const cJSON *cond = NULL;
+    for (; k < sec->field_count; k++) {
+        cond = cJSON_GetObjectItem(query, sec->fields[k]);
+        const cJSON *first;
+        size_t count;
+        if (!_points(cond, &first, &count) ||
+            (count > 1 && prefixes.count * count > RANGES_MAX))
+            break;
+        key_ranges_t longer = {0};
+        if (!_ranges_extend(&prefixes, first, count, &longer)) {
+            _ranges_release(&longer);
+            _ranges_release(&prefixes);
+            return SECONDARY_UNUSABLE;
+        }
+        _ranges_release(&prefixes);
+        prefixes = longer;
+    }
+
+    secondary_match_t match = SECONDARY_UNUSABLE;
+    if (k == sec->field_count) {
+        match = _ranges_close(&prefixes, NULL, out) ? SECONDARY_EQUALITY : SECONDARY_UNUSABLE;
+    } else if (sec->ordered || sec->bitmaps) {
+        bool bounded = query_is_operator(cond) && _ranges_close(&prefixes, cond, out);
+        if (!bounded) {
+            /* The prefix alone still narrows the walk */
+            _ranges_release(out);
+            bounded = k > 0 && _ranges_close(&prefixes, NULL, out);
+        }
+        if (bounded)
+            match = SECONDARY_RANGE;
+    }
+    _ranges_release(&prefixes);
+    if (match == SECONDARY_UNUSABLE)
+        _ranges_release(out);
+    else
+        _ranges_seal(out);
+    return match;
+}
+
+/**
+ * @brief Looks up the posting list or bitmap stored under a key.
+ *
+ * @param[in] sec The index.
+ * @param[in] key Encoded key.
+ * @return The posting list (hash and ordered indexes), the bitmap (bitmap
+ *         indexes), or NULL.
+ */
+static const void *_entry_get(const secondary_t *sec, const secondary_key_t *key)
+{
+    if (sec->bitmaps)
+        return skiplist_get(sec->bitmaps, key->data, key->len);
+    if (sec->ordered)
+        return skiplist_get(sec->ordered, key->data, key->len);
+    return index_get(sec->values, key->data, key->len);
+}
+
+/**
+ * @brief Tells how an index can narrow a query.
+ *
+ * @param[in]  sec      The index.
+ * @param[in]  query    Query object.
+ * @param[out] estimate Receives an upper bound of the documents a scan visits.
+ * @return The kind of predicate the index can answer.
+ */
+secondary_match_t secondary_match(const secondary_t *sec, const cJSON *query, size_t *estimate)
+{
+    *estimate = sec->entries;
+    if (sec->broken || sec->text)
+        return SECONDARY_UNUSABLE;
+
+    key_ranges_t r;
+    secondary_match_t match = _range(sec, query, &r);
+    if (match == SECONDARY_EQUALITY) {
+        *estimate = 0;
+        for (size_t i = 0; i < r.count; i++) {
+            const void *entry = _entry_get(sec, &r.ranges[i].lo);
+            if (entry)
+                *estimate += sec->bitmaps ? bitmap_count(entry)
+                                          : ((const posting_t *) entry)->count;
+        }
+    }
+    _ranges_release(&r);
+    return match;
+}
+
+/**
+ * @brief Counts the documents secondary_scan() visits for a query.
+ *
+ * @param[in] sec   The index.
+ * @param[in] query Query object.
+ * @param[in] cap   Count past which keys are no longer walked.
+ * @return The count, or cap + 1 once it is exceeded.
+ */
+size_t secondary_count(const secondary_t *sec, const cJSON *query, size_t cap)
+{
+    if (sec->broken || sec->text)
+        return sec->entries;
+
+    key_ranges_t r;
+    secondary_match_t match = _range(sec, query, &r);
+    skiplist_t *list = sec->ordered ? sec->ordered : sec->bitmaps;
+    if (match == SECONDARY_UNUSABLE)
+        return sec->entries;
+
+    size_t count = 0;
+    for (size_t i = 0; i < r.count && count <= cap; i++) {
+        const key_range_t *range = &r.ranges[i];
+        if (match == SECONDARY_EQUALITY || !list) {
+            const void *entry = _entry_get(sec, &range->lo);
+            if (entry)
+                count += sec->bitmaps ? bitmap_count(entry) : ((const posting_t *) entry)->count;
+            continue;
+        }
+        skiplist_node_t *node = skiplist_lower(list, range->lo.data, range->lo.len, true);
+        for (; node && count <= cap; node = skiplist_next(node)) {
+            size_t len;
+            const char *key = skiplist_key(node, &len);
+            if (skiplist_compare(key, len, range->hi.data, range->hi.len) >= 0)
+                break;
+            const void *entry = skiplist_value(node);
+            count += sec->bitmaps ? bitmap_count(entry) : ((const posting_t *) entry)->count;
+        }
+    }
+    _ranges_release(&r);
+    return count > cap ? cap + 1 : count;
+}
+
+/**
+ * @brief Visits the documents of an ordered or bitmap index within one range.
+ *
+ * @param[in] sec        The index.
+ * @param[in] list       Skiplist of the index.
+ * @param[in] range      The range (NULL for the whole list).
+ * @param[in] descending True to walk from the highest key.
+ * @param[in] visit      Visitor.
+ * @param[in] ctx        Visitor context.
+ * @return false if the visitor stopped the scan.
+ */
+static bool _range_visit(const secondary_t *sec, const skiplist_t *list, const key_range_t *range,
+                         bool descending, secondary_visit_fn visit, void *ctx)
+{
+    skiplist_node_t *first =
+        skiplist_lower(list, range ? range->lo.data : NULL, range ? range->lo.len : 0, true);
+    skiplist_node_t *last =
+        skiplist_upper(list, range ? range->hi.data : NULL, range ? range->hi.len : 0, false);
+    if (!first || !last)
+        return true;
+    secondary_key_t fkey, lkey;
+    fkey.data = skiplist_key(first, &fkey.len);
+    lkey.data = skiplist_key(last, &lkey.len);
+    if (skiplist_compare(fkey.data, fkey.len, lkey.data, lkey.len) > 0)
+        return true;
+
+    skiplist_node_t *node = descending ? last : first;
+    skiplist_node_t *end = descending ? first : last;
+    for (;;) {
+        secondary_key_t key;
+        key.data = skiplist_key(node, &key.len);
+        if (!_entry_visit(sec, skiplist_value(node), &key, visit, ctx))
+            return false;
+        if (node == end)
+            return true;
+        node = descending ? skiplist_prev(node) : skiplist_next(node);
+    }
+}
+
+/**
+ * @brief Visits the documents that can match a query.
+ *
+ * @param[in] sec        The index.
+ * @param[in] query      Query object.
+ * @param[in] descending True to walk from the highest key.
+ * @param[in] visit      Visitor.
+ * @param[in] ctx        Visitor context.
+ */
+void secondary_scan(const secondary_t *sec, const cJSON *query, bool descending,
+                    secondary_visit_fn visit, void *ctx)
+{
+    if (sec->broken || sec->text)
+        return;
+
+    key_ranges_t r;
+    secondary_match_t match = _range(sec, query, &r);
+    skiplist_t *list = sec->ordered ? sec->ordered : sec->bitmaps;
+    if (match == SECONDARY_UNUSABLE) {
+        /* Unconstrained fields walk the whole list */
+        if (list)
+            _range_visit(sec, list, NULL, descending, visit, ctx);
+        return;
+    }
+
+    for (size_t i = 0; i < r.count; i++) {
+        const key_range_t *range = &r.ranges[descending ? r.count - 1 - i : i];
+        bool more;
+        if (list) {
+            more = _range_visit(sec, list, range, descending, visit, ctx);
+        } else {
+            const posting_t *posting = _entry_get(sec, &range->lo);
+            more = !posting || _posting_visit(posting, &range->lo, visit, ctx);
+        }
+        if (!more)
+            break;
+    }
+    _ranges_release(&r);
+}
+
+/**
+ * @brief Collects the slots of the documents a bitmap index matches.
+ *
+ * @param[in] sec   A bitmap index.
+ * @param[in] query Query object.
+ * @return A new bitmap (caller frees), or NULL if the index cannot answer or
+ *         memory is exhausted.
+ */
+bitmap_t *secondary_select(const secondary_t *sec, const cJSON *query)
+{
+    if (!sec->bitmaps || sec->broken)
+        return NULL;
+
+    key_ranges_t r;
+    bitmap_t *set = _range(sec, query, &r) != SECONDARY_UNUSABLE ? bitmap_create() : NULL;
+    for (size_t i = 0; set && i < r.count; i++) {
+        const key_range_t *range = &r.ranges[i];
+        skiplist_node_t *node = skiplist_lower(sec->bitmaps, range->lo.data, range->lo.len, true);
+        for (; node; node = skiplist_next(node)) {
+            size_t len;
+            const char *key = skiplist_key(node, &len);
+            if (skiplist_compare(key, len, range->hi.data, range->hi.len) >= 0)
+                break;
+            if (!bitmap_or(set, skiplist_value(node))) {
+                bitmap_free(set);
+                set = NULL;
+                break;
+            }
+        }
+    }
+    _ranges_release(&r);
+    return set;
+}
+
+/**
+ * @brief Ranks the documents of a text index against a search text.
+ *
+ * @param[in] sec   A text index.
+ * @param[in] text  Search text.
+ * @param[in] limit Maximum number of results (0 for all).
+ * @param[in] visit Visitor.
+ * @param[in] ctx   Visitor context.
+ * @return false if the index cannot answer or memory is exhausted.
+ */
+bool secondary_search(const secondary_t *sec, const char *text, size_t limit,
+                      fulltext_visit_fn visit, void *ctx)
+{
+    if (!sec->text || sec->broken)
+        return false;
+    return fulltext_search(sec->text, text, limit, visit, ctx);
+}
+
+/**
+ * @brief Decodes the indexed fields of a visited key.
+ *
+ * @param[in] sec The index.
+ * @param[in] key Key passed to the visitor.
+ * @param[in] out Object receiving the fields.
+ * @return false if a field holds a value the key does not record, or on
+ *         allocation failure.
+ */
+bool secondary_key_values(const secondary_t *sec, const secondary_key_t *key, cJSON *out)
+{
+    const unsigned char *p = (const unsigned char *) key->data;
+    const unsigned char *end = p + key->len;
+    for (size_t i = 0; i < sec->field_count && p < end; i++) {
+        cJSON *value = NULL;
+        switch (*p++) {
+            case TAG_MISSING:
+                continue;
+            case TAG_NUMBER: {
+                uint64_t bits = 0;
+                for (int b = 0; b < 8; b++)
+                    bits = (bits << 8) | p[b];
+                p += 8;
+                bits = (bits >> 63) ? bits & ~(1ULL << 63) : ~bits;
+                double d;
+                memcpy(&d, &bits, sizeof(d));
+                value = cJSON_CreateNumber(d);
+                break;
+        }
+        case TAG_STRING:
+            value = cJSON_CreateString((const char *) p);
+            p += strlen((const char *) p) + 1;
+            break;
+        case TAG_FALSE:
+            value = cJSON_CreateFalse();
+            break;
+        case TAG_TRUE:
+            value = cJSON_CreateTrue();
+            break;
+        default:
+            return false;
+        }
+        if (!value || !query_path_put(sec->paths[i], out, value)) {
+            cJSON_Delete(value);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the number of distinct keys of an index.
+ *
+ * @param[in] sec The index.
+ * @return Keys (terms, for text indexes).
+ */
+size_t secondary_keys(const secondary_t *sec)
+{
+    return sec->ordered   ? skiplist_count(sec->ordered)
+           : sec->text    ? fulltext_terms(sec->text)
+           : sec->bitmaps ? skiplist_count(sec->bitmaps)
+                          : index_count(sec->values);
+}
+
+/**
+ * @brief Describes an index for listings.
+ *
+ * @param[in] sec The index.
+ * @return A new object (caller frees).
+ */
+cJSON *secondary_describe(const secondary_t *sec)
+{
+    cJSON *info = cJSON_Duplicate(sec->spec, 1);
+    if (!info)
+        return NULL;
+    cJSON_AddStringToObject(info, "name", sec->name);
+    cJSON_AddNumberToObject(info, "keys", (double) secondary_keys(sec));
+    cJSON_AddNumberToObject(info, "entries", (double) sec->entries);
+    if (sec->text)
+        cJSON_AddNumberToObject(info, "bytes", (double) fulltext_bytes(sec->text));
+    if (sec->bitmaps) {
+        size_t bytes = 0;
+        for (skiplist_node_t *node = skiplist_lower(sec->bitmaps, NULL, 0, true); node;
+             node = skiplist_next(node))
+            bytes += bitmap_bytes(skiplist_value(node));
+        cJSON_AddNumberToObject(info, "bytes", (double) bytes);
+    }
+    return info;
+}
+
+/**
+ * @brief Writes a little-endian integer of @p size bytes.
+ *
+ * @param[in] fp    Destination stream.
+ * @param[in] value Value to write.
+ * @param[in] size  Number of bytes (4 or 8).
+ * @return false on a write error.
+ */
+static bool _write_uint(FILE *fp, uint64_t value, size_t size)
+{
+    unsigned char b[8];
+    for (size_t i = 0; i < size; i++)
+        b[i] = (unsigned char) (value >> (8 * i));
+    return fwrite(b, 1, size, fp) == size;
+}
+
+/**
+ * @brief Reads a little-endian integer of @p size bytes.
+ *
+ * @param[in]  fp    Source stream.
+ * @param[out] value Receives the value.
+ * @param[in]  size  Number of bytes (4 or 8).
+ * @return false if the stream ends first.
+ */
+static bool _read_uint(FILE *fp, uint64_t *value, size_t size)
+{
+    unsigned char b[8];
+    if (fread(b, 1, size, fp) != size)
+        return false;
+    *value = 0;
+    for (size_t i = 0; i < size; i++)
+        *value |= (uint64_t) b[i] << (8 * i);
+    return true;
+}
+
+/**
+ * @brief Destination of secondary_save().
+ */
+typedef struct
+{
+    FILE *fp;                       /**< Destination stream. */
+    const index_t *numbers;         /**< Positions of the stored documents. */
+    const secondary_slots_t *slots; /**< Slot table (bitmap indexes only). */
+} save_t;
+
+/**
+ * @brief Writes the position of a stored document.
+ *
+ * @param[in] save   The save state.
+ * @param[in] stored Stored pointer.
+ * @return false on a write error or if the document has no position.
+ */
+static bool _save_doc(const save_t *save, const cJSON *stored)
+{
+    uintptr_t number =
+        stored ? (uintptr_t) index_get(save->numbers, (const char *) &stored, sizeof(stored)) : 0;
+    return number > 0 && _write_uint(save->fp, number - 1, 4);
+}
+
+/**
+ * @brief Writes the document of a slot (bitmap_visit_fn).
+ *
+ * @param[in] value The slot.
+ * @param[in] ctx   The save_t of the save.
+ * @return false on failure.
+ */
+static bool _save_slot(uint32_t value, void *ctx)
+{
+    const save_t *save = ctx;
+    return _save_doc(save, save->slots->docs[value]);
+}
+
+/**
+ * @brief Writes one key and its documents (index_visit_fn).
+ *
+ * Layout: u32 key length, key bytes, u32 document count, then the u32
+ * position of every document.
+ *
+ * @param[in] key   Key bytes.
+ * @param[in] len   Key length.
+ * @param[in] value Posting list, or bitmap of slots when saving a bitmap index.
+ * @param[in] ctx   The save_t of the save.
+ * @return false on failure.
+ */
+static bool _save_entry(const char *key, size_t len, void *value, void *ctx)
+{
+    const save_t *save = ctx;
+    const posting_t *posting = value;
+    size_t count = save->slots ? bitmap_count(value) : posting->count;
+    if (!_write_uint(save->fp, len, 4) || fwrite(key, 1, len, save->fp) != len ||
+        !_write_uint(save->fp, count, 4))
+        return false;
+    if (save->slots)
+        return bitmap_foreach(value, _save_slot, (void *) save);
+    for (size_t i = 0; i < count; i++) {
+        if (!_save_doc(save, posting->docs[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the contents of an index to a stream.
+ *
+ * Layout (little-endian): u64 entries, then for text indexes the inverted
+ * index (see fulltext_save()), for the others u64 keys followed by every key
+ * (see _save_entry()), in key order for ordered and bitmap indexes.
+ *
+ * @param[in] sec     The index.
+ * @param[in] fp      Destination stream.
+ * @param[in] numbers Positions of the stored documents.
+ * @return false on failure.
+ */
+bool secondary_save(const secondary_t *sec, FILE *fp, const index_t *numbers)
+{
+    if (sec->broken || (sec->bitmaps && !sec->slots) || !_write_uint(fp, sec->entries, 8))
+        return false;
+    if (sec->text)
+        return fulltext_save(sec->text, fp, numbers);
+
+    save_t save = {fp, numbers, sec->bitmaps ? sec->slots : NULL};
+    if (sec->values)
+        return _write_uint(fp, index_count(sec->values), 8) &&
+               index_foreach(sec->values, _save_entry, &save);
+
+    skiplist_t *list = sec->ordered ? sec->ordered : sec->bitmaps;
+    bool ok = _write_uint(fp, skiplist_count(list), 8);
+    for (skiplist_node_t *node = skiplist_lower(list, NULL, 0, true); ok && node;
+         node = skiplist_next(node)) {
+        size_t len;
+        const char *key = skiplist_key(node, &len);
+        ok = _save_entry(key, len, skiplist_value(node), &save);
+    }
+    return ok;
+}
+
+/**
+ * @brief Reads the documents of one key into a new bitmap.
+ *
+ * @param[in] sec   A bitmap index.
+ * @param[in] fp    Source stream.
+ * @param[in] key   Key bytes.
+ * @param[in] len   Key length.
+ * @param[in] n     Documents stored under the key.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false on failure.
+ */
+static bool _load_bitmap(secondary_t *sec, FILE *fp, const char *key, size_t len, uint64_t n,
+                         cJSON *const *docs, size_t count)
+{
+    bitmap_t *bitmap = bitmap_create();
+    if (!bitmap || !skiplist_put(sec->bitmaps, key, len, bitmap, NULL)) {
+        bitmap_free(bitmap);
+        return false;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t position;
+        uint32_t slot;
+        if (!_read_uint(fp, &position, 4) || position >= count ||
+            !_slot_acquire(sec->slots, docs[position], &slot))
+            return false;
+        if (!bitmap_add(bitmap, slot)) {
+            _slot_release(sec->slots, slot);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the documents of one key into a new posting list.
+ *
+ * @param[in] sec   A hash or ordered index.
+ * @param[in] fp    Source stream.
+ * @param[in] key   Key bytes.
+ * @param[in] len   Key length.
+ * @param[in] n     Documents stored under the key.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false on failure, or if the key holds more documents than @p count.
+ */
+static bool _load_posting(secondary_t *sec, FILE *fp, const char *key, size_t len, uint64_t n,
+                          cJSON *const *docs, size_t count)
+{
+    /* A corrupted count must not size the list: no key holds more documents than exist */
+    if (n > count)
+        return false;
+    posting_t *posting = calloc(1, sizeof(*posting));
+    if (posting)
+        posting->docs = malloc((size_t) n * sizeof(*posting->docs));
+    bool ok = posting && posting->docs &&
+              (sec->ordered ? skiplist_put(sec->ordered, key, len, posting, NULL)
+                            : index_put(sec->values, key, len, posting, NULL));
+    if (!ok) {
+        _posting_free(posting);
+        return false;
+    }
+    posting->cap = (size_t) n;
+    for (; posting->count < n; posting->count++) {
+        uint64_t position;
+        if (!_read_uint(fp, &position, 4) || position >= count)
+            return false;
+        posting->docs[posting->count] = docs[position];
+    }
+    return true;
+}
+
+/**
+ * @brief Fills an empty index with contents written by secondary_save().
+ *
+ * @param[in] sec   An empty index.
+ * @param[in] fp    Source stream.
+ * @param[in] docs  Stored document of every position.
+ * @param[in] count Entries in @p docs.
+ * @return false on failure.
+ */
+bool secondary_load(secondary_t *sec, FILE *fp, cJSON *const *docs, size_t count)
+{
+    uint64_t entries, keys;
+    if ((sec->bitmaps && !sec->slots) || !_read_uint(fp, &entries, 8))
+        return false;
+    sec->entries = (size_t) entries;
+    if (sec->text)
+        return fulltext_load(sec->text, fp, docs, count);
+    /* Every document is stored under one key at most, which bounds what the slots reserve */
+    if (entries > count || !_read_uint(fp, &keys, 8))
+        return false;
+    if (sec->bitmaps &&
+        !index_reserve(sec->slots->numbers, index_count(sec->slots->numbers) + sec->entries))
+        return false;
+
+    char *key = NULL;
+    size_t cap = 0;
+    uint64_t loaded = 0;
+    bool ok = true;
+    for (uint64_t k = 0; ok && k < keys; k++) {
+        uint64_t len, n;
+        ok = _read_uint(fp, &len, 4) && len > 0;
+        if (ok && len > cap) {
+            char *grown = realloc(key, (size_t) len);
+            ok = grown != NULL;
+            key = ok ? grown : key;
+            cap = ok ? (size_t) len : cap;
+        }
+        ok = ok && fread(key, 1, (size_t) len, fp) == len && _read_uint(fp, &n, 4) && n > 0;
+        /* Keys are unique; a repeated one would leak the list it replaces */
+        ok = ok && !(sec->values ? index_get(sec->values, key, (size_t) len)
+                                 : skiplist_get(sec->ordered ? sec->ordered : sec->bitmaps, key,
+                                                (size_t) len));
+        if (ok)
+            ok = sec->bitmaps ? _load_bitmap(sec, fp, key, (size_t) len, n, docs, count)
+                              : _load_posting(sec, fp, key, (size_t) len, n, docs, count);
+        loaded += n;
+    }
+    free(key);
+    return ok && loaded == entries;
+}
@@ -10,6 +10,7 @@
 #include "../include/server.h"
 
 #include "../include/database.h"
+#include "../include/query.h"
 #include "../include/utils.h"
 
 #include <arpa/inet.h>
@@ -76,6 +77,79 @@ void send_response(int sock, int code, const char *msg, cJSON *data)
     cJSON_Delete(resp);
 }
 
+/**
+ * @brief Answers a failed write, reporting uniqueness violations as conflicts.
+ *
+ * @param[in] sock Target client socket.
+ * @param[in] code Status code for other failures.
+ * @param[in] msg  Message for other failures.
+ */
+void send_write_error(int sock, int code, const char *msg)
+{
+    switch (db_last_error()) {
+        case DB_ERROR_DUPLICATE_ID:
+            send_response(sock, 409, "Duplicate _id", NULL);
+            break;
+        case DB_ERROR_DUPLICATE_KEY:
+            send_response(sock, 409, "Duplicate key", NULL);
+            break;
+        default:
+            send_response(sock, code, msg, NULL);
+            break;
+    }
+}
+
+/**
+ * @brief Resolves the optional per-request "durability" field.
+ *
+ * Accepted values are "none", "flush" and "fsync".
+ *
+ * @param[in]  req   The parsed request object.
+ * @param[out] level The requested level, DB_DURABILITY_DEFAULT when absent.
+ * @return false if the field is present but not a recognised level.
+ */
+bool parse_durability(cJSON *req, db_durability_t *level)
+{
+    cJSON *field = cJSON_GetObjectItem(req, "durability");
+    *level = DB_DURABILITY_DEFAULT;
+    if (!field)
+        return true;
+    if (!cJSON_IsString(field))
+        return false;
+
+    if (strcmp(field->valuestring, "none") == 0) {
+        *level = DB_DURABILITY_NONE;
+    } else if (strcmp(field->valuestring, "flush") == 0) {
+        *level = DB_DURABILITY_FLUSH;
+    } else if (strcmp(field->valuestring, "fsync") == 0) {
+        *level = DB_DURABILITY_FSYNC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Builds the response payload describing a snapshot.
+ *
+ * @param[in] id Snapshot id.
+ * @return A new object with the id, its state and, once known, its directory.
+ */
+static cJSON *snapshot_info(long id)
+{
+    static const char *names[] = {"running", "done", "failed"};
+    char path[600] = "";
+    db_snapshot_state_t state = db_snapshot_status(id, path, sizeof(path));
+
+    cJSON *info = cJSON_CreateObject();
+    cJSON_AddNumberToObject(info, "id", (double) id);
+    cJSON_AddStringToObject(info, "status",
+                            state == DB_SNAPSHOT_UNKNOWN ? "unknown" : names[state]);
+    if (path[0])
+        cJSON_AddStringToObject(info, "path", path);
+    return info;
+}
+
 /**
  * @brief Thread entry point for handling individual client communication.
  *
@@ -123,6 +197,15 @@ void *handle_client(void *arg)
         cJSON *action = cJSON_GetObjectItem(req, "action");
         cJSON *coll = cJSON_GetObjectItem(req, "collection");
 
+        db_durability_t durability;
+        if (!parse_durability(req, &durability)) {
+            send_response(sock, 400, "Invalid 'durability'", NULL);
+            cJSON_Delete(req);
+            continue;
+        }
+        /* Applies to the writes issued by this request only */
+        db_set_request_durability(durability);
+
         if (cJSON_IsString(action)) {
             char *act_str = action->valuestring;
             char *coll_str = cJSON_IsString(coll) ? coll->valuestring : "";
@@ -134,8 +217,24 @@ void *handle_client(void *arg)
             }
 
             if (strcmp(act_str, "snapshot") == 0) {
-                db_force_snapshot();
-                send_response(sock, 200, "Snapshot created", NULL);
+                /* Written by a forked process; the client polls with snapshot_status */
+                long id = db_snapshot_start();
+                if (id > 0) {
+                    send_response(sock, 200, "Snapshot started", snapshot_info(id));
+                } else {
+                    send_response(sock, 500, "Snapshot failed", NULL);
+                }
+            } else if (strcmp(act_str, "snapshot_status") == 0) {
+                cJSON *id = cJSON_GetObjectItem(req, "id");
+                if (!cJSON_IsNumber(id)) {
+                    send_response(sock, 400, "Missing 'id'", NULL);
+                } else if (db_snapshot_status((long) id->valuedouble, NULL, 0) ==
+                           DB_SNAPSHOT_UNKNOWN) {
+                    send_response(sock, 404, "Unknown snapshot", NULL);
+                } else {
+                    send_response(sock, 200, "Snapshot status",
+                                  snapshot_info((long) id->valuedouble));
+                }
             } else if (strlen(coll_str) == 0) {
                 send_response(sock, 400, "Missing 'collection'", NULL);
             } else if (strcmp(act_str, "insert") == 0) {
@@ -144,7 +243,7 @@ void *handle_client(void *arg)
                     send_response(sock, 200, "Inserted", data);
                 } else {
                     cJSON_Delete(data);
-                    send_response(sock, 500, "Insert failed", NULL);
+                    send_write_error(sock, 500, "Insert failed");
                 }
             } else if (strcmp(act_str, "update") == 0) {
                 cJSON *id = cJSON_GetObjectItem(req, "id");
@@ -152,6 +251,9 @@ void *handle_client(void *arg)
                 /* Core now handles selective merge and ignores _id in 'data' */
                 if (cJSON_IsString(id) && db_update(coll_str, id->valuestring, data)) {
                     send_response(sock, 200, "Updated", data);
+                } else if (cJSON_IsString(id)) {
+                    cJSON_Delete(data);
+                    send_write_error(sock, 404, "Not Found or Update Failed");
                 } else {
                     cJSON_Delete(data);
                     send_response(sock, 404, "Not Found or Update Failed", NULL);
@@ -164,14 +266,67 @@ void *handle_client(void *arg)
                     send_response(sock, 200, "Upsert Success", data);
                 } else {
                     cJSON_Delete(data);
-                    send_response(sock, 500, "Upsert failed", NULL);
+                    send_write_error(sock, 500, "Upsert failed");
                 }
-            } else if (strcmp(act_str, "find") == 0) {
+            } else if (strcmp(act_str, "find") == 0 || strcmp(act_str, "explain") == 0) {
+                /* "explain" runs the same find and describes its plan instead */
                 cJSON *query = cJSON_GetObjectItem(req, "query");
                 cJSON *limit_obj = cJSON_GetObjectItem(req, "limit");
-                int limit = cJSON_IsNumber(limit_obj) ? limit_obj->valueint : 0;
-                cJSON *result = db_find(coll_str, query, limit);
-                send_response(sock, 200, "Success", result);
+                /* "sort": {"field": 1} ascending, {"field": -1} descending */
+                cJSON *sort_obj = cJSON_GetObjectItem(req, "sort");
+                cJSON *sort_key = cJSON_IsObject(sort_obj) ? sort_obj->child : NULL;
+                db_find_options_t opts = {0};
+                opts.limit = cJSON_IsNumber(limit_obj) ? limit_obj->valueint : 0;
+                if (sort_key && cJSON_IsNumber(sort_key)) {
+                    opts.sort = sort_key->string;
+                    opts.descending = sort_key->valuedouble < 0;
+                }
+                /* "fields": ["a", "b"] returns only those fields, never array elements */
+                cJSON *fields = cJSON_GetObjectItem(req, "fields");
+                bool fields_ok = cJSON_IsArray(fields);
+                for (cJSON *f = fields_ok ? fields->child : NULL; f; f = f->next) {
+                    fields_ok = fields_ok && cJSON_IsString(f) &&
+                                !query_field_positional(f->valuestring);
+                }
+                opts.fields = fields_ok ? fields : NULL;
+                /* "projection": {"a": 1} returns a and _id, {"a": 0} everything but a */
+                cJSON *projection = cJSON_GetObjectItem(req, "projection");
+                bool projection_ok = db_projection_valid(projection) && !fields;
+                opts.projection = projection_ok ? projection : NULL;
+                if (sort_obj && !opts.sort) {
+                    send_response(sock, 400, "Invalid 'sort'", NULL);
+                } else if (fields && !fields_ok) {
+                    send_response(sock, 400, "Invalid 'fields'", NULL);
+                } else if (projection && !projection_ok) {
+                    send_response(sock, 400, "Invalid 'projection'", NULL);
+                } else if (strcmp(act_str, "find") == 0) {
+                    cJSON *result = db_find_ex(coll_str, query, &opts);
+                    send_response(sock, 200, "Success", result);
+                } else {
+                    cJSON *plan = db_explain(coll_str, query, &opts);
+                    if (plan) {
+                        send_response(sock, 200, "Success", plan);
+                    } else {
+                        send_response(sock, 404, "Collection not found", NULL);
+                    }
+                }
+            } else if (strcmp(act_str, "search") == 0) {
+                /* "limit" defaults to the 10 best matches; 0 returns every match */
+                cJSON *field = cJSON_GetObjectItem(req, "field");
+                cJSON *text = cJSON_GetObjectItem(req, "text");
+                cJSON *limit_obj = cJSON_GetObjectItem(req, "limit");
+                int limit = cJSON_IsNumber(limit_obj) ? limit_obj->valueint : 10;
+                bool valid = cJSON_IsString(field) && cJSON_IsString(text);
+                cJSON *result = valid ? db_search(coll_str, field->valuestring,
+                                                  text->valuestring, limit)
+                                      : NULL;
+                if (!valid) {
+                    send_response(sock, 400, "Missing 'field' or 'text'", NULL);
+                } else if (!result) {
+                    send_response(sock, 404, "No text index on 'field'", NULL);
+                } else {
+                    send_response(sock, 200, "Success", result);
+                }
             } else if (strcmp(act_str, "delete") == 0) {
                 cJSON *id = cJSON_GetObjectItem(req, "id");
                 if (cJSON_IsString(id) && db_delete(coll_str, id->valuestring)) {
@@ -179,6 +334,27 @@ void *handle_client(void *arg)
                 } else {
                     send_response(sock, 404, "Not Found", NULL);
                 }
+            } else if (strcmp(act_str, "createIndex") == 0) {
+                /* The request itself is the specification; other members are ignored */
+                if (!cJSON_IsString(cJSON_GetObjectItem(req, "field")) &&
+                    !cJSON_IsArray(cJSON_GetObjectItem(req, "fields"))) {
+                    send_response(sock, 400, "Missing 'field' or 'fields'", NULL);
+                } else if (db_create_index(coll_str, req)) {
+                    send_response(sock, 200, "Index created", db_list_indexes(coll_str));
+                } else {
+                    send_write_error(sock, 500, "Index creation failed");
+                }
+            } else if (strcmp(act_str, "dropIndex") == 0) {
+                cJSON *name = cJSON_GetObjectItem(req, "name");
+                if (!cJSON_IsString(name)) {
+                    send_response(sock, 400, "Missing 'name'", NULL);
+                } else if (db_drop_index(coll_str, name->valuestring)) {
+                    send_response(sock, 200, "Index dropped", NULL);
+                } else {
+                    send_response(sock, 404, "Index not found", NULL);
+                }
+            } else if (strcmp(act_str, "listIndexes") == 0) {
+                send_response(sock, 200, "Success", db_list_indexes(coll_str));
             } else if (strcmp(act_str, "count") == 0) {
                 cJSON *d = cJSON_CreateObject();
                 cJSON_AddNumberToObject(d, "count", db_count(coll_str));
@@ -189,6 +365,7 @@ void *handle_client(void *arg)
         } else {
             send_response(sock, 400, "Missing 'action'", NULL);
         }
+        db_set_request_durability(DB_DURABILITY_DEFAULT);
         cJSON_Delete(req);
     }
 
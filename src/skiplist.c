@@ -0,0 +1,365 @@
+/**
+ * @file skiplist.c
+ * @brief Skiplist ordered map for range indexes.
+ *
+ * Implements the list declared in skiplist.h. Every node is one allocation
+ * holding its forward links and a copy of its key. Node heights follow a
+ * geometric distribution with p = 1/4, drawn from a per-list xorshift
+ * generator so lists do not share state.
+ */
+
+#include "../include/skiplist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Maximum node height (enough for 4^32 keys).
+ */
+#define SKIPLIST_MAX_LEVEL 32
+
+/**
+ * @brief A list node, followed in memory by its key bytes.
+ */
+struct skiplist_node
+{
+    const char *key;       /**< Key bytes (stored after the links). */
+    size_t len;            /**< Key length in bytes. */
+    void *value;           /**< Stored value. */
+    skiplist_node_t *prev; /**< Previous node at the bottom level (NULL for the first). */
+    int level;             /**< Number of forward links. */
+    skiplist_node_t *next[]; /**< Forward links, one per level. */
+};
+
+/**
+ * @brief Skiplist state.
+ */
+struct skiplist
+{
+    skiplist_node_t *head; /**< Sentinel holding SKIPLIST_MAX_LEVEL links. */
+    int level;             /**< Levels currently in use. */
+    size_t count;          /**< Number of keys. */
+    uint64_t rng;          /**< State of the level generator. */
+};
+
+/**
+ * @brief Compares two keys in list order.
+ *
+ * @param[in] a    First key.
+ * @param[in] alen Length of @p a.
+ * @param[in] b    Second key.
+ * @param[in] blen Length of @p b.
+ * @return A negative, zero or positive value.
+ */
+int skiplist_compare(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0)
+        return c;
+    return (alen > blen) - (alen < blen);
+}
+
+/**
+ * @brief Allocates a node with its key.
+ *
+ * @param[in] level Number of forward links.
+ * @param[in] key   Key bytes (may be NULL for the sentinel).
+ * @param[in] len   Key length in bytes.
+ * @return The node, or NULL on allocation failure.
+ */
+static skiplist_node_t *_node_create(int level, const char *key, size_t len)
+{
+    size_t links = (size_t) level * sizeof(skiplist_node_t *);
+    skiplist_node_t *node = calloc(1, sizeof(*node) + links + len + 1);
+    if (!node)
+        return NULL;
+    char *copy = (char *) node + sizeof(*node) + links;
+    if (key)
+        memcpy(copy, key, len);
+    node->key = copy;
+    node->len = len;
+    node->level = level;
+    return node;
+}
+
+/**
+ * @brief Draws the height of a new node.
+ *
+ * @param[in] list The list.
+ * @return A level between 1 and SKIPLIST_MAX_LEVEL.
+ */
+static int _random_level(skiplist_t *list)
+{
+    uint64_t x = list->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    list->rng = x;
+
+    int level = 1;
+    while (level < SKIPLIST_MAX_LEVEL && (x & 3) == 0) {
+        level++;
+        x >>= 2;
+    }
+    return level;
+}
+
+/**
+ * @brief Finds the predecessors of a key on every level.
+ *
+ * @param[in]  list   The list.
+ * @param[in]  key    Key bytes.
+ * @param[in]  len    Key length in bytes.
+ * @param[out] update Receives the last node before the key on each level.
+ * @return The first node not below the key (NULL at the end).
+ */
+static skiplist_node_t *_find(const skiplist_t *list, const char *key, size_t len,
+                              skiplist_node_t *update[SKIPLIST_MAX_LEVEL])
+{
+    skiplist_node_t *x = list->head;
+    for (int i = list->level - 1; i >= 0; i--) {
+        while (x->next[i] && skiplist_compare(x->next[i]->key, x->next[i]->len, key, len) < 0)
+            x = x->next[i];
+        update[i] = x;
+    }
+    return x->next[0];
+}
+
+/**
+ * @brief Creates an empty list.
+ *
+ * @return The new list, or NULL on allocation failure.
+ */
+skiplist_t *skiplist_create(void)
+{
+    skiplist_t *list = calloc(1, sizeof(*list));
+    if (!list)
+        return NULL;
+    list->head = _node_create(SKIPLIST_MAX_LEVEL, NULL, 0);
+    if (!list->head) {
+        free(list);
+        return NULL;
+    }
+    list->level = 1;
+    list->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t) (uintptr_t) list;
+    return list;
+}
+
+/**
+ * @brief Releases a list and optionally its values.
+ *
+ * @param[in] list       The list (may be NULL).
+ * @param[in] free_value Value destructor (may be NULL).
+ */
+void skiplist_free(skiplist_t *list, skiplist_free_fn free_value)
+{
+    if (!list)
+        return;
+    skiplist_node_t *node = list->head->next[0];
+    while (node) {
+        skiplist_node_t *next = node->next[0];
+        if (free_value)
+            free_value(node->value);
+        free(node);
+        node = next;
+    }
+    free(list->head);
+    free(list);
+}
+
+/**
+ * @brief Returns the number of keys in the list.
+ *
+ * @param[in] list The list.
+ * @return Key count.
+ */
+size_t skiplist_count(const skiplist_t *list)
+{
+    return list->count;
+}
+
+/**
+ * @brief Looks up a key.
+ *
+ * @param[in] list The list.
+ * @param[in] key  Key bytes.
+ * @param[in] len  Key length in bytes.
+ * @return The stored value, or NULL if absent.
+ */
+void *skiplist_get(const skiplist_t *list, const char *key, size_t len)
+{
+    skiplist_node_t *node = skiplist_lower(list, key, len, true);
+    return (node && skiplist_compare(node->key, node->len, key, len) == 0) ? node->value : NULL;
+}
+
+/**
+ * @brief Inserts a key or replaces its value.
+ *
+ * @param[in]  list  The list.
+ * @param[in]  key   Key bytes (copied).
+ * @param[in]  len   Key length in bytes.
+ * @param[in]  value Value to store.
+ * @param[out] old   Receives the replaced value or NULL (may be NULL).
+ * @return false on allocation failure.
+ */
+bool skiplist_put(skiplist_t *list, const char *key, size_t len, void *value, void **old)
+{
+    skiplist_node_t *update[SKIPLIST_MAX_LEVEL];
+    skiplist_node_t *x = _find(list, key, len, update);
+    if (x && skiplist_compare(x->key, x->len, key, len) == 0) {
+        if (old)
+            *old = x->value;
+        x->value = value;
+        return true;
+    }
+
+    int level = _random_level(list);
+    skiplist_node_t *node = _node_create(level, key, len);
+    if (!node)
+        return false;
+    node->value = value;
+
+    for (int i = list->level; i < level; i++)
+        update[i] = list->head;
+    if (level > list->level)
+        list->level = level;
+    for (int i = 0; i < level; i++) {
+        node->next[i] = update[i]->next[i];
+        update[i]->next[i] = node;
+    }
+    node->prev = update[0] == list->head ? NULL : update[0];
+    if (node->next[0])
+        node->next[0]->prev = node;
+
+    list->count++;
+    if (old)
+        *old = NULL;
+    return true;
+}
+
+/**
+ * @brief Removes a key.
+ *
+ * @param[in] list The list.
+ * @param[in] key  Key bytes.
+ * @param[in] len  Key length in bytes.
+ * @return The removed value, or NULL if absent.
+ */
+void *skiplist_remove(skiplist_t *list, const char *key, size_t len)
+{
+    skiplist_node_t *update[SKIPLIST_MAX_LEVEL];
+    skiplist_node_t *x = _find(list, key, len, update);
+    if (!x || skiplist_compare(x->key, x->len, key, len) != 0)
+        return NULL;
+
+    for (int i = 0; i < x->level; i++)
+        update[i]->next[i] = x->next[i];
+    if (x->next[0])
+        x->next[0]->prev = x->prev;
+    while (list->level > 1 && !list->head->next[list->level - 1])
+        list->level--;
+
+    void *value = x->value;
+    free(x);
+    list->count--;
+    return value;
+}
+
+/**
+ * @brief Finds the first node at or above a lower bound.
+ *
+ * @param[in] list      The list.
+ * @param[in] key       Bound key (NULL for the first node).
+ * @param[in] len       Bound key length.
+ * @param[in] inclusive True to include a node equal to the bound.
+ * @return The node, or NULL.
+ */
+skiplist_node_t *skiplist_lower(const skiplist_t *list, const char *key, size_t len,
+                                bool inclusive)
+{
+    skiplist_node_t *x = list->head;
+    if (!key)
+        return x->next[0];
+    for (int i = list->level - 1; i >= 0; i--) {
+        while (x->next[i]) {
+            int c = skiplist_compare(x->next[i]->key, x->next[i]->len, key, len);
+            if (c > 0 || (c == 0 && inclusive))
+                break;
+            x = x->next[i];
+        }
+    }
+    return x->next[0];
+}
+
+/**
+ * @brief Finds the last node at or below an upper bound.
+ *
+ * @param[in] list      The list.
+ * @param[in] key       Bound key (NULL for the last node).
+ * @param[in] len       Bound key length.
+ * @param[in] inclusive True to include a node equal to the bound.
+ * @return The node, or NULL.
+ */
+skiplist_node_t *skiplist_upper(const skiplist_t *list, const char *key, size_t len,
+                                bool inclusive)
+{
+    skiplist_node_t *x = list->head;
+    for (int i = list->level - 1; i >= 0; i--) {
+        while (x->next[i]) {
+            if (key) {
+                int c = skiplist_compare(x->next[i]->key, x->next[i]->len, key, len);
+                if (c > 0 || (c == 0 && !inclusive))
+                    break;
+            }
+            x = x->next[i];
+        }
+    }
+    return x == list->head ? NULL : x;
+}
+
+/**
+ * @brief Returns the next node in key order.
+ *
+ * @param[in] node A node.
+ * @return The next node, or NULL.
+ */
+skiplist_node_t *skiplist_next(const skiplist_node_t *node)
+{
+    return node->next[0];
+}
+
+/**
+ * @brief Returns the previous node in key order.
+ *
+ * @param[in] node A node.
+ * @return The previous node, or NULL.
+ */
+skiplist_node_t *skiplist_prev(const skiplist_node_t *node)
+{
+    return node->prev;
+}
+
+/**
+ * @brief Returns the key of a node.
+ *
+ * @param[in]  node A node.
+ * @param[out] len  Receives the key length.
+ * @return The key bytes.
+ */
+const char *skiplist_key(const skiplist_node_t *node, size_t *len)
+{
+    *len = node->len;
+    return node->key;
+}
+
+/**
+ * @brief Returns the value of a node.
+ *
+ * @param[in] node A node.
+ * @return The stored value.
+ */
+void *skiplist_value(const skiplist_node_t *node)
+{
+    return node->value;
+}
@@ -0,0 +1,1007 @@
+/**
+ * @file storage.c
+ * @brief Storage file encoding for the Database system.
+ *
+ * Implements the JSON and binary image formats declared in storage.h. The
+ * binary encoding tags every value with a one-byte type and prefixes strings,
+ * arrays and objects with their length, so documents can be skipped or
+ * decoded without scanning for delimiters.
+ */
+
+#include "../include/storage.h"
+
+#include "../include/utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Maximum nesting depth accepted by the decoder.
+ */
+#define STORAGE_MAX_DEPTH 1000
+
+/** * @name Binary value tags
+ * @{
+ */
+#define TAG_NULL 'n'   /**< JSON null. */
+#define TAG_TRUE 't'   /**< JSON true. */
+#define TAG_FALSE 'f'  /**< JSON false. */
+#define TAG_INT 'i'    /**< Integral number stored as i32. */
+#define TAG_DOUBLE 'd' /**< Number stored as IEEE-754 double. */
+#define TAG_STRING 's' /**< u32 length + bytes. */
+#define TAG_ARRAY 'a'  /**< u32 count + values. */
+#define TAG_OBJECT 'o' /**< u32 count + (u32 key length + key + value) pairs. */
+/** @} */
+
+/** * @name Binary section markers
+ * @{
+ */
+#define SECTION_COLLECTION 'C' /**< Start of a collection section. */
+#define SECTION_END 'E'        /**< End of file. */
+/** @} */
+
+/**
+ * @brief A document found by storage_scan(), waiting to be decoded.
+ */
+typedef struct
+{
+    const uint8_t *data;     /**< Encoded document. */
+    size_t len;              /**< Encoded length in bytes. */
+    storage_format_t format; /**< Encoding of the span. */
+    cJSON *coll;             /**< Collection array the document belongs to. */
+    cJSON *doc;              /**< Decoded document (filled by the workers). */
+} load_span_t;
+
+/**
+ * @brief State shared by the scan callback and the workers of storage_load().
+ */
+typedef struct
+{
+    cJSON *root;        /**< Root object being built. */
+    cJSON *coll;        /**< Collection currently being scanned. */
+    load_span_t *spans; /**< Every document span, in file order. */
+    size_t count;       /**< Entries used in spans. */
+    size_t cap;         /**< Entries allocated in spans. */
+} load_ctx_t;
+
+/**
+ * @brief Read cursor over an encoded buffer.
+ */
+typedef struct
+{
+    const uint8_t *pos; /**< Next byte to read. */
+    const uint8_t *end; /**< One past the last readable byte. */
+} cursor_t;
+
+/**
+ * @brief Ensures @p extra more bytes fit in a growable buffer.
+ */
+static bool _reserve(uint8_t **buf, size_t *cap, size_t len, size_t extra)
+{
+    if (len + extra <= *cap)
+        return true;
+
+    size_t new_cap = *cap ? *cap : 256;
+    while (new_cap < len + extra)
+        new_cap *= 2;
+
+    uint8_t *grown = realloc(*buf, new_cap);
+    if (!grown)
+        return false;
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+/**
+ * @brief Stores a u32 in little-endian order.
+ */
+static void _put_u32(uint8_t *dst, uint32_t v)
+{
+    dst[0] = (uint8_t) v;
+    dst[1] = (uint8_t) (v >> 8);
+    dst[2] = (uint8_t) (v >> 16);
+    dst[3] = (uint8_t) (v >> 24);
+}
+
+/**
+ * @brief Loads a little-endian u32.
+ */
+static uint32_t _get_u32(const uint8_t *src)
+{
+    return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) |
+           ((uint32_t) src[3] << 24);
+}
+
+/**
+ * @brief Appends a tag byte followed by a u32.
+ */
+static bool _emit_tag_u32(uint8_t **buf, size_t *cap, size_t *len, uint8_t tag, uint32_t v)
+{
+    if (!_reserve(buf, cap, *len, 5))
+        return false;
+    (*buf)[*len] = tag;
+    _put_u32(*buf + *len + 1, v);
+    *len += 5;
+    return true;
+}
+
+/**
+ * @brief Appends a u32 length followed by raw bytes.
+ */
+static bool _emit_bytes(uint8_t **buf, size_t *cap, size_t *len, const char *s, size_t n)
+{
+    if (!_reserve(buf, cap, *len, 4 + n))
+        return false;
+    _put_u32(*buf + *len, (uint32_t) n);
+    memcpy(*buf + *len + 4, s, n);
+    *len += 4 + n;
+    return true;
+}
+
+/**
+ * @brief Encodes a single value in the binary document encoding.
+ *
+ * @param[in]     item The value to encode.
+ * @param[in,out] buf  Growable output buffer.
+ * @param[in,out] cap  Allocated size of @p buf.
+ * @param[in,out] len  Bytes used in @p buf.
+ * @return true on success, false on allocation failure.
+ */
+bool storage_encode(const cJSON *item, uint8_t **buf, size_t *cap, size_t *len)
+{
+    if (cJSON_IsObject(item) || cJSON_IsArray(item)) {
+        bool is_obj = cJSON_IsObject(item);
+        if (!_emit_tag_u32(buf, cap, len, is_obj ? TAG_OBJECT : TAG_ARRAY,
+                           (uint32_t) cJSON_GetArraySize(item)))
+            return false;
+
+        const cJSON *child = item->child;
+        while (child) {
+            if (is_obj) {
+                const char *key = child->string ? child->string : "";
+                if (!_emit_bytes(buf, cap, len, key, strlen(key)))
+                    return false;
+            }
+            if (!storage_encode(child, buf, cap, len))
+                return false;
+            child = child->next;
+        }
+        return true;
+    }
+
+    if (cJSON_IsString(item)) {
+        if (!_reserve(buf, cap, *len, 1))
+            return false;
+        (*buf)[(*len)++] = TAG_STRING;
+        return _emit_bytes(buf, cap, len, item->valuestring, strlen(item->valuestring));
+    }
+
+    if (cJSON_IsNumber(item)) {
+        double d = item->valuedouble;
+        if (d >= -2147483648.0 && d <= 2147483647.0 && d == (double) (int32_t) d) {
+            return _emit_tag_u32(buf, cap, len, TAG_INT, (uint32_t) (int32_t) d);
+        }
+        if (!_reserve(buf, cap, *len, 9))
+            return false;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        (*buf)[*len] = TAG_DOUBLE;
+        _put_u32(*buf + *len + 1, (uint32_t) bits);
+        _put_u32(*buf + *len + 5, (uint32_t) (bits >> 32));
+        *len += 9;
+        return true;
+    }
+
+    if (!_reserve(buf, cap, *len, 1))
+        return false;
+    if (cJSON_IsTrue(item)) {
+        (*buf)[(*len)++] = TAG_TRUE;
+    } else if (cJSON_IsFalse(item)) {
+        (*buf)[(*len)++] = TAG_FALSE;
+    } else {
+        /* Null and anything without a JSON representation */
+        (*buf)[(*len)++] = TAG_NULL;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads a u32 from the cursor.
+ */
+static bool _take_u32(cursor_t *cur, uint32_t *out)
+{
+    if (cur->end - cur->pos < 4)
+        return false;
+    *out = _get_u32(cur->pos);
+    cur->pos += 4;
+    return true;
+}
+
+/**
+ * @brief Reads a length-prefixed byte string into a new NUL-terminated buffer.
+ */
+static char *_take_string(cursor_t *cur)
+{
+    uint32_t n;
+    if (!_take_u32(cur, &n) || (size_t) (cur->end - cur->pos) < n)
+        return NULL;
+
+    char *s = malloc((size_t) n + 1);
+    if (!s)
+        return NULL;
+    memcpy(s, cur->pos, n);
+    s[n] = '\0';
+    cur->pos += n;
+    return s;
+}
+
+/**
+ * @brief Recursively decodes one value at the cursor.
+ */
+static cJSON *_decode_value(cursor_t *cur, int depth)
+{
+    if (cur->pos >= cur->end || depth > STORAGE_MAX_DEPTH)
+        return NULL;
+
+    uint8_t tag = *cur->pos++;
+    switch (tag) {
+        case TAG_NULL:
+            return cJSON_CreateNull();
+        case TAG_TRUE:
+            return cJSON_CreateTrue();
+        case TAG_FALSE:
+            return cJSON_CreateFalse();
+        case TAG_INT: {
+            uint32_t v;
+            if (!_take_u32(cur, &v))
+                return NULL;
+            return cJSON_CreateNumber((double) (int32_t) v);
+        }
+        case TAG_DOUBLE: {
+            uint32_t lo, hi;
+            if (!_take_u32(cur, &lo) || !_take_u32(cur, &hi))
+                return NULL;
+            uint64_t bits = ((uint64_t) hi << 32) | lo;
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return cJSON_CreateNumber(d);
+        }
+        case TAG_STRING: {
+            char *s = _take_string(cur);
+            if (!s)
+                return NULL;
+            cJSON *item = cJSON_CreateString(s);
+            free(s);
+            return item;
+        }
+        case TAG_ARRAY:
+        case TAG_OBJECT: {
+            uint32_t count;
+            if (!_take_u32(cur, &count))
+                return NULL;
+
+            cJSON *item = (tag == TAG_OBJECT) ? cJSON_CreateObject() : cJSON_CreateArray();
+            for (uint32_t i = 0; item && i < count; i++) {
+                char *key = NULL;
+                if (tag == TAG_OBJECT && !(key = _take_string(cur))) {
+                    cJSON_Delete(item);
+                    return NULL;
+                }
+                cJSON *child = _decode_value(cur, depth + 1);
+                if (!child) {
+                    free(key);
+                    cJSON_Delete(item);
+                    return NULL;
+                }
+                if (key) {
+                    cJSON_AddItemToObject(item, key, child);
+                    free(key);
+                } else {
+                    cJSON_AddItemToArray(item, child);
+                }
+            }
+            return item;
+        }
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * @brief Decodes a single value from the binary document encoding.
+ *
+ * @param[in] data Encoded bytes.
+ * @param[in] len  Number of bytes available in @p data.
+ * @return The decoded value, or NULL if the bytes are malformed.
+ */
+cJSON *storage_decode(const uint8_t *data, size_t len)
+{
+    cursor_t cur = {data, data + len};
+    return _decode_value(&cur, 0);
+}
+
+/**
+ * @brief Tells whether a collection entry is a placeholder for an unloaded document.
+ */
+static bool _is_placeholder(const cJSON *doc)
+{
+    return cJSON_IsRaw(doc) && !doc->valuestring;
+}
+
+/**
+ * @brief Returns the document to serialize for a collection entry.
+ *
+ * Placeholders are resolved into a temporary copy stored in @p owned, which
+ * the caller frees once the document has been written.
+ */
+static const cJSON *_resolve_doc(const cJSON *doc, storage_resolve_fn resolve, void *ctx,
+                                 cJSON **owned)
+{
+    *owned = NULL;
+    if (!_is_placeholder(doc))
+        return doc;
+    if (resolve)
+        *owned = resolve(doc, ctx);
+    return *owned;
+}
+
+/**
+ * @brief Writes a collection name as a quoted JSON string.
+ */
+static bool _write_json_key(FILE *fp, const char *name, bool first)
+{
+    cJSON *key = cJSON_CreateString(name ? name : "");
+    char *str = key ? cJSON_PrintUnformatted(key) : NULL;
+    bool ok = str && fprintf(fp, "%s\n%s: ", first ? "" : ",", str) > 0;
+    free(str);
+    cJSON_Delete(key);
+    return ok;
+}
+
+/**
+ * @brief Writes the image as JSON, one compact document per line.
+ */
+static bool _write_json(FILE *fp, const cJSON *root, storage_resolve_fn resolve, void *ctx)
+{
+    bool ok = fputc('{', fp) != EOF;
+
+    const cJSON *coll = root->child;
+    while (ok && coll) {
+        ok = _write_json_key(fp, coll->string, coll == root->child);
+        if (ok && !cJSON_IsArray(coll)) {
+            char *str = cJSON_PrintUnformatted(coll);
+            ok = str && fputs(str, fp) != EOF;
+            free(str);
+        } else if (ok) {
+            ok = fputc('[', fp) != EOF;
+            const cJSON *doc = coll->child;
+            while (ok && doc) {
+                cJSON *owned;
+                const cJSON *resolved = _resolve_doc(doc, resolve, ctx, &owned);
+                char *str = resolved ? cJSON_PrintUnformatted(resolved) : NULL;
+                ok = str && fprintf(fp, "%s\n%s", doc == coll->child ? "" : ",", str) > 0;
+                free(str);
+                cJSON_Delete(owned);
+                doc = doc->next;
+            }
+            ok = ok && fputs(coll->child ? "\n]" : "]", fp) != EOF;
+        }
+        coll = coll->next;
+    }
+
+    return ok && fputs("\n}\n", fp) != EOF;
+}
+
+/**
+ * @brief Writes the image as a stream of binary collection sections.
+ */
+static bool _write_binary(FILE *fp, const cJSON *root, storage_resolve_fn resolve, void *ctx)
+{
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    bool ok = fwrite(STORAGE_MAGIC, 1, 4, fp) == 4;
+
+    const cJSON *coll = root->child;
+    while (ok && coll) {
+        if (!cJSON_IsArray(coll) || !coll->string) {
+            coll = coll->next;
+            continue;
+        }
+
+        /* Section header: tag, name, document count */
+        size_t len = 0;
+        ok = _reserve(&buf, &cap, len, 1);
+        if (ok) {
+            buf[len++] = SECTION_COLLECTION;
+            ok = _emit_bytes(&buf, &cap, &len, coll->string, strlen(coll->string)) &&
+                 _reserve(&buf, &cap, len, 4);
+        }
+        if (ok) {
+            _put_u32(buf + len, (uint32_t) cJSON_GetArraySize(coll));
+            len += 4;
+            ok = fwrite(buf, 1, len, fp) == len;
+        }
+
+        /* Documents: length prefix reserved first, patched after encoding */
+        const cJSON *doc = coll->child;
+        while (ok && doc) {
+            cJSON *owned;
+            const cJSON *resolved = _resolve_doc(doc, resolve, ctx, &owned);
+            len = 4;
+            ok = resolved && _reserve(&buf, &cap, 0, 4) &&
+                 storage_encode(resolved, &buf, &cap, &len);
+            if (ok) {
+                _put_u32(buf, (uint32_t) (len - 4));
+                ok = fwrite(buf, 1, len, fp) == len;
+            }
+            cJSON_Delete(owned);
+            doc = doc->next;
+        }
+        coll = coll->next;
+    }
+
+    if (ok)
+        ok = fputc(SECTION_END, fp) != EOF;
+    free(buf);
+    return ok;
+}
+
+/**
+ * @brief Writes a database image to an open stream.
+ *
+ * @param[in] fp      Destination stream.
+ * @param[in] root    Object mapping collection names to document arrays.
+ * @param[in] format  Format to write.
+ * @param[in] resolve Placeholder resolver (may be NULL).
+ * @param[in] ctx     Context passed to @p resolve.
+ * @return true if everything was written to the stream.
+ */
+bool storage_write(FILE *fp, const cJSON *root, storage_format_t format,
+                   storage_resolve_fn resolve, void *ctx)
+{
+    if (!fp || !root)
+        return false;
+    return format == STORAGE_FORMAT_BINARY ? _write_binary(fp, root, resolve, ctx)
+                                           : _write_json(fp, root, resolve, ctx);
+}
+
+/**
+ * @brief Reads a u32 directly from the stream.
+ */
+static bool _read_u32(FILE *fp, uint32_t *out)
+{
+    uint8_t b[4];
+    if (fread(b, 1, 4, fp) != 4)
+        return false;
+    *out = _get_u32(b);
+    return true;
+}
+
+/**
+ * @brief Streams binary collection sections into a new root object.
+ *
+ * Only one encoded document is buffered at a time.
+ */
+static cJSON *_read_binary(FILE *fp)
+{
+    cJSON *root = cJSON_CreateObject();
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    bool ok = true;
+
+    int tag;
+    while (ok && (tag = fgetc(fp)) == SECTION_COLLECTION) {
+        uint32_t name_len, count;
+        ok = _read_u32(fp, &name_len) && _reserve(&buf, &cap, 0, (size_t) name_len + 1) &&
+             fread(buf, 1, name_len, fp) == name_len && _read_u32(fp, &count);
+        if (!ok)
+            break;
+        buf[name_len] = '\0';
+
+        cJSON *coll = cJSON_GetObjectItemCaseSensitive(root, (const char *) buf);
+        if (!coll) {
+            coll = cJSON_CreateArray();
+            cJSON_AddItemToObject(root, (const char *) buf, coll);
+        }
+
+        for (uint32_t i = 0; ok && i < count; i++) {
+            uint32_t doc_len;
+            ok = _read_u32(fp, &doc_len) && _reserve(&buf, &cap, 0, doc_len) &&
+                 fread(buf, 1, doc_len, fp) == doc_len;
+            cJSON *doc = ok ? storage_decode(buf, doc_len) : NULL;
+            if (!doc) {
+                ok = false;
+                break;
+            }
+            cJSON_AddItemToArray(coll, doc);
+        }
+    }
+    if (ok && tag != SECTION_END)
+        ok = false;
+
+    free(buf);
+    if (!ok) {
+        cJSON_Delete(root);
+        return NULL;
+    }
+    return root;
+}
+
+/**
+ * @brief Reads and parses a whole JSON image.
+ */
+static cJSON *_read_json(FILE *fp)
+{
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (len <= 0)
+        return NULL;
+
+    char *data = malloc(len + 1);
+    if (!data)
+        return NULL;
+
+    cJSON *root = NULL;
+    if (fread(data, 1, len, fp) == (size_t) len) {
+        data[len] = '\0';
+        root = cJSON_Parse(data);
+    }
+    free(data);
+    return root;
+}
+
+/**
+ * @brief Loads a database image from an open stream.
+ *
+ * @param[in] fp Source stream positioned at the start of the file.
+ * @return The root object, or NULL if the stream is empty or malformed.
+ */
+cJSON *storage_read(FILE *fp)
+{
+    if (!fp)
+        return NULL;
+
+    char magic[4];
+    if (fread(magic, 1, 4, fp) == 4 && memcmp(magic, STORAGE_MAGIC, 4) == 0)
+        return _read_binary(fp);
+
+    fseek(fp, 0, SEEK_SET);
+    return _read_json(fp);
+}
+
+/**
+ * @brief Advances the cursor over @p n bytes.
+ */
+static bool _skip_bytes(cursor_t *cur, size_t n)
+{
+    if ((size_t) (cur->end - cur->pos) < n)
+        return false;
+    cur->pos += n;
+    return true;
+}
+
+/**
+ * @brief Skips one encoded value without decoding it.
+ */
+static bool _skip_encoded(cursor_t *cur, int depth)
+{
+    if (cur->pos >= cur->end || depth > STORAGE_MAX_DEPTH)
+        return false;
+
+    uint8_t tag = *cur->pos++;
+    uint32_t n;
+    switch (tag) {
+        case TAG_NULL:
+        case TAG_TRUE:
+        case TAG_FALSE:
+            return true;
+        case TAG_INT:
+            return _skip_bytes(cur, 4);
+        case TAG_DOUBLE:
+            return _skip_bytes(cur, 8);
+        case TAG_STRING:
+            return _take_u32(cur, &n) && _skip_bytes(cur, n);
+        case TAG_ARRAY:
+        case TAG_OBJECT:
+            if (!_take_u32(cur, &n))
+                return false;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t key_len;
+                if (tag == TAG_OBJECT && !(_take_u32(cur, &key_len) && _skip_bytes(cur, key_len)))
+                    return false;
+                if (!_skip_encoded(cur, depth + 1))
+                    return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Locates the string `_id` member of an encoded document.
+ */
+static void _binary_find_id(const uint8_t *doc, size_t len, const uint8_t **id, size_t *id_len)
+{
+    cursor_t cur = {doc, doc + len};
+    uint32_t count;
+
+    *id = NULL;
+    if (len == 0 || *cur.pos++ != TAG_OBJECT || !_take_u32(&cur, &count))
+        return;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t key_len, value_len;
+        if (!_take_u32(&cur, &key_len) || (size_t) (cur.end - cur.pos) < key_len)
+            return;
+        bool is_id = key_len == 3 && memcmp(cur.pos, "_id", 3) == 0;
+        cur.pos += key_len;
+
+        if (is_id) {
+            if (cur.pos < cur.end && *cur.pos++ == TAG_STRING && _take_u32(&cur, &value_len) &&
+                (size_t) (cur.end - cur.pos) >= value_len) {
+                *id = cur.pos;
+                *id_len = value_len;
+            }
+            return;
+        }
+        if (!_skip_encoded(&cur, 1))
+            return;
+    }
+}
+
+/**
+ * @brief Reports the document spans of a binary image.
+ */
+static bool _scan_binary(const uint8_t *data, size_t len, storage_span_fn fn, void *ctx)
+{
+    cursor_t cur = {data + 4, data + len};
+    char *name = NULL;
+    bool ok = true;
+
+    while (ok && cur.pos < cur.end && *cur.pos == SECTION_COLLECTION) {
+        cur.pos++;
+        uint32_t count;
+        free(name);
+        ok = (name = _take_string(&cur)) && _take_u32(&cur, &count) &&
+             fn(ctx, name, STORAGE_FORMAT_BINARY, NULL, 0, NULL, 0);
+
+        for (uint32_t i = 0; ok && i < count; i++) {
+            uint32_t doc_len;
+            ok = _take_u32(&cur, &doc_len) && (size_t) (cur.end - cur.pos) >= doc_len;
+            if (!ok)
+                break;
+
+            const uint8_t *id;
+            size_t id_len = 0;
+            _binary_find_id(cur.pos, doc_len, &id, &id_len);
+            ok = fn(ctx, name, STORAGE_FORMAT_BINARY, cur.pos, doc_len, id, id_len);
+            cur.pos += doc_len;
+        }
+    }
+
+    free(name);
+    return ok && cur.pos < cur.end && *cur.pos == SECTION_END;
+}
+
+/**
+ * @brief Skips JSON whitespace.
+ */
+static const uint8_t *_json_ws(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+/**
+ * @brief Skips a JSON string starting at its opening quote.
+ *
+ * @return Pointer past the closing quote, or NULL if unterminated. Sets
+ *         @p escaped when the string contains escape sequences.
+ */
+static const uint8_t *_json_skip_string(const uint8_t *p, const uint8_t *end, bool *escaped)
+{
+    for (p++; p < end; p++) {
+        if (*p == '"')
+            return p + 1;
+        if (*p == '\\') {
+            *escaped = true;
+            p++;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Skips one JSON value by tracking nesting, without decoding it.
+ */
+static const uint8_t *_json_skip_value(const uint8_t *p, const uint8_t *end)
+{
+    int depth = 0;
+    bool escaped;
+
+    do {
+        p = _json_ws(p, end);
+        if (p >= end)
+            return NULL;
+
+        switch (*p) {
+            case '"':
+                if (!(p = _json_skip_string(p, end, &escaped)))
+                    return NULL;
+                break;
+            case '{':
+            case '[':
+                if (++depth > STORAGE_MAX_DEPTH)
+                    return NULL;
+                p++;
+                break;
+            case '}':
+            case ']':
+                if (--depth < 0)
+                    return NULL;
+                p++;
+                break;
+            case ',':
+            case ':':
+                if (depth == 0)
+                    return NULL;
+                p++;
+                break;
+            default:
+                /* Number or literal */
+                while (p < end && *p != ',' && *p != ':' && *p != ']' && *p != '}' &&
+                       *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+                    p++;
+                break;
+        }
+    } while (depth > 0);
+
+    return p;
+}
+
+/**
+ * @brief Skips one JSON document, noting where its string `_id` is.
+ *
+ * Ids containing escape sequences are not reported, so the caller decodes
+ * those documents instead of comparing raw bytes.
+ */
+static const uint8_t *_json_scan_doc(const uint8_t *p, const uint8_t *end, const uint8_t **id,
+                                     size_t *id_len)
+{
+    *id = NULL;
+    if (*p != '{')
+        return _json_skip_value(p, end);
+
+    p = _json_ws(p + 1, end);
+    if (p < end && *p == '}')
+        return p + 1;
+
+    while (p < end && *p == '"') {
+        const uint8_t *key = p;
+        bool escaped = false;
+        if (!(p = _json_skip_string(p, end, &escaped)))
+            return NULL;
+        bool is_id = !escaped && p - key == 5 && memcmp(key, "\"_id\"", 5) == 0;
+
+        p = _json_ws(p, end);
+        if (p >= end || *p != ':')
+            return NULL;
+        p = _json_ws(p + 1, end);
+
+        const uint8_t *value = p;
+        escaped = false;
+        p = (p < end && *p == '"') ? _json_skip_string(p, end, &escaped)
+                                   : _json_skip_value(p, end);
+        if (!p)
+            return NULL;
+        if (is_id && !*id && *value == '"' && !escaped) {
+            *id = value + 1;
+            *id_len = (size_t) (p - value) - 2;
+        }
+
+        p = _json_ws(p, end);
+        if (p < end && *p == '}')
+            return p + 1;
+        if (p >= end || *p != ',')
+            return NULL;
+        p = _json_ws(p + 1, end);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Decodes a quoted JSON object key into a new string.
+ */
+static char *_json_key(const uint8_t *key, size_t len)
+{
+    cJSON *parsed = cJSON_ParseWithLength((const char *) key, len);
+    char *name = NULL;
+    if (cJSON_IsString(parsed)) {
+        name = parsed->valuestring;
+        parsed->valuestring = NULL;
+    }
+    cJSON_Delete(parsed);
+    return name;
+}
+
+/**
+ * @brief Reports the document spans of a JSON image.
+ */
+static bool _scan_json(const uint8_t *data, size_t len, storage_span_fn fn, void *ctx)
+{
+    const uint8_t *end = data + len;
+    const uint8_t *p = _json_ws(data, end);
+    if (p >= end || *p != '{')
+        return false;
+
+    p = _json_ws(p + 1, end);
+    if (p < end && *p == '}')
+        return true;
+
+    while (p < end && *p == '"') {
+        const uint8_t *key = p;
+        bool escaped = false;
+        if (!(p = _json_skip_string(p, end, &escaped)))
+            return false;
+
+        char *name = _json_key(key, (size_t) (p - key));
+        p = _json_ws(p, end);
+        if (!name || p >= end || *p != ':') {
+            free(name);
+            return false;
+        }
+
+        /* Only arrays of documents can be loaded lazily */
+        p = _json_ws(p + 1, end);
+        bool ok = p < end && *p == '[' && fn(ctx, name, STORAGE_FORMAT_JSON, NULL, 0, NULL, 0);
+        if (ok)
+            p = _json_ws(p + 1, end);
+        if (ok && p < end && *p == ']') {
+            p++;
+        } else {
+            while (ok) {
+                const uint8_t *doc = p, *id;
+                size_t id_len = 0;
+                ok = p < end && (p = _json_scan_doc(p, end, &id, &id_len)) &&
+                     fn(ctx, name, STORAGE_FORMAT_JSON, doc, (size_t) (p - doc), id, id_len);
+                if (ok)
+                    p = _json_ws(p, end);
+                if (!ok || p >= end || *p == ']')
+                    break;
+                ok = *p == ',';
+                p = _json_ws(p + 1, end);
+            }
+            ok = ok && p < end && *p++ == ']';
+        }
+        free(name);
+        if (!ok)
+            return false;
+
+        p = _json_ws(p, end);
+        if (p < end && *p == '}')
+            return true;
+        if (p >= end || *p != ',')
+            return false;
+        p = _json_ws(p + 1, end);
+    }
+    return false;
+}
+
+/**
+ * @brief Walks an image held in memory without decoding its documents.
+ *
+ * Before the documents of a collection are reported, @p fn is called once
+ * with a NULL @p doc to announce the collection, so empty collections are
+ * preserved.
+ *
+ * @param[in] data Image bytes.
+ * @param[in] len  Image size in bytes.
+ * @param[in] fn   Callback invoked for every document span.
+ * @param[in] ctx  Context passed to @p fn.
+ * @return true if the whole image was well-formed and scanned.
+ */
+bool storage_scan(const uint8_t *data, size_t len, storage_span_fn fn, void *ctx)
+{
+    if (!data || !fn)
+        return false;
+    if (len >= 4 && memcmp(data, STORAGE_MAGIC, 4) == 0)
+        return _scan_binary(data, len, fn, ctx);
+    return _scan_json(data, len, fn, ctx);
+}
+
+/**
+ * @brief Decodes one document span reported by storage_scan().
+ *
+ * @param[in] doc    First byte of the encoded document.
+ * @param[in] len    Length of the encoded document.
+ * @param[in] format Encoding of the span.
+ * @return The decoded document, or NULL if malformed.
+ */
+cJSON *storage_materialize(const uint8_t *doc, size_t len, storage_format_t format)
+{
+    if (format == STORAGE_FORMAT_BINARY)
+        return storage_decode(doc, len);
+    return cJSON_ParseWithLength((const char *) doc, len);
+}
+
+/**
+ * @brief Collects document spans for storage_load().
+ */
+static bool _load_collect(void *arg, const char *collection, storage_format_t format,
+                          const uint8_t *doc, size_t len, const uint8_t *id, size_t id_len)
+{
+    (void) id;
+    (void) id_len;
+    load_ctx_t *ctx = arg;
+
+    if (!doc) {
+        ctx->coll = cJSON_GetObjectItemCaseSensitive(ctx->root, collection);
+        if (!ctx->coll) {
+            ctx->coll = cJSON_CreateArray();
+            cJSON_AddItemToObject(ctx->root, collection, ctx->coll);
+        }
+        return ctx->coll != NULL;
+    }
+
+    if (ctx->count == ctx->cap) {
+        size_t cap = ctx->cap ? ctx->cap * 2 : 1024;
+        load_span_t *grown = realloc(ctx->spans, cap * sizeof(*grown));
+        if (!grown)
+            return false;
+        ctx->spans = grown;
+        ctx->cap = cap;
+    }
+    ctx->spans[ctx->count++] = (load_span_t) {doc, len, format, ctx->coll, NULL};
+    return true;
+}
+
+/**
+ * @brief Decodes a range of collected spans (runs on a worker thread).
+ */
+static void _load_range(size_t begin, size_t end, void *arg)
+{
+    load_ctx_t *ctx = arg;
+    for (size_t i = begin; i < end; i++) {
+        load_span_t *span = &ctx->spans[i];
+        span->doc = storage_materialize(span->data, span->len, span->format);
+    }
+}
+
+/**
+ * @brief Decodes an image held in memory on several threads.
+ *
+ * @param[in] data    Image bytes.
+ * @param[in] len     Image size in bytes.
+ * @param[in] threads Number of decoding threads.
+ * @return The root object, or NULL if the image is malformed.
+ */
+cJSON *storage_load(const uint8_t *data, size_t len, int threads)
+{
+    load_ctx_t ctx = {cJSON_CreateObject(), NULL, NULL, 0, 0};
+    bool ok = ctx.root && storage_scan(data, len, _load_collect, &ctx);
+
+    if (ok)
+        utils_parallel_for(ctx.count, threads, _load_range, &ctx);
+
+    /* Link in file order; the collection lists are only touched here */
+    for (size_t i = 0; i < ctx.count; i++) {
+        load_span_t *span = &ctx.spans[i];
+        if (ok && span->doc) {
+            cJSON_AddItemToArray(span->coll, span->doc);
+        } else {
+            ok = false;
+            cJSON_Delete(span->doc);
+        }
+    }
+
+    free(ctx.spans);
+    if (!ok) {
+        cJSON_Delete(ctx.root);
+        return NULL;
+    }
+    return ctx.root;
+}
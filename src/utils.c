@@ -2,17 +2,30 @@
  * @file utils.c
  * @brief General utility functions for the Database system.
  *
- * Provides helper functions for unique ID generation and system logging.
- * These implementations support the core database operations by managing
- * identity and observability.
+ * Provides helper functions for unique ID generation, system logging and
+ * splitting work across threads. These implementations support the core
+ * database operations by managing identity, observability and parallelism.
  */
 
 #include "../include/utils.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief One range of a utils_parallel_for() call.
+ */
+typedef struct
+{
+    size_t begin;      /**< First index of the range. */
+    size_t end;        /**< One past the last index. */
+    utils_range_fn fn; /**< Work function. */
+    void *ctx;         /**< Work function context. */
+} range_task_t;
 
 /**
  * @brief Character set used for random UUID generation.
@@ -69,3 +82,72 @@ void utils_log(const char *level, const char *msg)
         printf("[%s] [%s] %s\n", buf, level, msg);
     }
 }
+
+/**
+ * @brief Returns the number of online CPUs (at least 1).
+ *
+ * @return int Number of processors available to the process.
+ */
+int utils_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+/**
+ * @brief Worker thread entry point for utils_parallel_for().
+ *
+ * @param[in] arg The range_task_t to run.
+ * @return void* Always NULL.
+ */
+static void *_range_worker(void *arg)
+{
+    range_task_t *task = arg;
+    task->fn(task->begin, task->end, task->ctx);
+    return NULL;
+}
+
+/**
+ * @brief Splits [0, count) into contiguous ranges and runs them on a worker pool.
+ *
+ * @param[in] count   Number of indices to process.
+ * @param[in] threads Number of threads to use.
+ * @param[in] fn      Function invoked once per range.
+ * @param[in] ctx     Context passed to @p fn.
+ */
+void utils_parallel_for(size_t count, int threads, utils_range_fn fn, void *ctx)
+{
+    if (threads < 1)
+        threads = 1;
+    if ((size_t) threads > count)
+        threads = count > 0 ? (int) count : 1;
+
+    range_task_t *tasks = threads > 1 ? calloc(threads, sizeof(*tasks)) : NULL;
+    pthread_t *tids = tasks ? calloc(threads, sizeof(*tids)) : NULL;
+    if (!tids) {
+        free(tasks);
+        fn(0, count, ctx);
+        return;
+    }
+
+    bool *started = calloc(threads, sizeof(*started));
+    for (int i = 0; i < threads; i++) {
+        tasks[i] = (range_task_t) {count * i / threads, count * (i + 1) / threads, fn, ctx};
+        /* Range 0 runs on the caller; failed spawns run after it */
+        if (i > 0 && started)
+            started[i] = pthread_create(&tids[i], NULL, _range_worker, &tasks[i]) == 0;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (i == 0 || !started || !started[i])
+            _range_worker(&tasks[i]);
+    }
+    for (int i = 1; i < threads; i++) {
+        if (started && started[i])
+            pthread_join(tids[i], NULL);
+    }
+
+    free(started);
+    free(tids);
+    free(tasks);
+}
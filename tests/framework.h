@@ -10,6 +10,10 @@
 #ifndef TEST_FRAMEWORK_H
 #define TEST_FRAMEWORK_H
 
+#include "../include/database.h"
+#include "../include/query.h"
+
+#include <stdbool.h>
 #include <stdio.h>
 
 /** * @name ANSI Color Codes
@@ -77,4 +81,58 @@ static int g_tests_failed = 0;                      /**< Total number of asserti
         printf("%sPASS%s\n", CLR_GREEN, CLR_RESET);                            \
     } while (0)
 
+/** * @name Engine Helpers
+ * @{
+ */
+
+/**
+ * @brief Counts the documents of a collection a query selects.
+ * * Shared by find_count() and match_count().
+ * @param coll       The collection.
+ * @param query_text The query, as JSON.
+ * @param scan       Read every document and count those query_match()
+ *                   accepts, instead of the results of the query.
+ * @return The number of documents, or -1 if a find returned one the query
+ *         does not match.
+ */
+static int _test_count(const char *coll, const char *query_text, bool scan)
+{
+    cJSON *query = cJSON_Parse(query_text);
+    cJSON *res = db_find(coll, scan ? NULL : query, 0);
+    int count = 0;
+    bool stray = false;
+    for (cJSON *doc = res ? res->child : NULL; doc; doc = doc->next) {
+        bool match = query_match(doc, query);
+        count += match;
+        stray = stray || (!scan && !match);
+    }
+    cJSON_Delete(res);
+    cJSON_Delete(query);
+    return stray ? -1 : count;
+}
+
+/**
+ * @brief Runs a find and returns the number of results.
+ * @param coll       The collection.
+ * @param query_text The query, as JSON.
+ * @return The number of results, or -1 if one does not match the query.
+ */
+static __attribute__((unused)) int find_count(const char *coll, const char *query_text)
+{
+    return _test_count(coll, query_text, false);
+}
+
+/**
+ * @brief Counts the documents a query matches by reading the whole collection.
+ * * Gives the expected result of a find without relying on its indexes or plan.
+ * @param coll       The collection.
+ * @param query_text The query, as JSON.
+ * @return The number of matching documents.
+ */
+static __attribute__((unused)) int match_count(const char *coll, const char *query_text)
+{
+    return _test_count(coll, query_text, true);
+}
+/** @} */
+
 #endif /* TEST_FRAMEWORK_H */
@@ -18,12 +18,222 @@
  */
 void test_query_exact_match(void);
 
+/**
+ * @brief Query engine range operator test.
+ * @note Implementation located in test_query.c.
+ */
+void test_query_range(void);
+
+/**
+ * @brief Compiled query test.
+ * @note Implementation located in test_query.c.
+ */
+void test_query_compiled(void);
+
+/**
+ * @brief Query operator test.
+ * @note Implementation located in test_query.c.
+ */
+void test_query_operators(void);
+
+/**
+ * @brief Query field path test.
+ * @note Implementation located in test_query.c.
+ */
+void test_query_paths(void);
+
+/**
+ * @brief Planner statistics and cost test.
+ * @note Implementation located in test_planner.c.
+ */
+void test_planner_basic(void);
+
+/**
+ * @brief Hash index test.
+ * @note Implementation located in test_index.c.
+ */
+void test_index_basic(void);
+
+/**
+ * @brief Skiplist test.
+ * @note Implementation located in test_index.c.
+ */
+void test_skiplist_basic(void);
+
+/**
+ * @brief Secondary index module test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_secondary_basic(void);
+
+/**
+ * @brief Ordered index module test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_secondary_ordered(void);
+
+/**
+ * @brief Compound index module test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_secondary_compound(void);
+
+/**
+ * @brief Inverted index module test.
+ * @note Implementation located in test_fulltext.c.
+ */
+void test_fulltext_basic(void);
+
+/**
+ * @brief Compressed bitmap module test.
+ * @note Implementation located in test_bitmap.c.
+ */
+void test_bitmap_basic(void);
+
 /**
  * @brief Full CRUD workflow test.
  * @note Implementation located in test_crud.c.
  */
 void test_crud_workflow(void);
 
+/**
+ * @brief `_id` lookup consistency test.
+ * @note Implementation located in test_crud.c.
+ */
+void test_id_lookup(void);
+
+/**
+ * @brief Per-collection `_id` index test.
+ * @note Implementation located in test_crud.c.
+ */
+void test_collection_isolation(void);
+
+/**
+ * @brief Find projection test.
+ * @note Implementation located in test_crud.c.
+ */
+void test_projection(void);
+
+/**
+ * @brief Secondary indexes through the engine test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_secondary_engine(void);
+
+/**
+ * @brief Range query and sorted find test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_ordered_engine(void);
+
+/**
+ * @brief Compound and covering index test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_compound_engine(void);
+
+/**
+ * @brief Unique index test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_unique_engine(void);
+
+/**
+ * @brief TTL index and reaper test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_ttl_engine(void);
+
+/**
+ * @brief Index file test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_index_files(void);
+
+/**
+ * @brief Query operator engine test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_operator_engine(void);
+
+/**
+ * @brief Field path engine test.
+ * @note Implementation located in test_secondary.c.
+ */
+void test_path_engine(void);
+
+/**
+ * @brief Planned find and explain test.
+ * @note Implementation located in test_planner.c.
+ */
+void test_planner_engine(void);
+
+/**
+ * @brief Text index and search test.
+ * @note Implementation located in test_fulltext.c.
+ */
+void test_text_engine(void);
+
+/**
+ * @brief Bitmap index test.
+ * @note Implementation located in test_bitmap.c.
+ */
+void test_bitmap_engine(void);
+
+/**
+ * @brief Write-ahead log crash recovery test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_wal_replay(void);
+
+/**
+ * @brief Concurrent group commit test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_group_commit(void);
+
+/**
+ * @brief Log checkpointing test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_background_checkpoint(void);
+
+/**
+ * @brief Binary storage format round-trip test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_binary_format(void);
+
+/**
+ * @brief Lazy, memory-mapped startup test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_lazy_load(void);
+
+/**
+ * @brief Parallel startup load and index build test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_parallel_load(void);
+
+/**
+ * @brief Per-collection storage files test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_collection_files(void);
+
+/**
+ * @brief Incremental snapshot and restore test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_incremental_snapshot(void);
+
+/**
+ * @brief Forked snapshot test.
+ * @note Implementation located in test_persistence.c.
+ */
+void test_fork_snapshot(void);
+
 /**
  * @brief Test runner entry point.
  * * Sets up a temporary database file, executes all registered unit tests,
@@ -44,20 +254,57 @@ int main(void)
 
     /* 3. Execute Query Logic Tests */
     REGISTER_TEST(test_query_exact_match);
+    REGISTER_TEST(test_query_range);
+    REGISTER_TEST(test_query_compiled);
+    REGISTER_TEST(test_query_operators);
+    REGISTER_TEST(test_query_paths);
+    REGISTER_TEST(test_planner_basic);
+    REGISTER_TEST(test_index_basic);
+    REGISTER_TEST(test_skiplist_basic);
+    REGISTER_TEST(test_secondary_basic);
+    REGISTER_TEST(test_secondary_ordered);
+    REGISTER_TEST(test_secondary_compound);
+    REGISTER_TEST(test_fulltext_basic);
+    REGISTER_TEST(test_bitmap_basic);
 
     /* 4. Reset database state to isolate test side-effects */
     db_drop_all();
 
     /* 5. Execute CRUD Workflow Tests */
     REGISTER_TEST(test_crud_workflow);
+    REGISTER_TEST(test_id_lookup);
+    REGISTER_TEST(test_collection_isolation);
+    REGISTER_TEST(test_projection);
+    REGISTER_TEST(test_secondary_engine);
+    REGISTER_TEST(test_ordered_engine);
+    REGISTER_TEST(test_compound_engine);
+    REGISTER_TEST(test_unique_engine);
+    REGISTER_TEST(test_ttl_engine);
+    REGISTER_TEST(test_index_files);
+    REGISTER_TEST(test_operator_engine);
+    REGISTER_TEST(test_path_engine);
+    REGISTER_TEST(test_planner_engine);
+    REGISTER_TEST(test_text_engine);
+    REGISTER_TEST(test_bitmap_engine);
+
+    /* 6. Execute Persistence Tests (re-open the suite database on exit) */
+    REGISTER_TEST(test_wal_replay);
+    REGISTER_TEST(test_group_commit);
+    REGISTER_TEST(test_background_checkpoint);
+    REGISTER_TEST(test_binary_format);
+    REGISTER_TEST(test_lazy_load);
+    REGISTER_TEST(test_parallel_load);
+    REGISTER_TEST(test_collection_files);
+    REGISTER_TEST(test_incremental_snapshot);
+    REGISTER_TEST(test_fork_snapshot);
 
-    /* 6. Cleanup database memory resources */
+    /* 7. Cleanup database memory resources */
     db_cleanup();
 
-    /* 7. Remove the physical test file to leave no trace */
-    remove("data/test_db.json");
+    /* 8. Remove the physical test files to leave no trace */
+    db_destroy("data/test_db.json");
 
-    /* 8. Final Report */
+    /* 9. Final Report */
     printf("Result: %d Run, %d Failed.\n", g_tests_run, g_tests_failed);
 
     return (g_tests_failed > 0) ? 1 : 0;
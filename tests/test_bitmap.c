@@ -0,0 +1,362 @@
+/**
+ * @file test_bitmap.c
+ * @brief Unit tests for compressed bitmaps and bitmap indexes.
+ *
+ * This test suite validates the bitmap on its own (array and bitset
+ * containers, conversions between them, intersections and unions) and the
+ * bitmap indexes built on it through the engine (multi-predicate finds,
+ * maintenance on writes and restarts).
+ */
+
+#include "../include/bitmap.h"
+#include "../include/database.h"
+#include "framework.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Values above every test value, so sets span several containers.
+ */
+#define SPAN 200000
+
+/**
+ * @brief Values collected by a walk.
+ */
+typedef struct
+{
+    uint32_t values[16];
+    size_t count;
+    size_t stop;
+} walk_t;
+
+/**
+ * @brief Records a visited value (bitmap_visit_fn).
+ */
+static bool collect(uint32_t value, void *ctx)
+{
+    walk_t *walk = ctx;
+    if (walk->count < 16)
+        walk->values[walk->count] = value;
+    walk->count++;
+    return walk->stop == 0 || walk->count < walk->stop;
+}
+
+/**
+ * @brief Checks the values of a walk are strictly ascending (bitmap_visit_fn).
+ */
+static bool ascending(uint32_t value, void *ctx)
+{
+    int64_t *last = ctx;
+    if ((int64_t) value <= *last)
+        return false;
+    *last = value;
+    return true;
+}
+
+/**
+ * @brief Fills a bitmap and its reference with pseudo-random values.
+ *
+ * Values below 65536 are dense (bitset container), the next 65536 sparse
+ * (array container) and the rest either, depending on @p dense.
+ */
+static bool fill(bitmap_t *b, bool *ref, uint32_t seed, bool dense)
+{
+    for (uint32_t v = 0; v < SPAN; v++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t r = (seed >> 16) % 100;
+        bool in = v < 65536 ? r < 40 : v < 131072 ? r < 2 : dense ? r < 30 : r < 1;
+        ref[v] = in;
+        if (in && !bitmap_add(b, v))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Tells whether a bitmap holds exactly the values of a reference.
+ */
+static bool same(const bitmap_t *b, const bool *ref)
+{
+    size_t count = 0;
+    for (uint32_t v = 0; v < SPAN; v++) {
+        if (bitmap_contains(b, v) != ref[v])
+            return false;
+        count += ref[v];
+    }
+    int64_t last = -1;
+    return bitmap_count(b) == count && bitmap_foreach(b, ascending, &last);
+}
+
+/**
+ * @brief Tests the compressed bitmap module.
+ * * This test ensures that:
+ * 1. Values are added, found and removed, duplicates once.
+ * 2. Walks are ascending across containers and can be stopped.
+ * 3. Dense containers turn into bitsets and back once emptied enough.
+ * 4. Intersections and unions of every container pairing are exact.
+ * 5. Copies are independent of their source.
+ */
+TEST_START(test_bitmap_basic)
+
+static bool ref_a[SPAN], ref_b[SPAN], ref_x[SPAN];
+bitmap_t *a = bitmap_create();
+ASSERT(a != NULL);
+
+/* 1. Single values */
+ASSERT(bitmap_add(a, 7) == true);
+ASSERT(bitmap_add(a, 7) == true);
+ASSERT(bitmap_add(a, 70000) == true);
+ASSERT(bitmap_add(a, 3) == true);
+ASSERT_EQ((int) bitmap_count(a), 3);
+ASSERT(bitmap_contains(a, 7) && bitmap_contains(a, 70000) && !bitmap_contains(a, 8));
+ASSERT(bitmap_remove(a, 7) == true);
+ASSERT(bitmap_remove(a, 7) == false);
+ASSERT(bitmap_remove(a, 65536) == false);
+ASSERT_EQ((int) bitmap_count(a), 2);
+
+/* 2. Walks */
+walk_t walk = {.stop = 0};
+ASSERT(bitmap_foreach(a, collect, &walk) == true);
+ASSERT(walk.count == 2 && walk.values[0] == 3 && walk.values[1] == 70000);
+walk = (walk_t){.stop = 1};
+ASSERT(bitmap_foreach(a, collect, &walk) == false);
+ASSERT_EQ((int) walk.count, 1);
+ASSERT(bitmap_remove(a, 3) && bitmap_remove(a, 70000));
+ASSERT_EQ((int) bitmap_count(a), 0);
+ASSERT(bitmap_bytes(a) < 256);
+
+/* 3. Conversions: one full container costs 8 KB, a sparse one 2 bytes per value */
+for (uint32_t v = 0; v < 65536; v++)
+    ASSERT(bitmap_add(a, v) == true);
+ASSERT_EQ((int) bitmap_count(a), 65536);
+size_t dense = bitmap_bytes(a);
+ASSERT(dense >= 8192 && dense < 8192 + 256);
+for (uint32_t v = 0; v < 65536; v++) {
+    if (v % 64 != 0)
+        ASSERT(bitmap_remove(a, v) == true);
+}
+ASSERT_EQ((int) bitmap_count(a), 1024);
+ASSERT(bitmap_bytes(a) <= BITMAP_ARRAY_MAX + 256);
+ASSERT(bitmap_contains(a, 640) && !bitmap_contains(a, 641));
+bitmap_free(a);
+
+/* 4. Intersections and unions, over dense and sparse containers */
+for (int round = 0; round < 4; round++) {
+    a = bitmap_create();
+    bitmap_t *b = bitmap_create();
+    ASSERT(fill(a, ref_a, 17 + round, round & 1) == true);
+    ASSERT(fill(b, ref_b, 91 + round, round & 2) == true);
+    ASSERT(same(a, ref_a) && same(b, ref_b));
+
+    bitmap_t *x = bitmap_copy(a);
+    ASSERT(x != NULL);
+    bitmap_and(x, b);
+    for (uint32_t v = 0; v < SPAN; v++)
+        ref_x[v] = ref_a[v] && ref_b[v];
+    ASSERT(same(x, ref_x) == true);
+    bitmap_free(x);
+
+    x = bitmap_copy(b);
+    bitmap_and(x, a);
+    ASSERT(same(x, ref_x) == true);
+    bitmap_free(x);
+
+    x = bitmap_copy(a);
+    ASSERT(bitmap_or(x, b) == true);
+    for (uint32_t v = 0; v < SPAN; v++)
+        ref_x[v] = ref_a[v] || ref_b[v];
+    ASSERT(same(x, ref_x) == true);
+    bitmap_free(x);
+
+    /* 5. Copies: the sources survived the operations on their copies */
+    ASSERT(same(a, ref_a) && same(b, ref_b));
+
+    x = bitmap_create();
+    bitmap_and(x, a);
+    ASSERT_EQ((int) bitmap_count(x), 0);
+    ASSERT(bitmap_or(x, a) == true);
+    ASSERT(same(x, ref_a) == true);
+    bitmap_free(x);
+    bitmap_free(a);
+    bitmap_free(b);
+}
+
+TEST_END
+
+/**
+ * @brief Number of documents in the engine test.
+ */
+#define PEOPLE 600
+
+/**
+ * @brief Field values of the engine test documents.
+ */
+typedef struct
+{
+    const char *status[PEOPLE];
+    int age[PEOPLE];
+    bool active[PEOPLE];
+    bool deleted[PEOPLE];
+} people_t;
+
+/**
+ * @brief Counts the documents of the model matching every given value.
+ */
+static int expected(const people_t *p, const char *status, int region, int active, int min_age,
+                    int max_age)
+{
+    int count = 0;
+    for (int i = 0; i < PEOPLE; i++) {
+        if (p->deleted[i] || (status && strcmp(p->status[i], status) != 0) ||
+            (region >= 0 && i % 4 != region) || (active >= 0 && p->active[i] != active) ||
+            p->age[i] < min_age || p->age[i] >= max_age)
+            continue;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Tests bitmap indexes through the engine.
+ * * This test ensures that:
+ * 1. Bitmap indexes accept a single field, reject `unique` and list their size.
+ * 2. Queries on several indexed fields return what a scan returns, ranges
+ *    and sorted finds included.
+ * 3. Updates and deletes are reflected in the results.
+ * 4. Bitmap indexes are rebuilt on restart, lazily loaded documents included.
+ * 5. Dropping the indexes falls back to scans.
+ */
+TEST_START(test_bitmap_engine)
+
+static people_t p;
+static const char *statuses[3] = {"open", "closed", "pending"};
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+char id[32], region[8];
+for (int i = 0; i < PEOPLE; i++) {
+    p.status[i] = statuses[i % 3];
+    p.age[i] = i % 50;
+    p.active[i] = i % 5 != 0;
+    p.deleted[i] = false;
+    cJSON *doc = cJSON_CreateObject();
+    snprintf(id, sizeof(id), "p%d", i);
+    snprintf(region, sizeof(region), "r%d", i % 4);
+    cJSON_AddStringToObject(doc, "_id", id);
+    cJSON_AddStringToObject(doc, "status", p.status[i]);
+    cJSON_AddStringToObject(doc, "region", region);
+    cJSON_AddBoolToObject(doc, "active", p.active[i]);
+    cJSON_AddNumberToObject(doc, "age", p.age[i]);
+    ASSERT(db_insert("people", doc) == true);
+    cJSON_Delete(doc);
+}
+
+/* 1. Specifications */
+cJSON *spec = cJSON_Parse("{\"fields\":[\"status\",\"region\"],\"type\":\"bitmap\"}");
+ASSERT(db_create_index("people", spec) == false);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"status\",\"type\":\"bitmap\",\"unique\":true}");
+ASSERT(db_create_index("people", spec) == false);
+cJSON_Delete(spec);
+const char *fields[4] = {"status", "region", "active", "age"};
+for (int i = 0; i < 4; i++) {
+    spec = cJSON_CreateObject();
+    cJSON_AddStringToObject(spec, "field", fields[i]);
+    cJSON_AddStringToObject(spec, "type", "bitmap");
+    ASSERT(db_create_index("people", spec) == true);
+    cJSON_Delete(spec);
+}
+spec = cJSON_Parse("{\"field\":\"status\"}");
+ASSERT(db_create_index("people", spec) == true);
+cJSON_Delete(spec);
+cJSON *list = db_list_indexes("people");
+ASSERT_EQ(cJSON_GetArraySize(list), 6);
+cJSON *info = cJSON_GetArrayItem(list, 1);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "name")->valuestring, "status:bitmap") == 0);
+ASSERT_EQ((int) cJSON_GetObjectItem(info, "keys")->valuedouble, 3);
+ASSERT_EQ((int) cJSON_GetObjectItem(info, "entries")->valuedouble, PEOPLE);
+ASSERT(cJSON_GetObjectItem(info, "bytes")->valuedouble > 0);
+cJSON_Delete(list);
+
+/* 2. Multi-predicate finds */
+ASSERT_EQ(find_count("people", "{\"status\":\"open\"}"), expected(&p, "open", -1, -1, 0, 50));
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"region\":\"r1\",\"active\":true}"),
+          expected(&p, "open", 1, 1, 0, 50));
+ASSERT_EQ(find_count("people",
+                     "{\"status\":\"closed\",\"active\":false,\"age\":{\"$gte\":10,\"$lt\":30}}"),
+          expected(&p, "closed", -1, 0, 10, 30));
+ASSERT_EQ(find_count("people", "{\"region\":\"r2\",\"age\":{\"$lt\":5}}"),
+          expected(&p, NULL, 2, -1, 0, 5));
+ASSERT_EQ(find_count("people", "{\"status\":\"unknown\",\"region\":\"r2\"}"), 0);
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"region\":\"r1\",\"age\":-1}"), 0);
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"_id\":\"p3\"}"), 1);
+
+cJSON *query = cJSON_Parse("{\"status\":\"pending\",\"active\":true}");
+db_find_options_t opts = {.sort = "age", .descending = true, .limit = 5};
+cJSON *res = db_find_ex("people", query, &opts);
+ASSERT_EQ(cJSON_GetArraySize(res), 5);
+ASSERT_EQ((int) cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "age")->valuedouble, 49);
+ASSERT_EQ((int) cJSON_GetObjectItem(cJSON_GetArrayItem(res, 4), "age")->valuedouble, 48);
+cJSON_Delete(res);
+cJSON_Delete(query);
+
+/* 3. Writes */
+cJSON *change = cJSON_Parse("{\"status\":\"closed\",\"active\":false}");
+for (int i = 0; i < PEOPLE; i += 7) {
+    snprintf(id, sizeof(id), "p%d", i);
+    ASSERT(db_update("people", id, change) == true);
+    p.status[i] = "closed";
+    p.active[i] = false;
+}
+cJSON_Delete(change);
+for (int i = 1; i < PEOPLE; i += 11) {
+    snprintf(id, sizeof(id), "p%d", i);
+    ASSERT(db_delete("people", id) == true);
+    p.deleted[i] = true;
+}
+ASSERT_EQ(find_count("people", "{\"status\":\"closed\",\"active\":false}"),
+          expected(&p, "closed", -1, 0, 0, 50));
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"region\":\"r3\"}"),
+          expected(&p, "open", 3, -1, 0, 50));
+ASSERT_EQ(find_count("people", "{\"region\":\"r1\",\"active\":true,\"age\":{\"$gt\":40}}"),
+          expected(&p, NULL, 1, 1, 41, 50));
+
+/* Slots freed by deletes are reused by inserts */
+cJSON *doc = cJSON_Parse("{\"_id\":\"new\",\"status\":\"open\",\"region\":\"r9\"}");
+ASSERT(db_insert("people", doc) == true);
+cJSON_Delete(doc);
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"region\":\"r9\"}"), 1);
+ASSERT(db_delete("people", "new") == true);
+
+/* 4. Lazy restart */
+db_cleanup();
+db_set_lazy_load(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+ASSERT_EQ(find_count("people", "{\"status\":\"closed\",\"region\":\"r2\",\"active\":false}"),
+          expected(&p, "closed", 2, 0, 0, 50));
+ASSERT_EQ(find_count("people", "{\"status\":\"pending\",\"age\":{\"$gte\":25}}"),
+          expected(&p, "pending", -1, -1, 25, 50));
+ASSERT_EQ(find_count("people", "{\"status\":\"closed\",\"region\":\"r2\",\"active\":false}"),
+          expected(&p, "closed", 2, 0, 0, 50));
+
+/* 5. Drop */
+ASSERT(db_drop_index("people", "status:bitmap") == true);
+ASSERT(db_drop_index("people", "region:bitmap") == true);
+ASSERT(db_drop_index("people", "active:bitmap") == true);
+ASSERT(db_drop_index("people", "age:bitmap") == true);
+ASSERT(db_drop_index("people", "age:bitmap") == false);
+ASSERT_EQ(find_count("people", "{\"status\":\"open\",\"region\":\"r1\",\"active\":true}"),
+          expected(&p, "open", 1, 1, 0, 50));
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_set_lazy_load(false);
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
@@ -98,3 +98,185 @@ cJSON_Delete(upsert_data);
 db_set_test_mode(false);
 
 TEST_END
+
+/**
+ * @brief Finds a document by `_id` and returns one of its numeric fields.
+ *
+ * @return The field value, or -1 if the document was not found.
+ */
+static int find_field(const char *coll, const char *id, const char *field)
+{
+    cJSON *q = cJSON_CreateObject();
+    cJSON_AddStringToObject(q, "_id", id);
+    cJSON *res = db_find(coll, q, 0);
+    cJSON *doc = cJSON_GetArrayItem(res, 0);
+    int value = doc ? cJSON_GetObjectItem(doc, field)->valueint : -1;
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+    return value;
+}
+
+/**
+ * @brief Tests that `_id` lookups always see the stored version of a document.
+ * * This test ensures that:
+ * 1. A lookup after an insert, an update and an upsert returns the latest version.
+ * 2. A lookup after a delete finds nothing.
+ */
+TEST_START(test_id_lookup)
+
+db_set_test_mode(true);
+
+/* 1. Every write is visible through the index */
+cJSON *doc = cJSON_Parse("{\"_id\":\"k1\",\"v\":1}");
+ASSERT(db_insert("lookups", doc) == true);
+ASSERT_EQ(find_field("lookups", "k1", "v"), 1);
+
+cJSON *patch = cJSON_Parse("{\"v\":2}");
+ASSERT(db_update("lookups", "k1", patch) == true);
+ASSERT_EQ(find_field("lookups", "k1", "v"), 2);
+
+cJSON_SetNumberValue(cJSON_GetObjectItem(patch, "v"), 3);
+ASSERT(db_upsert("lookups", "k1", patch) == true);
+ASSERT_EQ(find_field("lookups", "k1", "v"), 3);
+
+/* 2. Deleted documents are gone */
+ASSERT(db_delete("lookups", "k1") == true);
+ASSERT_EQ(find_field("lookups", "k1", "v"), -1);
+
+cJSON_Delete(doc);
+cJSON_Delete(patch);
+db_set_test_mode(false);
+
+TEST_END
+
+/**
+ * @brief Tests that `_id` lookups and writes stay within their collection.
+ * * This test ensures that:
+ * 1. The same `_id` can exist in two collections, and lookups return the right one.
+ * 2. Inserting an `_id` that a collection already holds is rejected.
+ * 3. Update and delete only touch the named collection.
+ * 4. Upsert inserts a missing document under the requested `_id`.
+ */
+TEST_START(test_collection_isolation)
+
+db_set_test_mode(true);
+
+/* 1. Same `_id`, two collections */
+cJSON *a = cJSON_Parse("{\"_id\":\"shared\",\"v\":1}");
+cJSON *b = cJSON_Parse("{\"_id\":\"shared\",\"v\":2}");
+ASSERT(db_insert("iso_a", a) == true);
+ASSERT(db_insert("iso_b", b) == true);
+ASSERT_EQ(find_field("iso_a", "shared", "v"), 1);
+ASSERT_EQ(find_field("iso_b", "shared", "v"), 2);
+ASSERT_EQ(find_field("iso_c", "shared", "v"), -1);
+
+/* 2. Duplicates are rejected */
+ASSERT(db_insert("iso_a", b) == false);
+ASSERT_EQ(db_count("iso_a"), 1);
+
+/* 3. Writes are scoped to their collection */
+cJSON *patch = cJSON_Parse("{\"v\":10}");
+ASSERT(db_update("iso_a", "shared", patch) == true);
+ASSERT_EQ(find_field("iso_b", "shared", "v"), 2);
+ASSERT(db_delete("iso_b", "shared") == true);
+ASSERT_EQ(find_field("iso_a", "shared", "v"), 10);
+ASSERT(db_delete("iso_b", "shared") == false);
+
+/* 4. Upsert of a missing document keeps the requested `_id` */
+ASSERT(db_upsert("iso_b", "fresh", patch) == true);
+ASSERT_EQ(find_field("iso_b", "fresh", "v"), 10);
+ASSERT(db_upsert("iso_b", "fresh", patch) == true);
+ASSERT_EQ(db_count("iso_b"), 1);
+
+cJSON_Delete(a);
+cJSON_Delete(b);
+cJSON_Delete(patch);
+db_set_test_mode(false);
+
+TEST_END
+
+/**
+ * @brief Finds documents with a projection and compares them to the expected JSON.
+ *
+ * @param[in] query      Query filter, as JSON.
+ * @param[in] projection Projection, as JSON.
+ * @param[in] expected   Expected result array, as JSON.
+ * @return true if the results equal the expected ones.
+ */
+static bool find_projected(const char *query, const char *projection, const char *expected)
+{
+    cJSON *q = cJSON_Parse(query);
+    cJSON *p = cJSON_Parse(projection);
+    cJSON *want = cJSON_Parse(expected);
+    db_find_options_t opts = {.projection = p};
+    cJSON *res = db_find_ex("projected", q, &opts);
+    bool same = cJSON_Compare(res, want, true);
+    cJSON_Delete(res);
+    cJSON_Delete(want);
+    cJSON_Delete(p);
+    cJSON_Delete(q);
+    return same;
+}
+
+/**
+ * @brief Tests find projections.
+ * * This test ensures that:
+ * 1. Included fields are returned with the `_id` unless it is excluded.
+ * 2. Excluded fields, nested ones included, are left out of whole documents.
+ * 3. `_id` lookups and index-covered finds apply projections too.
+ * 4. Projections mixing included and excluded fields, or including array
+ *    elements, are rejected; array elements can be excluded.
+ */
+TEST_START(test_projection)
+
+db_set_test_mode(true);
+
+cJSON *doc = cJSON_Parse("{\"_id\":\"p1\",\"tier\":\"gold\",\"name\":\"Ann\","
+                         "\"address\":{\"city\":\"Paris\",\"zip\":\"75001\"},\"bio\":\"long\","
+                         "\"tags\":[\"a\",\"b\"]}");
+ASSERT(db_insert("projected", doc) == true);
+cJSON_Delete(doc);
+
+/* 1. Inclusion */
+ASSERT(find_projected("{\"tier\":\"gold\"}", "{\"name\":1,\"address.city\":true}",
+                      "[{\"name\":\"Ann\",\"address\":{\"city\":\"Paris\"},\"_id\":\"p1\"}]"));
+ASSERT(find_projected("{}", "{\"name\":1,\"_id\":0}", "[{\"name\":\"Ann\"}]"));
+ASSERT(find_projected("{}", "{\"_id\":1}", "[{\"_id\":\"p1\"}]"));
+
+/* 2. Exclusion */
+ASSERT(find_projected("{}", "{\"bio\":0,\"address.zip\":0,\"tags.0\":0,\"_id\":0}",
+                      "[{\"tier\":\"gold\",\"name\":\"Ann\",\"address\":{\"city\":\"Paris\"},"
+                      "\"tags\":[\"b\"]}]"));
+ASSERT(find_projected("{}",
+                      "{\"bio\":false,\"address\":0,\"tier\":0,\"name\":0,\"tags\":0,\"_id\":1}",
+                      "[{\"_id\":\"p1\"}]"));
+ASSERT(find_projected("{\"name\":\"Ann\"}", "{}",
+                      "[{\"_id\":\"p1\",\"tier\":\"gold\",\"name\":\"Ann\","
+                      "\"address\":{\"city\":\"Paris\",\"zip\":\"75001\"},\"bio\":\"long\","
+                      "\"tags\":[\"a\",\"b\"]}]"));
+
+/* 3. `_id` lookups and covered finds */
+ASSERT(find_projected("{\"_id\":\"p1\"}", "{\"address\":0,\"bio\":0,\"tags\":0}",
+                      "[{\"_id\":\"p1\",\"tier\":\"gold\",\"name\":\"Ann\"}]"));
+ASSERT(find_projected("{\"_id\":\"p1\"}", "{\"name\":1}", "[{\"name\":\"Ann\",\"_id\":\"p1\"}]"));
+cJSON *spec = cJSON_Parse("{\"field\":\"tier\"}");
+ASSERT(db_create_index("projected", spec) == true);
+ASSERT(find_projected("{\"tier\":\"gold\"}", "{\"tier\":1}",
+                      "[{\"tier\":\"gold\",\"_id\":\"p1\"}]"));
+cJSON_Delete(spec);
+
+/* 4. Invalid projections */
+const char *invalid[] = {"{\"name\":1,\"bio\":0}", "{\"name\":\"yes\"}", "[\"name\"]",
+                         "{\"tags.1\":1}"};
+for (size_t i = 0; i < sizeof(invalid) / sizeof(*invalid); i++) {
+    cJSON *p = cJSON_Parse(invalid[i]);
+    ASSERT(db_projection_valid(p) == false);
+    cJSON_Delete(p);
+}
+ASSERT(find_projected("{}", "{\"name\":1,\"bio\":0}", "[]"));
+ASSERT(find_projected("{}", "{\"tags.1\":true}", "[]"));
+
+ASSERT(db_delete("projected", "p1") == true);
+db_set_test_mode(false);
+
+TEST_END
@@ -0,0 +1,254 @@
+/**
+ * @file test_fulltext.c
+ * @brief Unit tests for the inverted index and text search.
+ *
+ * This test suite validates the inverted index on its own (tokenization,
+ * ranking, limits, removal and compaction of the posting lists) and through
+ * the engine (text indexes maintained by writes and the db_search() call).
+ */
+
+#include "../include/database.h"
+#include "../include/fulltext.h"
+#include "../include/secondary.h"
+#include "framework.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Documents ranked by a search.
+ */
+typedef struct
+{
+    cJSON *docs[256];
+    double scores[256];
+    int count;
+} ranked_t;
+
+/**
+ * @brief Records a ranked document (fulltext_visit_fn).
+ */
+static bool rank(cJSON *doc, double score, void *ctx)
+{
+    ranked_t *ranked = ctx;
+    if (ranked->count < 256) {
+        ranked->docs[ranked->count] = doc;
+        ranked->scores[ranked->count] = score;
+    }
+    ranked->count++;
+    return true;
+}
+
+/**
+ * @brief Runs a search and returns the number of results.
+ */
+static int search(const fulltext_t *ft, const char *text, size_t limit, ranked_t *ranked)
+{
+    ranked->count = 0;
+    return fulltext_search(ft, text, limit, rank, ranked) ? ranked->count : -1;
+}
+
+/**
+ * @brief Tests the inverted index module.
+ * * This test ensures that:
+ * 1. Text is split on non-alphanumeric ASCII bytes and matched case-insensitively,
+ *    while UTF-8 words stay whole.
+ * 2. Documents holding a word more often, or in a shorter text, rank first,
+ *    and equal scores keep insertion order.
+ * 3. Limits keep the best documents.
+ * 4. Removed and replaced documents are reported correctly.
+ * 5. Removing most documents compacts the posting lists.
+ */
+TEST_START(test_fulltext_basic)
+
+fulltext_t *ft = fulltext_create();
+ASSERT(ft != NULL);
+cJSON *docs[4];
+const char *texts[4] = {"Disk failure on node-7, disk replaced", "disk DISK disk",
+                        "network partition on node-7", "Überlastung der Platte"};
+for (int i = 0; i < 4; i++) {
+    docs[i] = cJSON_CreateObject();
+    ASSERT(fulltext_add(ft, texts[i], docs[i]) == true);
+}
+ranked_t ranked;
+
+/* 1. Tokens */
+ASSERT_EQ(search(ft, "DISK", 0, &ranked), 2);
+ASSERT_EQ(search(ft, "7", 0, &ranked), 2);
+ASSERT_EQ(search(ft, "node-7", 0, &ranked), 2);
+ASSERT_EQ(search(ft, "Überlastung", 0, &ranked), 1);
+ASSERT(ranked.docs[0] == docs[3]);
+ASSERT_EQ(search(ft, "berlastung", 0, &ranked), 0);
+ASSERT_EQ(search(ft, "", 0, &ranked), 0);
+ASSERT_EQ(search(ft, "...", 0, &ranked), 0);
+
+/* 2. Ranking */
+ASSERT_EQ(search(ft, "disk", 0, &ranked), 2);
+ASSERT(ranked.docs[0] == docs[1]);
+ASSERT(ranked.scores[0] > ranked.scores[1]);
+ASSERT_EQ(search(ft, "disk partition", 0, &ranked), 3);
+ASSERT(ranked.docs[0] == docs[1] && ranked.docs[1] == docs[2] && ranked.docs[2] == docs[0]);
+ASSERT_EQ(search(ft, "on", 0, &ranked), 2);
+ASSERT(ranked.docs[0] == docs[2]);
+
+/* 3. Limits */
+ASSERT_EQ(search(ft, "disk node", 1, &ranked), 1);
+ASSERT(ranked.docs[0] == docs[0]);
+
+/* 4. Removal and replacement */
+ASSERT(fulltext_remove(ft, texts[1], docs[1]) == true);
+ASSERT(fulltext_remove(ft, texts[1], docs[1]) == false);
+ASSERT_EQ(search(ft, "disk", 0, &ranked), 1);
+cJSON *moved = cJSON_CreateObject();
+fulltext_replace(ft, docs[0], moved);
+ASSERT_EQ(search(ft, "disk", 0, &ranked), 1);
+ASSERT(ranked.docs[0] == moved);
+ASSERT(fulltext_remove(ft, texts[0], docs[0]) == false);
+ASSERT(fulltext_remove(ft, texts[0], moved) == true);
+ASSERT_EQ(search(ft, "disk", 0, &ranked), 0);
+cJSON_Delete(moved);
+for (int i = 0; i < 4; i++)
+    cJSON_Delete(docs[i]);
+fulltext_free(ft);
+
+/* 5. Compaction: one word in every document takes two bytes per entry */
+ft = fulltext_create();
+cJSON *many[1000];
+char text[64];
+for (int i = 0; i < 1000; i++) {
+    many[i] = cJSON_CreateObject();
+    snprintf(text, sizeof(text), "common w%d", i % 10);
+    ASSERT(fulltext_add(ft, text, many[i]) == true);
+}
+ASSERT_EQ((int) fulltext_terms(ft), 11);
+size_t before = fulltext_bytes(ft);
+ASSERT(before <= 2 * 2000 + 16);
+for (int i = 0; i < 1000; i++) {
+    if (i % 100 == 0)
+        continue;
+    snprintf(text, sizeof(text), "common w%d", i % 10);
+    ASSERT(fulltext_remove(ft, text, many[i]) == true);
+}
+ASSERT(fulltext_bytes(ft) < before / 10);
+ASSERT_EQ(search(ft, "common", 0, &ranked), 10);
+ASSERT(ranked.docs[0] == many[0] && ranked.docs[9] == many[900]);
+ASSERT_EQ(search(ft, "w0", 0, &ranked), 10);
+ASSERT_EQ(search(ft, "w1", 0, &ranked), 0);
+for (int i = 0; i < 1000; i++)
+    cJSON_Delete(many[i]);
+fulltext_free(ft);
+
+TEST_END
+
+/**
+ * @brief Inserts a ticket with a description.
+ *
+ * @return The result of db_insert().
+ */
+static bool insert_ticket(const char *id, const char *description)
+{
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddStringToObject(doc, "_id", id);
+    cJSON_AddStringToObject(doc, "description", description);
+    bool ok = db_insert("tickets", doc);
+    cJSON_Delete(doc);
+    return ok;
+}
+
+/**
+ * @brief Tests text indexes through the engine.
+ * * This test ensures that:
+ * 1. Text indexes accept a single field only and can sit next to a hash
+ *    index on the same field.
+ * 2. db_search() returns copies ranked best first with their `_score`.
+ * 3. Updates and deletes are reflected in the results.
+ * 4. Text indexes are rebuilt on restart, lazily loaded documents included.
+ * 5. Searching a field without a text index fails.
+ */
+TEST_START(test_text_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+ASSERT(insert_ticket("t1", "Disk failure on node 7") == true);
+ASSERT(insert_ticket("t2", "Replace failed disk, disk is full") == true);
+ASSERT(insert_ticket("t3", "Network flapping") == true);
+cJSON *odd = cJSON_Parse("{\"_id\":\"t4\",\"description\":42}");
+ASSERT(db_insert("tickets", odd) == true);
+cJSON_Delete(odd);
+
+/* 1. Specifications */
+cJSON *spec = cJSON_Parse("{\"fields\":[\"description\",\"title\"],\"type\":\"text\"}");
+ASSERT(db_create_index("tickets", spec) == false);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"description\",\"type\":\"text\",\"unique\":true}");
+ASSERT(db_create_index("tickets", spec) == false);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"description\"}");
+ASSERT(db_create_index("tickets", spec) == true);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"description\",\"type\":\"text\"}");
+ASSERT(db_create_index("tickets", spec) == true);
+cJSON *list = db_list_indexes("tickets");
+ASSERT_EQ(cJSON_GetArraySize(list), 3);
+cJSON *info = cJSON_GetArrayItem(list, 2);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "name")->valuestring, "description:text") == 0);
+ASSERT_EQ((int) cJSON_GetObjectItem(info, "entries")->valuedouble, 3);
+ASSERT(cJSON_GetObjectItem(info, "bytes")->valuedouble > 0);
+cJSON_Delete(list);
+
+/* 2. Ranking */
+cJSON *res = db_search("tickets", "description", "disk", 10);
+ASSERT_EQ(cJSON_GetArraySize(res), 2);
+cJSON *best = cJSON_GetArrayItem(res, 0);
+ASSERT(strcmp(cJSON_GetObjectItem(best, "_id")->valuestring, "t2") == 0);
+ASSERT(cJSON_GetObjectItem(best, "_score")->valuedouble >
+       cJSON_GetObjectItem(cJSON_GetArrayItem(res, 1), "_score")->valuedouble);
+cJSON_Delete(res);
+res = db_search("tickets", "description", "disk network", 1);
+ASSERT_EQ(cJSON_GetArraySize(res), 1);
+cJSON_Delete(res);
+
+/* 3. Writes */
+cJSON *change = cJSON_Parse("{\"description\":\"Network disk unreachable\"}");
+ASSERT(db_update("tickets", "t3", change) == true);
+cJSON_Delete(change);
+ASSERT(db_delete("tickets", "t2") == true);
+res = db_search("tickets", "description", "disk", 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 2);
+cJSON_Delete(res);
+res = db_search("tickets", "description", "flapping", 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 0);
+cJSON_Delete(res);
+
+/* 4. Lazy restart */
+db_cleanup();
+db_set_lazy_load(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+res = db_search("tickets", "description", "unreachable", 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 1);
+ASSERT(strcmp(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "_id")->valuestring, "t3") == 0);
+cJSON_Delete(res);
+ASSERT(insert_ticket("t5", "Unreachable") == true);
+res = db_search("tickets", "description", "unreachable", 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 2);
+cJSON_Delete(res);
+
+/* 5. Missing index */
+ASSERT(db_search("tickets", "title", "disk", 0) == NULL);
+ASSERT(db_search("nothing", "description", "disk", 0) == NULL);
+ASSERT(db_drop_index("tickets", "description:text") == true);
+ASSERT(db_search("tickets", "description", "disk", 0) == NULL);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(spec);
+db_cleanup();
+db_set_lazy_load(false);
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
@@ -0,0 +1,128 @@
+/**
+ * @file test_index.c
+ * @brief Unit tests for the hash index and the skiplist.
+ *
+ * This test suite validates the open-addressing hash table used for `_id`
+ * lookups (insertion, replacement, growth and removal with backward shifting)
+ * and the skiplist behind ordered indexes (ordering, bounds and walks).
+ */
+
+#include "../include/index.h"
+#include "../include/skiplist.h"
+#include "framework.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Tests insertion, lookup, replacement and removal.
+ * * This test ensures that:
+ * 1. Keys are found after the table grew many times.
+ * 2. Keys are compared by length and bytes, not as C strings.
+ * 3. Replacing a key returns the previous value without adding an entry.
+ * 4. Removing keys keeps every remaining key reachable.
+ */
+TEST_START(test_index_basic)
+
+index_t *idx = index_create(0);
+ASSERT(idx != NULL);
+
+/* 1. Growth; values are the key numbers plus one (NULL means absent) */
+char key[32];
+for (long i = 0; i < 50000; i++) {
+    int len = snprintf(key, sizeof(key), "doc-%ld", i);
+    ASSERT(index_put(idx, key, (size_t) len, (void *) (i + 1), NULL) == true);
+}
+ASSERT_EQ((int) index_count(idx), 50000);
+ASSERT(index_get(idx, "doc-0", 5) == (void *) 1);
+ASSERT(index_get(idx, "doc-49999", 9) == (void *) 50000);
+ASSERT(index_get(idx, "doc-50000", 9) == NULL);
+
+/* 2. Length-delimited keys */
+ASSERT(index_get(idx, "doc-12345-suffix", 9) == (void *) 12346);
+ASSERT(index_get(idx, "doc-1", 4) == NULL);
+
+/* 3. Replacement */
+void *old = NULL;
+ASSERT(index_put(idx, "doc-7", 5, (void *) 99, &old) == true);
+ASSERT(old == (void *) 8);
+ASSERT(index_get(idx, "doc-7", 5) == (void *) 99);
+ASSERT_EQ((int) index_count(idx), 50000);
+
+/* 4. Remove every odd key, then check every even key */
+for (long i = 1; i < 50000; i += 2) {
+    int len = snprintf(key, sizeof(key), "doc-%ld", i);
+    ASSERT(index_remove(idx, key, (size_t) len) != NULL);
+}
+ASSERT_EQ((int) index_count(idx), 25000);
+ASSERT(index_remove(idx, "doc-1", 5) == NULL);
+bool all_found = true;
+for (long i = 0; i < 50000; i += 2) {
+    int len = snprintf(key, sizeof(key), "doc-%ld", i);
+    all_found = all_found && index_get(idx, key, (size_t) len) == (void *) (i + 1);
+}
+ASSERT(all_found);
+
+index_free(idx, NULL);
+
+TEST_END
+
+/**
+ * @brief Tests ordering, bound searches and walks of the skiplist.
+ * * This test ensures that:
+ * 1. Keys inserted in random order are walked in memcmp() order, both ways.
+ * 2. Lower and upper bounds honour inclusiveness and the list ends.
+ * 3. A prefix sorts before the longer keys sharing it.
+ * 4. Removal keeps the links in both directions consistent.
+ */
+TEST_START(test_skiplist_basic)
+
+skiplist_t *list = skiplist_create();
+ASSERT(list != NULL);
+
+/* 1. Insert 0..9999 in a scrambled order (7919 is coprime with 10000) */
+char key[32];
+for (long i = 0; i < 10000; i++) {
+    long n = (i * 7919) % 10000;
+    int len = snprintf(key, sizeof(key), "k%05ld", n);
+    ASSERT(skiplist_put(list, key, (size_t) len, (void *) (n + 1), NULL) == true);
+}
+ASSERT_EQ((int) skiplist_count(list), 10000);
+long expected = 0;
+bool ordered = true;
+for (skiplist_node_t *node = skiplist_lower(list, NULL, 0, true); node;
+     node = skiplist_next(node))
+    ordered = ordered && skiplist_value(node) == (void *) (++expected);
+ASSERT(ordered && expected == 10000);
+for (skiplist_node_t *node = skiplist_upper(list, NULL, 0, true); node;
+     node = skiplist_prev(node))
+    ordered = ordered && skiplist_value(node) == (void *) (expected--);
+ASSERT(ordered && expected == 0);
+
+/* 2. Bounds */
+ASSERT(skiplist_value(skiplist_lower(list, "k00100", 6, true)) == (void *) 101);
+ASSERT(skiplist_value(skiplist_lower(list, "k00100", 6, false)) == (void *) 102);
+ASSERT(skiplist_value(skiplist_upper(list, "k00100", 6, true)) == (void *) 101);
+ASSERT(skiplist_value(skiplist_upper(list, "k00100", 6, false)) == (void *) 100);
+ASSERT(skiplist_lower(list, "k09999", 6, false) == NULL);
+ASSERT(skiplist_upper(list, "k00000", 6, false) == NULL);
+
+/* 3. Prefixes */
+ASSERT(skiplist_put(list, "k", 1, (void *) 1, NULL) == true);
+ASSERT(skiplist_value(skiplist_upper(list, "k0", 2, true)) == (void *) 1);
+ASSERT(skiplist_compare("k", 1, "k0", 2) < 0);
+
+/* 4. Removal */
+void *old = NULL;
+ASSERT(skiplist_put(list, "k00050", 6, (void *) 7, &old) == true && old == (void *) 51);
+ASSERT(skiplist_remove(list, "k00050", 6) == (void *) 7);
+ASSERT(skiplist_remove(list, "k00050", 6) == NULL);
+ASSERT(skiplist_get(list, "k00050", 6) == NULL);
+skiplist_node_t *after = skiplist_lower(list, "k00050", 6, true);
+ASSERT(skiplist_value(after) == (void *) 52);
+ASSERT(skiplist_value(skiplist_prev(after)) == (void *) 50);
+ASSERT_EQ((int) skiplist_count(list), 10000);
+
+skiplist_free(list, NULL);
+
+TEST_END
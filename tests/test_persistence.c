@@ -0,0 +1,706 @@
+/**
+ * @file test_persistence.c
+ * @brief Unit tests for durable storage and crash recovery.
+ *
+ * This test suite verifies that mutations survive a restart, including the
+ * case where the process stops before the write-ahead log was checkpointed.
+ */
+
+#include "../include/database.h"
+#include "framework.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Reads a whole file into a heap-allocated, NUL-terminated buffer.
+ *
+ * @param[in] path File to read.
+ * @return The file contents (caller frees), or NULL if it cannot be read.
+ */
+static char *read_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = malloc(len + 1);
+    if (buf) {
+        size_t n = fread(buf, 1, len, fp);
+        buf[n] = '\0';
+    }
+    fclose(fp);
+    return buf;
+}
+
+/**
+ * @brief Replaces a file with the given contents.
+ *
+ * @param[in] path     File to write.
+ * @param[in] contents NUL-terminated data to store.
+ */
+static void write_file(const char *path, const char *contents)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        fputs(contents, fp);
+        fclose(fp);
+    }
+}
+
+/**
+ * @brief Tests that the write-ahead log is replayed after an unclean stop.
+ *
+ * This test ensures that:
+ * 1. In WAL mode, writes are appended to the log instead of rewriting the image.
+ * 2. db_init() replays inserts, updates and deletes from the log.
+ * 3. A torn trailing record (crash mid-append) is ignored.
+ */
+TEST_START(test_wal_replay)
+
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(true);
+db_init("data/test_wal.json");
+db_set_test_mode(true);
+
+/* 1. Mutate through the log */
+cJSON *a = cJSON_CreateObject();
+cJSON_AddStringToObject(a, "_id", "a");
+cJSON_AddNumberToObject(a, "v", 1);
+cJSON *b = cJSON_CreateObject();
+cJSON_AddStringToObject(b, "_id", "b");
+cJSON *patch = cJSON_CreateObject();
+cJSON_AddNumberToObject(patch, "v", 2);
+
+ASSERT(db_insert("items", a) == true);
+ASSERT(db_insert("items", b) == true);
+ASSERT(db_update("items", "a", patch) == true);
+ASSERT(db_delete("items", "b") == true);
+
+/* 2. The collection image must not have been written by those writes */
+ASSERT(access("data/test_wal.json.d/items.coll", F_OK) != 0);
+
+/* 3. Simulate a crash: drop the shutdown image, restore the log, add a torn record */
+char *wal = read_file("data/test_wal.json.wal");
+ASSERT(wal != NULL);
+db_cleanup();
+remove("data/test_wal.json.d/items.coll");
+write_file("data/test_wal.json.wal", wal);
+FILE *fp = fopen("data/test_wal.json.wal", "ab");
+ASSERT(fp != NULL);
+fputs("{\"op\":\"put\",\"collection\":\"items\",\"doc\":{\"_id\":\"c\"", fp);
+fclose(fp);
+
+/* 4. Recovery */
+db_init("data/test_wal.json");
+ASSERT_EQ(db_count("items"), 1);
+
+cJSON *q = cJSON_CreateObject();
+cJSON_AddStringToObject(q, "_id", "a");
+cJSON *res = db_find("items", q, 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 1);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "v")->valueint, 2);
+
+/* Cleanup resources and restore the suite database */
+free(wal);
+cJSON_Delete(a);
+cJSON_Delete(b);
+cJSON_Delete(patch);
+cJSON_Delete(q);
+cJSON_Delete(res);
+
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(false);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Writer thread for the group commit test: 25 fsync-durable inserts.
+ *
+ * @param[in] arg Unused.
+ * @return void* Always NULL.
+ */
+static void *commit_writer(void *arg)
+{
+    (void) arg;
+    db_set_request_durability(DB_DURABILITY_FSYNC);
+    for (int i = 0; i < 25; i++) {
+        cJSON *doc = cJSON_CreateObject();
+        cJSON_AddNumberToObject(doc, "seq", i);
+        db_insert("events", doc);
+        cJSON_Delete(doc);
+    }
+    db_set_request_durability(DB_DURABILITY_DEFAULT);
+    return NULL;
+}
+
+/**
+ * @brief Tests concurrent writers sharing commits through the WAL.
+ *
+ * This test ensures that:
+ * 1. Concurrent fsync-durable writers all complete and are acknowledged.
+ * 2. Every acknowledged write is in the log before shutdown.
+ * 3. Writes at DB_DURABILITY_NONE are not lost on a clean shutdown.
+ */
+TEST_START(test_group_commit)
+
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(true);
+db_init("data/test_wal.json");
+db_set_test_mode(true);
+
+/* 1. Concurrent fsync writers */
+pthread_t threads[8];
+for (int i = 0; i < 8; i++)
+    pthread_create(&threads[i], NULL, commit_writer, NULL);
+for (int i = 0; i < 8; i++)
+    pthread_join(threads[i], NULL);
+ASSERT_EQ(db_count("events"), 200);
+
+/* 2. Every record reached the log */
+char *wal = read_file("data/test_wal.json.wal");
+ASSERT(wal != NULL);
+int lines = 0;
+for (const char *c = wal; *c; c++)
+    lines += (*c == '\n');
+ASSERT_EQ(lines, 200);
+free(wal);
+
+/* 3. Buffered writes are flushed by the shutdown checkpoint */
+db_set_durability(DB_DURABILITY_NONE);
+cJSON *doc = cJSON_CreateObject();
+cJSON_AddStringToObject(doc, "_id", "lazy");
+ASSERT(db_insert("events", doc) == true);
+cJSON_Delete(doc);
+db_set_durability(DB_DURABILITY_FLUSH);
+
+db_cleanup();
+db_init("data/test_wal.json");
+ASSERT_EQ(db_count("events"), 201);
+
+/* Restore the suite database */
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(false);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests that checkpoints fold the log into the image.
+ *
+ * This test ensures that:
+ * 1. db_checkpoint() writes the logged documents into the image and empties the log.
+ * 2. The background thread checkpoints on its own once a threshold is crossed.
+ */
+TEST_START(test_background_checkpoint)
+
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(true);
+db_init("data/test_wal.json");
+db_set_test_mode(true);
+
+/* 1. Explicit checkpoint */
+cJSON *doc = cJSON_CreateObject();
+cJSON_AddStringToObject(doc, "_id", "first");
+ASSERT(db_insert("jobs", doc) == true);
+cJSON_Delete(doc);
+
+db_checkpoint();
+char *image = read_file("data/test_wal.json.d/jobs.coll");
+char *wal = read_file("data/test_wal.json.wal");
+ASSERT(image != NULL && wal != NULL);
+ASSERT(strstr(image, "first") != NULL);
+ASSERT_EQ(strlen(wal), 0);
+free(image);
+free(wal);
+
+/* 2. Operation-count threshold, picked up by the checkpointer thread */
+db_set_checkpoint_policy(0, 5, 0);
+for (int i = 0; i < 5; i++) {
+    doc = cJSON_CreateObject();
+    cJSON_AddNumberToObject(doc, "n", i);
+    cJSON_AddStringToObject(doc, "tag", "threshold");
+    ASSERT(db_insert("jobs", doc) == true);
+    cJSON_Delete(doc);
+}
+
+bool folded = false;
+for (int i = 0; i < 40 && !folded; i++) {
+    usleep(50000);
+    image = read_file("data/test_wal.json.d/jobs.coll");
+    folded = image && strstr(image, "threshold") != NULL;
+    free(image);
+}
+ASSERT(folded == true);
+
+/* Restore defaults and the suite database */
+db_set_checkpoint_policy(64L * 1024 * 1024, 100000, 300);
+db_cleanup();
+db_destroy("data/test_wal.json");
+db_set_wal_mode(false);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests the binary storage format and JSON import/export.
+ *
+ * This test ensures that:
+ * 1. The storage file is written in binary when that format is selected.
+ * 2. Every JSON type round-trips through the binary encoding on restart.
+ * 3. A JSON export can be imported back into an emptied database.
+ */
+TEST_START(test_binary_format)
+
+db_cleanup();
+db_destroy("data/test_bin.xdb");
+db_set_storage_format(STORAGE_FORMAT_BINARY);
+db_init("data/test_bin.xdb");
+db_set_test_mode(true);
+
+/* 1. A document exercising every value type */
+cJSON *doc = cJSON_Parse("{\"_id\":\"d1\",\"s\":\"h\\u00e9llo\",\"i\":-42,\"big\":"
+                         "1e300,\"f\":0.25,\"t\":true,\"n\":null,\"arr\":[1,\"x\",[]],"
+                         "\"obj\":{\"k\":{\"deep\":false}}}");
+ASSERT(doc != NULL);
+ASSERT(db_insert("types", doc) == true);
+
+/* 2. Restart from the binary file */
+db_cleanup();
+char *raw = read_file("data/test_bin.xdb.d/types.coll");
+ASSERT(raw != NULL);
+ASSERT(memcmp(raw, STORAGE_MAGIC, 4) == 0);
+free(raw);
+
+db_init("data/test_bin.xdb");
+cJSON *res = db_find("types", NULL, 0);
+ASSERT_EQ(cJSON_GetArraySize(res), 1);
+ASSERT(cJSON_Compare(cJSON_GetArrayItem(res, 0), doc, true));
+cJSON_Delete(res);
+
+/* 3. JSON export / import round trip */
+ASSERT(db_export("data/test_bin.json", STORAGE_FORMAT_JSON) == true);
+db_drop_all();
+ASSERT_EQ(db_count("types"), 0);
+ASSERT(db_import("data/test_bin.json") == true);
+ASSERT_EQ(db_count("types"), 1);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(doc);
+db_cleanup();
+db_destroy("data/test_bin.xdb");
+remove("data/test_bin.json");
+db_set_storage_format(STORAGE_FORMAT_JSON);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests lazily materialized startup from a memory-mapped file.
+ *
+ * This test ensures that, for both storage formats:
+ * 1. `_id` lookups, scans, updates and deletes work on undecoded documents.
+ * 2. Documents whose `_id` needs unescaping are still found.
+ * 3. A checkpoint writes documents that were never decoded.
+ */
+TEST_START(test_lazy_load)
+
+const char *paths[] = {"data/test_lazy.json", "data/test_lazy.xdb"};
+for (int f = 0; f < 2; f++) {
+    db_cleanup();
+    db_destroy(paths[f]);
+    db_set_storage_format(f == 0 ? STORAGE_FORMAT_JSON : STORAGE_FORMAT_BINARY);
+    db_init(paths[f]);
+    db_set_test_mode(true);
+
+    for (int i = 0; i < 20; i++) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "{\"_id\":\"u%d\",\"n\":%d,\"tags\":[\"a\",{\"b\":null}]}",
+                 i, i);
+        cJSON *doc = cJSON_Parse(buf);
+        db_insert("users", doc);
+        cJSON_Delete(doc);
+    }
+    cJSON *odd = cJSON_Parse("{\"_id\":\"q\\\"1\",\"n\":-1}");
+    db_insert("users", odd);
+    cJSON_Delete(odd);
+    db_cleanup();
+
+    /* 1. Restart lazily */
+    db_set_lazy_load(true);
+    db_init(paths[f]);
+    ASSERT_EQ(db_count("users"), 21);
+
+    cJSON *q = cJSON_Parse("{\"_id\":\"u7\"}");
+    cJSON *res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetArraySize(res), 1);
+    ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "n")->valueint, 7);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+
+    cJSON *patch = cJSON_Parse("{\"n\":100}");
+    ASSERT(db_update("users", "u3", patch) == true);
+    cJSON_Delete(patch);
+    ASSERT(db_delete("users", "u4") == true);
+    ASSERT(db_delete("users", "u4") == false);
+
+    /* 2. Escaped `_id` */
+    q = cJSON_Parse("{\"_id\":\"q\\\"1\"}");
+    res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetArraySize(res), 1);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+
+    q = cJSON_Parse("{\"n\":100}");
+    res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetArraySize(res), 1);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+
+    /* The scan decoded every document; the index must follow them */
+    q = cJSON_Parse("{\"_id\":\"u7\"}");
+    res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "n")->valueint, 7);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+
+    /* 3. Checkpoint with the rest still undecoded, then reload eagerly */
+    db_cleanup();
+    db_set_lazy_load(false);
+    db_init(paths[f]);
+    ASSERT_EQ(db_count("users"), 20);
+    q = cJSON_Parse("{\"_id\":\"u19\"}");
+    res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetArraySize(res), 1);
+    cJSON *tags = cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "tags");
+    ASSERT_EQ(cJSON_GetArraySize(tags), 2);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+    q = cJSON_Parse("{\"_id\":\"u3\"}");
+    res = db_find("users", q, 0);
+    ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "n")->valueint, 100);
+    cJSON_Delete(res);
+    cJSON_Delete(q);
+}
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy(paths[0]);
+db_destroy(paths[1]);
+db_set_storage_format(STORAGE_FORMAT_JSON);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests parallel loading and index building at startup.
+ *
+ * This test ensures that, for both storage formats:
+ * 1. A multi-threaded load yields the same collections, in the same order,
+ *    as a single-threaded one.
+ * 2. The index built on the worker pool serves `_id` lookups for every collection.
+ */
+TEST_START(test_parallel_load)
+
+const char *paths[] = {"data/test_par.json", "data/test_par.xdb"};
+for (int f = 0; f < 2; f++) {
+    db_cleanup();
+    db_destroy(paths[f]);
+    db_set_storage_format(f == 0 ? STORAGE_FORMAT_JSON : STORAGE_FORMAT_BINARY);
+    db_set_wal_mode(true);
+    db_set_durability(DB_DURABILITY_NONE);
+    db_init(paths[f]);
+    db_set_test_mode(true);
+
+    for (int i = 0; i < 6000; i++) {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "{\"_id\":\"p%d\",\"seq\":%d}", i, i);
+        cJSON *doc = cJSON_Parse(buf);
+        db_insert((i % 3) ? "events" : "users", doc);
+        cJSON_Delete(doc);
+    }
+    db_cleanup();
+    db_set_wal_mode(false);
+    db_set_durability(DB_DURABILITY_FLUSH);
+
+    /* 1. Sequential reference load */
+    db_set_load_threads(1);
+    db_init(paths[f]);
+    cJSON *expected = db_find("events", NULL, 0);
+    db_cleanup();
+
+    db_set_load_threads(4);
+    db_init(paths[f]);
+    ASSERT_EQ(db_count("users"), 2000);
+    cJSON *actual = db_find("events", NULL, 0);
+    ASSERT_EQ(cJSON_GetArraySize(actual), 4000);
+    ASSERT(cJSON_Compare(expected, actual, true));
+    cJSON_Delete(expected);
+    cJSON_Delete(actual);
+
+    /* 2. Index lookups */
+    for (int i = 0; i < 6000; i += 997) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "{\"_id\":\"p%d\"}", i);
+        cJSON *q = cJSON_Parse(buf);
+        cJSON *res = db_find((i % 3) ? "events" : "users", q, 0);
+        ASSERT_EQ(cJSON_GetArraySize(res), 1);
+        ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "seq")->valueint, i);
+        cJSON_Delete(res);
+        cJSON_Delete(q);
+    }
+}
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy(paths[0]);
+db_destroy(paths[1]);
+db_set_load_threads(0);
+db_set_storage_format(STORAGE_FORMAT_JSON);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Returns the inode of a file, or 0 if it does not exist.
+ *
+ * A file replaced through a temporary file and a rename gets a new inode.
+ */
+static ino_t file_inode(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+/**
+ * @brief Tests that every collection is stored in its own file.
+ *
+ * This test ensures that:
+ * 1. A write only rewrites the image of the collection it touches.
+ * 2. Collection names are encoded into safe file names and discovered on restart.
+ * 3. Dropped collections lose their files.
+ * 4. A single-file database from an earlier version is converted on startup.
+ */
+TEST_START(test_collection_files)
+
+db_cleanup();
+db_destroy("data/test_coll.json");
+db_init("data/test_coll.json");
+db_set_test_mode(true);
+
+/* 1. Writes touch one file each */
+cJSON *doc = cJSON_Parse("{\"kind\":\"click\"}");
+ASSERT(db_insert("events", doc) == true);
+ASSERT(db_insert("sessions", doc) == true);
+ino_t events = file_inode("data/test_coll.json.d/events.coll");
+ino_t sessions = file_inode("data/test_coll.json.d/sessions.coll");
+ASSERT(events != 0 && sessions != 0);
+
+cJSON_DeleteItemFromObject(doc, "_id");
+ASSERT(db_insert("sessions", doc) == true);
+ASSERT(file_inode("data/test_coll.json.d/events.coll") == events);
+ASSERT(file_inode("data/test_coll.json.d/sessions.coll") != sessions);
+
+/* 2. Encoded names survive a restart */
+ASSERT(db_insert("a/b c", doc) == true);
+ASSERT(file_inode("data/test_coll.json.d/a%2fb%20c.coll") != 0);
+db_cleanup();
+db_init("data/test_coll.json");
+ASSERT_EQ(db_count("a/b c"), 1);
+ASSERT_EQ(db_count("sessions"), 2);
+
+/* 3. Drop */
+db_drop_all();
+ASSERT(file_inode("data/test_coll.json.d/events.coll") == 0);
+ASSERT(file_inode("data/test_coll.json.d/a%2fb%20c.coll") == 0);
+
+/* 4. Legacy single-file layout */
+db_cleanup();
+db_destroy("data/test_coll.json");
+write_file("data/test_coll.json", "{\"legacy\": [{\"_id\": \"x\"}]}");
+db_init("data/test_coll.json");
+ASSERT_EQ(db_count("legacy"), 1);
+ASSERT(access("data/test_coll.json", F_OK) != 0);
+ASSERT(file_inode("data/test_coll.json.d/legacy.coll") != 0);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(doc);
+db_cleanup();
+db_destroy("data/test_coll.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Counts the lines of a file.
+ */
+static int file_lines(const char *path)
+{
+    char *text = read_file(path);
+    int lines = 0;
+    for (const char *c = text; c && *c; c++)
+        lines += (*c == '\n');
+    free(text);
+    return lines;
+}
+
+/**
+ * @brief Tests incremental snapshots and restoring them.
+ *
+ * This test ensures that:
+ * 1. Collection images are shared with the snapshot instead of copied.
+ * 2. A later snapshot only stores the log written since the previous one.
+ * 3. Restoring either snapshot reproduces the state it was taken at.
+ */
+TEST_START(test_incremental_snapshot)
+
+db_cleanup();
+db_destroy("data/test_snap.json");
+db_destroy("data/test_snap_r1.json");
+db_destroy("data/test_snap_r2.json");
+db_set_wal_mode(true);
+db_init("data/test_snap.json");
+db_set_test_mode(true);
+
+/* 1. Base snapshot over a checkpointed collection and one logged write */
+cJSON *doc = cJSON_Parse("{\"_id\":\"e1\"}");
+ASSERT(db_insert("events", doc) == true);
+db_checkpoint();
+ASSERT(db_insert("sessions", doc) == true);
+
+char first[600], second[600], path[700];
+ASSERT(db_snapshot(first, sizeof(first)) == true);
+snprintf(path, sizeof(path), "%s/events.coll", first);
+ASSERT(file_inode(path) == file_inode("data/test_snap.json.d/events.coll"));
+snprintf(path, sizeof(path), "%s/snapshot.wal", first);
+ASSERT_EQ(file_lines(path), 1);
+
+/* 2. Incremental snapshot */
+sleep(1);
+cJSON_Delete(doc);
+doc = cJSON_Parse("{\"_id\":\"s2\"}");
+ASSERT(db_insert("sessions", doc) == true);
+ASSERT(db_delete("events", "e1") == true);
+ASSERT(db_snapshot(second, sizeof(second)) == true);
+ASSERT(strcmp(first, second) != 0);
+snprintf(path, sizeof(path), "%s/snapshot.wal", second);
+ASSERT_EQ(file_lines(path), 2);
+snprintf(path, sizeof(path), "%s/MANIFEST.json", second);
+char *manifest = read_file(path);
+ASSERT(manifest != NULL && strstr(manifest, strrchr(first, '/') + 1) != NULL);
+free(manifest);
+
+/* 3. Restore both points */
+db_cleanup();
+ASSERT(db_restore_snapshot(first, "data/test_snap_r1.json") == true);
+ASSERT(db_restore_snapshot(second, "data/test_snap_r2.json") == true);
+ASSERT(db_restore_snapshot(second, "data/test_snap_r2.json") == false);
+
+db_init("data/test_snap_r1.json");
+ASSERT_EQ(db_count("events"), 1);
+ASSERT_EQ(db_count("sessions"), 1);
+db_cleanup();
+db_init("data/test_snap_r2.json");
+ASSERT_EQ(db_count("events"), 0);
+ASSERT_EQ(db_count("sessions"), 2);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(doc);
+db_cleanup();
+db_set_wal_mode(false);
+db_destroy("data/test_snap.json");
+db_destroy("data/test_snap_r1.json");
+db_destroy("data/test_snap_r2.json");
+first[strlen(first) - 2] = '\0';
+second[strlen(second) - 2] = '\0';
+db_destroy(first);
+db_destroy(second);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests snapshots written by a forked process.
+ *
+ * This test ensures that:
+ * 1. db_snapshot_start() returns an id whose status can be polled.
+ * 2. The snapshot holds the state at the time it was started, not later writes.
+ * 3. Unchanged collection images are linked and changed ones are serialized.
+ */
+TEST_START(test_fork_snapshot)
+
+db_cleanup();
+db_destroy("data/test_fork.json");
+db_destroy("data/test_fork_r.json");
+db_set_wal_mode(true);
+db_init("data/test_fork.json");
+db_set_test_mode(true);
+
+/* 1. One checkpointed collection and one only in the log */
+cJSON *doc = cJSON_Parse("{\"v\":1}");
+ASSERT(db_insert("stable", doc) == true);
+db_checkpoint();
+ASSERT(db_insert("recent", doc) == true);
+
+long id = db_snapshot_start();
+ASSERT(id > 0);
+cJSON_DeleteItemFromObject(doc, "_id");
+ASSERT(db_insert("recent", doc) == true);
+
+char path[600] = "";
+db_snapshot_state_t state;
+for (int i = 0; i < 500; i++) {
+    state = db_snapshot_status(id, path, sizeof(path));
+    if (state != DB_SNAPSHOT_RUNNING)
+        break;
+    usleep(10000);
+}
+ASSERT(state == DB_SNAPSHOT_DONE);
+ASSERT(db_snapshot_status(id + 1000, NULL, 0) == DB_SNAPSHOT_UNKNOWN);
+
+/* 3. Linked vs. serialized images */
+char image[700];
+snprintf(image, sizeof(image), "%s/stable.coll", path);
+ASSERT(file_inode(image) == file_inode("data/test_fork.json.d/stable.coll"));
+snprintf(image, sizeof(image), "%s/recent.coll", path);
+ASSERT(file_inode(image) != 0);
+
+/* 2. Restore the point the snapshot was started at */
+db_cleanup();
+ASSERT(db_restore_snapshot(path, "data/test_fork_r.json") == true);
+db_init("data/test_fork_r.json");
+ASSERT_EQ(db_count("stable"), 1);
+ASSERT_EQ(db_count("recent"), 1);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(doc);
+db_cleanup();
+db_set_wal_mode(false);
+db_destroy("data/test_fork.json");
+db_destroy("data/test_fork_r.json");
+path[strlen(path) - 2] = '\0';
+db_destroy(path);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
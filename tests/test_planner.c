@@ -0,0 +1,285 @@
+/**
+ * @file test_planner.c
+ * @brief Unit tests for the query planner.
+ *
+ * This test suite validates the statistics and cost model of the planner
+ * module, and that finds take the cheapest access path and report it through
+ * db_explain() without changing their results.
+ */
+
+#include "../include/database.h"
+#include "../include/planner.h"
+#include "../third_party/cJSON/cJSON.h"
+#include "framework.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Estimates the selectivity of a query given as text.
+ *
+ * @param[in] stats      The statistics.
+ * @param[in] query_text Query filter as JSON text.
+ * @return The estimate.
+ */
+static double selectivity(const planner_stats_t *stats, const char *query_text)
+{
+    cJSON *query = cJSON_Parse(query_text);
+    double sel = planner_selectivity(stats, query);
+    cJSON_Delete(query);
+    return sel;
+}
+
+/**
+ * @brief Explains a query given as text.
+ *
+ * @param[in] coll       Collection name.
+ * @param[in] query_text Query filter as JSON text.
+ * @param[in] sort       Sort field (may be NULL).
+ * @param[in] limit      Results wanted (0 for all).
+ * @return The explain output (caller frees), or NULL.
+ */
+static cJSON *explain(const char *coll, const char *query_text, const char *sort, int limit)
+{
+    cJSON *query = cJSON_Parse(query_text);
+    db_find_options_t opts = {.sort = sort, .limit = limit};
+    cJSON *out = db_explain(coll, query, &opts);
+    cJSON_Delete(query);
+    return out;
+}
+
+/**
+ * @brief Reads a string member of the chosen plan.
+ *
+ * @param[in] out  Explain output.
+ * @param[in] name Member name.
+ * @return The string, or "" if it is missing.
+ */
+static const char *plan_string(const cJSON *out, const char *name)
+{
+    const cJSON *value = cJSON_GetObjectItem(cJSON_GetObjectItem(out, "plan"), name);
+    return cJSON_IsString(value) ? value->valuestring : "";
+}
+
+/**
+ * @brief Reads a number member of explain output.
+ *
+ * @param[in] out  Explain output.
+ * @param[in] name Member name.
+ * @return The number, or -1 if it is missing.
+ */
+static int number(const cJSON *out, const char *name)
+{
+    const cJSON *value = cJSON_GetObjectItem(out, name);
+    return cJSON_IsNumber(value) ? value->valueint : -1;
+}
+
+/**
+ * @brief Tests planner statistics and costs.
+ * * This test ensures that:
+ * 1. Sampled statistics record presence, distinct values and numeric ranges,
+ *    nested fields included.
+ * 2. Selectivity follows equality, ranges, set and logical operators, and
+ *    falls back to defaults for unknown fields.
+ * 3. Exact counts replace sampled ones.
+ * 4. A limit only shortens paths reading candidates in result order.
+ */
+TEST_START(test_planner_basic)
+
+/* 1. Statistics of a full sample */
+planner_stats_t *stats = planner_stats_create();
+ASSERT(stats != NULL);
+cJSON *docs[100];
+for (int i = 0; i < 100; i++) {
+    char text[128];
+    if (i % 2 == 0)
+        snprintf(text, sizeof(text), "{\"k\":%d,\"u\":%d,\"opt\":1,\"a\":{\"b\":%d}}", i % 5, i,
+                 i % 2);
+    else
+        snprintf(text, sizeof(text), "{\"k\":%d,\"u\":%d,\"a\":{\"b\":%d}}", i % 5, i, i % 2);
+    docs[i] = cJSON_Parse(text);
+}
+ASSERT(planner_stats_sample(stats, (const cJSON *const *) docs, 100, 100) == true);
+ASSERT_EQ((int) planner_stats_docs(stats), 100);
+cJSON *info = planner_stats_describe(stats, NULL);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetObjectItem(info, "k"), "distinct")->valueint, 5);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetObjectItem(info, "u"), "distinct")->valueint, 100);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetObjectItem(info, "u"), "max")->valueint, 99);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetObjectItem(info, "a.b"), "distinct")->valueint, 2);
+ASSERT(cJSON_GetObjectItem(cJSON_GetObjectItem(info, "opt"), "present")->valuedouble == 0.5);
+cJSON_Delete(info);
+
+/* 2. Selectivity */
+ASSERT(fabs(selectivity(stats, "{\"k\":1}") - 0.2) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"K\":1,\"a.b\":0}") - 0.1) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"k\":{\"$ne\":1}}") - 0.8) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"k\":{\"$in\":[1,2]}}") - 0.4) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"$or\":[{\"k\":1},{\"k\":2}]}") - 0.36) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"opt\":{\"$exists\":false}}") - 0.5) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"u\":{\"$gte\":0,\"$lt\":49.5}}") - 0.5) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"u\":{\"$gt\":500}}") - 0.005) < 1e-9);
+ASSERT(fabs(selectivity(stats, "{\"missing\":1}") - 0.1) < 1e-9);
+ASSERT(selectivity(stats, "{\"k\":{\"$bogus\":1}}") == 0);
+ASSERT(planner_selectivity(stats, NULL) == 1);
+
+/* 3. Exact counts */
+ASSERT(planner_stats_set(stats, "k", 8, 50) == true);
+ASSERT(fabs(selectivity(stats, "{\"k\":1}") - 0.0625) < 1e-9);
+
+/* 4. Costs */
+plan_t plan = {.access = PLAN_INDEX, .candidates = 1000, .ordered = true};
+planner_cost(&plan, 100, 10, true);
+ASSERT(plan.examined == 100);
+planner_cost(&plan, 100, 0, true);
+ASSERT(plan.examined == 1000);
+plan.ordered = false;
+planner_cost(&plan, 100, 10, true);
+ASSERT(plan.examined == 1000);
+planner_cost(&plan, 100, 10, false);
+ASSERT(plan.examined == 100);
+ASSERT(strcmp(planner_access_name(PLAN_INTERSECT), "intersect") == 0);
+
+for (int i = 0; i < 100; i++)
+    cJSON_Delete(docs[i]);
+planner_stats_free(stats);
+
+TEST_END
+
+/**
+ * @brief Tests planned finds and db_explain().
+ * * This test ensures that:
+ * 1. `_id`, hash, bitmap and range predicates are answered by the `_id`
+ *    index, an index, an intersection and a range walk, and others by a scan.
+ * 2. A sorted find with a limit walks the sort index unless an equality
+ *    holds fewer candidates, and reports the documents it examined. The
+ *    sort field is matched to the index ignoring case.
+ * 3. Statistics are sampled again once the collection changed enough.
+ * 4. Unknown collections have no plan.
+ */
+TEST_START(test_planner_engine)
+
+db_cleanup();
+db_destroy("data/test_plan.json");
+db_set_wal_mode(true);
+db_set_durability(DB_DURABILITY_NONE);
+db_init("data/test_plan.json");
+db_set_test_mode(true);
+static const char *statuses[] = {"open", "paid", "shipped", "void"};
+for (int i = 0; i < 2000; i++) {
+    char text[160];
+    snprintf(text, sizeof(text),
+             "{\"_id\":\"o%d\",\"n\":%d,\"status\":\"%s\",\"customer\":\"c%d\",\"total\":%d,"
+             "\"region\":\"r%d\"}",
+             i, i, statuses[i % 4], i % 200, i, i % 8);
+    cJSON *doc = cJSON_Parse(text);
+    ASSERT(db_insert("orders", doc) == true);
+    cJSON_Delete(doc);
+}
+const char *specs[] = {
+    "{\"field\":\"customer\"}",
+    "{\"field\":\"total\",\"type\":\"ordered\"}",
+    "{\"field\":\"status\",\"type\":\"bitmap\"}",
+    "{\"field\":\"region\",\"type\":\"bitmap\"}",
+};
+for (int i = 0; i < 4; i++) {
+    cJSON *spec = cJSON_Parse(specs[i]);
+    ASSERT(db_create_index("orders", spec) == true);
+    cJSON_Delete(spec);
+}
+
+/* 1. Access paths */
+cJSON *out = explain("orders", "{\"_id\":\"o42\"}", NULL, 0);
+ASSERT(strcmp(plan_string(out, "access"), "id") == 0);
+ASSERT_EQ(number(out, "examined"), 1);
+ASSERT_EQ(number(out, "returned"), 1);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"customer\":\"c7\"}", NULL, 0);
+ASSERT(strcmp(plan_string(out, "access"), "index") == 0);
+ASSERT(strcmp(plan_string(out, "index"), "customer") == 0);
+ASSERT_EQ(number(out, "examined"), 10);
+ASSERT_EQ(number(out, "returned"), 10);
+ASSERT_EQ(cJSON_GetArraySize(cJSON_GetObjectItem(out, "rejected")), 1);
+cJSON *stats = cJSON_GetObjectItem(out, "statistics");
+ASSERT_EQ(number(stats, "documents"), 2000);
+cJSON *customer = cJSON_GetObjectItem(cJSON_GetObjectItem(stats, "fields"), "customer");
+ASSERT_EQ(number(customer, "distinct"), 200);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"status\":\"paid\",\"region\":\"r1\"}", NULL, 0);
+ASSERT(strcmp(plan_string(out, "access"), "intersect") == 0);
+ASSERT_EQ(number(out, "examined"), 250);
+ASSERT_EQ(number(out, "returned"), 250);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"total\":{\"$gte\":100,\"$lt\":150},\"status\":\"open\"}", NULL, 0);
+ASSERT(strcmp(plan_string(out, "index"), "total") == 0);
+ASSERT_EQ(number(out, "examined"), 50);
+ASSERT_EQ(number(out, "returned"), 13);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"n\":{\"$in\":[5,6]}}", NULL, 0);
+ASSERT(strcmp(plan_string(out, "access"), "scan") == 0);
+ASSERT_EQ(number(out, "examined"), 2000);
+ASSERT_EQ(number(out, "returned"), 2);
+cJSON_Delete(out);
+
+/* 2. Sorted finds with a limit */
+out = explain("orders", "{\"status\":\"open\"}", "total", 5);
+ASSERT(strcmp(plan_string(out, "index"), "total") == 0);
+ASSERT(cJSON_IsTrue(cJSON_GetObjectItem(cJSON_GetObjectItem(out, "plan"), "limitPushedDown")));
+ASSERT_EQ(number(out, "examined"), 17);
+ASSERT_EQ(number(out, "returned"), 5);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"STATUS\":\"open\"}", "Total", 5);
+ASSERT(strcmp(plan_string(out, "index"), "total") == 0);
+ASSERT(cJSON_IsTrue(cJSON_GetObjectItem(cJSON_GetObjectItem(out, "plan"), "ordered")));
+ASSERT_EQ(number(out, "examined"), 17);
+cJSON_Delete(out);
+
+out = explain("orders", "{\"customer\":\"c3\"}", "total", 5);
+ASSERT(strcmp(plan_string(out, "index"), "customer") == 0);
+ASSERT_EQ(number(out, "examined"), 10);
+cJSON_Delete(out);
+
+cJSON *query = cJSON_Parse("{\"status\":\"open\"}");
+db_find_options_t opts = {.sort = "total", .descending = true, .limit = 3};
+cJSON *res = db_find_ex("orders", query, &opts);
+ASSERT_EQ(cJSON_GetArraySize(res), 3);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "n")->valueint, 1996);
+ASSERT_EQ(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 2), "n")->valueint, 1988);
+cJSON_Delete(res);
+cJSON_Delete(query);
+
+/* 3. Stale statistics */
+for (int i = 2000; i < 2300; i++) {
+    char text[64];
+    snprintf(text, sizeof(text), "{\"_id\":\"o%d\",\"n\":%d}", i, i);
+    cJSON *doc = cJSON_Parse(text);
+    ASSERT(db_insert("orders", doc) == true);
+    cJSON_Delete(doc);
+    if (i == 2050) {
+        out = explain("orders", "{}", NULL, 1);
+        ASSERT_EQ(number(cJSON_GetObjectItem(out, "statistics"), "documents"), 2000);
+        cJSON_Delete(out);
+    }
+}
+out = explain("orders", "{}", NULL, 1);
+ASSERT_EQ(number(cJSON_GetObjectItem(out, "statistics"), "documents"), 2300);
+ASSERT_EQ(number(out, "examined"), 1);
+cJSON_Delete(out);
+
+/* 4. Unknown collections */
+ASSERT(explain("missing", "{}", NULL, 0) == NULL);
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy("data/test_plan.json");
+db_set_wal_mode(false);
+db_set_durability(DB_DURABILITY_FLUSH);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
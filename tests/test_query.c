@@ -4,13 +4,17 @@
  *
  * This test suite validates the logic engine responsible for comparing
  * database documents against JSON filter criteria, ensuring that exact
- * matches succeed and mismatches are correctly identified.
+ * matches succeed and mismatches are correctly identified, and the range
+ * operators and value ordering shared with ordered indexes, and that compiled
+ * queries agree with the interpreter, including on dotted field paths.
  */
 
 #include "../include/query.h"
 #include "../third_party/cJSON/cJSON.h"
 #include "framework.h"
 
+#include <string.h>
+
 /**
  * @brief Tests basic key-value matching for strings and numbers.
  * * This test ensures that:
@@ -43,3 +47,299 @@ cJSON_Delete(q_match);
 cJSON_Delete(q_fail);
 
 TEST_END
+
+/**
+ * @brief Tests range operators and value ordering.
+ * * This test ensures that:
+ * 1. `$gt`, `$gte`, `$lt` and `$lte` combine into a range on numbers and strings.
+ * 2. Range operators never match values of another type, or missing fields.
+ * 3. Unknown operators do not match.
+ * 4. query_compare() orders numbers before strings before booleans.
+ */
+TEST_START(test_query_range)
+
+cJSON *doc = cJSON_Parse("{\"ts\":1700000100,\"name\":\"m\",\"flag\":true}");
+
+/* 1. Ranges */
+cJSON *q_window = cJSON_Parse("{\"ts\":{\"$gte\":1700000000,\"$lt\":1700003600}}");
+cJSON *q_before = cJSON_Parse("{\"ts\":{\"$lt\":1700000100}}");
+cJSON *q_upto = cJSON_Parse("{\"ts\":{\"$lte\":1700000100}}");
+cJSON *q_names = cJSON_Parse("{\"name\":{\"$gt\":\"a\",\"$lte\":\"m\"}}");
+ASSERT(query_match(doc, q_window) == true);
+ASSERT(query_match(doc, q_before) == false);
+ASSERT(query_match(doc, q_upto) == true);
+ASSERT(query_match(doc, q_names) == true);
+
+/* 2. Type mismatches */
+cJSON *q_mixed = cJSON_Parse("{\"name\":{\"$gt\":0}}");
+cJSON *q_missing = cJSON_Parse("{\"other\":{\"$gt\":0}}");
+cJSON *q_bool = cJSON_Parse("{\"flag\":{\"$gte\":false}}");
+ASSERT(query_match(doc, q_mixed) == false);
+ASSERT(query_match(doc, q_missing) == false);
+ASSERT(query_match(doc, q_bool) == false);
+
+/* 3. Unknown operators */
+cJSON *q_unknown = cJSON_Parse("{\"ts\":{\"$near\":1}}");
+ASSERT(query_match(doc, q_unknown) == false);
+
+/* 4. Ordering */
+cJSON *values = cJSON_Parse("[-1, 2.5, \"\", \"b\", false, true]");
+bool ordered = query_compare(NULL, values->child) < 0;
+for (cJSON *v = values->child; v && v->next; v = v->next)
+    ordered = ordered && query_compare(v, v->next) < 0 && query_compare(v->next, v) > 0;
+ASSERT(ordered);
+
+cJSON_Delete(values);
+cJSON_Delete(q_unknown);
+cJSON_Delete(q_bool);
+cJSON_Delete(q_missing);
+cJSON_Delete(q_mixed);
+cJSON_Delete(q_names);
+cJSON_Delete(q_upto);
+cJSON_Delete(q_before);
+cJSON_Delete(q_window);
+cJSON_Delete(doc);
+
+TEST_END
+
+/**
+ * @brief Tests compiled queries against the interpreter.
+ * * This test ensures that:
+ * 1. query_run() agrees with query_match() on every pairing of sample
+ * documents and queries, covering equality, ranges, type mismatches, missing
+ * fields, unknown operators, repeated fields and field names in another case.
+ * 2. A NULL query matches everything and a NULL document only matches it.
+ * 3. The program does not depend on the query once compiled.
+ */
+TEST_START(test_query_compiled)
+
+const char *docs[] = {
+    "{\"ts\":1700000100,\"name\":\"m\",\"flag\":true}",
+    "{\"TS\":5,\"Name\":\"b\",\"flag\":false,\"tags\":[1]}",
+    "{\"ts\":\"late\",\"name\":7}",
+    "{}",
+};
+const char *queries[] = {
+    "{}",
+    "{\"name\":\"m\"}",
+    "{\"NAME\":\"b\"}",
+    "{\"ts\":{\"$gte\":5,\"$lt\":1700000100}}",
+    "{\"ts\":{\"$gt\":\"a\"},\"name\":{\"$lte\":7}}",
+    "{\"flag\":false}",
+    "{\"flag\":true,\"ts\":1700000100}",
+    "{\"name\":{\"$gt\":\"a\"},\"Name\":{\"$lt\":\"c\"}}",
+    "{\"ts\":{\"$near\":1}}",
+    "{\"ts\":{\"$gt\":true}}",
+    "{\"tags\":[1]}",
+    "{\"flag\":null}",
+    "{\"other\":1}",
+};
+
+/* 1. Agreement */
+bool agree = true;
+for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+    cJSON *query = cJSON_Parse(queries[q]);
+    query_program_t *prog = query_compile(query);
+    ASSERT(prog != NULL);
+    for (size_t d = 0; d < sizeof(docs) / sizeof(docs[0]); d++) {
+        cJSON *doc = cJSON_Parse(docs[d]);
+        agree = agree && query_run(prog, doc) == query_match(doc, query);
+        cJSON_Delete(doc);
+    }
+    query_program_free(prog);
+    cJSON_Delete(query);
+}
+ASSERT(agree);
+
+/* 2. NULL query and document */
+cJSON *doc = cJSON_Parse(docs[0]);
+query_program_t *all = query_compile(NULL);
+ASSERT(query_run(all, doc) == true);
+ASSERT(query_run(all, NULL) == true);
+query_program_free(all);
+
+/* 3. Queries released after compiling */
+cJSON *query = cJSON_Parse("{\"name\":{\"$gte\":\"m\"}}");
+query_program_t *prog = query_compile(query);
+ASSERT(query_run(prog, NULL) == false);
+cJSON_Delete(query);
+ASSERT(query_run(prog, doc) == true);
+
+query_program_free(prog);
+cJSON_Delete(doc);
+
+TEST_END
+
+/**
+ * @brief Matches a document against a query with both matchers.
+ *
+ * @return 1 or 0 for a match, or -1 if the compiled query disagrees with
+ *         query_match().
+ */
+static int match_both(cJSON *doc, const char *query_text)
+{
+    cJSON *query = cJSON_Parse(query_text);
+    query_program_t *prog = query_compile(query);
+    bool interpreted = query_match(doc, query);
+    bool compiled = query_run(prog, doc);
+    query_program_free(prog);
+    cJSON_Delete(query);
+    return interpreted == compiled ? interpreted : -1;
+}
+
+/**
+ * @brief Tests comparison, set and logical operators.
+ * * This test ensures that:
+ * 1. `$eq`, `$ne`, `$in` and `$nin` compare by type and value, and arrays,
+ *    objects and null compare in full.
+ * 2. `$ne`, `$nin`, `$exists: false` and `$not` match missing fields, and
+ *    malformed operands never match.
+ * 3. `$and`, `$or` and `$not` combine filters, nested or not.
+ * 4. query_flatten() lifts `$and` branches and merges operators on a field.
+ */
+TEST_START(test_query_operators)
+
+cJSON *doc = cJSON_Parse("{\"n\":5,\"s\":\"b\",\"t\":true,\"z\":null,\"tags\":[1,\"x\"],"
+                         "\"addr\":{\"city\":\"Oslo\",\"zip\":1}}");
+
+/* 1. Equality and sets */
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$eq\":5}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$ne\":5}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$ne\":\"5\"}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"s\":{\"$in\":[\"a\",\"b\"]}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"s\":{\"$in\":[]}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"s\":{\"$nin\":[\"a\",\"b\"]}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$nin\":[\"5\",true]}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"z\":null}"), 1);
+ASSERT_EQ(match_both(doc, "{\"n\":null}"), 0);
+ASSERT_EQ(match_both(doc, "{\"tags\":[1,\"x\"]}"), 1);
+ASSERT_EQ(match_both(doc, "{\"tags\":[1]}"), 0);
+ASSERT_EQ(match_both(doc, "{\"addr\":{\"zip\":1,\"city\":\"Oslo\"}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"addr\":{\"city\":\"Oslo\"}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"addr\":{\"$in\":[{\"city\":\"Oslo\",\"zip\":1}]}}"), 1);
+
+/* 2. Missing fields and malformed operands */
+ASSERT_EQ(match_both(doc, "{\"m\":{\"$ne\":1}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"m\":{\"$nin\":[1]}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"m\":{\"$exists\":false}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"z\":{\"$exists\":true}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"m\":{\"$not\":{\"$gt\":1}}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$not\":{\"$gt\":1}}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$not\":4}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$in\":5}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"m\":{\"$nin\":5}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$exists\":\"yes\"}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"n\":{\"$gte\":1,\"$ne\":5}}"), 0);
+
+/* 3. Logical operators */
+ASSERT_EQ(match_both(doc, "{\"$or\":[{\"n\":1},{\"s\":\"b\"}]}"), 1);
+ASSERT_EQ(match_both(doc, "{\"$or\":[{\"n\":1},{\"s\":\"a\"}]}"), 0);
+ASSERT_EQ(match_both(doc, "{\"$or\":[]}"), 0);
+ASSERT_EQ(match_both(doc, "{\"$or\":{\"n\":5}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"$and\":[{\"n\":{\"$gt\":1}},{\"n\":{\"$lt\":9}}],\"t\":true}"), 1);
+ASSERT_EQ(match_both(doc, "{\"$and\":[{\"n\":5},7]}"), 0);
+ASSERT_EQ(match_both(doc, "{\"$and\":[]}"), 1);
+ASSERT_EQ(match_both(doc, "{\"$not\":{\"n\":5,\"s\":\"a\"}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"$not\":{\"$or\":[{\"n\":5},{\"m\":1}]}}"), 0);
+ASSERT_EQ(match_both(doc,
+                     "{\"$or\":[{\"$and\":[{\"n\":{\"$lt\":3}},{\"t\":true}]},"
+                     "{\"$and\":[{\"s\":{\"$in\":[\"b\"]}},{\"m\":{\"$exists\":false}}]}]}"),
+          1);
+ASSERT_EQ(match_both(NULL, "{\"m\":{\"$exists\":false}}"), 0);
+
+/* 4. Flattening */
+cJSON *query = cJSON_Parse("{\"a\":{\"$gt\":1},\"$and\":[{\"a\":{\"$lt\":5}},{\"b\":2},"
+                           "{\"a\":3},{\"b\":4}],\"$not\":{\"c\":1},\"$or\":[{\"d\":1}]}");
+cJSON *flat = query_flatten(query);
+cJSON *expected = cJSON_Parse("{\"a\":{\"$gt\":1,\"$lt\":5,\"$eq\":3},\"b\":2,"
+                              "\"$or\":[{\"d\":1}]}");
+ASSERT(cJSON_Compare(flat, expected, true));
+
+cJSON_Delete(expected);
+cJSON_Delete(flat);
+cJSON_Delete(query);
+cJSON_Delete(doc);
+
+TEST_END
+
+/**
+ * @brief Tests dotted field paths.
+ * * This test ensures that:
+ * 1. Queries reach members of nested objects and elements of arrays, with
+ *    and without compiling, ignoring case like top-level fields.
+ * 2. Operators apply to nested values, and a path a document does not hold
+ *    is a missing field.
+ * 3. Parsed paths read, detach and store values, and tell whether one path
+ *    lies within another; names with array indexes are told apart.
+ * 4. Documents are copied without the values some paths name, leaving the
+ *    original intact.
+ */
+TEST_START(test_query_paths)
+
+cJSON *doc = cJSON_Parse("{\"name\":\"a\",\"address\":{\"City\":\"Paris\",\"geo\":{\"lat\":48.8}},"
+                         "\"items\":[{\"sku\":\"x1\",\"qty\":2},{\"sku\":\"y2\",\"qty\":5}],"
+                         "\"a.b\":1}");
+
+/* 1. Nested members and array elements */
+ASSERT_EQ(match_both(doc, "{\"address.city\":\"Paris\"}"), 1);
+ASSERT_EQ(match_both(doc, "{\"ADDRESS.CITY\":\"Paris\"}"), 1);
+ASSERT_EQ(match_both(doc, "{\"address.geo.lat\":{\"$gt\":48}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"items.1.sku\":\"y2\",\"items.0.qty\":2}"), 1);
+ASSERT_EQ(match_both(doc, "{\"items.1\":{\"sku\":\"y2\",\"qty\":5}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"address\":{\"$exists\":true},\"address.city\":\"Lyon\"}"), 0);
+
+/* 2. Missing paths */
+ASSERT_EQ(match_both(doc, "{\"items.2.sku\":{\"$exists\":false}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"items.sku\":{\"$exists\":false}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"name.first\":{\"$ne\":\"a\"}}"), 1);
+ASSERT_EQ(match_both(doc, "{\"address.geo.lat.x\":{\"$in\":[48.8]}}"), 0);
+ASSERT_EQ(match_both(doc, "{\"a.b\":1}"), 0);
+ASSERT_EQ(match_both(doc, "{\"$or\":[{\"items.0.qty\":{\"$gte\":3}},"
+                          "{\"items.1.qty\":{\"$gte\":3}}]}"),
+          1);
+
+/* 3. Parsed paths */
+query_path_t *path = query_path_create("items.1.QTY");
+query_path_t *items = query_path_create("Items");
+ASSERT(strcmp(query_path_text(path), "items.1.QTY") == 0);
+ASSERT_EQ(query_path_get(path, doc)->valueint, 5);
+ASSERT(query_path_within(path, items) && !query_path_within(items, path));
+ASSERT(query_path_within(items, items));
+ASSERT(query_field_positional("items.1.QTY") && query_field_positional("0"));
+ASSERT(!query_field_positional("address.city") && !query_field_positional("a.1b"));
+cJSON *out = cJSON_CreateObject();
+cJSON *value = query_path_detach(path, doc);
+ASSERT(value != NULL && query_path_get(path, doc) == NULL);
+ASSERT(query_path_put(path, out, value) == true);
+cJSON *expected = cJSON_Parse("{\"items\":{\"1\":{\"QTY\":5}}}");
+ASSERT(cJSON_Compare(out, expected, true));
+value = cJSON_CreateNumber(6);
+ASSERT(query_path_put(path, out, value) == false);
+cJSON_Delete(value);
+value = cJSON_CreateNumber(7);
+ASSERT(query_path_put(items, out, value) == false);
+cJSON_Delete(value);
+
+/* 4. Copies without some paths (items.1.qty was detached above) */
+query_path_t *skip[] = {query_path_create("items.0.sku"), query_path_create("address.geo"),
+                        query_path_create("NAME"), query_path_create("items.5")};
+cJSON *copy = query_path_copy_except(doc, skip, 4);
+cJSON *kept = cJSON_Parse("{\"address\":{\"City\":\"Paris\"},"
+                          "\"items\":[{\"qty\":2},{\"sku\":\"y2\"}],\"a.b\":1}");
+ASSERT(cJSON_Compare(copy, kept, true));
+ASSERT(query_path_get(skip[0], doc) != NULL);
+cJSON_Delete(copy);
+copy = query_path_copy_except(doc, skip, 0);
+ASSERT(cJSON_Compare(copy, doc, true));
+cJSON_Delete(copy);
+
+cJSON_Delete(kept);
+for (size_t i = 0; i < 4; i++)
+    query_path_free(skip[i]);
+cJSON_Delete(expected);
+cJSON_Delete(out);
+query_path_free(items);
+query_path_free(path);
+cJSON_Delete(doc);
+
+TEST_END
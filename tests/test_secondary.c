@@ -0,0 +1,1237 @@
+/**
+ * @file test_secondary.c
+ * @brief Unit tests for secondary indexes.
+ *
+ * This test suite validates the secondary index module on its own (value
+ * encoding, posting lists, pointer replacement, ordered walks and ranges)
+ * and through the engine (maintenance on writes, use by find, sorted finds,
+ * the index catalog across restarts).
+ */
+
+#include "../include/database.h"
+#include "../include/secondary.h"
+#include "framework.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+/**
+ * @brief Documents collected by a scan.
+ */
+typedef struct
+{
+    cJSON *docs[64];
+    int count;
+} visited_t;
+
+/**
+ * @brief Records a visited document (secondary_visit_fn).
+ */
+static bool collect(cJSON *doc, const secondary_key_t *key, void *ctx)
+{
+    (void) key;
+    visited_t *visited = ctx;
+    if (visited->count < 64)
+        visited->docs[visited->count] = doc;
+    visited->count++;
+    return true;
+}
+
+/**
+ * @brief Scans an index for a query and collects the candidates.
+ *
+ * Ordered indexes are also walked when the query leaves their field alone.
+ *
+ * @return The candidate count, or -1 if the index does not apply.
+ */
+static int scan(const secondary_t *sec, const char *query_text, bool descending,
+                visited_t *visited)
+{
+    cJSON *query = cJSON_Parse(query_text);
+    size_t estimate;
+    visited->count = 0;
+    int count = -1;
+    bool walk_all = secondary_ordered(sec) && !cJSON_GetObjectItem(query, secondary_field(sec));
+    if (secondary_match(sec, query, &estimate) != SECONDARY_UNUSABLE || walk_all) {
+        secondary_scan(sec, query, descending, collect, visited);
+        count = visited->count;
+    }
+    cJSON_Delete(query);
+    return count;
+}
+
+/**
+ * @brief Scans an index for a query and returns the number of candidates.
+ *
+ * @return The candidate count, or -1 if the index does not apply.
+ */
+static int lookup_count(const secondary_t *sec, const char *query_text)
+{
+    visited_t visited;
+    return scan(sec, query_text, false, &visited);
+}
+
+/**
+ * @brief Tests the secondary index module.
+ * * This test ensures that:
+ * 1. Invalid specifications are rejected.
+ * 2. Values are matched by type and value, like query_match() does.
+ * 3. Queries that do not compare the field with a scalar are not answered,
+ *    and hash indexes leave range operators alone.
+ * 4. Removal and pointer replacement keep posting lists in insertion order.
+ */
+TEST_START(test_secondary_basic)
+
+/* 1. Specifications */
+cJSON *spec = cJSON_Parse("{\"field\":\"\"}");
+ASSERT(secondary_create(spec) == NULL);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"k\",\"type\":\"btree\"}");
+ASSERT(secondary_create(spec) == NULL);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"k\"}");
+secondary_t *sec = secondary_create(spec);
+cJSON_Delete(spec);
+ASSERT(sec != NULL);
+ASSERT(strcmp(secondary_name(sec), "k") == 0);
+ASSERT(secondary_ordered(sec) == false);
+
+/* 2. Typed values */
+cJSON *docs[6] = {
+    cJSON_Parse("{\"k\":1}"),   cJSON_Parse("{\"k\":\"1\"}"), cJSON_Parse("{\"k\":-0.0}"),
+    cJSON_Parse("{\"k\":true}"), cJSON_Parse("{\"k\":[1]}"),  cJSON_Parse("{\"k\":1.0}"),
+};
+for (int i = 0; i < 6; i++)
+    ASSERT(secondary_add(sec, docs[i], docs[i]) == true);
+ASSERT_EQ(lookup_count(sec, "{\"k\":1}"), 2);
+ASSERT_EQ(lookup_count(sec, "{\"k\":\"1\"}"), 1);
+ASSERT_EQ(lookup_count(sec, "{\"k\":0}"), 1);
+ASSERT_EQ(lookup_count(sec, "{\"k\":true}"), 1);
+ASSERT_EQ(lookup_count(sec, "{\"k\":false}"), 0);
+
+/* 3. Not applicable */
+ASSERT_EQ(lookup_count(sec, "{\"other\":1}"), -1);
+ASSERT_EQ(lookup_count(sec, "{\"k\":[1]}"), -1);
+ASSERT_EQ(lookup_count(sec, "{\"k\":{\"$gt\":0}}"), -1);
+
+/* 4. Order is kept across removal and replacement */
+visited_t visited;
+cJSON *extra = cJSON_Parse("{\"k\":1}");
+ASSERT(secondary_add(sec, extra, extra) == true);
+secondary_remove(sec, docs[5], docs[5]);
+secondary_replace(sec, docs[0], docs[0], extra);
+ASSERT_EQ(scan(sec, "{\"k\":1}", false, &visited), 2);
+ASSERT(visited.docs[0] == extra && visited.docs[1] == extra);
+
+cJSON *info = secondary_describe(sec);
+ASSERT_EQ(cJSON_GetObjectItem(info, "entries")->valueint, 5);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "type")->valuestring, "hash") == 0);
+cJSON_Delete(info);
+
+cJSON_Delete(extra);
+for (int i = 0; i < 6; i++)
+    cJSON_Delete(docs[i]);
+secondary_free(sec);
+
+TEST_END
+
+/**
+ * @brief Tests ordered indexes.
+ * * This test ensures that:
+ * 1. Keys are walked in query_compare() order, ties in insertion order.
+ * 2. Range bounds are inclusive or exclusive as requested and stay within
+ *    the type of the compared value.
+ * 3. Contradictory ranges and mixed-type bounds are handled.
+ * 4. An unconstrained field walks every document, in both directions.
+ */
+TEST_START(test_secondary_ordered)
+
+cJSON *spec = cJSON_Parse("{\"field\":\"v\",\"type\":\"ordered\"}");
+secondary_t *sec = secondary_create(spec);
+cJSON_Delete(spec);
+ASSERT(sec != NULL);
+ASSERT(secondary_ordered(sec) == true);
+
+/* 1. Mixed keys, added out of order */
+cJSON *docs = cJSON_Parse("[{\"v\":10},{\"v\":-2.5},{\"v\":\"b\"},{\"v\":true},{\"v\":1e300},"
+                          "{\"v\":-1e300},{\"v\":\"a\"},{\"v\":false},{\"v\":10},{\"v\":0},{}]");
+for (cJSON *doc = docs->child; doc; doc = doc->next)
+    ASSERT(secondary_add(sec, doc, doc) == true);
+ASSERT_EQ((int) secondary_entries(sec), 10);
+
+visited_t visited;
+ASSERT_EQ(scan(sec, "{}", false, &visited), 10);
+const int ascending[10] = {5, 1, 9, 0, 8, 4, 6, 2, 7, 3};
+bool in_order = true;
+for (int i = 0; i < 10; i++)
+    in_order = in_order && visited.docs[i] == cJSON_GetArrayItem(docs, ascending[i]);
+ASSERT(in_order);
+
+/* 2. Ranges */
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gt\":0}}", false, &visited), 3);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gte\":0}}", false, &visited), 4);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gte\":-2.5,\"$lt\":10}}", false, &visited), 2);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$lte\":10}}", false, &visited), 5);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gte\":\"\"}}", false, &visited), 2);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$lt\":\"b\"}}", false, &visited), 1);
+ASSERT_EQ(scan(sec, "{\"v\":10}", false, &visited), 2);
+
+/* 3. Empty and unusable ranges */
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gt\":10,\"$lt\":0}}", false, &visited), 0);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gt\":10,\"$lt\":10}}", false, &visited), 0);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gt\":0,\"$lt\":\"z\"}}", false, &visited), -1);
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gt\":true}}", false, &visited), -1);
+
+/* 4. Descending walk */
+ASSERT_EQ(scan(sec, "{\"v\":{\"$gte\":0}}", true, &visited), 4);
+ASSERT(visited.docs[0] == cJSON_GetArrayItem(docs, 4));
+ASSERT(visited.docs[1] == cJSON_GetArrayItem(docs, 0));
+ASSERT(visited.docs[2] == cJSON_GetArrayItem(docs, 8));
+ASSERT(visited.docs[3] == cJSON_GetArrayItem(docs, 9));
+
+secondary_remove(sec, cJSON_GetArrayItem(docs, 0), cJSON_GetArrayItem(docs, 0));
+ASSERT_EQ(scan(sec, "{\"v\":10}", false, &visited), 1);
+cJSON *info = secondary_describe(sec);
+ASSERT_EQ(cJSON_GetObjectItem(info, "keys")->valueint, 9);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "type")->valuestring, "ordered") == 0);
+cJSON_Delete(info);
+
+cJSON_Delete(docs);
+secondary_free(sec);
+
+TEST_END
+
+/**
+ * @brief Index and output array used by decode().
+ */
+typedef struct
+{
+    const secondary_t *sec;
+    cJSON *out;
+} decoded_t;
+
+/**
+ * @brief Decodes the key of a visited document (secondary_visit_fn).
+ *
+ * Appends the decoded fields, or null if the key does not hold them.
+ */
+static bool decode(cJSON *doc, const secondary_key_t *key, void *ctx)
+{
+    (void) doc;
+    decoded_t *decoded = ctx;
+    cJSON *values = cJSON_CreateObject();
+    if (!secondary_key_values(decoded->sec, key, values)) {
+        cJSON_Delete(values);
+        values = cJSON_CreateNull();
+    }
+    cJSON_AddItemToArray(decoded->out, values);
+    return true;
+}
+
+/**
+ * @brief Tests compound indexes.
+ * * This test ensures that:
+ * 1. Field lists must be non-empty and free of repeats.
+ * 2. Hash indexes only answer equality on every field.
+ * 3. Ordered indexes answer an equality prefix, alone or closed by a range
+ *    on the next field, and skip documents without the first field.
+ * 4. Keys decode back into the indexed fields, except values they do not record.
+ */
+TEST_START(test_secondary_compound)
+
+/* 1. Specifications */
+const char *invalid[] = {"{\"fields\":[]}", "{\"fields\":[\"a\",\"a\"]}",
+                         "{\"field\":\"a\",\"fields\":[\"b\"]}", "{\"fields\":[\"a\",1]}"};
+for (int i = 0; i < 4; i++) {
+    cJSON *spec = cJSON_Parse(invalid[i]);
+    ASSERT(secondary_create(spec) == NULL);
+    cJSON_Delete(spec);
+}
+
+/* 2. Hash */
+cJSON *spec = cJSON_Parse("{\"fields\":[\"tenant\",\"status\"]}");
+secondary_t *hash = secondary_create(spec);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"fields\":[\"tenant\",\"status\"],\"type\":\"ordered\"}");
+secondary_t *ordered = secondary_create(spec);
+cJSON_Delete(spec);
+ASSERT(hash != NULL && ordered != NULL);
+ASSERT(strcmp(secondary_name(hash), "tenant,status") == 0);
+ASSERT(secondary_covers(hash, "status") && !secondary_covers(hash, "n"));
+
+cJSON *docs = cJSON_Parse("[{\"tenant\":\"t1\",\"status\":\"open\"},"
+                          "{\"tenant\":\"t1\",\"status\":\"closed\"},{\"tenant\":\"t1\"},"
+                          "{\"tenant\":\"t2\",\"status\":\"open\"},"
+                          "{\"tenant\":\"t1\",\"status\":null},{\"status\":\"open\"}]");
+for (cJSON *doc = docs->child; doc; doc = doc->next) {
+    ASSERT(secondary_add(hash, doc, doc) == true);
+    ASSERT(secondary_add(ordered, doc, doc) == true);
+}
+ASSERT_EQ((int) secondary_entries(hash), 5);
+ASSERT_EQ(lookup_count(hash, "{\"tenant\":\"t1\",\"status\":\"open\"}"), 1);
+ASSERT_EQ(lookup_count(hash, "{\"tenant\":\"t1\"}"), -1);
+
+/* 3. Ordered prefixes */
+size_t estimate;
+cJSON *query = cJSON_Parse("{\"status\":\"open\"}");
+ASSERT(secondary_match(ordered, query, &estimate) == SECONDARY_UNUSABLE);
+cJSON_Delete(query);
+query = cJSON_Parse("{\"tenant\":\"t1\",\"status\":\"open\"}");
+ASSERT(secondary_match(ordered, query, &estimate) == SECONDARY_EQUALITY);
+ASSERT_EQ((int) estimate, 1);
+cJSON_Delete(query);
+ASSERT_EQ(lookup_count(ordered, "{\"tenant\":\"t1\"}"), 4);
+ASSERT_EQ(lookup_count(ordered, "{\"tenant\":\"t1\",\"status\":{\"$gte\":\"d\"}}"), 1);
+ASSERT_EQ(lookup_count(ordered, "{\"tenant\":{\"$gt\":\"t1\"}}"), 1);
+ASSERT_EQ(lookup_count(ordered, "{}"), 5);
+
+/* 4. Decoding, in key order: missing < strings < null */
+decoded_t decoded = {ordered, cJSON_CreateArray()};
+query = cJSON_Parse("{\"tenant\":\"t1\"}");
+secondary_scan(ordered, query, false, decode, &decoded);
+cJSON *expected = cJSON_Parse("[{\"tenant\":\"t1\"},{\"tenant\":\"t1\",\"status\":\"closed\"},"
+                              "{\"tenant\":\"t1\",\"status\":\"open\"},null]");
+ASSERT(cJSON_Compare(decoded.out, expected, true));
+cJSON_Delete(expected);
+cJSON_Delete(query);
+cJSON_Delete(decoded.out);
+secondary_free(hash);
+secondary_free(ordered);
+cJSON_Delete(docs);
+
+/* Ranges after a prefix step over the remaining fields; numbers decode exactly */
+spec = cJSON_Parse("{\"fields\":[\"t\",\"n\",\"x\"],\"type\":\"ordered\"}");
+ordered = secondary_create(spec);
+cJSON_Delete(spec);
+docs = cJSON_Parse("[{\"t\":1,\"n\":1,\"x\":9},{\"t\":1,\"n\":2,\"x\":-1},{\"t\":1,\"n\":2},"
+                   "{\"t\":1,\"n\":3,\"x\":\"z\"},{\"t\":1,\"n\":4,\"x\":0},{\"t\":2,\"n\":3}]");
+for (cJSON *doc = docs->child; doc; doc = doc->next)
+    ASSERT(secondary_add(ordered, doc, doc) == true);
+ASSERT_EQ(lookup_count(ordered, "{\"t\":1,\"n\":{\"$gt\":1,\"$lte\":3}}"), 3);
+ASSERT_EQ(lookup_count(ordered, "{\"t\":1,\"n\":{\"$gte\":2,\"$lt\":3}}"), 2);
+ASSERT_EQ(lookup_count(ordered, "{\"t\":1,\"n\":2,\"x\":{\"$lt\":0}}"), 1);
+
+decoded.sec = ordered;
+decoded.out = cJSON_CreateArray();
+query = cJSON_Parse("{\"t\":1,\"n\":{\"$gte\":-1e300}}");
+secondary_scan(ordered, query, true, decode, &decoded);
+expected = cJSON_Parse("[{\"t\":1,\"n\":4,\"x\":0},{\"t\":1,\"n\":3,\"x\":\"z\"},"
+                       "{\"t\":1,\"n\":2,\"x\":-1},{\"t\":1,\"n\":2},{\"t\":1,\"n\":1,\"x\":9}]");
+ASSERT(cJSON_Compare(decoded.out, expected, true));
+cJSON_Delete(expected);
+cJSON_Delete(query);
+cJSON_Delete(decoded.out);
+secondary_free(ordered);
+cJSON_Delete(docs);
+
+TEST_END
+
+/**
+ * @brief Tests secondary indexes through the engine.
+ * * This test ensures that:
+ * 1. An index built over existing documents answers finds correctly.
+ * 2. Inserts, updates, upserts and deletes keep it up to date.
+ * 3. The definition survives a restart, including a lazy one.
+ * 4. Dropping the index removes it from the catalog.
+ */
+TEST_START(test_secondary_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_wal_mode(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+/* 1. Build over existing documents */
+for (int i = 0; i < 100; i++) {
+    char text[96];
+    snprintf(text, sizeof(text), "{\"_id\":\"o%d\",\"user_id\":%d,\"status\":\"%s\"}", i, i % 10,
+             i % 2 ? "open" : "closed");
+    cJSON *doc = cJSON_Parse(text);
+    ASSERT(db_insert("orders", doc) == true);
+    cJSON_Delete(doc);
+}
+cJSON *spec = cJSON_Parse("{\"field\":\"user_id\"}");
+ASSERT(db_create_index("orders", spec) == true);
+ASSERT(db_create_index("orders", spec) == true);
+ASSERT_EQ(find_count("orders", "{\"user_id\":3}"), 10);
+ASSERT_EQ(find_count("orders", "{\"user_id\":3,\"status\":\"open\"}"), 10);
+ASSERT_EQ(find_count("orders", "{\"user_id\":4,\"status\":\"open\"}"), 0);
+ASSERT_EQ(find_count("orders", "{\"user_id\":42}"), 0);
+
+/* 2. Writes keep the index current */
+cJSON *patch = cJSON_Parse("{\"user_id\":42}");
+ASSERT(db_update("orders", "o3", patch) == true);
+ASSERT(db_upsert("orders", "new", patch) == true);
+ASSERT(db_delete("orders", "o13") == true);
+ASSERT_EQ(find_count("orders", "{\"user_id\":3}"), 8);
+ASSERT_EQ(find_count("orders", "{\"user_id\":42}"), 2);
+
+cJSON *list = db_list_indexes("orders");
+ASSERT_EQ(cJSON_GetArraySize(list), 2);
+cJSON *info = cJSON_GetArrayItem(list, 1);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "name")->valuestring, "user_id") == 0);
+ASSERT_EQ(cJSON_GetObjectItem(info, "entries")->valueint, 100);
+ASSERT_EQ(cJSON_GetObjectItem(info, "keys")->valueint, 11);
+cJSON_Delete(list);
+
+/* 3. Restart, replaying the log and then lazily */
+db_cleanup();
+db_init("data/test_sec.json");
+ASSERT_EQ(find_count("orders", "{\"user_id\":42}"), 2);
+db_cleanup();
+db_set_wal_mode(false);
+db_set_lazy_load(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+ASSERT_EQ(find_count("orders", "{\"user_id\":5}"), 10);
+ASSERT(db_update("orders", "o5", patch) == true);
+ASSERT_EQ(find_count("orders", "{\"user_id\":5}"), 9);
+ASSERT_EQ(find_count("orders", "{\"user_id\":42}"), 3);
+
+/* 4. Drop */
+ASSERT(db_drop_index("orders", "user_id") == true);
+ASSERT(db_drop_index("orders", "user_id") == false);
+db_cleanup();
+db_init("data/test_sec.json");
+list = db_list_indexes("orders");
+ASSERT_EQ(cJSON_GetArraySize(list), 1);
+cJSON_Delete(list);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(spec);
+cJSON_Delete(patch);
+db_cleanup();
+db_set_lazy_load(false);
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Runs a sorted find and returns the `n` field of each result.
+ *
+ * @return The number of results (at most 16 are stored in @p out).
+ */
+static int find_sorted(const char *coll, const char *query_text, const char *sort,
+                       bool descending, int limit, int out[16])
+{
+    cJSON *query = cJSON_Parse(query_text);
+    db_find_options_t opts = {.sort = sort, .descending = descending, .limit = limit};
+    cJSON *res = db_find_ex(coll, query, &opts);
+    int count = 0;
+    for (cJSON *doc = res ? res->child : NULL; doc; doc = doc->next, count++) {
+        if (count < 16)
+            out[count] = cJSON_GetObjectItem(doc, "n")->valueint;
+    }
+    cJSON_Delete(res);
+    cJSON_Delete(query);
+    return count;
+}
+
+/**
+ * @brief Tests range queries and sorted finds through the engine.
+ * * This test ensures that:
+ * 1. Time-window queries return the same documents with and without an
+ *    ordered index on `ts`.
+ * 2. Sorted finds with a limit return the top documents in order, whether
+ *    read from the index or sorted after a scan, and nothing when no
+ *    document matches.
+ * 3. Documents without the sort field sort first and disable the index walk
+ *    only when the query leaves the field unconstrained.
+ * 4. The index type survives a restart.
+ */
+TEST_START(test_ordered_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_wal_mode(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+/* Events one minute apart, inserted out of time order */
+for (int i = 0; i < 200; i++) {
+    int n = (i * 37) % 200;
+    char text[96];
+    snprintf(text, sizeof(text), "{\"n\":%d,\"ts\":%d,\"kind\":\"%s\"}", n, 1700000000 + 60 * n,
+             n % 4 ? "view" : "click");
+    cJSON *doc = cJSON_Parse(text);
+    ASSERT(db_insert("events", doc) == true);
+    cJSON_Delete(doc);
+}
+
+/* 1. Time windows, scanned and then indexed */
+const char *window = "{\"ts\":{\"$gte\":1700003000,\"$lt\":1700006000}}";
+const char *clicks = "{\"ts\":{\"$gt\":1700003000},\"kind\":\"click\"}";
+int top[16];
+ASSERT_EQ(find_count("events", window), 50);
+ASSERT_EQ(find_count("events", clicks), 37);
+ASSERT_EQ(find_sorted("events", window, "ts", true, 3, top), 3);
+ASSERT(top[0] == 99 && top[1] == 98 && top[2] == 97);
+
+cJSON *spec = cJSON_Parse("{\"field\":\"ts\",\"type\":\"ordered\"}");
+ASSERT(db_create_index("events", spec) == true);
+ASSERT_EQ(find_count("events", window), 50);
+ASSERT_EQ(find_count("events", clicks), 37);
+ASSERT_EQ(find_sorted("events", window, "ts", true, 3, top), 3);
+ASSERT(top[0] == 99 && top[1] == 98 && top[2] == 97);
+ASSERT_EQ(find_sorted("events", window, "ts", false, 2, top), 2);
+ASSERT(top[0] == 50 && top[1] == 51);
+
+/* 2. Sort with limit over the whole collection */
+ASSERT_EQ(find_sorted("events", "{}", "ts", true, 2, top), 2);
+ASSERT(top[0] == 199 && top[1] == 198);
+ASSERT_EQ(find_sorted("events", "{\"kind\":\"click\"}", "ts", true, 2, top), 2);
+ASSERT(top[0] == 196 && top[1] == 192);
+ASSERT_EQ(find_sorted("events", "{\"kind\":\"click\"}", "n", false, 2, top), 2);
+ASSERT(top[0] == 0 && top[1] == 4);
+ASSERT_EQ(find_sorted("events", "{\"kind\":\"none\"}", "n", false, 2, top), 0);
+
+/* 3. A document without `ts` */
+cJSON *bare = cJSON_Parse("{\"n\":-1}");
+ASSERT(db_insert("events", bare) == true);
+cJSON_Delete(bare);
+ASSERT_EQ(find_sorted("events", "{}", "ts", false, 2, top), 2);
+ASSERT(top[0] == -1 && top[1] == 0);
+ASSERT_EQ(find_sorted("events", window, "ts", false, 1, top), 1);
+ASSERT(top[0] == 50);
+
+/* 4. Restart */
+db_cleanup();
+db_init("data/test_sec.json");
+cJSON *list = db_list_indexes("events");
+cJSON *info = cJSON_GetArrayItem(list, 1);
+ASSERT(info && strcmp(cJSON_GetObjectItem(info, "type")->valuestring, "ordered") == 0);
+cJSON_Delete(list);
+ASSERT_EQ(find_sorted("events", window, "ts", true, 1, top), 1);
+ASSERT(top[0] == 99);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(spec);
+db_cleanup();
+db_set_wal_mode(false);
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests compound and covering indexes through the engine.
+ * * This test ensures that:
+ * 1. Finds on both fields, or on a prefix, return the same documents as a scan.
+ * 2. Covered finds return exactly the requested fields, `_id` included.
+ * 3. Documents whose key does not hold a requested value are read instead.
+ * 4. Covered finds keep working on lazily loaded documents.
+ */
+TEST_START(test_compound_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+for (int i = 0; i < 100; i++) {
+    char text[160];
+    snprintf(text, sizeof(text),
+             "{\"_id\":\"t%d\",\"tenant\":\"%c\",\"status\":\"%s\",\"n\":%d,\"body\":\"%0*d\"}", i,
+             'a' + i % 4, i % 3 ? "open" : "closed", i, 64, i);
+    cJSON *doc = cJSON_Parse(text);
+    ASSERT(db_insert("tickets", doc) == true);
+    cJSON_Delete(doc);
+}
+cJSON *odd = cJSON_Parse("{\"_id\":\"odd\",\"tenant\":\"a\",\"status\":[\"open\"]}");
+ASSERT(db_insert("tickets", odd) == true);
+cJSON_Delete(odd);
+
+/* 1. Plain finds */
+const char *both = "{\"tenant\":\"a\",\"status\":\"open\"}";
+ASSERT_EQ(find_count("tickets", both), 16);
+ASSERT_EQ(find_count("tickets", "{\"tenant\":\"a\"}"), 26);
+cJSON *spec = cJSON_Parse("{\"fields\":[\"tenant\",\"status\"],\"type\":\"ordered\"}");
+ASSERT(db_create_index("tickets", spec) == true);
+cJSON_Delete(spec);
+ASSERT_EQ(find_count("tickets", both), 16);
+ASSERT_EQ(find_count("tickets", "{\"tenant\":\"a\"}"), 26);
+
+/* 2. Covered */
+cJSON *fields = cJSON_Parse("[\"_id\",\"status\"]");
+db_find_options_t opts = {.fields = fields};
+cJSON *query = cJSON_Parse(both);
+cJSON *res = db_find_ex("tickets", query, &opts);
+cJSON_Delete(query);
+ASSERT_EQ(cJSON_GetArraySize(res), 16);
+cJSON *first = cJSON_GetArrayItem(res, 0);
+ASSERT_EQ(cJSON_GetArraySize(first), 2);
+ASSERT(strcmp(cJSON_GetObjectItem(first, "_id")->valuestring, "t4") == 0);
+ASSERT(strcmp(cJSON_GetObjectItem(first, "status")->valuestring, "open") == 0);
+cJSON_Delete(res);
+
+/* 3. Values the key does not record */
+query = cJSON_Parse("{\"tenant\":\"a\"}");
+opts.sort = "status";
+opts.descending = false;
+opts.limit = 1;
+res = db_find_ex("tickets", query, &opts);
+ASSERT_EQ(cJSON_GetArraySize(res), 1);
+ASSERT(cJSON_IsArray(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 0), "status")));
+cJSON_Delete(res);
+cJSON_Delete(query);
+
+/* 4. Lazy restart */
+db_cleanup();
+db_set_lazy_load(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+query = cJSON_Parse(both);
+opts = (db_find_options_t){.fields = fields, .limit = 3};
+res = db_find_ex("tickets", query, &opts);
+ASSERT_EQ(cJSON_GetArraySize(res), 3);
+ASSERT(strcmp(cJSON_GetObjectItem(cJSON_GetArrayItem(res, 2), "_id")->valuestring, "t16") == 0);
+cJSON_Delete(res);
+cJSON_Delete(query);
+
+/* Cleanup resources and restore the suite database */
+cJSON_Delete(fields);
+db_cleanup();
+db_set_lazy_load(false);
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Inserts a document from its JSON text.
+ *
+ * @return The result of db_insert().
+ */
+static bool insert_text(const char *coll, const char *text)
+{
+    cJSON *doc = cJSON_Parse(text);
+    bool ok = db_insert(coll, doc);
+    cJSON_Delete(doc);
+    return ok;
+}
+
+/**
+ * @brief Tests unique indexes.
+ * * This test ensures that:
+ * 1. `unique` must be a boolean and is kept in the normalized specification.
+ * 2. Inserts, updates and upserts sharing a key with another document fail
+ *    with DB_ERROR_DUPLICATE_KEY and leave the collection unchanged.
+ * 3. A document may be rewritten with its own key, and keys freed by
+ *    updates and deletes can be reused.
+ * 4. Documents left out of the index are not constrained.
+ * 5. A unique index cannot be built over existing duplicates.
+ */
+TEST_START(test_unique_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+/* 1. Specification */
+cJSON *spec = cJSON_Parse("{\"field\":\"email\",\"unique\":1}");
+ASSERT(secondary_create(spec) == NULL);
+cJSON_Delete(spec);
+spec = cJSON_Parse("{\"field\":\"email\",\"unique\":true}");
+secondary_t *sec = secondary_create(spec);
+ASSERT(sec != NULL);
+ASSERT(secondary_unique(sec) == true);
+ASSERT(cJSON_IsTrue(cJSON_GetObjectItem(secondary_spec(sec), "unique")));
+secondary_free(sec);
+
+/* 2. Writes */
+ASSERT(db_create_index("users", spec) == true);
+cJSON_Delete(spec);
+ASSERT(insert_text("users", "{\"_id\":\"u1\",\"email\":\"a@x\"}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u2\",\"email\":\"b@x\"}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u3\",\"email\":\"a@x\"}") == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_KEY);
+ASSERT(insert_text("users", "{\"_id\":\"u1\",\"email\":\"c@x\"}") == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_ID);
+ASSERT_EQ(db_count("users"), 2);
+
+cJSON *change = cJSON_Parse("{\"email\":\"a@x\"}");
+ASSERT(db_update("users", "u2", change) == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_KEY);
+ASSERT(db_upsert("users", "u2", change) == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_KEY);
+ASSERT(db_upsert("users", "u9", change) == false);
+ASSERT_EQ(db_count("users"), 2);
+ASSERT(db_update("users", "nobody", change) == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_NOT_FOUND);
+ASSERT_EQ(find_count("users", "{\"email\":\"b@x\"}"), 1);
+
+/* 3. Own key, freed keys */
+ASSERT(db_update("users", "u1", change) == true);
+ASSERT_EQ(db_last_error(), DB_ERROR_NONE);
+cJSON_Delete(change);
+change = cJSON_Parse("{\"email\":\"c@x\"}");
+ASSERT(db_update("users", "u1", change) == true);
+cJSON_Delete(change);
+ASSERT(insert_text("users", "{\"_id\":\"u3\",\"email\":\"a@x\"}") == true);
+ASSERT(db_delete("users", "u3") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u4\",\"email\":\"a@x\"}") == true);
+
+/* 4. Unindexed documents */
+ASSERT(insert_text("users", "{\"_id\":\"u5\"}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u6\"}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u7\",\"email\":null}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"u8\",\"email\":null}") == true);
+
+/* 5. Existing duplicates */
+spec = cJSON_Parse("{\"fields\":[\"team\",\"role\"],\"unique\":true}");
+ASSERT(insert_text("users", "{\"_id\":\"m1\",\"team\":\"x\",\"role\":\"lead\"}") == true);
+ASSERT(insert_text("users", "{\"_id\":\"m2\",\"team\":\"x\",\"role\":\"dev\"}") == true);
+ASSERT(db_create_index("users", spec) == true);
+ASSERT(insert_text("users", "{\"_id\":\"m3\",\"team\":\"x\",\"role\":\"lead\"}") == false);
+ASSERT(db_drop_index("users", "team,role") == true);
+ASSERT(insert_text("users", "{\"_id\":\"m3\",\"team\":\"x\",\"role\":\"lead\"}") == true);
+ASSERT(db_create_index("users", spec) == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_KEY);
+cJSON_Delete(spec);
+cJSON *list = db_list_indexes("users");
+ASSERT_EQ(cJSON_GetArraySize(list), 2);
+cJSON_Delete(list);
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Inserts a session whose `ts` lies some seconds in the past.
+ *
+ * @return The result of db_insert().
+ */
+static bool insert_session(int n, double age)
+{
+    char id[32];
+    snprintf(id, sizeof(id), "s%d", n);
+    cJSON *doc = cJSON_CreateObject();
+    cJSON_AddStringToObject(doc, "_id", id);
+    cJSON_AddNumberToObject(doc, "ts", (double) time(NULL) - age);
+    bool ok = db_insert("sessions", doc);
+    cJSON_Delete(doc);
+    return ok;
+}
+
+/**
+ * @brief Tests TTL indexes and the reaper.
+ * * This test ensures that:
+ * 1. `expireAfterSeconds` must be a non-negative number on a single field and
+ *    makes the index ordered.
+ * 2. db_expire() deletes expired documents across several batches and
+ *    leaves fresh ones, non-numeric timestamps and missing fields alone.
+ * 3. The deletions are persisted and the index definition survives a restart.
+ * 4. The background reaper deletes documents once they expire.
+ */
+TEST_START(test_ttl_engine)
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+/* 1. Specification */
+const char *invalid[4] = {"{\"field\":\"ts\",\"expireAfterSeconds\":-1}",
+                          "{\"field\":\"ts\",\"expireAfterSeconds\":\"1h\"}",
+                          "{\"fields\":[\"ts\",\"user\"],\"expireAfterSeconds\":60}",
+                          "{\"field\":\"ts\",\"type\":\"hash\",\"expireAfterSeconds\":60}"};
+for (int i = 0; i < 4; i++) {
+    cJSON *spec = cJSON_Parse(invalid[i]);
+    ASSERT(db_create_index("sessions", spec) == false);
+    cJSON_Delete(spec);
+}
+cJSON *spec = cJSON_Parse("{\"field\":\"ts\",\"expireAfterSeconds\":3600}");
+ASSERT(db_create_index("sessions", spec) == true);
+cJSON_Delete(spec);
+cJSON *list = db_list_indexes("sessions");
+cJSON *info = cJSON_GetArrayItem(list, 1);
+ASSERT(strcmp(cJSON_GetObjectItem(info, "type")->valuestring, "ordered") == 0);
+ASSERT_EQ((int) cJSON_GetObjectItem(info, "expireAfterSeconds")->valuedouble, 3600);
+cJSON_Delete(list);
+
+/* 2. Expiry, over more than two batches */
+for (int i = 0; i < 2500; i++)
+    ASSERT(insert_session(i, 7200) == true);
+for (int i = 2500; i < 2510; i++)
+    ASSERT(insert_session(i, 60) == true);
+ASSERT(insert_text("sessions", "{\"_id\":\"text\",\"ts\":\"yesterday\"}") == true);
+ASSERT(insert_text("sessions", "{\"_id\":\"none\"}") == true);
+ASSERT_EQ(db_expire(), 2500L);
+ASSERT_EQ(db_count("sessions"), 12);
+ASSERT_EQ(db_expire(), 0L);
+ASSERT_EQ(find_count("sessions", "{\"ts\":{\"$lt\":0}}"), 0);
+
+/* 3. Restart */
+db_cleanup();
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+ASSERT_EQ(db_count("sessions"), 12);
+ASSERT(insert_session(9000, 3601) == true);
+ASSERT_EQ(db_expire(), 1L);
+
+/* 4. Background reaper */
+ASSERT(insert_session(9001, 4000) == true);
+db_set_ttl_interval(1);
+for (int i = 0; i < 50 && db_count("sessions") > 12; i++)
+    usleep(100 * 1000);
+ASSERT_EQ(db_count("sessions"), 12);
+db_set_ttl_interval(60);
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Returns the inode of a file, or 0 if it does not exist.
+ */
+static ino_t index_file_inode(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+/**
+ * @brief Answers the queries of the index file test from every kind of index.
+ *
+ * @param[out] out Users equal to 3, `ts` in [100, 150), status "a" with a user
+ *                 of at least 5, and "word3" search hits.
+ */
+static void index_file_probe(int out[4])
+{
+    out[0] = find_count("items", "{\"user\":3}");
+    out[1] = find_count("items", "{\"ts\":{\"$gte\":100,\"$lt\":150}}");
+    out[2] = find_count("items", "{\"status\":\"a\",\"user\":{\"$gte\":5}}");
+    cJSON *res = db_search("items", "body", "word3", 0);
+    out[3] = cJSON_GetArraySize(res);
+    cJSON_Delete(res);
+}
+
+/**
+ * @brief Tests index files saved next to the collection images.
+ * * This test ensures that:
+ * 1. A clean shutdown saves the secondary indexes of a collection, and a
+ *    restart on the same image uses the file without rewriting it.
+ * 2. Indexes loaded from the file answer queries and enforce uniqueness
+ *    like built ones, and the log replayed on top of them is applied.
+ * 3. A file saved against another image is ignored and the indexes rebuilt.
+ * 4. Truncated and corrupted files are ignored and the indexes rebuilt, and
+ *    document counts larger than the collection are rejected before the
+ *    lists are allocated.
+ * 5. Dropping indexes updates the file, and the last one removes it.
+ */
+TEST_START(test_index_files)
+
+const char *image = "data/test_sec.json.d/items.coll";
+const char *file = "data/test_sec.json.d/items.coll.idx";
+
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_wal_mode(true);
+db_set_lazy_load(true);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+
+const char *specs[5] = {"{\"field\":\"user\"}", "{\"field\":\"ts\",\"type\":\"ordered\"}",
+                        "{\"field\":\"status\",\"type\":\"bitmap\"}",
+                        "{\"field\":\"body\",\"type\":\"text\"}",
+                        "{\"field\":\"email\",\"unique\":true}"};
+for (int i = 0; i < 5; i++) {
+    cJSON *spec = cJSON_Parse(specs[i]);
+    ASSERT(db_create_index("items", spec) == true);
+    cJSON_Delete(spec);
+}
+const char *statuses[3] = {"a", "b", "c"};
+for (int i = 0; i < 300; i++) {
+    char text[256];
+    snprintf(text, sizeof(text),
+             "{\"_id\":\"d%d\",\"user\":%d,\"ts\":%d,\"status\":\"%s\",\"body\":\"word%d common\","
+             "\"email\":\"e%d\"}",
+             i, i % 10, i, statuses[i % 3], i % 7, i);
+    ASSERT(insert_text("items", text) == true);
+}
+int expected[4], got[4];
+index_file_probe(expected);
+ASSERT_EQ(expected[0], 30);
+ASSERT_EQ(expected[1], 50);
+ASSERT_EQ(expected[2], 50);
+ASSERT_EQ(expected[3], 43);
+
+/* 1. Saved on shutdown, used as is on restart */
+db_cleanup();
+ino_t saved = index_file_inode(file);
+ASSERT(saved != 0);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+index_file_probe(got);
+ASSERT(memcmp(got, expected, sizeof(got)) == 0);
+ASSERT(insert_text("items", "{\"_id\":\"dup\",\"email\":\"e7\"}") == false);
+ASSERT_EQ(db_last_error(), DB_ERROR_DUPLICATE_KEY);
+cJSON *list = db_list_indexes("items");
+for (int i = 1; i <= 5; i++)
+    ASSERT_EQ((int) cJSON_GetObjectItem(cJSON_GetArrayItem(list, i), "entries")->valuedouble, 300);
+cJSON_Delete(list);
+db_cleanup();
+ASSERT(index_file_inode(file) == saved);
+
+/* 2. Crash after more writes: the saved pair plus the log */
+ASSERT(link(image, "data/test_sec.json.d/items.bak") == 0);
+ASSERT(link(file, "data/test_sec.json.d/items.idx.bak") == 0);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+ASSERT(db_delete("items", "d3") == true);
+ASSERT(insert_text("items", "{\"_id\":\"n1\",\"user\":3,\"ts\":120,\"status\":\"a\","
+                            "\"body\":\"word3\",\"email\":\"n1\"}") == true);
+char *wal = NULL;
+FILE *fp = fopen("data/test_sec.json.wal", "rb");
+ASSERT(fp != NULL);
+size_t wal_len = 0;
+ASSERT(getdelim(&wal, &wal_len, '\0', fp) > 0);
+fclose(fp);
+db_cleanup();
+ASSERT(rename("data/test_sec.json.d/items.bak", image) == 0);
+ASSERT(rename("data/test_sec.json.d/items.idx.bak", file) == 0);
+fp = fopen("data/test_sec.json.wal", "wb");
+ASSERT(fp != NULL);
+fputs(wal, fp);
+fclose(fp);
+free(wal);
+
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+index_file_probe(got);
+ASSERT_EQ(got[0], 30);
+ASSERT_EQ(got[1], 51);
+ASSERT_EQ(got[2], 50);
+ASSERT_EQ(got[3], 43);
+ASSERT(insert_text("items", "{\"_id\":\"dup\",\"email\":\"n1\"}") == false);
+ASSERT(insert_text("items", "{\"_id\":\"reuse\",\"email\":\"e3\"}") == true);
+ASSERT(db_delete("items", "reuse") == true);
+db_cleanup();
+ASSERT(index_file_inode(file) != saved);
+
+/* 3. Stale file */
+saved = index_file_inode(file);
+ASSERT(utime(image, NULL) == 0);
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+index_file_probe(got);
+ASSERT_EQ(got[0], 30);
+ASSERT_EQ(got[3], 43);
+db_cleanup();
+ASSERT(index_file_inode(file) != saved);
+
+/* 4. Truncated file, then one whose first key claims 2^32 - 1 documents */
+for (int i = 0; i < 2; i++) {
+    saved = index_file_inode(file);
+    fp = fopen(file, "r+b");
+    ASSERT(fp != NULL);
+    if (i == 0) {
+        ASSERT(fseek(fp, 0, SEEK_END) == 0);
+        ASSERT(ftruncate(fileno(fp), ftell(fp) / 2) == 0);
+    } else {
+        /* The key follows the magic, the stamp, the first spec and two counts */
+        uint64_t spec_len = 0;
+        uint32_t key_len = 0, docs = UINT32_MAX;
+        ASSERT(fseek(fp, 4 + 6 * sizeof(uint64_t), SEEK_SET) == 0);
+        ASSERT(fread(&spec_len, sizeof(spec_len), 1, fp) == 1);
+        ASSERT(fseek(fp, (long) (spec_len + 2 * sizeof(uint64_t)), SEEK_CUR) == 0);
+        ASSERT(fread(&key_len, sizeof(key_len), 1, fp) == 1);
+        ASSERT(fseek(fp, (long) key_len, SEEK_CUR) == 0);
+        ASSERT(fwrite(&docs, sizeof(docs), 1, fp) == 1);
+    }
+    fclose(fp);
+    db_init("data/test_sec.json");
+    db_set_test_mode(true);
+    index_file_probe(got);
+    ASSERT_EQ(got[0], 30);
+    ASSERT_EQ(got[1], 51);
+    ASSERT_EQ(got[3], 43);
+    db_cleanup();
+    ASSERT(index_file_inode(file) != saved);
+}
+
+/* Counts alone: one key claiming 2^32 - 1 documents, then 2^64 - 1 entries */
+cJSON *spec = cJSON_Parse("{\"field\":\"user\"}");
+cJSON *one = cJSON_CreateObject();
+const unsigned char corrupt[2][25] = {
+    {1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 'k', 0xFF, 0xFF, 0xFF, 0xFF},
+    {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 'k', 1, 0,
+     0, 0}};
+for (int i = 0; i < 2; i++) {
+    secondary_t *sec = secondary_create(spec);
+    fp = fmemopen((void *) corrupt[i], sizeof(corrupt[i]), "rb");
+    ASSERT(sec != NULL && fp != NULL);
+    ASSERT(secondary_load(sec, fp, &one, 1) == false);
+    fclose(fp);
+    secondary_free(sec);
+}
+cJSON_Delete(one);
+cJSON_Delete(spec);
+
+/* 5. Dropped indexes */
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+ASSERT(db_drop_index("items", "ts") == true);
+db_cleanup();
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+index_file_probe(got);
+ASSERT_EQ(got[0], 30);
+ASSERT_EQ(got[1], 51);
+ASSERT_EQ(got[3], 43);
+ASSERT(db_drop_index("items", "user") == true);
+ASSERT(db_drop_index("items", "status:bitmap") == true);
+ASSERT(db_drop_index("items", "body:text") == true);
+ASSERT(db_drop_index("items", "email") == true);
+db_cleanup();
+ASSERT(index_file_inode(file) == 0);
+
+/* Cleanup resources and restore the suite database */
+db_destroy("data/test_sec.json");
+db_set_wal_mode(false);
+db_set_lazy_load(false);
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests query operators through the indexes and the engine.
+ * * This test ensures that:
+ * 1. `$eq` and `$in` turn into one key per value on hash, ordered and
+ *    bitmap indexes, and operators that may match missing fields are left
+ *    to the query.
+ * 2. Finds with every operator return the documents query_match() accepts,
+ *    whichever indexes, `$and` branches or `$or` bitmap merges serve them.
+ * 3. A sorted `$in` on an ordered index returns its values in order.
+ */
+TEST_START(test_operator_engine)
+
+/* 1. Candidates */
+cJSON *spec = cJSON_Parse("{\"fields\":[\"a\",\"b\"],\"type\":\"ordered\"}");
+secondary_t *sec = secondary_create(spec);
+cJSON_Delete(spec);
+ASSERT(sec != NULL);
+cJSON *docs[12];
+for (int i = 0; i < 12; i++) {
+    char text[48];
+    snprintf(text, sizeof(text), "{\"a\":%d,\"b\":%d}", i % 4, i);
+    docs[i] = cJSON_Parse(text);
+    ASSERT(secondary_add(sec, docs[i], docs[i]) == true);
+}
+visited_t visited;
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$in\":[3,1,3,7]}}"), 6);
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$eq\":2}}"), 3);
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$in\":[]}}"), 0);
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$in\":[1,null]}}"), -1);
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$ne\":1}}"), -1);
+ASSERT_EQ(lookup_count(sec, "{\"a\":{\"$gte\":2,\"$exists\":true}}"), 6);
+ASSERT_EQ(scan(sec, "{\"a\":{\"$in\":[1,3]},\"b\":{\"$gte\":5,\"$lt\":10}}", true, &visited), 3);
+ASSERT(visited.docs[0] == docs[7] && visited.docs[1] == docs[9] && visited.docs[2] == docs[5]);
+size_t estimate;
+cJSON *query = cJSON_Parse("{\"a\":{\"$in\":[0,1]},\"b\":{\"$in\":[0,1,4,6]}}");
+ASSERT(secondary_match(sec, query, &estimate) == SECONDARY_EQUALITY);
+ASSERT_EQ((int) estimate, 3);
+cJSON_Delete(query);
+for (int i = 0; i < 12; i++)
+    cJSON_Delete(docs[i]);
+secondary_free(sec);
+
+/* 2. Finds against a full read */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+static const char *colors[] = {"red", "green", "blue"};
+for (int i = 0; i < 300; i++) {
+    char text[128];
+    if (i % 7 == 0)
+        snprintf(text, sizeof(text), "{\"n\":%d,\"color\":\"%s\"}", i, colors[i % 3]);
+    else
+        snprintf(text, sizeof(text), "{\"n\":%d,\"color\":\"%s\",\"size\":%d,\"name\":\"u%d\"}",
+                 i, colors[i % 3], i % 5, i % 20);
+    ASSERT(insert_text("items", text) == true);
+}
+const char *specs[] = {
+    "{\"field\":\"n\",\"type\":\"ordered\"}",
+    "{\"field\":\"color\",\"type\":\"bitmap\"}",
+    "{\"field\":\"size\",\"type\":\"bitmap\"}",
+    "{\"field\":\"name\"}",
+};
+for (int i = 0; i < 4; i++) {
+    spec = cJSON_Parse(specs[i]);
+    ASSERT(db_create_index("items", spec) == true);
+    cJSON_Delete(spec);
+}
+const char *queries[] = {
+    "{\"n\":{\"$in\":[4,8,15,16,23,42,999]}}",
+    "{\"name\":{\"$in\":[\"u1\",\"u2\"]},\"n\":{\"$lt\":100}}",
+    "{\"color\":{\"$in\":[\"red\",\"blue\"]},\"size\":{\"$in\":[1,2]}}",
+    "{\"color\":{\"$ne\":\"red\"}}",
+    "{\"size\":{\"$nin\":[0,1,2]}}",
+    "{\"size\":{\"$exists\":false}}",
+    "{\"name\":{\"$not\":{\"$in\":[\"u3\",\"u4\"]}},\"n\":{\"$gte\":250}}",
+    "{\"$and\":[{\"n\":{\"$gte\":100}},{\"n\":{\"$lt\":120}},{\"color\":\"green\"}]}",
+    "{\"$or\":[{\"color\":\"red\",\"size\":3},{\"size\":4}]}",
+    "{\"$or\":[{\"color\":\"red\"},{\"n\":{\"$lt\":10}}],\"size\":0}",
+    "{\"$or\":[{\"color\":\"blue\"},{\"size\":{\"$exists\":false}}]}",
+    "{\"$not\":{\"$or\":[{\"color\":\"red\"},{\"size\":{\"$gt\":1}}]}}",
+    "{\"$or\":[]}",
+};
+for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+    ASSERT_EQ(find_count("items", queries[i]), match_count("items", queries[i]));
+ASSERT_EQ(find_count("items", queries[0]), 6);
+ASSERT_EQ(find_count("items", queries[5]), 43);
+ASSERT_EQ(find_count("items", queries[8]), 68);
+
+/* 3. Sorted sets */
+int ns[16];
+ASSERT_EQ(find_sorted("items", "{\"n\":{\"$in\":[10,250,3,77]}}", "n", true, 3, ns), 3);
+ASSERT(ns[0] == 250 && ns[1] == 77 && ns[2] == 10);
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END
+
+/**
+ * @brief Tests dotted field paths through the indexes and the engine.
+ * * This test ensures that:
+ * 1. Indexes key documents by nested members and array elements, and leave
+ *    out documents that do not hold the path.
+ * 2. Finds on paths return the documents query_match() accepts, through
+ *    hash, ordered and bitmap indexes alike, and sort on nested fields.
+ * 3. Requested nested fields come back inside their enclosing objects, from
+ *    the documents or from the index keys; array elements cannot be requested.
+ */
+TEST_START(test_path_engine)
+
+/* 1. Keys */
+cJSON *spec = cJSON_Parse("{\"field\":\"address.city\"}");
+secondary_t *sec = secondary_create(spec);
+cJSON_Delete(spec);
+ASSERT(sec != NULL);
+cJSON *docs = cJSON_Parse("[{\"address\":{\"city\":\"Oslo\"}},{\"address\":{\"City\":\"Oslo\"}},"
+                          "{\"address\":\"Oslo\"},{\"address.city\":\"Oslo\"},"
+                          "{\"city\":\"Oslo\"}]");
+for (cJSON *doc = docs->child; doc; doc = doc->next)
+    ASSERT(secondary_add(sec, doc, doc) == true);
+ASSERT_EQ((int) secondary_entries(sec), 2);
+ASSERT_EQ(lookup_count(sec, "{\"address.city\":\"Oslo\"}"), 2);
+secondary_free(sec);
+cJSON_Delete(docs);
+
+/* 2. Finds against a full read */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_init("data/test_sec.json");
+db_set_test_mode(true);
+static const char *cities[] = {"Oslo", "Lima", "Pune"};
+for (int i = 0; i < 120; i++) {
+    char text[160];
+    if (i % 10 == 0)
+        snprintf(text, sizeof(text), "{\"n\":%d}", i);
+    else
+        snprintf(text, sizeof(text),
+                 "{\"n\":%d,\"address\":{\"city\":\"%s\",\"zip\":%d},\"tags\":[\"t%d\",\"u\"]}", i,
+                 cities[i % 3], 1000 - i, i % 4);
+    ASSERT(insert_text("people", text) == true);
+}
+const char *specs[] = {
+    "{\"field\":\"address.city\"}",
+    "{\"field\":\"address.zip\",\"type\":\"ordered\"}",
+    "{\"field\":\"tags.0\",\"type\":\"bitmap\"}",
+    "{\"fields\":[\"address.city\",\"address.zip\"],\"type\":\"ordered\"}",
+};
+const char *queries[] = {
+    "{\"address.city\":\"Lima\"}",
+    "{\"address.zip\":{\"$gte\":950,\"$lt\":990}}",
+    "{\"tags.0\":{\"$in\":[\"t1\",\"t3\"]},\"address.city\":{\"$ne\":\"Pune\"}}",
+    "{\"address.city\":\"Oslo\",\"address.zip\":{\"$lt\":920}}",
+    "{\"$or\":[{\"tags.0\":\"t0\"},{\"tags.0\":{\"$exists\":false}}]}",
+    "{\"address\":{\"$exists\":false}}",
+};
+int before[6];
+for (int i = 0; i < 6; i++)
+    before[i] = match_count("people", queries[i]);
+for (int i = 0; i < 4; i++) {
+    spec = cJSON_Parse(specs[i]);
+    ASSERT(db_create_index("people", spec) == true);
+    cJSON_Delete(spec);
+}
+for (int i = 0; i < 6; i++)
+    ASSERT_EQ(find_count("people", queries[i]), before[i]);
+ASSERT_EQ(before[0], 36);
+ASSERT_EQ(before[5], 12);
+int ns[16];
+ASSERT_EQ(find_sorted("people", "{\"address.city\":\"Pune\"}", "address.zip", false, 3, ns), 3);
+ASSERT(ns[0] == 119 && ns[1] == 116 && ns[2] == 113);
+
+/* 3. Nested fields */
+cJSON *fields = cJSON_Parse("[\"address.city\",\"n\",\"tags\"]");
+db_find_options_t opts = {.fields = fields};
+cJSON *query = cJSON_Parse("{\"n\":1}");
+cJSON *res = db_find_ex("people", query, &opts);
+cJSON *expected =
+    cJSON_Parse("[{\"address\":{\"city\":\"Lima\"},\"n\":1,\"tags\":[\"t1\",\"u\"]}]");
+ASSERT(cJSON_Compare(res, expected, true));
+cJSON_Delete(expected);
+cJSON_Delete(res);
+cJSON_Delete(fields);
+fields = cJSON_Parse("[\"n\",\"tags.1\"]");
+opts.fields = fields;
+res = db_find_ex("people", query, &opts);
+ASSERT_EQ(cJSON_GetArraySize(res), 0);
+cJSON_Delete(res);
+cJSON_Delete(fields);
+fields = cJSON_Parse("[\"address.zip\",\"address\"]");
+opts.fields = fields;
+res = db_find_ex("people", query, &opts);
+expected = cJSON_Parse("[{\"address\":{\"city\":\"Lima\",\"zip\":999}}]");
+ASSERT(cJSON_Compare(res, expected, true));
+cJSON_Delete(expected);
+cJSON_Delete(res);
+cJSON_Delete(query);
+cJSON_Delete(fields);
+fields = cJSON_Parse("[\"address.zip\",\"address.city\"]");
+opts = (db_find_options_t){.fields = fields, .sort = "address.zip", .limit = 2};
+query = cJSON_Parse("{\"address.city\":\"Oslo\"}");
+res = db_find_ex("people", query, &opts);
+expected = cJSON_Parse("[{\"address\":{\"zip\":883,\"city\":\"Oslo\"}},"
+                       "{\"address\":{\"zip\":886,\"city\":\"Oslo\"}}]");
+ASSERT(cJSON_Compare(res, expected, true));
+cJSON_Delete(expected);
+cJSON_Delete(res);
+cJSON_Delete(query);
+cJSON_Delete(fields);
+
+/* Cleanup resources and restore the suite database */
+db_cleanup();
+db_destroy("data/test_sec.json");
+db_set_test_mode(false);
+db_init("data/test_db.json");
+
+TEST_END